@@ -1,4 +1,5 @@
 #include <bootloader.h>
+#include <clocksource.h>
 #include <malloc.h>
 #include <pci.h>
 #include <task.h>
@@ -123,7 +124,7 @@ uacpi_status uacpi_kernel_io_write32(uacpi_handle handle, uacpi_size offset,
 
 uacpi_u64 uacpi_kernel_get_nanoseconds_since_boot(void) {
   // no this is not a stub function! we just haven't set up a timer on first run
-  return (timerBootUnix * 1000 * 1000000) + (timerTicks * 1000000);
+  return clockMonotonic();
 }
 
 uacpi_status uacpi_kernel_install_interrupt_handler(
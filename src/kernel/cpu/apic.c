@@ -3,6 +3,7 @@
 #include <bootloader.h>
 #include <linked_list.h>
 #include <malloc.h>
+#include <smp.h>
 #include <system.h>
 #include <timer.h>
 
@@ -80,8 +81,9 @@ IOAPIC *ioApicFetch(uint8_t irq) {
 
 size_t apicGetBase() { return rdmsr(IA32_APIC_BASE_MSR) & 0xFFFFF000; }
 void   apicSetBase(size_t apic) {
-  wrmsr(IA32_APIC_BASE_MSR,
-          apic | IA32_APIC_BASE_MSR_ENABLE | IA32_APIC_BASE_MSR_BSP);
+  // (the BSP flag stays as the firmware left it)
+  size_t bsp = rdmsr(IA32_APIC_BASE_MSR) & IA32_APIC_BASE_MSR_BSP;
+  wrmsr(IA32_APIC_BASE_MSR, apic | IA32_APIC_BASE_MSR_ENABLE | bsp);
 }
 
 uint32_t apicCurrentCore() {
@@ -93,6 +95,21 @@ uint32_t apicCurrentCore() {
   return (apicRead(APIC_REGISTER_ID) >> 24) & 0xFF;
 }
 
+// Gets through even if the target has interrupts off (see paging.c)
+void apicSendNmi(uint32_t lapicId) {
+  while (apicRead(APIC_REGISTER_ICR_LOW) & APIC_ICR_PENDING)
+    asm volatile("pause");
+  apicWrite(APIC_REGISTER_ICR_HIGH, lapicId << 24);
+  apicWrite(APIC_REGISTER_ICR_LOW, APIC_ICR_DELIVERY_NMI | APIC_ICR_ASSERT);
+}
+
+void apicSendIpi(uint32_t lapicId, uint8_t vector) {
+  while (apicRead(APIC_REGISTER_ICR_LOW) & APIC_ICR_PENDING)
+    asm volatile("pause");
+  apicWrite(APIC_REGISTER_ICR_HIGH, lapicId << 24);
+  apicWrite(APIC_REGISTER_ICR_LOW, vector | APIC_ICR_ASSERT);
+}
+
 /* PCI routing */
 
 uacpi_iteration_decision uacpiBusMatch(void *user, uacpi_namespace_node *node,
@@ -311,15 +328,17 @@ uint8_t irqPerCoreAllocate(uint8_t gsi, uint32_t *lapicId) {
     panic();
   }
 
-  // note to the todo: for when the time comes, keep in mind that a lot of
-  // handlers assume only they are ran and nothing else at the same time sooo
+  // note: different IRQs can now run at the same time on different cores,
+  // but every one of them still only ever lands on a single core
 
-  // find the core with the least irqs allocated
+  // find the core with the least irqs allocated (out of the ones up already)
   int    min = MAX_IRQ;
-  size_t minIndex = 0;
-  for (size_t i = 0; i < 1; i++) { // todo: bootloader.smp->cpu_count
+  size_t minIndex = bootloader.smpBspIndex;
+  for (size_t i = 0; i < bootloader.smp->cpu_count && i < SMP_MAX_CPUS; i++) {
+    if (!cpus[i] || !cpus[i]->online)
+      continue;
     if (irqPerCpu[i] < min) {
-      irqPerCpu[i] = min;
+      min = irqPerCpu[i];
       minIndex = i;
     }
   }
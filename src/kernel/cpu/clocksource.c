@@ -0,0 +1,70 @@
+#include <clocksource.h>
+#include <system.h>
+#include <timer.h>
+#include <util.h>
+#include <vdso.h>
+
+// Clocksources, nanosecond timekeeping over whatever counter is best
+// Copyright (C) 2025 Panagiotis
+
+// where the current clocksource took over
+static uint64_t clockBaseNs = 0;
+static uint64_t clockBaseCycles = 0;
+
+// Only ever done while a single CPU is up
+void clocksourceSwitch(Clocksource *next) {
+  clockBaseNs = clockMonotonic();
+  clockBaseCycles = next->read();
+  clocksource = next;
+  vdsoClockUpdate(next->vdsoMode, clockBaseNs, clockBaseCycles, next->mult);
+  debugf("[clocksource] Switched: name{%s} resolution{%ldns}\n", next->name,
+         next->resolution);
+}
+
+uint64_t clockMonotonic() {
+  Clocksource *source = clocksource;
+  if (!source)
+    return 0;
+
+  uint64_t cycles = source->read();
+  if (cycles < clockBaseCycles) // another CPU's TSC, a hair behind
+    return clockBaseNs;
+  __uint128_t delta = cycles - clockBaseCycles;
+  return clockBaseNs + (uint64_t)((delta * source->mult) >> CLOCKSOURCE_SHIFT);
+}
+
+uint64_t clockRealtime() {
+  return timerBootUnix * NS_PER_SEC + clockMonotonic();
+}
+
+/* Time Stamp Counter */
+
+static uint64_t clocksourceTscRead() { return rdtsc(); }
+
+Clocksource clocksourceTsc = {.name = "tsc",
+                               .read = clocksourceTscRead,
+                               .resolution = 1,
+                               .vdsoMode = VDSO_CLOCK_TSC};
+
+// Ticks at the same rate no matter the P/C-state (CPUID.80000007h:EDX[8])
+bool clocksourceTscInvariant() {
+  uint32_t eax = 0x80000000, ebx = 0, ecx = 0, edx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  if (eax < 0x80000007)
+    return false;
+
+  eax = 0x80000007;
+  ecx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  return (edx >> 8) & 1;
+}
+
+// Takes over once calibrated: the TSC counted cycles while ns went by
+void initiateClocksourceTsc(uint64_t cycles, uint64_t ns) {
+  if (!clocksourceTscInvariant())
+    debugf("[clocksource] Warning! TSC isn't invariant, using it anyway!\n");
+
+  // (calibration takes well under 4s, so this can't overflow)
+  clocksourceTsc.mult = (ns << CLOCKSOURCE_SHIFT) / cycles;
+  clocksourceSwitch(&clocksourceTsc);
+}
@@ -1,4 +1,3 @@
-#include <bootloader.h>
 #include <fastSyscall.h>
 #include <gdt.h>
 #include <isr.h>
@@ -19,10 +18,7 @@ void initiateSyscallInst() {
     panic();
   }
 
-  // setup this core's thread info structure
-  threadInfo.syscall_stack = 0;
-  threadInfo.lapic_id = bootloader.smp[bootloader.smpBspIndex].bsp_lapic_id;
-  wrmsr(MSRID_KERNEL_GSBASE, (size_t)&threadInfo);
+  // (the thread info structure is this core's GS base, see smp.c)
 
   uint64_t star_reg = rdmsr(MSRID_STAR);
   star_reg &= 0x00000000ffffffff;
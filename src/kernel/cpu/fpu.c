@@ -0,0 +1,268 @@
+#include <fpu.h>
+#include <linux.h>
+#include <slab.h>
+#include <smp.h>
+#include <string.h>
+#include <system.h>
+#include <task.h>
+
+// Lazy FPU/SSE/AVX context switching
+// Copyright (C) 2025 Panagiotis
+
+// A task's fpuenv is up to date whenever it isn't running, as it gets saved on
+// the way out if it was used. The registers might still hold it after that:
+// that's the case for as long as the CPU's fpuOwner is the task & the task's
+// fpuCpu is the CPU (nothing else got loaded on either side since).
+
+size_t   fpuSize = FPU_LEGACY_SIZE;
+uint64_t fpuXfeatures = 0;
+
+static bool     fpuSized = false; // by the first CPU, the rest have to agree
+static bool     fpuXsaveopt = false;
+static uint32_t fpuMxcsrMask = 0xffbf; // if the CPU doesn't report one
+
+// sized once XSAVE is figured out (see initiateFpuCpu())
+SlabCache cacheFpuState = {.name = "fpu_state",
+                           .align = 64,
+                           .LOCK_CACHE = ATOMIC_FLAG_INIT};
+
+static inline void fpuSaveArea(uint8_t *area) {
+  if (!fpuXfeatures)
+    asm volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+  else if (fpuXsaveopt) // skips what hasn't changed since it got loaded
+    asm volatile("xsaveopt64 (%0)" : : "r"(area), "a"(-1), "d"(-1)
+                 : "memory");
+  else
+    asm volatile("xsave64 (%0)" : : "r"(area), "a"(-1), "d"(-1) : "memory");
+}
+
+static inline void fpuRestoreArea(uint8_t *area) {
+  if (!fpuXfeatures)
+    asm volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+  else
+    asm volatile("xrstor64 (%0)" : : "r"(area), "a"(-1), "d"(-1) : "memory");
+}
+
+static inline void fpuActivate(CpuInfo *local) {
+  if (local->fpuActive)
+    return;
+  asm volatile("clts");
+  local->fpuActive = true;
+}
+
+static inline void fpuDeactivate(CpuInfo *local) {
+  if (!local->fpuActive)
+    return;
+  uint64_t cr0;
+  asm volatile("mov %%cr0, %0" : "=r"(cr0));
+  asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_TS));
+  local->fpuActive = false;
+}
+
+static inline bool fpuLoaded(CpuInfo *local, Task *task) {
+  return local->fpuOwner == task && task->fpuCpu == local->id;
+}
+
+// The x87 & SSE parts get their defaults, anything past them starts out in
+// its initial state (XSTATE_BV clear)
+static void fpuAreaReset(uint8_t *area) {
+  memset(area, 0, fpuSize);
+  struct fpstate *legacy = (struct fpstate *)area;
+  legacy->cwd = 0x37f;
+  legacy->mxcsr = 0x1f80;
+  if (fpuXfeatures)
+    *(uint64_t *)(area + FPU_LEGACY_SIZE) = XFEATURE_X87 | XFEATURE_SSE;
+}
+
+void fpuTaskInit(Task *task) {
+  task->fpuenv = slabAlloc(&cacheFpuState);
+  fpuAreaReset(task->fpuenv);
+  task->fpuCpu = FPU_CPU_NONE;
+}
+
+void fpuTaskFree(Task *task) {
+  if (!task->fpuenv) // (task 0 never got one)
+    return;
+  slabFree(&cacheFpuState, task->fpuenv);
+  task->fpuenv = 0;
+}
+
+// Ran by schedule(), with interrupts off
+void fpuSwitch(CpuInfo *local, Task *old, Task *next) {
+  if (old == next)
+    return;
+
+  if (local->fpuActive && !old->kernel_task && local->fpuOwner == old)
+    fpuSaveArea(old->fpuenv);
+
+  // only skip the trap if the registers already have what it'd load
+  if (!next->kernel_task && fpuLoaded(local, next))
+    fpuActivate(local);
+  else
+    fpuDeactivate(local);
+}
+
+// Device Not Available (#NM), the current task wants the FPU
+bool fpuHandleNm() {
+  CpuInfo *local = cpuLocal();
+  Task    *task = local->current;
+  if (task->kernel_task) // the kernel is built without any FPU/SSE use
+    return false;
+
+  fpuActivate(local);
+  if (!fpuLoaded(local, task)) {
+    fpuRestoreArea(task->fpuenv);
+    local->fpuOwner = task;
+    task->fpuCpu = local->id;
+  }
+  return true;
+}
+
+// Makes sure the (current) task's fpuenv has its latest state
+void fpuSave(Task *task) {
+  bool interrupts = checkInterrupts();
+  asm volatile("cli");
+  CpuInfo *local = cpuLocal();
+  if (task == local->current && local->fpuActive && local->fpuOwner == task)
+    fpuSaveArea(task->fpuenv);
+  if (interrupts)
+    asm volatile("sti");
+}
+
+// The (current) task's fpuenv got changed, whatever the registers hold is stale
+void fpuDrop(Task *task) {
+  bool interrupts = checkInterrupts();
+  asm volatile("cli");
+  CpuInfo *local = cpuLocal();
+  task->fpuCpu = FPU_CPU_NONE;
+  if (local->fpuOwner == task) {
+    local->fpuOwner = 0;
+    fpuDeactivate(local);
+  }
+  if (interrupts)
+    asm volatile("sti");
+}
+
+/* Signal frames, laid out like Linux does (so debuggers & unwinders get it) */
+
+// What a signal frame's fpstate takes up (has to be 64 byte aligned!)
+size_t fpuSignalSize() {
+  return fpuXfeatures ? fpuSize + FP_XSTATE_MAGIC2_SIZE : FPU_LEGACY_SIZE;
+}
+
+// Expects fpuSave() to have been done already
+void fpuSignalSave(Task *task, void *frame) {
+  memcpy(frame, task->fpuenv, fpuSize);
+  if (!fpuXfeatures)
+    return;
+
+  // tells whoever's reading it that the extended state follows
+  struct fpstate *legacy = (struct fpstate *)frame;
+  memset(&legacy->sw_reserved, 0, sizeof(legacy->sw_reserved));
+  legacy->sw_reserved.magic1 = FP_XSTATE_MAGIC1;
+  legacy->sw_reserved.extended_size = fpuSignalSize();
+  legacy->sw_reserved.xfeatures = fpuXfeatures;
+  legacy->sw_reserved.xstate_size = fpuSize;
+  *(uint32_t *)((size_t)frame + fpuSize) = FP_XSTATE_MAGIC2;
+}
+
+// Userland might've messed with the frame, so only the extended state it
+// describes properly gets taken & nothing that'd make the restore fault
+void fpuSignalRestore(Task *task, void *frame) {
+  uint8_t        *area = task->fpuenv;
+  struct fpstate *legacy = (struct fpstate *)frame;
+  memcpy(area, frame, FPU_LEGACY_SIZE);
+  ((struct fpstate *)area)->mxcsr &= fpuMxcsrMask;
+
+  if (fpuXfeatures) {
+    uint64_t *header = (uint64_t *)(area + FPU_LEGACY_SIZE);
+    if (legacy->sw_reserved.magic1 == FP_XSTATE_MAGIC1 &&
+        legacy->sw_reserved.xstate_size == fpuSize &&
+        *(uint32_t *)((size_t)frame + fpuSize) == FP_XSTATE_MAGIC2) {
+      memcpy(area + FPU_LEGACY_SIZE, (void *)((size_t)frame + FPU_LEGACY_SIZE),
+             fpuSize - FPU_LEGACY_SIZE);
+      header[0] &= fpuXfeatures; // XSTATE_BV
+    } else {
+      // a plain fxsave frame, the rest goes back to its initial state
+      memset(header, 0, fpuSize - FPU_LEGACY_SIZE);
+      header[0] = XFEATURE_X87 | XFEATURE_SSE;
+    }
+    memset(&header[1], 0, 56); // XCOMP_BV & reserved, or XRSTOR faults
+  }
+
+  fpuDrop(task); // gets loaded once it's used
+}
+
+// Enables XSAVE (with AVX & AVX-512 if present) & sizes the save area after
+// it. Every CPU has to come up with the same, tasks move between them.
+static void fpuInitiateXsave() {
+  uint32_t eax = 1, ebx = 0, ecx = 0, edx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  if (!(ecx & (1 << 26)))
+    return;
+
+  uint64_t cr4;
+  asm volatile("mov %%cr4, %0" : "=r"(cr4));
+  asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_OSXSAVE));
+
+  eax = 0xd;
+  ecx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  uint64_t xfeatures = (eax | ((uint64_t)edx << 32)) &
+                       (XFEATURE_X87 | XFEATURE_SSE | XFEATURE_AVX |
+                        XFEATURE_AVX512);
+  if (!(xfeatures & XFEATURE_AVX) ||
+      (xfeatures & XFEATURE_AVX512) != XFEATURE_AVX512)
+    xfeatures &= ~XFEATURE_AVX512;
+  asm volatile("xsetbv" : : "c"(0), "a"((uint32_t)xfeatures),
+               "d"((uint32_t)(xfeatures >> 32)));
+
+  // size for what's enabled now
+  eax = 0xd;
+  ecx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  size_t size = DivRoundUp(ebx, 64) * 64;
+
+  eax = 0xd;
+  ecx = 1;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  bool xsaveopt = eax & 1;
+
+  if (fpuSized && (xfeatures != fpuXfeatures || size != fpuSize ||
+                   xsaveopt != fpuXsaveopt)) {
+    debugf("[fpu] FATAL! CPUs disagree on XSAVE! xfeatures{%lx} size{%ld}\n",
+           xfeatures, size);
+    panic();
+  }
+
+  fpuXfeatures = xfeatures;
+  fpuSize = size;
+  fpuXsaveopt = xsaveopt;
+}
+
+// Nobody's state is in the registers yet, so the first use traps
+void initiateFpuCpu() {
+  bool interrupts = checkInterrupts();
+  asm volatile("cli");
+  CpuInfo *local = cpuLocal();
+
+  fpuInitiateXsave();
+  if (!fpuSized) {
+    fpuSized = true;
+    cacheFpuState.size = fpuSize;
+    debugf("[fpu] Lazy switching ready: xfeatures{%lx} size{%ld} opt{%d}\n",
+           fpuXfeatures, fpuSize, fpuXsaveopt);
+  }
+
+  // what MXCSR bits are writable (restoring anything else faults)
+  __attribute__((aligned(16))) struct fpstate legacy = {0};
+  asm volatile("clts; fxsave64 %0" : "=m"(legacy));
+  if (legacy.mxcsr_mask)
+    fpuMxcsrMask = legacy.mxcsr_mask;
+
+  local->fpuOwner = 0;
+  local->fpuActive = true; // (just so it actually gets written)
+  fpuDeactivate(local);
+  if (interrupts)
+    asm volatile("sti");
+}
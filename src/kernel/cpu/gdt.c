@@ -4,27 +4,24 @@
 // GDT & TSS Entry configurator
 // Copyright (C) 2024 Panagiotis
 
+// Every CPU loads a copy of this, with a TSS of its own (see gdt_load())
 static GDTEntries gdt;
-static GDTPtr     gdtr;
-static TSSPtr     tss;
 
-TSSPtr *tssPtr = &tss;
-
-void gdt_load_tss(TSSPtr *tss) {
+void gdt_load_tss(GDTEntries *gdt, TSSPtr *tss) {
   size_t addr = (size_t)tss;
 
-  gdt.tss.base_low = (uint16_t)addr;
-  gdt.tss.base_mid = (uint8_t)(addr >> 16);
-  gdt.tss.flags1 = 0b10001001;
-  gdt.tss.flags2 = 0;
-  gdt.tss.base_high = (uint8_t)(addr >> 24);
-  gdt.tss.base_upper32 = (uint32_t)(addr >> 32);
-  gdt.tss.reserved = 0;
+  gdt->tss.base_low = (uint16_t)addr;
+  gdt->tss.base_mid = (uint8_t)(addr >> 16);
+  gdt->tss.flags1 = 0b10001001;
+  gdt->tss.flags2 = 0;
+  gdt->tss.base_high = (uint8_t)(addr >> 24);
+  gdt->tss.base_upper32 = (uint32_t)(addr >> 32);
+  gdt->tss.reserved = 0;
 
   asm volatile("ltr %0" : : "rm"((uint16_t)0x58) : "memory");
 }
 
-void gdt_reload() {
+void gdt_reload(GDTPtr *gdtr) {
   asm volatile("lgdt %0\n\t"
                "push $0x28\n\t"
                "lea 1f(%%rip), %%rax\n\t"
@@ -38,10 +35,23 @@ void gdt_reload() {
                "mov %%eax, %%gs\n\t"
                "mov %%eax, %%ss\n\t"
                :
-               : "m"(gdtr)
+               : "m"(*gdtr)
                : "rax", "memory");
 }
 
+// Loads the calling CPU's own copy of the GDT, along with its TSS. Reloading
+// the segments clears the FS/GS bases!
+void gdt_load(GDTEntries *cpuGdt, GDTPtr *cpuGdtr, TSSPtr *cpuTss) {
+  memcpy(cpuGdt, &gdt, sizeof(GDTEntries));
+  cpuGdtr->limit = sizeof(GDTEntries) - 1;
+  cpuGdtr->base = (uint64_t)cpuGdt;
+
+  gdt_reload(cpuGdtr);
+
+  memset(cpuTss, 0, sizeof(TSSPtr));
+  gdt_load_tss(cpuGdt, cpuTss);
+}
+
 void initiateGDT() {
   // Null descriptor. (0)
   gdt.descriptors[0].limit = 0;
@@ -129,11 +139,5 @@ void initiateGDT() {
   gdt.tss.base_upper32 = 0;
   gdt.tss.reserved = 0;
 
-  gdtr.limit = sizeof(GDTEntries) - 1;
-  gdtr.base = (uint64_t)&gdt;
-
-  gdt_reload();
-
-  memset(&tss, 0, sizeof(TSSPtr));
-  gdt_load_tss(&tss);
+  // (loaded by initiateSmpBsp() & every other CPU, see smp.c)
 }
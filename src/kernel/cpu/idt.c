@@ -19,6 +19,9 @@ void set_idt_gate(int n, uint64_t handler, uint8_t flags) {
   idt[n].isr_high = (uint32_t)(handler >> 32);
 }
 
+// Has the vector switch onto the given TSS stack (1-7) when it comes in
+void set_idt_ist(int n, uint8_t ist) { idt[n].ist = ist; }
+
 void set_idt() {
   idt_reg.base = (size_t)&idt;
   idt_reg.limit = IDT_ENTRIES * sizeof(idt_gate_t) - 1;
@@ -3,13 +3,41 @@
 
 bits    64
 
+; CpuInfo offsets (see smp.h)
+%define CPU_SWITCHING     24
+%define CPU_FLUSH_PENDING 32
+
+; kernel GS is only loaded while in ring 0, so swap when coming from/going to
+; ring 3 (%1 = offset of the frame's CS)
+%macro SWAPGS_IF_USER 1
+    test qword [rsp+%1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
 global asm_finalize
 asm_finalize:
   ; rdi = switch stack pointer
-  ; rsi = next pagedir
+  ; rsi = next pagedir (cr3 value, 0 to keep the current one)
+  ; rdx = cleared once off of the old task's stack (0 for none)
 
   mov rsp, rdi
+  test rsi, rsi
+  jz .same_pagedir
   mov cr3, rsi
+  mov qword [gs:CPU_SWITCHING], 0
+  xor eax, eax
+  xchg rax, [gs:CPU_FLUSH_PENDING]
+  test rax, rax
+  jz .same_pagedir
+  mov rax, cr3 ; a shootdown came in before the load, redo it
+  mov cr3, rax
+.same_pagedir:
+  test rdx, rdx
+  jz .released
+  mov byte [rdx], 0
+.released:
 
   pop rbp
   ; mov ds, ebp
@@ -32,11 +60,14 @@ asm_finalize:
   pop rax
 
   add rsp, 16      ; pop error code and interrupt number
+  SWAPGS_IF_USER 8
   iretq            ; pops (CS, EIP, EFLAGS) and also (SS, ESP) if privilege change occurs
 
 global syscall_entry
 syscall_entry:
   swapgs
+global syscall_reentry ; already on kernel GS (signal handlers after EINTR)
+syscall_reentry:
   mov cr2, rax ; use cr2 as an extra register
   mov rax, qword [gs:0] ; thread pointer
   ; mov rax, [rax] ; kernel stack top
@@ -104,9 +135,11 @@ syscall_entry:
 
   pop rsp ; reset rsp
 
+  swapgs
   o64 sysret
 
 isr_common:
+    SWAPGS_IF_USER 24
     push rax
     push rbx
     push rcx
@@ -160,6 +193,7 @@ asm_isr_exit:
     pop rax
 
     add rsp, 16      ; pop error code and interrupt number
+    SWAPGS_IF_USER 8
     iretq            ; pops (CS, EIP, EFLAGS) and also (SS, ESP) if privilege change occurs
 
 ; generate isr stubs that jump to isr_common, in order to get a consistent stack frame
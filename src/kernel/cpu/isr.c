@@ -1,4 +1,5 @@
 #include <apic.h>
+#include <fpu.h>
 #include <idt.h>
 #include <isr.h>
 #include <kb.h>
@@ -7,10 +8,13 @@
 #include <paging.h>
 #include <rtl8139.h>
 #include <schedule.h>
+#include <smp.h>
 #include <syscalls.h>
 #include <system.h>
 #include <task.h>
 #include <timer.h>
+#include <util.h>
+#include <vma.h>
 
 // ISR Entry configurator
 // Copyright (C) 2024 Panagiotis
@@ -115,6 +119,10 @@ void        initiateISR() {
     set_idt_gate(i, (uint64_t)asm_isr_redirect_table[i], 0x8E);
   }
 
+  // Can't trust whatever stack these come in on (see smp.h)
+  set_idt_ist(2, SMP_IST_NMI);
+  set_idt_ist(8, SMP_IST_DF);
+
   // APIC Spurious Interrupts
   set_idt_gate(0xff, (uint64_t)isr255, 0x8E);
 
@@ -154,9 +162,38 @@ void handleTaskFault(AsmPassedInterrupt *regs) {
   schedule((uint64_t)regs);
 }
 
+// Page faults that are part of normal operation (copy-on-write, demand
+// paging). The handler can take locks & get rescheduled, which overwrites the
+// top of the TSS stack (where our frame lives if the fault came from
+// userland), hence why we keep a copy of it around.
+bool handlePageFault(AsmPassedInterrupt *regs) {
+  uint64_t err_pos;
+  asm volatile("movq %%cr2, %0" : "=r"(err_pos));
+  uint64_t *pagedir = GetPageDirectory();
+
+  AsmPassedInterrupt frame;
+  memcpy(&frame, regs, sizeof(AsmPassedInterrupt));
+
+  bool interruptible = regs->rflags & RFLAGS_IF;
+  if (interruptible)
+    asm volatile("sti");
+  bool ret = VirtualHandleFault(pagedir, err_pos, regs->error);
+  if (!ret && !currentTask->pagedirOverride)
+    ret = vmaHandleFault(currentTask->infoPd, err_pos, regs->error);
+  if (interruptible)
+    asm volatile("cli");
+
+  memcpy(regs, &frame, sizeof(AsmPassedInterrupt));
+  return ret;
+}
+
 // pass stack ptr
 void handle_interrupt(uint64_t rsp) {
   AsmPassedInterrupt *cpu = (AsmPassedInterrupt *)rsp;
+  // TLB shootdowns (see paging.c), GS can't be trusted in here
+  if (cpu->interrupt == 2 && smpHandleNmi())
+    return;
+
   if (cpu->interrupt >= 32 && cpu->interrupt <= 47) { // IRQ
     /* Ack the IRQ respectively */
     if (cpu->interrupt >= 40) {
@@ -189,6 +226,12 @@ void handle_interrupt(uint64_t rsp) {
       }
     }
 
+    if (cpu->interrupt == 14 && tasksInitiated && handlePageFault(cpu))
+      return;
+
+    if (cpu->interrupt == 7 && tasksInitiated && fpuHandleNm())
+      return;
+
     if (currentTask->systemCallInProgress)
       debugf("[isr] Happened from system call!\n");
 
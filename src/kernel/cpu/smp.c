@@ -0,0 +1,121 @@
+#include <apic.h>
+#include <bootloader.h>
+#include <fastSyscall.h>
+#include <gdt.h>
+#include <idt.h>
+#include <paging.h>
+#include <smp.h>
+#include <system.h>
+#include <task.h>
+#include <timer.h>
+#include <util.h>
+#include <vdso.h>
+#include <vmm.h>
+
+// Symmetric multiprocessing: per-CPU areas & bringing up the other CPUs
+// Copyright (C) 2025 Panagiotis
+
+_Static_assert(offsetof(CpuInfo, threadInfo) == 0, "see isr.asm");
+_Static_assert(offsetof(CpuInfo, switching) == 24, "see isr.asm");
+_Static_assert(offsetof(CpuInfo, flushPending) == 32, "see isr.asm");
+
+CpuInfo *cpus[SMP_MAX_CPUS] = {0};
+
+static CpuInfo cpuBsp = {0}; // needed way before there's any heap
+
+// Loads the CPU's own GDT & TSS and makes its area reachable through GS
+static void smpInitiateCpu(CpuInfo *cpu) {
+  cpu->self = cpu;
+  gdt_load(&cpu->gdt, &cpu->gdtr, &cpu->tss); // (clears GS base)
+  cpu->tss.ist1 = (uint64_t)cpu->istNmi + SMP_IST_STACK_SIZE; // SMP_IST_NMI
+  cpu->tss.ist2 = (uint64_t)cpu->istDf + SMP_IST_STACK_SIZE;  // SMP_IST_DF
+  wrmsr(MSRID_GSBASE, (size_t)cpu);
+  wrmsr(MSRID_KERNEL_GSBASE, 0);
+
+  // what the vDSO's getcpu() gets back from RDTSCP
+  if (vdsoRdtscpSupported())
+    wrmsr(MSRID_TSC_AUX, cpu->id);
+}
+
+void initiateSmpBsp() {
+  CpuInfo *cpu = &cpuBsp;
+  cpu->id = bootloader.smpBspIndex;
+  if (cpu->id >= SMP_MAX_CPUS) {
+    debugf("[smp] FATAL! BSP index out of bounds! index{%d}\n", cpu->id);
+    panic();
+  }
+
+  cpu->threadInfo.lapic_id = bootloader.smp->bsp_lapic_id;
+  cpu->bsp = true;
+  cpu->online = true;
+  smpInitiateCpu(cpu);
+  cpus[cpu->id] = cpu;
+}
+
+// Where the other CPUs land, still on limine's stack & page directory
+static void smpApEntry(struct limine_smp_info *info) {
+  CpuInfo *cpu = (CpuInfo *)info->extra_argument;
+  smpInitiateCpu(cpu);
+
+  set_idt();
+  initiatePagingCpu();
+  initiateSSE();
+  initiateSyscallInst();
+  smpInitiateAPIC();
+  initiateApicTimerAp();
+
+  // the idle task represents the execution we're in right now
+  Task *idle = cpu->idleTask;
+  ChangePageDirectoryUnsafe(idle->infoPd->pagedir);
+  idle->running = true;
+  idle->onCpu = 1;
+  cpu->current = idle;
+  atomicWrite8((uint8_t *)&cpu->online, true);
+
+  debugf("[smp] CPU ready: id{%d} lapic{%d}\n", cpu->id, info->lapic_id);
+  asm volatile("sti");
+  kernelDummyEntry();
+}
+
+void initiateSmp() {
+  struct limine_smp_response *smp = bootloader.smp;
+  size_t                      online = 1;
+  for (size_t i = 0; i < smp->cpu_count; i++) {
+    if (i == bootloader.smpBspIndex)
+      continue;
+    if (i >= SMP_MAX_CPUS) {
+      debugf("[smp] Too many CPUs, ignoring the rest! max{%d}\n",
+             SMP_MAX_CPUS);
+      break;
+    }
+
+    struct limine_smp_info *info = smp->cpus[i];
+    CpuInfo                *cpu = (CpuInfo *)VirtualAllocateZeroed(
+        DivRoundUp(sizeof(CpuInfo), PAGE_SIZE));
+    cpu->id = i;
+    cpu->threadInfo.lapic_id = info->lapic_id;
+    cpu->idleTask = taskCreateIdle();
+    cpus[i] = cpu;
+
+    // one at a time, waiting for it to come online
+    info->extra_argument = (uint64_t)cpu;
+    atomicWrite64((uint64_t *)&info->goto_address, (uint64_t)smpApEntry);
+    while (!atomicRead8((uint8_t *)&cpu->online))
+      handControl();
+    online++;
+  }
+
+  debugf("[smp] Multiprocessing ready: cpus{%ld}\n", online);
+}
+
+// TLB shootdowns come in as NMIs, which might've interrupted the moments GS is
+// still the user's. So the CPU is found by its LAPIC ID instead.
+bool smpHandleNmi() {
+  uint32_t lapicId = apicCurrentCore();
+  for (int i = 0; i < SMP_MAX_CPUS; i++) {
+    CpuInfo *cpu = cpus[i];
+    if (cpu && cpu->threadInfo.lapic_id == lapicId)
+      return PagingShootdownHandle(cpu);
+  }
+  return false;
+}
@@ -1,4 +1,5 @@
 #include <console.h>
+#include <fpu.h>
 #include <system.h>
 
 // Source code for handling ports via assembly references
@@ -55,6 +56,13 @@ uint64_t wrmsr(uint32_t msrid, uint64_t value) {
   return value;
 }
 
+uint64_t rdtsc() {
+  uint32_t low;
+  uint32_t high;
+  __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+  return (uint64_t)low << 0 | (uint64_t)high << 32;
+}
+
 bool checkSSE() {
   uint32_t eax = 0x1, ebx = 0, ecx = 0, edx = 0;
   cpuid(&eax, &ebx, &ecx, &edx);
@@ -101,26 +109,8 @@ void        initiateSSE() {
                :
                : "rax");
 
-  // Do AVX stuff under certain conditions (qemu and prolly other stuff fake
-  // not having support but all AVX instructions succeed)
-  uint32_t eax = 1, ebx = 0, ecx = 0, edx = 0;
-  cpuid(&eax, &ebx, &ecx, &edx);
-
-  if (ecx & (1 << 26)) {
-    debugf("[cpu] The xsave instruction is available. Enabling..\n");
-    uint64_t cr4;
-    asm volatile("mov %%cr4, %0" : "=r"(cr4));
-    cr4 |= (uint32_t)1 << 18;
-    asm volatile("mov %0, %%cr4" : : "r"(cr4));
-
-    if (ecx & (1 << 28)) {
-      debugf("[cpu] The AVX extensions are available. Enabling..\n");
-      uint32_t xcr0_lo = 0x7; // x87 (bit 0), SSE (bit 1), AVX (bit 2)
-      uint32_t xcr0_hi = 0;
-      asm volatile("xsetbv" ::"c"(0), "a"(xcr0_lo), "d"(xcr0_hi));
-    }
-  }
-
+  // XSAVE (& AVX along with it) and lazy switching
+  initiateFpuCpu();
   debugf("[cpu] Extra CPU features have all been enabled without issue\n");
 }
 
@@ -1,9 +1,20 @@
 #include <apic.h>
+#include <clocksource.h>
 #include <isr.h>
 #include <rtc.h>
 #include <schedule.h>
+#include <smp.h>
 #include <system.h>
+#include <task.h>
 #include <timer.h>
+#include <util.h>
+
+// PIT ticks, only there to calibrate against (& to tell the time until then)
+static volatile uint64_t timerPitTicks = 0;
+
+static uint64_t timerPitRead() { return timerPitTicks; }
+
+Clocksource clocksourcePit = {.name = "pit", .read = timerPitRead};
 
 void initiatePitTimer(uint32_t reload_value) {
   // outportb(0x43, 0b00110100);
@@ -22,21 +33,241 @@ void initiatePitTimer(uint32_t reload_value) {
 
   RTC rtc = {0};
   readFromCMOS(&rtc);
-  timerTicks = 0;
+  timerPitTicks = 0;
 
   timerBootUnix = rtcToUnix(&rtc);
+  clocksourcePit.resolution = timerFrequency * NS_PER_SEC / TIMER_ACCURANCY;
+  clocksourcePit.mult = clocksourcePit.resolution << CLOCKSOURCE_SHIFT;
+  clocksourceSwitch(&clocksourcePit);
   debugf("[timer] Ready to fire: frequency{%dMHz}\n", timerFrequency);
 }
 
+static void timerPitTick() { timerPitTicks++; }
+
+uint64_t timerNow() { return clockMonotonic() / NS_PER_MS; }
+
+/* Timer wheels, expect the wheel to be locked */
+
+static void timerWheelInsert(TimerWheel *wheel, Timer *timer) {
+  uint64_t expires = MAX(timer->expires, wheel->next);
+  uint64_t delta = expires - wheel->next;
+  if (delta >= TIMER_WHEEL_RANGE) { // goes back on when it comes around
+    expires = wheel->next + TIMER_WHEEL_RANGE - 1;
+    delta = TIMER_WHEEL_RANGE - 1;
+  }
+
+  uint8_t level = 0;
+  while (delta >> (TIMER_WHEEL_BITS * (level + 1)))
+    level++;
+  uint8_t slot = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+  timer->level = level;
+  timer->slot = slot;
+  timer->prev = 0;
+  timer->next = wheel->slots[level][slot];
+  if (timer->next)
+    timer->next->prev = timer;
+  wheel->slots[level][slot] = timer;
+  wheel->occupied[level] |= 1ULL << slot;
+  wheel->pending++;
+  timer->armed = true;
+}
+
+static void timerWheelUnlink(TimerWheel *wheel, Timer *timer) {
+  if (timer->prev)
+    timer->prev->next = timer->next;
+  else
+    wheel->slots[timer->level][timer->slot] = timer->next;
+  if (timer->next)
+    timer->next->prev = timer->prev;
+  if (!wheel->slots[timer->level][timer->slot])
+    wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+
+  timer->next = 0;
+  timer->prev = 0;
+  wheel->pending--;
+  timer->armed = false;
+}
+
+// Takes a whole slot off of the wheel
+static Timer *timerWheelDetach(TimerWheel *wheel, uint8_t level, uint8_t slot) {
+  Timer *ret = wheel->slots[level][slot];
+  wheel->slots[level][slot] = 0;
+  wheel->occupied[level] &= ~(1ULL << slot);
+
+  Timer *browse = ret;
+  while (browse) {
+    browse->armed = false;
+    wheel->pending--;
+    browse = browse->next;
+  }
+  return ret;
+}
+
+// When the wheel next has to be looked at: the earliest (non-empty) slot that
+// either runs (bottom level) or gets spread out to the levels below (others)
+static uint64_t timerWheelNextEvent(TimerWheel *wheel) {
+  uint64_t ret = 0;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    uint64_t occupied = wheel->occupied[level];
+    if (!occupied)
+      continue;
+
+    int      shift = TIMER_WHEEL_BITS * level;
+    uint64_t unit = 1ULL << shift;
+    uint64_t index = DivRoundUp(wheel->next, unit);
+    uint64_t from = index & TIMER_WHEEL_MASK;
+    uint64_t later = occupied >> from;
+    uint64_t at = later ? index + __builtin_ctzll(later)
+                        : index + (TIMER_WHEEL_SLOTS - from) +
+                              __builtin_ctzll(occupied);
+    at <<= shift;
+    if (!ret || at < ret)
+      ret = at;
+  }
+  return ret;
+}
+
+static void timerWheelStep(TimerWheel *wheel, uint64_t at) {
+  // spread out whatever's coming up from the coarser levels
+  wheel->next = at;
+  for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+    int shift = TIMER_WHEEL_BITS * level;
+    if (at & ((1ULL << shift) - 1))
+      continue;
+
+    Timer *browse =
+        timerWheelDetach(wheel, level, (at >> shift) & TIMER_WHEEL_MASK);
+    while (browse) {
+      Timer *next = browse->next;
+      timerWheelInsert(wheel, browse);
+      browse = next;
+    }
+  }
+
+  Timer *browse = timerWheelDetach(wheel, 0, at & TIMER_WHEEL_MASK);
+  wheel->next = at + 1;
+  while (browse) {
+    Timer *next = browse->next;
+    if (browse->expires <= at) {
+      uint64_t again = browse->callback(browse);
+      if (again) {
+        browse->expires = again;
+        timerWheelInsert(wheel, browse);
+      }
+    } else // put there early, from too far away
+      timerWheelInsert(wheel, browse);
+    browse = next;
+  }
+}
+
+// Runs everything due by now
+static void timerWheelRun(TimerWheel *wheel, uint64_t now) {
+  while (wheel->pending) {
+    uint64_t at = timerWheelNextEvent(wheel);
+    if (at > now)
+      break;
+    timerWheelStep(wheel, at);
+  }
+
+  // nothing in between, might as well skip ahead
+  if (wheel->next <= now)
+    wheel->next = now + 1;
+  wheel->deadline = wheel->pending ? timerWheelNextEvent(wheel) : 0;
+}
+
+/* Timers */
+
+// Has the timer go off at expires (timerTicks), on the calling CPU
+void timerArm(Timer *timer, uint64_t expires) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  timerDisarm(timer);
+
+  CpuInfo    *local = cpuLocal();
+  TimerWheel *wheel = &local->wheel;
+  spinlockAcquire(&wheel->LOCK_WHEEL);
+  if (!wheel->pending) // nothing to go through in between
+    wheel->next = MAX(wheel->next, timerTicks);
+  timer->expires = expires;
+  timer->wheel = wheel;
+  timerWheelInsert(wheel, timer);
+  wheel->deadline = timerWheelNextEvent(wheel);
+  spinlockRelease(&wheel->LOCK_WHEEL);
+
+  if (!local->programmed || wheel->deadline < local->programmed)
+    timerProgram();
+  if (ints)
+    asm volatile("sti");
+}
+
+// Once this returns, the timer's callback isn't running anywhere either (its
+// wheel stays locked throughout). The LAPIC timer is left as is, it'll just
+// find nothing to do.
+void timerDisarm(Timer *timer) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  while (timer->wheel) {
+    TimerWheel *wheel = timer->wheel;
+    spinlockAcquire(&wheel->LOCK_WHEEL);
+    bool here = timer->wheel == wheel; // (might've moved meanwhile)
+    if (here && timer->armed)
+      timerWheelUnlink(wheel, timer);
+    spinlockRelease(&wheel->LOCK_WHEEL);
+    if (here)
+      break;
+  }
+  if (ints)
+    asm volatile("sti");
+}
+
+// Arms the calling CPU's LAPIC timer (one-shot) for the first thing it has to
+// do, be it a timer or the end of a slice. Expects interrupts to be off.
+void timerProgram() {
+  if (!apicFreq)
+    return;
+
+  CpuInfo *local = cpuLocal();
+  uint64_t at = local->wheel.deadline;
+  if (local->sliceEnd && (!at || local->sliceEnd < at))
+    at = local->sliceEnd;
+  local->programmed = at;
+  if (!at) { // nothing to wake up for
+    apicWrite(APIC_REGISTER_TIMER_INITCNT, 0);
+    return;
+  }
+
+  uint64_t target = at * NS_PER_MS;
+  uint64_t now = clockMonotonic();
+  uint64_t max = 0xFFFFFFFFULL * NS_PER_MS / apicFreq;
+  uint64_t left = target > now ? MIN(target - now, max) : 0;
+  apicWrite(APIC_REGISTER_TIMER_INITCNT, MAX(left * apicFreq / NS_PER_MS, 1));
+}
+
+// Goes off whenever something's due on this CPU (or when it gets poked to
+// reschedule, see schedule.c)
 void timerTick(uint64_t rsp) {
-  timerTicks++;
+  CpuInfo    *local = cpuLocal();
+  TimerWheel *wheel = &local->wheel;
+  local->programmed = 0; // one-shot, it's spent
+
+  spinlockAcquire(&wheel->LOCK_WHEEL);
+  timerWheelRun(wheel, timerTicks);
+  spinlockRelease(&wheel->LOCK_WHEEL);
+
+  timerProgram();
   schedule(rsp);
 }
 
 uint32_t sleep(uint32_t time) {
   uint64_t target = timerTicks + (time);
-  while (target > timerTicks)
+  // stay off the run queue until the wakeup timer fires (see schedule.c), even
+  // if something wakes us up before that
+  while (target > timerTicks) {
+    if (tasksInitiated)
+      scheduleBlockUntil(TASK_STATE_BLOCKED, target);
     handControl();
+  }
 
   return 0;
 }
@@ -45,28 +276,48 @@ void initiateApicTimer() {
   size_t waitfor = 10; // in ms
   initiatePitTimer(1000);
   uint8_t ioapicInt = ioApicRedirect(0, false);
-  registerIRQhandler(ioapicInt, timerTick);
+  registerIRQhandler(ioapicInt, timerPitTick);
+
+  // start right on a PIT tick
+  uint64_t start = timerPitTicks + 1;
+  while (start > timerPitTicks)
+    ;
 
   apicWrite(APIC_REGISTER_TIMER_DIV, 0x3); // div 16
   apicWrite(APIC_REGISTER_TIMER_INITCNT, 0xFFFFFFFF);
+  uint64_t tscStart = rdtsc();
 
   // wait using the old pit
-  uint64_t target = timerTicks + waitfor;
-  while (target > timerTicks)
+  uint64_t target = start + waitfor;
+  while (target > timerPitTicks)
     ;
 
   // mask apic timer and get back time passed
   apicWrite(APIC_REGISTER_LVT_TIMER, 0x10000);
   uint32_t ticksInXms = 0xFFFFFFFF - apicRead(APIC_REGISTER_TIMER_CURRCNT);
+  uint64_t tscInXms = rdtsc() - tscStart;
 
   uint32_t lapicId = 0;
   uint8_t  targIrq = irqPerCoreAllocate(0, &lapicId);
   apicFreq = ticksInXms / waitfor;
 
-  // finally configure the it
-  apicWrite(APIC_REGISTER_LVT_TIMER, targIrq | APIC_LVT_TIMER_MODE_PERIODIC);
+  // the TSC keeps the time from here on out
+  initiateClocksourceTsc(tscInXms, waitfor * clocksourcePit.resolution);
+
+  // finally configure it, as one-shot (see timerProgram())
+  timerVector = targIrq;
+  apicWrite(APIC_REGISTER_LVT_TIMER, targIrq);
   apicWrite(APIC_REGISTER_TIMER_DIV, 0x3);
-  apicWrite(APIC_REGISTER_TIMER_INITCNT, apicFreq);
+  apicWrite(APIC_REGISTER_TIMER_INITCNT, 0);
   ioapicInt = ioApicRedirect(0, true); // mask the old pit
   registerIRQhandler(targIrq, timerTick);
+
+  debugf("[timer] Calibrated: lapic{%ld/ms}\n", apicFreq);
+}
+
+// Other CPUs reuse the calibration (& vector) of the BSP's
+void initiateApicTimerAp() {
+  apicWrite(APIC_REGISTER_LVT_TIMER, timerVector);
+  apicWrite(APIC_REGISTER_TIMER_DIV, 0x3);
+  apicWrite(APIC_REGISTER_TIMER_INITCNT, 0);
 }
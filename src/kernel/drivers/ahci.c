@@ -131,13 +131,13 @@ force_inline HBA_CMD_TBL *ahciSetUpCmd(ahci *ahciPtr, uint32_t portId,
   size_t totalBytes = count << 9;
   size_t i = 0;
   while (true) {
-    // decide what we need to put on this prdt
-    size_t spaceCovered = 0;
+    // decide what we need to put on this prdt. never past a page boundary, as
+    // buffers aren't always physically contiguous (see vmm.c)
+    size_t spaceCovered = MIN(totalBytes, AHCI_BYTES_PER_PRDT);
     if (!IS_ALIGNED((size_t)buff, 0x1000)) {
       size_t rounded = (((size_t)buff) + 4095) & ~4095;
       spaceCovered = MIN(rounded - (size_t)buff, totalBytes); // min(gap, limit)
     }
-    spaceCovered = MIN(totalBytes, AHCI_BYTES_PER_PRDT);
 
     // actually go forward doing so
     size_t targPhys = VirtualToPhysical((size_t)buff);
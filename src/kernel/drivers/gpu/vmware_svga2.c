@@ -8,6 +8,7 @@
 #include <timer.h>
 #include <util.h>
 #include <vga.h>
+#include <vmm.h>
 #include <vmware_svga2.h>
 
 // VMWare SVGA-II driver (despite the name it used also used in qemu)
@@ -54,12 +55,8 @@ void VMwareSvga2SetMode(uint32_t width, uint32_t height, uint32_t bpp) {
 void VMwareSvga2Sync() {
   size_t phys =
       VMWareSvga2Read(SVGA_REG_FB_START) + VMWareSvga2Read(SVGA_REG_FB_OFFSET);
-  size_t addr = 0x500000000000; // <- todo
-  size_t pages = DivRoundUp(VMWareSvga2Read(SVGA_REG_VRAM_SIZE), PAGE_SIZE);
-  for (int i = 0; i < pages; i++) {
-    VirtualMap(addr + i * PAGE_SIZE, phys + i * PAGE_SIZE, PF_RW | PF_CACHE_WC);
-  }
-  fb.virt = (uint8_t *)addr;
+  fb.virt = VirtualMapDevice(phys, VMWareSvga2Read(SVGA_REG_VRAM_SIZE),
+                             PF_RW | PF_CACHE_WC);
   fb.phys = phys;
 
   uint32_t bpp = VMWareSvga2Read(SVGA_REG_BPP);
@@ -2,6 +2,8 @@
 #include <console.h>
 #include <kb.h>
 #include <paging.h>
+#include <poll.h>
+#include <schedule.h>
 #include <task.h>
 
 #include <linux.h>
@@ -186,6 +188,18 @@ uint32_t kbCurr = 0;
 uint32_t kbMax = 0;
 uint32_t kbTaskId = 0;
 
+// Characters typed while nobody's reading (say, bash sitting in pselect6()),
+// fed to whoever reads next. LOCK_KB guards these & the reader's buffer, it's
+// taken by kbIrq() so anyone else needs interrupts off
+#define KB_PENDING_MAX 256
+
+Spinlock LOCK_KB = ATOMIC_FLAG_INIT;
+char     kbPending[KB_PENDING_MAX];
+uint32_t kbPendingStart = 0;
+uint32_t kbPendingCnt = 0;
+
+static void kbHandleChar(char out);
+
 uint8_t kbRead() {
   while (!(inportb(0x64) & 1))
     ;
@@ -271,6 +285,8 @@ bool kbTaskRead(uint32_t taskId, char *buff, uint32_t limit,
   if (!task)
     return false;
 
+  asm volatile("cli");
+  spinlockAcquire(&LOCK_KB);
   kbBuff = buff;
   kbCurr = 0;
   kbMax = limit;
@@ -278,9 +294,22 @@ bool kbTaskRead(uint32_t taskId, char *buff, uint32_t limit,
 
   if (changeTaskState)
     task->state = TASK_STATE_WAITING_INPUT;
+
+  // whatever got typed in the meantime comes first (might finish it already)
+  while (kbBuff && kbPendingCnt) {
+    char out = kbPending[kbPendingStart];
+    kbPendingStart = (kbPendingStart + 1) % KB_PENDING_MAX;
+    kbPendingCnt--;
+    kbHandleChar(out);
+  }
+  spinlockRelease(&LOCK_KB);
+  asm volatile("sti");
   return true;
 }
 
+// Whether there's typed input that nobody's read yet
+bool kbHasInput() { return atomicRead32(&kbPendingCnt) > 0; }
+
 void kbReset() {
   kbBuff = 0;
   kbCurr = 0;
@@ -359,7 +388,7 @@ void kbFinaliseStream() {
   Task *task = taskGet(kbTaskId);
   if (task) {
     task->tmpRecV = kbCurr;
-    task->state = TASK_STATE_READY;
+    scheduleWake(task);
   }
   kbReset();
 }
@@ -373,11 +402,8 @@ void kbChar(Task *task, char out) {
     kbFinaliseStream();
 }
 
-void kbIrq() {
-  char out = handleKbEvent();
-  if (!kbBuff || !out || !tasksInitiated)
-    return;
-
+// Expects LOCK_KB to be held, with someone reading
+static void kbHandleChar(char out) {
   Task *task = taskGet(kbTaskId);
 
   switch (out) {
@@ -402,4 +428,22 @@ void kbIrq() {
   }
 }
 
+void kbIrq() {
+  char out = handleKbEvent();
+  if (!out || !tasksInitiated)
+    return;
+
+  spinlockAcquire(&LOCK_KB);
+  bool queued = !kbBuff;
+  if (!queued)
+    kbHandleChar(out);
+  else if (kbPendingCnt < KB_PENDING_MAX)
+    kbPending[(kbPendingStart + kbPendingCnt++) % KB_PENDING_MAX] = out;
+  spinlockRelease(&LOCK_KB);
+
+  // stdin just became readable (see internalPollHandler())
+  if (queued)
+    pollWake();
+}
+
 bool kbIsOccupied() { return !!kbBuff; }
@@ -4,6 +4,8 @@
 #include <isr.h>
 #include <malloc.h>
 #include <system.h>
+#include <task.h>
+#include <timer.h>
 
 #include <util.h>
 
@@ -191,11 +193,13 @@ void E1000InterruptHandler() {
   if (status & ICR_TX_DESC_WRITTEN_BACK) {
     status &= ~ICR_TX_DESC_WRITTEN_BACK;
     // transmit succeeded
+    taskUnblock(&e1000->blockingTx);
   }
 
   if (status & ICR_TX_QUEUE_EMPTY) {
     status &= ~ICR_TX_QUEUE_EMPTY;
     // will be frequently hit, nothing to worry about
+    taskUnblock(&e1000->blockingTx);
   }
 
   if (status & ICR_LINK_STATUS_CHANGE) {
@@ -252,8 +256,16 @@ void sendE1000(NIC *nic, void *packet, uint32_t packetSize) {
     tail %= tx_desc_count;
   E1000CmdWrite(e1000, REG_TXDESCTAIL, tail);
 
-  while (!desc->status)
-    handControl(); // wait for it to be done
+  // wait for it to be done (CMD_RS has it interrupt us)
+  while (!desc->status) {
+    BlockedTask entry;
+    taskBlockPrepare(&e1000->blockingTx, &entry, 0);
+    if (desc->status)
+      taskBlockCancel(&e1000->blockingTx, &entry);
+    else
+      taskBlockSleep(&e1000->blockingTx, &entry, 0,
+                     timerTicks + E1000_TX_WAIT, false);
+  }
 }
 
 bool initiateE1000(PCIdevice *device) {
@@ -12,6 +12,7 @@
 #include <kb.h>
 #include <kernel_helper.h>
 #include <limine.h>
+#include <lock_stat.h>
 #include <malloc.h>
 #include <md5.h>
 #include <mouse.h>
@@ -23,6 +24,7 @@
 #include <rtc.h>
 #include <serial.h>
 #include <shell.h>
+#include <smp.h>
 #include <string.h>
 #include <sys.h>
 #include <syscalls.h>
@@ -31,6 +33,7 @@
 #include <testing.h>
 #include <timer.h>
 #include <util.h>
+#include <vdso.h>
 #include <vga.h>
 #include <vmm.h>
 
@@ -46,6 +49,11 @@ void _start(void) {
 
   initiateSerial();
   initialiseBootloaderParser();
+  initiateLockStat(); // before anything gets contended
+
+  // Everything per-CPU (currentTask & co) is reached through GS
+  initiateGDT();
+  initiateSmpBsp();
 
   // Framebuffer doesn't depend on paging, limine prepares it anyways
   initiateVGA();
@@ -55,11 +63,12 @@ void _start(void) {
   // None of the two depend on paging
   initiatePMM();
   initiateVMM();
+  testingEarly();
 
-  initiateGDT();
   initiateACPI(); // needed for APIC setup
   initiateISR();
   initiatePaging();
+  initiateVdso(); // before the clocksources, so it catches every switch
 
   debugf("\n====== REACHED SYSTEM ======\n");
   initiateApicTimer(); // mouse needs a timer
@@ -67,9 +76,13 @@ void _start(void) {
   fsMount("/dev/", CONNECTOR_DEV, 0, 0); // mouse & kb need it
   initiateKb();
   initiateMouse();
+  // tasks' FPU areas are sized after what it finds
+  initiateSSE();
   // any filesystem operations depend on currentTask
   initiateTasks();
   initiateKernelThreads();
+  // kb, mouse & the timer stay on the BSP, later IRQs get spread out
+  initiateSmp();
   initiateNetworking();
   initiatePCI();
   fsMount("/", CONNECTOR_AHCI, 0, 1);
@@ -83,7 +96,6 @@ void _start(void) {
   initiateSyscallInst();
   initiateSyscalls();
 
-  initiateSSE();
   // initiateTasks();
 
   testingInit();
@@ -1,3 +1,4 @@
+#include <caching.h>
 #include <kernel_helper.h>
 #include <nic_controller.h>
 #include <paging.h>
@@ -13,6 +14,7 @@
 // Copyright (C) 2024 Panagiotis
 
 Task *netHelperTask = 0;
+Task *kswapdTask = 0;
 
 void helperNet() {
   while (true) {
@@ -27,51 +29,51 @@ void helperNet() {
   }
 }
 
-void helperReaper() {
-  spinlockAcquire(&LOCK_REAPER);
-  if (reaperTask) {
-    if (reaperTask->state == TASK_STATE_SIGKILLED)
-      taskKill(reaperTask->id, 128 + reaperTask->tmpRecV);
-    if (reaperTask->state != TASK_STATE_DEAD)
-      goto end;
-
-    // we have a task to kill!
-    taskFreeChildren(reaperTask); // free the children
-
-    // free stacks
-    size_t stackSize = USER_STACK_PAGES * BLOCK_SIZE;
-    void  *tssRsp = (void *)(reaperTask->whileTssRsp - stackSize);
-    void  *syscallRsp = (void *)(reaperTask->whileSyscallRsp - stackSize);
-    VirtualFree(tssRsp, USER_STACK_PAGES);
-    VirtualFree(syscallRsp, USER_STACK_PAGES);
-
-    // free info splits
-    taskInfoFsDiscard(reaperTask->infoFs);
-
-    // interrupted syscalls
-    TaskSysInterrupted *intrBrowse = reaperTask->firstSysIntr;
-    while (intrBrowse) {
-      TaskSysInterrupted *next = intrBrowse->next;
-      free(next); // quick n dirty
-      intrBrowse = next;
-    }
-
-    // free the task now that it's safe
-    taskListDestroy(reaperTask);
+static void helperReap(Task *target) {
+  taskFreeChildren(target); // free the children
+
+  // free stacks
+  size_t stackSize = USER_STACK_PAGES * BLOCK_SIZE;
+  void  *tssRsp = (void *)(target->whileTssRsp - stackSize);
+  void  *syscallRsp = (void *)(target->whileSyscallRsp - stackSize);
+  VirtualFree(tssRsp, USER_STACK_PAGES);
+  VirtualFree(syscallRsp, USER_STACK_PAGES);
+
+  // free info splits (the address space goes once its last user is gone)
+  taskInfoFsDiscard(target->infoFs);
+  taskInfoPdDiscard(target->infoPd);
+
+  // interrupted syscalls
+  TaskSysInterrupted *intrBrowse = target->firstSysIntr;
+  while (intrBrowse) {
+    TaskSysInterrupted *next = intrBrowse->next;
+    slabFree(&cacheTaskSysInterrupted, intrBrowse);
+    intrBrowse = next;
+  }
 
-    // todo: free() the task in a safe manner. also implement some system for
-    // editing the global LL without race conditions
-    // (*) depends: task blocking, watchlists, task adding, forking, etc.
+  // free the task now that it's safe
+  taskListDestroy(target);
+}
 
-    // will need a good system for that so maybe delay it to when multithreading
-    // is implemented!
+void helperReaper() {
+  // grab the entire queue, so dying tasks never wait on us
+  spinlockAcquire(&LOCK_REAPER);
+  Task *browse = firstReaperTask;
+  firstReaperTask = 0;
+  spinlockRelease(&LOCK_REAPER);
 
-    // done! continue listening
-    reaperTask = 0;
+  while (browse) {
+    Task *next = browse->nextReaper;
+    if (browse->state == TASK_STATE_SIGKILLED)
+      taskKill(browse->id, 128 + browse->tmpRecV); // queues it back up
+    else if (browse->state != TASK_STATE_DEAD)
+      taskCallReaper(browse); // not quite there yet, try again later
+    else if (atomicRead8(&browse->onCpu))
+      taskCallReaper(browse); // some CPU is still on its stacks
+    else
+      helperReap(browse);
+    browse = next;
   }
-
-end:
-  spinlockRelease(&LOCK_REAPER);
 }
 
 void kernelHelpEntry() {
@@ -86,4 +88,7 @@ void kernelHelpEntry() {
 void initiateKernelThreads() {
   netHelperTask = taskCreateKernel((size_t)kernelHelpEntry, 0);
   taskNameKernel(netHelperTask, helperCmdline, sizeof(helperCmdline));
+
+  kswapdTask = taskCreateKernel((size_t)kswapdEntry, 0);
+  taskNameKernel(kswapdTask, kswapdCmdline, sizeof(kswapdCmdline));
 }
@@ -4,6 +4,7 @@
 #include <md5.h>
 #include <ne2k.h>
 #include <pci.h>
+#include <pmm.h>
 #include <shell.h>
 #include <string.h>
 #include <system.h>
@@ -12,6 +13,7 @@
 #include <util.h>
 #include <vmm.h>
 
+#include <bootloader.h>
 #include <timer.h>
 #include <vfs.h>
 
@@ -26,6 +28,10 @@
 
 extern void weirdTests();
 
+// Self-tests & benchmarks that run on boot (they slow it down quite a bit)
+#define TESTING_PMM 0   // buddy allocator, before anything else uses it
+#define TESTING_SCHED 0 // scheduler, with lots of sleeping tasks around
+
 void waitNicIPAssigned() {
   PCI *pci = firstPCI;
   while (pci) {
@@ -50,6 +56,118 @@ void waitNicIPAssigned() {
 void testingInit() {
   // waitNicIPAssigned();
   // run(argv[0], true, sizeof(argv) / sizeof(argv[0]), argv);
+#if TESTING_SCHED
+  testingScheduler();
+#endif
+}
+
+// Right after the memory managers are up
+void testingEarly() {
+#if TESTING_PMM
+  testingPmm();
+#endif
+}
+
+// Buddy allocator self-test: random allocation & free patterns. Every page gets
+// stamped with its own address, so overlapping blocks get caught on free.
+#define TESTING_PMM_SLOTS 64
+#define TESTING_PMM_ROUNDS 4096
+
+static void testingPmmRelease(size_t phys, int pages) {
+  for (int i = 0; i < pages; i++) {
+    size_t  page = phys + i * BLOCK_SIZE;
+    size_t *stamp = (size_t *)(page + bootloader.hhdmOffset);
+    if (*stamp != page || PhysicalReferenceCount(page) != 1) {
+      debugf("[testing::pmm] Corrupted block! phys{%lx} page{%lx}\n", phys,
+             page);
+      panic();
+    }
+  }
+  PhysicalFree(phys, pages);
+}
+
+void testingPmm() {
+  size_t slotsPhys[TESTING_PMM_SLOTS] = {0};
+  int    slotsPages[TESTING_PMM_SLOTS] = {0};
+  size_t freeBefore = physical.freeFrames;
+
+  for (int round = 0; round < TESTING_PMM_ROUNDS; round++) {
+    int slot = rand() % TESTING_PMM_SLOTS;
+    if (slotsPhys[slot]) {
+      testingPmmRelease(slotsPhys[slot], slotsPages[slot]);
+      slotsPhys[slot] = 0;
+      continue;
+    }
+
+    // mostly small blocks, with the occasional bigger (odd-sized) one
+    int    pages = (rand() % 8) ? inrand(1, 16) : inrand(17, 600);
+    size_t phys = PhysicalAllocate(pages);
+    if (!phys || phys % BLOCK_SIZE) {
+      debugf("[testing::pmm] Bad allocation! phys{%lx}\n", phys);
+      panic();
+    }
+    for (int i = 0; i < pages; i++) {
+      size_t page = phys + i * BLOCK_SIZE;
+      *(size_t *)(page + bootloader.hhdmOffset) = page;
+    }
+    slotsPhys[slot] = phys;
+    slotsPages[slot] = pages;
+  }
+
+  for (int i = 0; i < TESTING_PMM_SLOTS; i++) {
+    if (slotsPhys[i])
+      testingPmmRelease(slotsPhys[i], slotsPages[i]);
+  }
+
+  if (physical.freeFrames != freeBefore) {
+    debugf("[testing::pmm] Leaked pageframes! before{%ld} after{%ld}\n",
+           freeBefore, physical.freeFrames);
+    panic();
+  }
+  debugf("[testing::pmm] Passed: rounds{%d}\n", TESTING_PMM_ROUNDS);
+}
+
+// Scheduler benchmark: what a tick costs with lots of tasks around, almost all
+// of them asleep. Measured as the work we get done in a fixed period, before
+// and after spawning them. Every kernel task carries two USER_STACK_PAGES
+// stacks, so it spawns as many as a quarter of free memory fits (up to the max)
+#define TESTING_SCHED_TASKS 1000
+#define TESTING_SCHED_PERIOD 250 // ms
+
+static volatile bool testingSchedDone = false;
+
+static void testingSchedulerIdle() {
+  while (!testingSchedDone)
+    sleep(inrand(50, 500));
+  taskKill(currentTask->id, 0);
+}
+
+static uint64_t testingSchedulerWork() {
+  volatile uint64_t loops = 0;
+  uint64_t          target = timerTicks + TESTING_SCHED_PERIOD;
+  while (timerTicks < target)
+    loops++;
+  return loops;
+}
+
+void testingScheduler() {
+  size_t taskPages = 2 * USER_STACK_PAGES;
+  int    tasks = MIN(TESTING_SCHED_TASKS, physical.freeFrames / 4 / taskPages);
+
+  uint64_t before = testingSchedulerWork();
+
+  testingSchedDone = false;
+  for (int i = 0; i < tasks; i++) {
+    Task *task = taskCreateKernel((size_t)testingSchedulerIdle, 0);
+    task->noInformParent = true;
+  }
+  uint64_t after = testingSchedulerWork();
+  testingSchedDone = true;
+
+  debugf("[testing::sched] tasks{%d} loops/ms: before{%ld} after{%ld} "
+         "overhead{%ld%%}\n",
+         tasks, before / TESTING_SCHED_PERIOD, after / TESTING_SCHED_PERIOD,
+         before > after ? (before - after) * 100 / before : 0);
 }
 
 void weirdTests() {
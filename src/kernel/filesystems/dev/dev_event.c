@@ -1,5 +1,6 @@
 #include <dev.h>
 #include <malloc.h>
+#include <poll.h>
 #include <string.h>
 #include <syscalls.h>
 #include <task.h>
@@ -29,6 +30,8 @@ void inputGenerateEvent(DevInputEvent *item, uint16_t type, uint16_t code,
   assert(CircularIntWrite(&item->deviceEvents, (void *)&event,
                           sizeof(struct input_event)) ==
          sizeof(struct input_event));
+  taskUnblock(&item->blocking);
+  pollWake();
 }
 
 // /dev/input/eventX userspace stuff
@@ -47,14 +50,24 @@ size_t devInputEventOpen(char *filename, int flags, int mode, OpenFile *fd,
 size_t devInputEventRead(OpenFile *fd, uint8_t *out, size_t limit) {
   DevInputEvent *event = fd->dir;
 
+  size_t ret = 0;
   while (true) {
+    BlockedTask entry;
+    taskBlockPrepare(&event->blocking, &entry, 0);
     size_t cnt = CircularIntRead(&event->deviceEvents, out, limit);
     if (cnt > 0)
-      return cnt;
-    if (fd->flags & O_NONBLOCK)
-      return ERR(EWOULDBLOCK);
-    if (signalsPendingQuick(currentTask))
-      return ERR(EINTR);
+      ret = cnt;
+    else if (fd->flags & O_NONBLOCK)
+      ret = ERR(EWOULDBLOCK);
+    else if (signalsPendingQuick(currentTask))
+      ret = ERR(EINTR);
+    else {
+      taskBlockSleep(&event->blocking, &entry, 0, 0, true);
+      continue;
+    }
+
+    taskBlockCancel(&event->blocking, &entry);
+    return ret;
   }
 }
 
@@ -3,6 +3,7 @@
 #include <fb.h>
 #include <linked_list.h>
 #include <malloc.h>
+#include <poll.h>
 #include <string.h>
 #include <syscalls.h>
 #include <task.h>
@@ -53,6 +54,13 @@ void ptyPairCleanup(PtyPair *pair) {
   spinlockRelease(&LOCK_PTY_GLOBAL);
 }
 
+// Whatever either end (or poll()) might be waiting for could've changed.
+// Expects LOCK_PTY to be held
+void ptyWake(PtyPair *pair) {
+  taskUnblock(&pair->blocking);
+  pollWake();
+}
+
 void ptyTermiosDefaults(struct termios *term) {
   term->c_iflag = ICRNL | IXON | BRKINT | ISTRIP | INPCK;
   term->c_oflag = OPOST | ONLCR;
@@ -124,8 +132,10 @@ bool ptmxClose(OpenFile *fd) {
   pair->masterFds--;
   if (!pair->masterFds && !pair->slaveFds)
     ptyPairCleanup(pair);
-  else
+  else {
+    ptyWake(pair);
     spinlockRelease(&pair->LOCK_PTY);
+  }
   return true;
 }
 
@@ -148,8 +158,7 @@ size_t ptmxRead(OpenFile *fd, uint8_t *out, size_t limit) {
       spinlockRelease(&pair->LOCK_PTY);
       return ERR(EWOULDBLOCK);
     }
-    spinlockRelease(&pair->LOCK_PTY);
-    handControl();
+    taskBlockWait(&pair->blocking, &pair->LOCK_PTY, 0, false);
   }
 
   size_t toCopy = MIN(limit, ptmxDataAvail(pair));
@@ -158,6 +167,7 @@ size_t ptmxRead(OpenFile *fd, uint8_t *out, size_t limit) {
           PTY_BUFF_SIZE - toCopy);
   pair->ptrMaster -= toCopy;
 
+  ptyWake(pair);
   spinlockRelease(&pair->LOCK_PTY);
   return toCopy;
 }
@@ -182,8 +192,7 @@ size_t ptmxWrite(OpenFile *fd, uint8_t *in, size_t limit) {
       spinlockRelease(&pair->LOCK_PTY);
       return ERR(EWOULDBLOCK);
     }
-    spinlockRelease(&pair->LOCK_PTY);
-    handControl();
+    taskBlockWait(&pair->blocking, &pair->LOCK_PTY, 0, false);
   }
 
   // we already have a lock in our hands
@@ -200,6 +209,7 @@ size_t ptmxWrite(OpenFile *fd, uint8_t *in, size_t limit) {
   }
   // hexDump("fr", in, limit, 32, debugf);
 
+  ptyWake(pair);
   spinlockRelease(&pair->LOCK_PTY);
   return limit;
 }
@@ -331,8 +341,10 @@ bool ptsClose(OpenFile *fd) {
   pair->slaveFds--;
   if (!pair->masterFds && !pair->slaveFds)
     ptyPairCleanup(pair);
-  else
+  else {
+    ptyWake(pair);
     spinlockRelease(&pair->LOCK_PTY);
+  }
   return true;
 }
 
@@ -367,8 +379,7 @@ size_t ptsRead(OpenFile *fd, uint8_t *out, size_t limit) {
       spinlockRelease(&pair->LOCK_PTY);
       return ERR(EWOULDBLOCK);
     }
-    spinlockRelease(&pair->LOCK_PTY);
-    handControl();
+    taskBlockWait(&pair->blocking, &pair->LOCK_PTY, 0, false);
   }
 
   size_t toCopy = MIN(limit, ptsDataAvail(pair));
@@ -377,6 +388,7 @@ size_t ptsRead(OpenFile *fd, uint8_t *out, size_t limit) {
           PTY_BUFF_SIZE - toCopy);
   pair->ptrSlave -= toCopy;
 
+  ptyWake(pair);
   spinlockRelease(&pair->LOCK_PTY);
   return toCopy;
 }
@@ -419,13 +431,13 @@ size_t ptsWrite(OpenFile *fd, uint8_t *in, size_t limit) {
       spinlockRelease(&pair->LOCK_PTY);
       return ERR(EWOULDBLOCK);
     }
-    spinlockRelease(&pair->LOCK_PTY);
-    handControl();
+    taskBlockWait(&pair->blocking, &pair->LOCK_PTY, 0, false);
   }
 
   // we already have a lock in our hands
   size_t written = ptsWriteInner(pair, in, limit);
 
+  ptyWake(pair);
   spinlockRelease(&pair->LOCK_PTY);
   return written;
 }
@@ -467,6 +479,7 @@ size_t ptsIoctl(OpenFile *fd, uint64_t request, void *arg) {
   case TCSETSW:   // this drains(?), idek man
   case TCSETSF: { // idek anymore man
     memcpy(&pair->term, arg, sizeof(termios));
+    ptyWake(pair); // canonical mode decides what's there to read
     ret = 0;
     break;
   }
@@ -1,7 +1,10 @@
+#include <avl_tree.h>
 #include <bootloader.h>
 #include <ext2.h>
 #include <malloc.h>
 #include <paging.h>
+#include <pmm.h>
+#include <slab.h>
 #include <string.h>
 #include <syscalls.h>
 #include <system.h>
@@ -10,11 +13,50 @@
 #include <util.h>
 #include <vmm.h>
 
+SlabCache cacheExt2CacheObject =
+    SLAB_CACHE_INIT("ext2_cache_object", Ext2CacheObject, 0);
+
+// Unlinks the object off its file & frees it. Expects WLOCK_CACHE to be held
+// for writing & the object to be off the LRU already.
+static void ext2CacheFree(Ext2FoundObject *global, Ext2CacheObject *obj) {
+  if (obj->prev)
+    obj->prev->next = obj->next;
+  else
+    global->firstCacheObj = obj->next;
+  if (obj->next)
+    obj->next->prev = obj->prev;
+
+  VirtualFree(obj->buff, obj->lru.pages);
+  slabFree(&cacheExt2CacheObject, obj);
+}
+
+// Reclaim handler (see caching.c). Readers hold on to cache objects for as
+// long as they have WLOCK_FILE, hence that has to be free as well.
+static size_t ext2CacheEvict(CachingEntry *entry) {
+  Ext2CacheObject *obj = entry->owner;
+  Ext2FoundObject *global = obj->global;
+  size_t           pages = entry->pages;
+
+  if (!rwlockWriteTryAcquire(&global->WLOCK_FILE))
+    return 0;
+  if (!rwlockWriteTryAcquire(&global->WLOCK_CACHE)) {
+    rwlockWriteRelease(&global->WLOCK_FILE);
+    return 0;
+  }
+
+  cachingLruUnlink(entry);
+  ext2CacheFree(global, obj);
+
+  rwlockWriteRelease(&global->WLOCK_CACHE);
+  rwlockWriteRelease(&global->WLOCK_FILE);
+  return pages;
+}
+
 void ext2CacheAddSecurely(MountPoint *mnt, Ext2FoundObject *global,
                           uint8_t *buff, size_t blockIndex, size_t blocks) {
   Ext2 *ext2 = EXT2_PTR(mnt->fsInfo);
 
-  spinlockCntWriteAcquire(&global->WLOCK_CACHE);
+  rwlockWriteAcquire(&global->WLOCK_CACHE);
   // find anything as a start that is close
   Ext2CacheObject *cacheObj = global->firstCacheObj;
   Ext2CacheObject *lastCaught = global->firstCacheObj;
@@ -40,11 +82,15 @@ void ext2CacheAddSecurely(MountPoint *mnt, Ext2FoundObject *global,
         break;
       }
     }
-    Ext2CacheObject *target = calloc(sizeof(Ext2CacheObject), 1);
-    mnt->blocksCached += blocks;
+    Ext2CacheObject *target = slabAlloc(&cacheExt2CacheObject);
     target->blockIndex = blockIndex;
     target->blocks = blocks;
     target->buff = buff;
+    target->global = global;
+    target->lru.owner = target;
+    target->lru.pages = DivRoundUp((blocks + 1) * ext2->blockSize, BLOCK_SIZE);
+    target->lru.evict = ext2CacheEvict;
+    cachingLruInsert(&target->lru);
     if (!global->firstCacheObj) { // simple, no root
       global->firstCacheObj = target;
     } else if (browse) { // simple, all are smaller up to one which we use
@@ -77,33 +123,29 @@ void ext2CacheAddSecurely(MountPoint *mnt, Ext2FoundObject *global,
         break;
       // solve the problem:
       // for now the quickest method is to try and remove it.
-      VirtualFree(
-          browse->buff,
-          DivRoundUp((browse->blocks + 1) * ext2->blockSize, BLOCK_SIZE));
-      mnt->blocksCached -= browse->blocks;
-
       Ext2CacheObject *next = browse->next;
-      if (!browse->prev) {
-        // first object
-        global->firstCacheObj = browse->next;
-        if (global->firstCacheObj)
-          global->firstCacheObj->prev = 0;
-      } else {
-        Ext2CacheObject *prev = browse->prev;
-        prev->next = browse->next;
-        if (browse->next)
-          browse->next->prev = prev;
-      }
-      free(browse);
+      cachingLruRemove(&browse->lru);
+      ext2CacheFree(global, browse);
       browse = next;
     }
 
     // continue normally now
-    spinlockCntWriteRelease(&global->WLOCK_CACHE);
+    rwlockWriteRelease(&global->WLOCK_CACHE);
     ext2CacheAddSecurely(mnt, global, buff, blockIndex, blocks);
     return;
   }
-  spinlockCntWriteRelease(&global->WLOCK_CACHE);
+  rwlockWriteRelease(&global->WLOCK_CACHE);
+}
+
+// Forgets about every cached block of the file (writes, deletion)
+void ext2CacheDrop(Ext2FoundObject *global) {
+  rwlockWriteAcquire(&global->WLOCK_CACHE);
+  while (global->firstCacheObj) {
+    Ext2CacheObject *obj = global->firstCacheObj;
+    cachingLruRemove(&obj->lru);
+    ext2CacheFree(global, obj);
+  }
+  rwlockWriteRelease(&global->WLOCK_CACHE);
 }
 
 void ext2CachePush(Ext2 *ext2, Ext2OpenFd *fd) {
@@ -123,3 +165,188 @@ void ext2CachePush(Ext2 *ext2, Ext2OpenFd *fd) {
     ext2->firstObject->next->prev = ext2->firstObject;
   spinlockRelease(&ext2->LOCK_OBJECT);
 }
+
+// Page cache, used by mmap(). Every page cached holds one reference to its
+// frame, with each mapping of it holding another (see pmm.c). The whole of a
+// file's pages sit on the LRU as a single entry, of which only the ones not
+// mapped anywhere can be evicted.
+
+#define EXT2_EVICT_BATCH 64
+
+// Gathers (up to max) indices of cached pages that nobody has mapped, or just
+// counts them when out is 0. Expects LOCK_PAGES to be held.
+static size_t ext2PageCacheIdle(AVLheader *node, size_t *out, size_t max) {
+  if (!node)
+    return 0;
+
+  size_t cnt = ext2PageCacheIdle(node->left, out, max);
+  if (cnt < max && PhysicalReferenceCount(node->value) == 1) {
+    if (out)
+      out[cnt] = node->key;
+    cnt++;
+  }
+  if (cnt < max)
+    cnt += ext2PageCacheIdle(node->right, out ? &out[cnt] : 0, max - cnt);
+  return cnt;
+}
+
+// Reclaim handler (see caching.c)
+static size_t ext2PageCacheEvict(CachingEntry *entry) {
+  Ext2FoundObject *global = entry->owner;
+  size_t           indices[EXT2_EVICT_BATCH];
+  size_t           freed = 0;
+
+  if (!spinlockTryAcquire(&global->LOCK_PAGES))
+    return 0;
+
+  while (true) {
+    size_t cnt =
+        ext2PageCacheIdle(global->firstPage, indices, EXT2_EVICT_BATCH);
+    for (size_t i = 0; i < cnt; i++) {
+      PhysicalDereference(AVLLookup(global->firstPage, indices[i]));
+      AVLFree(&global->firstPage, indices[i]);
+    }
+    freed += cnt;
+    if (cnt < EXT2_EVICT_BATCH)
+      break;
+  }
+
+  entry->pages -= freed;
+  if (!global->firstPage)
+    cachingLruUnlink(entry);
+
+  spinlockRelease(&global->LOCK_PAGES);
+  return freed;
+}
+
+static size_t ext2PageCacheReclaimable(CachingEntry *entry) {
+  Ext2FoundObject *global = entry->owner;
+  if (!spinlockTryAcquire(&global->LOCK_PAGES))
+    return 0; // busy, can't tell
+
+  size_t ret = ext2PageCacheIdle(global->firstPage, 0, (size_t)-1);
+  spinlockRelease(&global->LOCK_PAGES);
+  return ret;
+}
+
+// Reads a whole page of the file straight off the disk (holes & whatever is
+// past the end of the file are zero)
+static void ext2PageRead(OpenFile *fd, size_t index, uint8_t *out) {
+  Ext2       *ext2 = EXT2_PTR(fd->mountPoint->fsInfo);
+  Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
+
+  memset(out, 0, PAGE_SIZE);
+
+  size_t filesize = COMBINE_64(dir->inode.size_high, dir->inode.size);
+  size_t offset = index * PAGE_SIZE;
+  if (offset >= filesize)
+    return;
+
+  assert(ext2->blockSize <= PAGE_SIZE);
+  size_t blockStart = offset / ext2->blockSize;
+  size_t blocks =
+      DivRoundUp(MIN(PAGE_SIZE, filesize - offset), ext2->blockSize);
+
+  rwlockReadAcquire(&dir->globalObject->WLOCK_FILE);
+  for (size_t i = 0; i < blocks; i++) {
+    uint32_t block = ext2BlockFetch(ext2, &dir->inode, dir->inodeNum,
+                                    &dir->lookup, blockStart + i);
+    if (!block)
+      continue;
+    getDiskBytes(&out[i * ext2->blockSize], BLOCK_TO_LBA(ext2, 0, block),
+                 ext2->blockSize / SECTOR_SIZE);
+  }
+  rwlockReadRelease(&dir->globalObject->WLOCK_FILE);
+}
+
+size_t ext2MmapPage(OpenFile *fd, size_t offset) {
+  Ext2OpenFd      *dir = EXT2_DIR_PTR(fd->dir);
+  Ext2FoundObject *global = dir->globalObject;
+  size_t           index = offset / PAGE_SIZE;
+
+  spinlockAcquire(&global->LOCK_PAGES);
+  size_t phys = AVLLookup(global->firstPage, index);
+  if (!phys) {
+    phys = PhysicalAllocate(1);
+    ext2PageRead(fd, index, (uint8_t *)(phys + bootloader.hhdmOffset));
+    AVLAllocate(&global->firstPage, index, phys);
+    global->pagesLru.pages++;
+  }
+  PhysicalReference(phys); // for the caller's mapping
+
+  if (!global->pagesLru.owner) {
+    global->pagesLru.owner = global;
+    global->pagesLru.evict = ext2PageCacheEvict;
+    global->pagesLru.reclaimable = ext2PageCacheReclaimable;
+  }
+  cachingLruInsert(&global->pagesLru);
+  spinlockRelease(&global->LOCK_PAGES);
+
+  return phys;
+}
+
+// Writes back any cached pages of a shared mapping (never extends the file)
+void ext2MmapSync(OpenFile *fd, size_t offset, size_t length) {
+  Ext2OpenFd      *dir = EXT2_DIR_PTR(fd->dir);
+  Ext2FoundObject *global = dir->globalObject;
+  size_t           filesize = COMBINE_64(dir->inode.size_high, dir->inode.size);
+
+  size_t oldPtr = dir->ptr;
+  int    oldFlags = fd->flags;
+  fd->flags &= ~O_APPEND;
+  for (size_t curr = offset & ~0xFFF; curr < offset + length && curr < filesize;
+       curr += PAGE_SIZE) {
+    spinlockAcquire(&global->LOCK_PAGES);
+    size_t phys = AVLLookup(global->firstPage, curr / PAGE_SIZE);
+    if (phys)
+      PhysicalReference(phys); // keep it around while writing
+    spinlockRelease(&global->LOCK_PAGES);
+    if (!phys)
+      continue;
+
+    dir->ptr = curr;
+    ext2Write(fd, (uint8_t *)(phys + bootloader.hhdmOffset),
+              MIN(PAGE_SIZE, filesize - curr));
+    PhysicalDereference(phys);
+  }
+  fd->flags = oldFlags;
+  dir->ptr = oldPtr;
+}
+
+// Keeps cached (and therefore mmap()'d) pages coherent with write()s
+void ext2PageCacheWrite(Ext2FoundObject *global, size_t offset, uint8_t *buff,
+                        size_t length) {
+  spinlockAcquire(&global->LOCK_PAGES);
+  if (!global->firstPage)
+    goto cleanup;
+
+  size_t curr = offset;
+  while (curr < offset + length) {
+    size_t pageOffset = curr % PAGE_SIZE;
+    size_t toCopy = MIN(PAGE_SIZE - pageOffset, offset + length - curr);
+    size_t phys = AVLLookup(global->firstPage, curr / PAGE_SIZE);
+
+    uint8_t *target = (uint8_t *)(phys + bootloader.hhdmOffset + pageOffset);
+    uint8_t *source = &buff[curr - offset];
+    if (phys && target != source) // ext2MmapSync() writes from the page itself
+      memcpy(target, source, toCopy);
+    curr += toCopy;
+  }
+
+cleanup:
+  spinlockRelease(&global->LOCK_PAGES);
+}
+
+// Forgets about everything cached (truncation, deletion). Pages that are
+// still mapped somewhere stay alive until they're unmapped.
+void ext2PageCacheDrop(MountPoint *mnt, Ext2FoundObject *global) {
+  spinlockAcquire(&global->LOCK_PAGES);
+  while (global->firstPage) {
+    AVLheader *node = (AVLheader *)global->firstPage;
+    PhysicalDereference(node->value);
+    AVLFree(&global->firstPage, node->key);
+  }
+  global->pagesLru.pages = 0;
+  cachingLruRemove(&global->pagesLru);
+  spinlockRelease(&global->LOCK_PAGES);
+}
@@ -8,6 +8,7 @@
 #include <task.h>
 #include <timer.h>
 #include <util.h>
+#include <vma.h>
 #include <vmm.h>
 
 bool ext2Mount(MountPoint *mount) {
@@ -213,6 +214,10 @@ size_t ext2Open(char *filename, int flags, int mode, OpenFile *fd,
     spinlockRelease(&ext2->LOCK_OBJECT);
   }
 
+  // whatever got mmap()'d before is now gone
+  if (flags & O_TRUNC)
+    ext2PageCacheDrop(fd->mountPoint, targetObject);
+
   // we opened a file!
   spinlockAcquire(&targetObject->LOCK_PROP);
   targetObject->openFds++;
@@ -245,6 +250,8 @@ cleanup:
   return ret;
 }
 
+static void ext2ReadLocked(OpenFile *fd, uint8_t *buff, size_t limit);
+
 size_t ext2Read(OpenFile *fd, uint8_t *buff, size_t naiveLimit) {
   Ext2       *ext2 = EXT2_PTR(fd->mountPoint->fsInfo);
   Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
@@ -262,12 +269,39 @@ size_t ext2Read(OpenFile *fd, uint8_t *buff, size_t naiveLimit) {
   if (limit > (filesize - dir->ptr))
     limit = filesize - dir->ptr;
 
+  // userspace buffers might be (shared) mappings of this very file, faulting
+  // them in takes WLOCK_FILE as well (see ext2PageRead()). So those are copied
+  // out of a bounce buffer instead, once it's been let go of
+  if ((size_t)buff >= bootloader.hhdmOffset) {
+    ext2ReadLocked(fd, buff, limit);
+    return limit;
+  }
+
+  size_t   bounceSize = EXT2_CACHE_MAX_PAGES * PAGE_SIZE;
+  uint8_t *bounce = (uint8_t *)malloc(MIN(limit, bounceSize));
+  for (size_t done = 0; done < limit;) {
+    size_t chunk = MIN(limit - done, bounceSize);
+    ext2ReadLocked(fd, bounce, chunk);
+    memcpy(&buff[done], bounce, chunk);
+    done += chunk;
+  }
+  free(bounce);
+  return limit;
+}
+
+// Reads into kernel memory, under WLOCK_FILE. Expects limit to be in bounds
+static void ext2ReadLocked(OpenFile *fd, uint8_t *buff, size_t limit) {
+  Ext2       *ext2 = EXT2_PTR(fd->mountPoint->fsInfo);
+  Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
+
   size_t blocksRequired = DivRoundUp(limit, ext2->blockSize);
+  // (one extra block for when we don't start on a block boundary)
+  size_t blocksChunk = EXT2_CACHE_MAX_PAGES * PAGE_SIZE / ext2->blockSize - 1;
 
-  spinlockCntReadAcquire(&dir->globalObject->WLOCK_FILE);
+  rwlockReadAcquire(&dir->globalObject->WLOCK_FILE);
 
   // find anything as a start that is close
-  spinlockCntReadAcquire(&dir->globalObject->WLOCK_CACHE);
+  rwlockReadAcquire(&dir->globalObject->WLOCK_CACHE);
   size_t           blockIndexStart = dir->ptr / ext2->blockSize;
   Ext2CacheObject *cacheObj = dir->globalObject->firstCacheObj;
   while (cacheObj) {
@@ -276,21 +310,22 @@ size_t ext2Read(OpenFile *fd, uint8_t *buff, size_t naiveLimit) {
       break;
     cacheObj = cacheObj->next;
   }
-  spinlockCntReadRelease(&dir->globalObject->WLOCK_CACHE);
+  rwlockReadRelease(&dir->globalObject->WLOCK_CACHE);
 
   size_t left = limit;
   for (size_t i = 0; i < (blocksRequired + 1); i++) {
     if (cacheObj && cacheObj->blockIndex == (blockIndexStart + i)) {
       // we are in a valid cache region
-      spinlockCntReadAcquire(&dir->globalObject->WLOCK_CACHE);
+      rwlockReadAcquire(&dir->globalObject->WLOCK_CACHE);
       uint32_t rem = dir->ptr % ext2->blockSize;
       size_t   toCopy = MIN(left, cacheObj->blocks * ext2->blockSize - rem);
       memcpy(&buff[limit - left], &cacheObj->buff[rem], toCopy);
+      cachingLruInsert(&cacheObj->lru);
       left -= toCopy;
       i += cacheObj->blocks - 1; // -1 cause it's added automatically
       dir->ptr += toCopy;
       cacheObj = cacheObj->next;
-      spinlockCntReadRelease(&dir->globalObject->WLOCK_CACHE);
+      rwlockReadRelease(&dir->globalObject->WLOCK_CACHE);
     } else {
       // we are not inside caching, let's see if we're close to it
       size_t blocksToScan = blocksRequired - i;
@@ -299,6 +334,7 @@ size_t ext2Read(OpenFile *fd, uint8_t *buff, size_t naiveLimit) {
       if (cacheObj)
         // to_be_scanned = target_location - current_location;
         blocksToScan = cacheObj->blockIndex - (dir->ptr / ext2->blockSize);
+      blocksToScan = MIN(blocksToScan, blocksChunk); // (see ext2ReadInner())
       uint32_t rem = dir->ptr % ext2->blockSize;
       size_t   toCopy = MIN(left, blocksToScan * ext2->blockSize - rem);
       assert(ext2ReadInner(fd, &buff[limit - left], toCopy) == toCopy);
@@ -310,8 +346,7 @@ size_t ext2Read(OpenFile *fd, uint8_t *buff, size_t naiveLimit) {
   }
 
   assert(left == 0);
-  spinlockCntReadRelease(&dir->globalObject->WLOCK_FILE);
-  return limit;
+  rwlockReadRelease(&dir->globalObject->WLOCK_FILE);
 }
 
 size_t ext2ReadInner(OpenFile *fd, uint8_t *buff, size_t limit) {
@@ -323,7 +358,8 @@ size_t ext2ReadInner(OpenFile *fd, uint8_t *buff, size_t limit) {
       ext2BlockChain(ext2, dir, dir->ptr / ext2->blockSize, blocksRequired);
   size_t tmpSize =
       DivRoundUp((blocksRequired + 1) * ext2->blockSize, BLOCK_SIZE);
-  uint8_t *tmp = (uint8_t *)VirtualAllocate(tmpSize);
+  assert(tmpSize <= EXT2_CACHE_MAX_PAGES);
+  uint8_t *tmp = (uint8_t *)VirtualAllocate(tmpSize); // becomes the cache's
   int      currBlock = 0;
 
   // optimization: we can use consecutive sectors to make our life easier
@@ -392,27 +428,52 @@ size_t ext2ReadInner(OpenFile *fd, uint8_t *buff, size_t limit) {
   return limit;
 }
 
+static void ext2WriteLocked(OpenFile *fd, uint8_t *buff, size_t limit);
+
 size_t ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
   Ext2       *ext2 = EXT2_PTR(fd->mountPoint->fsInfo);
   Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
 
   ext2CachePush(ext2, dir);
 
-  // todo! memory leak!
-  spinlockCntWriteAcquire(&dir->globalObject->WLOCK_CACHE);
-  dir->globalObject->firstCacheObj = 0;
-  spinlockCntWriteRelease(&dir->globalObject->WLOCK_CACHE);
-
   if (dir->inode.permission & S_IFDIR)
     return ERR(EISDIR);
 
-  spinlockCntWriteAcquire(&dir->globalObject->WLOCK_FILE);
+  // userspace buffers get copied in before taking WLOCK_FILE (see ext2Read()),
+  // a bounce buffer's worth at a time
+  if ((size_t)buff >= bootloader.hhdmOffset) {
+    ext2WriteLocked(fd, buff, limit);
+    return limit;
+  }
+
+  size_t   bounceSize = EXT2_CACHE_MAX_PAGES * PAGE_SIZE;
+  uint8_t *bounce = (uint8_t *)malloc(MIN(limit, bounceSize));
+  for (size_t done = 0; done < limit;) {
+    size_t chunk = MIN(limit - done, bounceSize);
+    memcpy(bounce, &buff[done], chunk);
+    ext2WriteLocked(fd, bounce, chunk);
+    done += chunk;
+  }
+  free(bounce);
+  return limit;
+}
+
+// Writes from kernel memory, under WLOCK_FILE
+static void ext2WriteLocked(OpenFile *fd, uint8_t *buff, size_t limit) {
+  Ext2       *ext2 = EXT2_PTR(fd->mountPoint->fsInfo);
+  Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
+
+  rwlockWriteAcquire(&dir->globalObject->WLOCK_FILE);
+
+  // readers are out (they hold onto cache objects under WLOCK_FILE)
+  ext2CacheDrop(dir->globalObject);
 
   size_t appendCursor = (size_t)(-1);
   if (fd->flags & O_APPEND) {
     appendCursor = dir->ptr;
     dir->ptr = COMBINE_64(dir->inode.size_high, dir->inode.size);
   }
+  size_t writeStart = dir->ptr;
 
   int ptrIgnoredBlocks = dir->ptr / ext2->blockSize;
   int ptrIgnoredBytes = dir->ptr % ext2->blockSize;
@@ -469,7 +530,7 @@ size_t ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
 
     size_t tmpSize =
         DivRoundUp((blocksRequired + 1) * ext2->blockSize, BLOCK_SIZE);
-    uint8_t *tmp = (uint8_t *)VirtualAllocate(tmpSize);
+    uint8_t *tmp = (uint8_t *)VirtualAllocateScattered(tmpSize);
 
     // our first block will have junk data in the start!
     getDiskBytes(tmp, BLOCK_TO_LBA(ext2, 0, blocks[0]),
@@ -550,11 +611,12 @@ size_t ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
   if (fd->flags & O_APPEND)
     dir->ptr = appendCursor;
 
-  spinlockCntWriteRelease(&dir->globalObject->WLOCK_FILE);
+  rwlockWriteRelease(&dir->globalObject->WLOCK_FILE);
+
+  ext2PageCacheWrite(dir->globalObject, writeStart, buff, limit);
 
   // debugf("[fd:%d id:%d] read %d bytes\n", fd->id, currentTask->id, curr);
   // debugf("%d / %d\n", dir->ptr, dir->inode.size);
-  return limit;
 }
 
 size_t ext2Seek(OpenFile *fd, size_t target, long int offset, int whence) {
@@ -727,14 +789,70 @@ cleanup:
   return ret;
 }
 
+// Frees the (unlinked) inode & its contents, once nothing refers to it anymore.
+// Expects WLOCK_GLOBAL_NOFD to be held for writing
+static void ext2InodeWipe(MountPoint *mnt, Ext2FoundObject *global,
+                          uint32_t inodeNum, Ext2Inode *inode) {
+  Ext2 *ext2 = EXT2_PTR(mnt->fsInfo);
+  if (global) { // the inode may be reused
+    ext2CacheDrop(global);
+    ext2PageCacheDrop(mnt, global);
+  }
+
+  if (inode->permission & S_IFREG || inode->permission & S_IFDIR) {
+    // regular file, delete the contents (really just mark them as free)
+    // same applies with empty directories that host the "." & ".." stuff
+    Ext2LookupControl control = {0};
+    ext2BlockFetchInit(ext2, &control);
+    size_t i = 0;
+    while (true) {
+      uint32_t block = ext2BlockFetch(ext2, inode, inodeNum, &control, i++);
+      if (!block || (i * ext2->blockSize) >= (inode->num_sectors * 512))
+        break;
+
+      uint32_t group = block / ext2->superblock.blocks_per_group;
+      uint32_t index = block % ext2->superblock.blocks_per_group;
+      ext2BlockDelete(ext2, group, index);
+      // todo: free indirect blocks
+    }
+    ext2BlockFetchCleanup(&control);
+  }
+
+  // before deleting, do some sanity stuff
+  inode->dtime = timerBootUnix + timerTicks / 1000; // needed
+  memset(&inode->blocks, 0, sizeof(inode->blocks));
+  inode->num_sectors = 0;
+  inode->size = 0;
+  inode->size_high = 0;
+  ext2InodeModifyM(ext2, inodeNum, inode);
+
+  // get rid of this inode
+  ext2InodeDelete(ext2, inodeNum);
+}
+
 bool ext2Close(OpenFile *fd) {
-  Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
+  Ext2OpenFd      *dir = EXT2_DIR_PTR(fd->dir);
+  Ext2FoundObject *global = dir->globalObject;
 
   ext2BlockFetchCleanup(&dir->lookup);
 
-  spinlockAcquire(&dir->globalObject->LOCK_PROP);
-  dir->globalObject->openFds--;
-  spinlockRelease(&dir->globalObject->LOCK_PROP);
+  spinlockAcquire(&global->LOCK_PROP);
+  global->openFds--;
+  bool wipe = !global->openFds && global->unlinked;
+  if (wipe)
+    global->unlinked = false;
+  spinlockRelease(&global->LOCK_PROP);
+
+  // it got unlinked while still in use, we were the last ones around
+  if (wipe) {
+    Ext2 *ext2 = EXT2_PTR(fd->mountPoint->fsInfo);
+    spinlockCntWriteAcquire(&ext2->WLOCK_GLOBAL_NOFD);
+    Ext2Inode *inode = ext2InodeFetch(ext2, dir->inodeNum);
+    assert(inode);
+    ext2InodeWipe(fd->mountPoint, global, dir->inodeNum, inode);
+    free(inode);
+    spinlockCntWriteRelease(&ext2->WLOCK_GLOBAL_NOFD);
+  }
 
   free(fd->dir);
   return true;
@@ -774,29 +892,18 @@ bool ext2DuplicateNodeUnsafe(OpenFile *original, OpenFile *orphan) {
 // task is taken into account
 size_t ext2Mmap(size_t addr, size_t length, int prot, int flags, OpenFile *fd,
                 size_t pgoffset) {
-  if (!(flags & MAP_PRIVATE)) {
-    debugf("[ext2::mmap] Unsupported flags! flags{%x}\n", flags);
-    // return ERR(ENOSYS);
-  }
+  if (pgoffset % PAGE_SIZE)
+    return ERR(EINVAL);
 
   // if (prot & PROT_WRITE && !(fd->flags & O_WRONLY || fd->flags & O_RDWR))
   //   return ERR(EACCES);
 
-  uint64_t mappingFlags = PF_USER;
-  if (prot & PROT_WRITE)
-    mappingFlags |= PF_RW;
-  // read & execute don't have to be specified..
-
-  int pages = DivRoundUp(length, PAGE_SIZE);
+  uint64_t mappingFlags = vmaProtFlags(prot);
+  int      pages = DivRoundUp(length, PAGE_SIZE);
 
-  size_t virt = 0;
-  if (!(flags & MAP_FIXED)) {
-    spinlockAcquire(&currentTask->infoPd->LOCK_PD);
-    virt = currentTask->infoPd->mmap_end;
-    currentTask->infoPd->mmap_end += pages * PAGE_SIZE;
-    spinlockRelease(&currentTask->infoPd->LOCK_PD);
-  } else {
-    virt = addr;
+  TaskInfoPagedir *info = currentTask->infoPd;
+  size_t           virt = addr;
+  if (flags & MAP_FIXED) {
     if (virt > bootloader.hhdmOffset &&
         virt < (bootloader.hhdmOffset + bootloader.mmTotal))
       return ERR(EACCES);
@@ -806,28 +913,22 @@ size_t ext2Mmap(size_t addr, size_t length, int prot, int flags, OpenFile *fd,
     }
   }
 
-  spinlockAcquire(&currentTask->infoPd->LOCK_PD);
-  size_t end = virt + pages * PAGE_SIZE;
-  if (end > currentTask->infoPd->mmap_end)
-    currentTask->infoPd->mmap_end = end;
-  spinlockRelease(&currentTask->infoPd->LOCK_PD);
-
-  // allocate physical space required
-  size_t phys = PhysicalAllocate(pages);
-  size_t hhdmAddition = bootloader.hhdmOffset + phys;
-
-  // now access it properly (via the HHDM, obviously)
-  for (int i = 0; i < pages; i++)
-    VirtualMap(virt + i * PAGE_SIZE, phys + i * PAGE_SIZE, mappingFlags);
-  memset((void *)(hhdmAddition), 0, pages * PAGE_SIZE);
-
-  // do the read
-  Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
-  size_t      oldPtr = dir->ptr;
-  dir->ptr = pgoffset;
-  ext2Read(fd, (void *)hhdmAddition, length);
-  dir->ptr = oldPtr;
+  // pages are faulted in from the page cache (see ext2MmapPage())
+  VmArea *vma = 0;
+  spinlockAcquire(&info->LOCK_PD);
+  if (!(flags & MAP_FIXED))
+    virt = vmaPlace(info, addr, pages * PAGE_SIZE);
+  if (virt) {
+    size_t end = virt + pages * PAGE_SIZE;
+    vma = vmaAddFile(info, virt, end, mappingFlags, fd, pgoffset,
+                     (flags & MAP_TYPE) == MAP_SHARED);
+    if (vma && flags & MAP_FIXED)
+      vmaDropPages(info, virt, end);
+  }
+  spinlockRelease(&info->LOCK_PD);
 
+  if (!vma)
+    return ERR(ENOMEM);
   return virt;
 }
 
@@ -857,10 +958,7 @@ size_t ext2Delete(MountPoint *mnt, char *filename, bool directory,
     goto cleanup;
   }
 
-  // todo: bool deleted, remove direntry, wipe on last close
   Ext2FoundObject *global = ext2GlobalFetch(ext2, inodeNum);
-  assert(!global || !global->openFds);
-
   inode = ext2InodeFetch(ext2, inodeNum);
   if (!inode) {
     ret = ERR(ENOENT);
@@ -940,35 +1038,18 @@ size_t ext2Delete(MountPoint *mnt, char *filename, bool directory,
     inode->hard_links = 0;
   }
   if (!inode->hard_links) {
-    if (inode->permission & S_IFREG || inode->permission & S_IFDIR) {
-      // regular file, delete the contents (really just mark them as free)
-      // same applies with empty directories that host the "." & ".." stuff
-      Ext2LookupControl control = {0};
-      ext2BlockFetchInit(ext2, &control);
-      size_t i = 0;
-      while (true) {
-        uint32_t block = ext2BlockFetch(ext2, inode, inodeNum, &control, i++);
-        if (!block || (i * ext2->blockSize) >= (inode->num_sectors * 512))
-          break;
-
-        uint32_t group = block / ext2->superblock.blocks_per_group;
-        uint32_t index = block % ext2->superblock.blocks_per_group;
-        ext2BlockDelete(ext2, group, index);
-        // todo: free indirect blocks
-      }
-      ext2BlockFetchCleanup(&control);
+    // still open (or mapped) somewhere? then the last close wipes it
+    bool inUse = false;
+    if (global) {
+      spinlockAcquire(&global->LOCK_PROP);
+      inUse = global->openFds;
+      global->unlinked = inUse;
+      spinlockRelease(&global->LOCK_PROP);
     }
-
-    // before deleting, do some sanity stuff
-    inode->dtime = timerBootUnix + timerTicks / 1000; // needed
-    memset(&inode->blocks, 0, sizeof(inode->blocks));
-    inode->num_sectors = 0;
-    inode->size = 0;
-    inode->size_high = 0;
-    ext2InodeModifyM(ext2, inodeNum, inode);
-
-    // get rid of this inode
-    ext2InodeDelete(ext2, inodeNum);
+    if (inUse)
+      ext2InodeModifyM(ext2, inodeNum, inode);
+    else
+      ext2InodeWipe(mnt, global, inodeNum, inode);
 
     // if it's a directory inform the parent
     if (inode->permission & S_IFDIR) {
@@ -1058,4 +1139,6 @@ VfsHandlers ext2Handlers = {.open = ext2Open,
                             .getdents64 = ext2Getdents64,
                             .seek = ext2Seek,
                             .getFilesize = ext2GetFilesize,
-                            .mmap = ext2Mmap};
+                            .mmap = ext2Mmap,
+                            .mmapPage = ext2MmapPage,
+                            .mmapSync = ext2MmapSync};
@@ -8,7 +8,7 @@
 bool ext2DirAllocate(Ext2 *ext2, uint32_t inodeNum, Ext2Inode *parentDirInode,
                      char *filename, uint8_t filenameLen, uint8_t type,
                      uint32_t inode) {
-  spinlockAcquire(&ext2->LOCK_DIRALLOC);
+  mutexAcquire(&ext2->LOCK_DIRALLOC);
   int entryLen = sizeof(Ext2Directory) + filenameLen;
 
   Ext2Inode *ino = parentDirInode; // <- todo
@@ -94,7 +94,7 @@ bool ext2DirAllocate(Ext2 *ext2, uint32_t inodeNum, Ext2Inode *parentDirInode,
 cleanup:
   ext2BlockFetchCleanup(&control);
   free(names);
-  spinlockRelease(&ext2->LOCK_DIRALLOC);
+  mutexRelease(&ext2->LOCK_DIRALLOC);
 
   return ret;
 }
@@ -102,7 +102,7 @@ cleanup:
 bool ext2DirRemove(Ext2 *ext2, Ext2Inode *parentDirInode,
                    uint32_t parentDirInodeNum, char *filename,
                    uint8_t filenameLen) {
-  spinlockAcquire(&ext2->LOCK_DIRALLOC);
+  mutexAcquire(&ext2->LOCK_DIRALLOC);
 
   Ext2Inode *ino = parentDirInode; // <- todo
   uint8_t   *names = (uint8_t *)malloc(ext2->blockSize);
@@ -154,7 +154,7 @@ bool ext2DirRemove(Ext2 *ext2, Ext2Inode *parentDirInode,
 
   ext2BlockFetchCleanup(&control);
   free(names);
-  spinlockRelease(&ext2->LOCK_DIRALLOC);
+  mutexRelease(&ext2->LOCK_DIRALLOC);
 
   return ret;
 }
@@ -1,13 +1,17 @@
 #include <bootloader.h>
 #include <caching.h>
 #include <dents.h>
+#include <lock_stat.h>
 #include <malloc.h>
+#include <paging.h>
 #include <proc.h>
+#include <slab.h>
 #include <string.h>
 #include <system.h>
 #include <task.h>
 #include <timer.h>
 #include <util.h>
+#include <vma.h>
 
 #include <fb.h>
 #include <syscalls.h>
@@ -25,20 +29,30 @@ typedef struct UserspaceProc {
 
 size_t meminfoRead(OpenFile *fd, uint8_t *out, size_t limit) {
   char   buff[1024] = {0};
-  size_t allocated = physical.allocatedSizeInBlocks * BLOCK_SIZE / 1024;
   size_t total = bootloader.mmTotal / 1024;
-  size_t free = total - allocated;
-
-  size_t cached = cachingInfoBlocks() * BLOCK_SIZE / 1024;
-  size_t available = free + cached;
-
-  size_t length = snprintf(buff, 1024,
-                           "%-15s %10lu kB\n"
-                           "%-15s %10lu kB\n"
-                           "%-15s %10lu kB\n"
-                           "%-15s %10lu kB\n",
-                           "MemTotal:", total, "MemFree:", free,
-                           "MemAvailable:", available, "Cached:", cached);
+  size_t free = physical.freeFrames * BLOCK_SIZE / 1024;
+
+  size_t cached = cachingInfoPages() * BLOCK_SIZE / 1024;
+  size_t reclaimable = cachingInfoReclaimable() * BLOCK_SIZE / 1024;
+  size_t available = free + reclaimable;
+
+  // pre-zeroed pageframes (see PhysicalScrub())
+  size_t zeroed = physical.zeroedFrames * BLOCK_SIZE / 1024;
+
+  size_t length = snprintf(
+      buff, 1024,
+      "%-15s %10lu kB\n"
+      "%-15s %10lu kB\n"
+      "%-15s %10lu kB\n"
+      "%-15s %10lu kB\n"
+      "%-15s %10lu kB\n"
+      "%-15s %10lu kB\n"
+      "%-15s %10lu\n"
+      "%-15s %10lu\n",
+      "MemTotal:", total, "MemFree:", free, "MemAvailable:", available,
+      "Cached:", cached, "Reclaimable:", reclaimable, "Zeroed:", zeroed,
+      "ZeroedHits:", physical.zeroedHits, "ZeroedMisses:",
+      physical.zeroedMisses);
 
   size_t toCopy = MIN(length - fd->pointer, limit);
   memcpy(out, buff, toCopy);
@@ -48,6 +62,49 @@ size_t meminfoRead(OpenFile *fd, uint8_t *out, size_t limit) {
 VfsHandlers handleMeminfo = {
     .read = meminfoRead, .seek = fsSimpleSeek, .stat = fakefsFstat};
 
+size_t slabinfoRead(OpenFile *fd, uint8_t *out, size_t limit) {
+  char   buff[4096] = {0};
+  size_t length = snprintf(buff, sizeof(buff),
+                           "slabinfo - version: 2.1\n"
+                           "# name            <active_objs> <num_objs> "
+                           "<objsize> <objperslab> <pagesperslab> : slabdata "
+                           "<active_slabs> <num_slabs>\n");
+
+  // statistics are read racily, good enough for a snapshot
+  spinlockAcquire(&LOCK_SLAB_CACHES);
+  SlabCache *browse = firstSlabCache;
+  while (browse && length < sizeof(buff)) {
+    length += snprintf(&buff[length], sizeof(buff) - length,
+                       "%-20s %6lu %6lu %6lu %4lu %4lu : slabdata %6lu %6lu\n",
+                       browse->name, browse->activeObjs, browse->totalObjs,
+                       browse->stride, browse->objsPerSlab,
+                       browse->pagesPerSlab,
+                       browse->slabsCnt - browse->emptyCnt, browse->slabsCnt);
+    browse = browse->next;
+  }
+  spinlockRelease(&LOCK_SLAB_CACHES);
+  length = MIN(length, sizeof(buff) - 1);
+
+  size_t toCopy = MIN(length - fd->pointer, limit);
+  memcpy(out, &buff[fd->pointer], toCopy);
+  fd->pointer += toCopy;
+  return toCopy;
+}
+VfsHandlers handleSlabinfo = {
+    .read = slabinfoRead, .seek = fsSimpleSeek, .stat = fakefsFstat};
+
+size_t lockStatRead(OpenFile *fd, uint8_t *out, size_t limit) {
+  char   buff[4096] = {0};
+  size_t length = lockStatPrint(buff, sizeof(buff));
+
+  size_t toCopy = fd->pointer < length ? MIN(length - fd->pointer, limit) : 0;
+  memcpy(out, &buff[fd->pointer], toCopy);
+  fd->pointer += toCopy;
+  return toCopy;
+}
+VfsHandlers handleLockStat = {
+    .read = lockStatRead, .seek = fsSimpleSeek, .stat = fakefsFstat};
+
 size_t uptimeRead(OpenFile *fd, uint8_t *out, size_t limit) {
   char   buff[1024] = {0};
   size_t secs = timerTicks / 1000;
@@ -219,6 +276,52 @@ VfsHandlers handleProcStatm = {.read = procStatmRead,
                                .duplicate = procEachDuplicate,
                                .close = procEachClose};
 
+// Only demand-paged regions are tracked; ELF segments are mapped right away
+// & don't show up here. The stack gets a line of its own.
+size_t procMapsRead(OpenFile *fd, uint8_t *out, size_t limit) {
+  UserspaceProc *uproc = fd->dir;
+  Task          *target = taskGet(uproc->pid);
+  assert(target);
+
+  TaskInfoPagedir *info = target->infoPd;
+
+  size_t heapEnd = DivRoundUp(info->heap_end, PAGE_SIZE) * PAGE_SIZE;
+  size_t size = PAGE_SIZE;
+  size_t length = 0;
+  char  *buff = malloc(size);
+  spinlockAcquire(&info->LOCK_PD);
+  for (VmArea *vma = vmaFirstFrom(info, 0); vma; vma = vmaNext(info, vma)) {
+    if ((size - length) < 128) {
+      size *= 2;
+      buff = realloc(buff, size);
+    }
+    bool heap = vma->start >= info->heap_start && vma->end <= heapEnd;
+    length += snprintf(
+        &buff[length], size - length, "%012lx-%012lx %c%c%c%c %08lx %s\n",
+        vma->start, vma->end, vma->flags & PF_USER ? 'r' : '-',
+        vma->flags & PF_RW ? 'w' : '-', vma->flags & PF_USER ? 'x' : '-',
+        vma->shared ? 's' : 'p', vma->file ? vma->pgoffset : 0,
+        heap ? "00:00 0 [heap]" : "00:00 0");
+  }
+  spinlockRelease(&info->LOCK_PD);
+  length += snprintf(&buff[length], size - length,
+                     "%012lx-%012lx rw-p 00000000 00:00 0 [stack]\n",
+                     VMA_MMAP_END, USER_STACK_BOTTOM);
+  length = MIN(length, size - 1);
+
+  size_t toCopy = fd->pointer < length ? MIN(length - fd->pointer, limit) : 0;
+  memcpy(out, &buff[fd->pointer], toCopy);
+  fd->pointer += toCopy;
+  free(buff);
+  return toCopy;
+}
+
+VfsHandlers handleProcMaps = {.read = procMapsRead,
+                              .stat = fakefsFstat,
+                              .open = procEachOpen,
+                              .duplicate = procEachDuplicate,
+                              .close = procEachClose};
+
 size_t procStatusRead(OpenFile *fd, uint8_t *out, size_t limit) {
   // todo: more!
   char   buff[1024] = {0};
@@ -302,6 +405,10 @@ bool procEachClose(OpenFile *fd) {
 void procSetup() {
   fakefsAddFile(&rootProc, rootProc.rootFile, "meminfo", 0,
                 S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleMeminfo);
+  fakefsAddFile(&rootProc, rootProc.rootFile, "slabinfo", 0,
+                S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleSlabinfo);
+  fakefsAddFile(&rootProc, rootProc.rootFile, "lock_stat", 0,
+                S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleLockStat);
   fakefsAddFile(&rootProc, rootProc.rootFile, "uptime", 0,
                 S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleUptime);
   fakefsAddFile(&rootProc, rootProc.rootFile, "stat", 0,
@@ -319,6 +426,8 @@ void procSetup() {
                 &handleProcStat);
   fakefsAddFile(&rootProc, id, "statm", 0,
                 S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleProcStatm);
+  fakefsAddFile(&rootProc, id, "maps", 0, S_IFREG | S_IRUSR | S_IRGRP | S_IROTH,
+                &handleProcMaps);
   fakefsAddFile(&rootProc, id, "status", 0,
                 S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleProcStatus);
   FakefsFile *task =
@@ -334,6 +443,8 @@ void procSetup() {
                 S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleProcStat);
   fakefsAddFile(&rootProc, taskId, "statm", 0,
                 S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleProcStatm);
+  fakefsAddFile(&rootProc, taskId, "maps", 0,
+                S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleProcMaps);
   fakefsAddFile(&rootProc, taskId, "status", 0,
                 S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, &handleProcStatus);
 }
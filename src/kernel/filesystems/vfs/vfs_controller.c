@@ -3,6 +3,7 @@
 #include <fat32.h>
 #include <malloc.h>
 #include <poll.h>
+#include <slab.h>
 #include <string.h>
 #include <syscalls.h>
 #include <system.h>
@@ -14,29 +15,31 @@
 // Simple VFS abstraction to manage filesystems
 // Copyright (C) 2024 Panagiotis
 
+SlabCache cacheOpenFile = SLAB_CACHE_INIT("open_file", OpenFile, 0);
+
 OpenFile *fsRegisterNode(Task *task, size_t id) {
   TaskInfoFiles *files = task->infoFiles;
-  spinlockCntWriteAcquire(&files->WLOCK_FILES);
+  rwlockWriteAcquire(&files->WLOCK_FILES);
   // debugf("reg %d\n", id);
-  OpenFile *file = calloc(sizeof(OpenFile), 1);
+  OpenFile *file = slabAlloc(&cacheOpenFile);
   file->id = id;
   assert(AVLAllocate((void **)&files->firstFile, id, (avlval)file));
-  spinlockCntWriteRelease(&files->WLOCK_FILES);
+  rwlockWriteRelease(&files->WLOCK_FILES);
   return file;
 }
 
 bool fsUnregisterNode(Task *task, OpenFile *file) {
   TaskInfoFiles *files = task->infoFiles;
-  spinlockCntWriteAcquire(&files->WLOCK_FILES);
+  rwlockWriteAcquire(&files->WLOCK_FILES);
   // debugf("unreg %d\n", file->id);
   bool ret = AVLUnregister((void **)&files->firstFile, file->id);
-  spinlockCntWriteRelease(&files->WLOCK_FILES);
+  rwlockWriteRelease(&files->WLOCK_FILES);
   return ret;
 }
 
 size_t fsIdFind(TaskInfoFiles *infoFiles) {
   size_t ret = -1;
-  spinlockCntWriteAcquire(&infoFiles->WLOCK_FILES);
+  rwlockWriteAcquire(&infoFiles->WLOCK_FILES);
   for (size_t i = 0; i < infoFiles->rlimitFdsSoft; i++) {
     if (!bitmapGenericGet(infoFiles->fdBitmap, i)) {
       bitmapGenericSet(infoFiles->fdBitmap, i, true);
@@ -44,16 +47,16 @@ size_t fsIdFind(TaskInfoFiles *infoFiles) {
       break;
     }
   }
-  spinlockCntWriteRelease(&infoFiles->WLOCK_FILES);
+  rwlockWriteRelease(&infoFiles->WLOCK_FILES);
 
   assert(ret != -1); // todo: RLIMIT errors
   return ret;
 }
 
 void fsIdRemove(TaskInfoFiles *infoFiles, size_t fd) {
-  spinlockCntWriteAcquire(&infoFiles->WLOCK_FILES);
+  rwlockWriteAcquire(&infoFiles->WLOCK_FILES);
   bitmapGenericSet(infoFiles->fdBitmap, fd, false);
-  spinlockCntWriteRelease(&infoFiles->WLOCK_FILES);
+  rwlockWriteRelease(&infoFiles->WLOCK_FILES);
 }
 
 char     *prefix = "/";
@@ -76,7 +79,7 @@ OpenFile *fsOpenGeneric(char *filename, Task *task, int flags, int mode) {
     // no mountpoint for this
     fsUnregisterNode(task, target);
     fsIdRemove(task->infoFiles, target->id);
-    free(target);
+    slabFree(&cacheOpenFile, target);
     free(safeFilename);
     return 0;
   }
@@ -96,7 +99,7 @@ OpenFile *fsOpenGeneric(char *filename, Task *task, int flags, int mode) {
       // failed to open
       fsUnregisterNode(task, target);
       fsIdRemove(task->infoFiles, target->id);
-      free(target);
+      slabFree(&cacheOpenFile, target);
       free(safeFilename);
 
       if (symlink && ret != ERR(ELOOP)) {
@@ -135,18 +138,39 @@ OpenFile *fsUserDuplicateNode(void *taskPtr, OpenFile *original,
   // target->id = fsIdFind(files);
 
   if (!fsUserDuplicateNodeUnsafe(original, orphan)) {
-    free(orphan);
+    slabFree(&cacheOpenFile, orphan);
     return 0;
   }
   return orphan;
 }
 
+// Duplicates that don't belong to any file descriptor table (used to keep
+// files around for as long as they're mmap()'d)
+OpenFile *fsOrphanDuplicate(OpenFile *original) {
+  OpenFile *orphan = slabAlloc(&cacheOpenFile);
+  if (!fsUserDuplicateNodeUnsafe(original, orphan)) {
+    slabFree(&cacheOpenFile, orphan);
+    return 0;
+  }
+  orphan->id = -1;
+  orphan->closeOnExec = false;
+  atomic_flag_clear(&orphan->LOCK_OPERATIONS); // original's might be held
+  return orphan;
+}
+
+void fsOrphanClose(OpenFile *orphan) {
+  spinlockAcquire(&orphan->LOCK_OPERATIONS);
+  if (orphan->handlers->close)
+    orphan->handlers->close(orphan);
+  slabFree(&cacheOpenFile, orphan);
+}
+
 OpenFile *fsUserGetNode(void *task, int fd) {
   Task          *target = (Task *)task;
   TaskInfoFiles *files = target->infoFiles;
-  spinlockCntReadAcquire(&files->WLOCK_FILES);
+  rwlockReadAcquire(&files->WLOCK_FILES);
   OpenFile *browse = (OpenFile *)AVLLookup(files->firstFile, fd);
-  spinlockCntReadRelease(&files->WLOCK_FILES);
+  rwlockReadRelease(&files->WLOCK_FILES);
 
   return browse;
 }
@@ -179,7 +203,7 @@ bool fsCloseGeneric(OpenFile *file, Task *task) {
   epollCloseNotify(file);
   if (!(file->closeFlags & VFS_CLOSE_FLAG_RETAIN_ID))
     fsIdRemove(task->infoFiles, file->id);
-  free(file);
+  slabFree(&cacheOpenFile, file);
   return res;
 }
 
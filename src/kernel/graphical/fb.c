@@ -110,12 +110,9 @@ size_t fbUserMmap(size_t addr, size_t length, int prot, int flags, OpenFile *fd,
                   size_t pgoffset) {
   if (!length)
     length = fb.width * fb.height * 4;
-  size_t targPages = DivRoundUp(length, PAGE_SIZE);
-  size_t physStart = fb.phys;
-  for (int i = 0; i < targPages; i++) {
-    VirtualMap(0x150000000000 + i * PAGE_SIZE, physStart + i * PAGE_SIZE,
-               PF_RW | PF_USER | PF_CACHE_WC);
-  } // todo: get rid of hardcoded location!
+  VirtualMapRegionL(GetPageDirectory(), 0x150000000000, fb.phys, length,
+                    PF_RW | PF_USER | PF_CACHE_WC);
+  // todo: get rid of hardcoded location!
   return 0x150000000000;
 }
 
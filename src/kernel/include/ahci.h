@@ -1,4 +1,5 @@
 #include "pci.h"
+#include "spinlock.h"
 #include "types.h"
 #include "util.h"
 
@@ -573,6 +574,8 @@ struct ahci {
   HBA_MEM           *mem;
 };
 
+Spinlock LOCK_AHCI_CMD_FIND;
+
 bool initiateAHCI(PCIdevice *device);
 bool ahciRead(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
               uint32_t starth, uint32_t count, uint8_t *buff);
@@ -16,9 +16,15 @@
 #define APIC_REGISTER_TIMER_INITCNT 0x380
 #define APIC_REGISTER_TIMER_CURRCNT 0x390
 #define APIC_REGISTER_TIMER_DIV 0x3E0
+#define APIC_REGISTER_ICR_LOW 0x300
+#define APIC_REGISTER_ICR_HIGH 0x310
 
 #define APIC_LVT_TIMER_MODE_PERIODIC (1 << 17)
 
+#define APIC_ICR_DELIVERY_NMI (4 << 8)
+#define APIC_ICR_PENDING (1 << 12)
+#define APIC_ICR_ASSERT (1 << 14)
+
 // APIC quick access
 // (same address for different cores)
 uint64_t apicPhys;
@@ -54,5 +60,7 @@ uint32_t apicRead(uint32_t offset);
 void     apicWrite(uint32_t offset, uint32_t value);
 
 uint32_t apicCurrentCore();
+void     apicSendNmi(uint32_t lapicId);
+void     apicSendIpi(uint32_t lapicId, uint8_t vector);
 
 #endif
@@ -1,8 +1,46 @@
+#include "spinlock.h"
 #include "types.h"
 
 #ifndef CACHING_H
 #define CACHING_H
 
-size_t cachingInfoBlocks();
+// Cached file data that can be given back under memory pressure. Every cache
+// embeds one of these per reclaimable unit & keeps it on the global LRU
+// (most recently used first), through cachingLruInsert().
 
-#endif
\ No newline at end of file
+#define CACHING_RECLAIM_BATCH 32  // pageframes reclaimed on allocation
+#define CACHING_KSWAPD_PERIOD 100 // ms between background trims
+#define CACHING_RECLAIM_BUSY ((size_t)-1) // see cachingReclaim()
+
+typedef struct CachingEntry CachingEntry;
+struct CachingEntry {
+  CachingEntry *next;
+  CachingEntry *prev;
+  bool          linked;
+
+  void  *owner;
+  size_t pages; // pageframes held, kept up to date by the owner
+
+  // called with LOCK_CACHING held, so it may only *try* to grab the owner's
+  // locks. returns pageframes freed & has to cachingLruUnlink() the entry
+  // once there's nothing left in it
+  size_t (*evict)(CachingEntry *entry);
+  // optional, pageframes evict() could free right now (all if missing)
+  size_t (*reclaimable)(CachingEntry *entry);
+};
+
+Spinlock      LOCK_CACHING;
+CachingEntry *firstCachingEntry;
+CachingEntry *lastCachingEntry;
+
+void cachingLruInsert(CachingEntry *entry);
+void cachingLruRemove(CachingEntry *entry);
+void cachingLruUnlink(CachingEntry *entry);
+
+size_t cachingReclaim(size_t target);
+void   kswapdEntry();
+
+size_t cachingInfoPages();
+size_t cachingInfoReclaimable();
+
+#endif
@@ -0,0 +1,32 @@
+#include "types.h"
+
+#ifndef CLOCKSOURCE_H
+#define CLOCKSOURCE_H
+
+// Where the time gets read off of: a free running counter & how to turn its
+// cycles into nanoseconds. Switching to a better one carries over whatever the
+// old one counted, so the clock never jumps back.
+
+#define CLOCKSOURCE_SHIFT 32 // ns = cycles * mult >> CLOCKSOURCE_SHIFT
+
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+typedef struct Clocksource {
+  char    *name;
+  uint64_t (*read)();
+  uint64_t mult;
+  uint64_t resolution; // ns
+  uint32_t vdsoMode;   // how userland reads it, VDSO_CLOCK_* (see vdso.h)
+} Clocksource;
+
+Clocksource *clocksource; // in use, 0 before there's any
+
+void     clocksourceSwitch(Clocksource *next);
+uint64_t clockMonotonic(); // ns since boot
+uint64_t clockRealtime();  // ns since the epoch
+
+bool clocksourceTscInvariant();
+void initiateClocksourceTsc(uint64_t cycles, uint64_t ns);
+
+#endif
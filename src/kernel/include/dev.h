@@ -26,6 +26,7 @@ typedef struct DevInputEvent {
 
   size_t          timesOpened;
   CircularInt     deviceEvents;
+  Blocking        blocking; // readers, woken up from the device's interrupts
   struct input_id inputid;
 
   size_t properties;
@@ -47,6 +48,7 @@ typedef struct PtyPair {
   struct PtyPair *next;
 
   Spinlock LOCK_PTY;
+  Blocking blocking; // reads & writes, on both ends
 
   int masterFds;
   int slaveFds;
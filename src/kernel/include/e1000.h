@@ -10,6 +10,7 @@
   ((E1000_RX_PAGE_COUNT * PAGE_SIZE) / sizeof(struct E1000RX))
 
 #define E1000_TX_PAGE_COUNT 1
+#define E1000_TX_WAIT 10 // ms, in case the write-back interrupt never comes
 #define E1000_TX_LIST_ENTRIES                                                  \
   ((E1000_TX_PAGE_COUNT * PAGE_SIZE) / sizeof(struct E1000TX))
 
@@ -53,6 +54,7 @@ typedef struct E1000_interface {
 
   E1000TX *txList;
   uint32_t txHead;
+  Blocking blockingTx; // senders, woken up once descriptors get written back
 
   bool eeprom;
 } E1000_interface;
@@ -1,3 +1,4 @@
+#include "caching.h"
 #include "system.h"
 #include "types.h"
 #include "vfs.h"
@@ -137,6 +138,10 @@ typedef struct Ext2Directory {
 #define EXT2_MAX_CONSEC_INODE 32
 #define EXT2_MAX_CONSEC_WRITE 32
 
+// Reads get cached in runs of up to this many pageframes, taken straight off
+// the HHDM so that reclaim can free them without touching any page tables
+#define EXT2_CACHE_MAX_PAGES 16
+
 typedef struct Ext2CacheObject {
   struct Ext2CacheObject *next;
   struct Ext2CacheObject *prev;
@@ -144,6 +149,9 @@ typedef struct Ext2CacheObject {
   uint32_t blockIndex;
   uint8_t *buff;
   uint32_t blocks; // size = this * ext2->blockSize
+
+  struct Ext2FoundObject *global;
+  CachingEntry            lru; // .pages is the size of buff
 } Ext2CacheObject;
 
 // basically something that has been accessed even once in the whole system
@@ -153,19 +161,25 @@ typedef struct Ext2FoundObject {
 
   // id
   uint32_t inode;
-  uint32_t openFds;
+  uint32_t openFds;  // mappings hold one as well
+  bool     unlinked; // wiped on the last close instead (see ext2Delete())
 
   // properties lock
   Spinlock LOCK_PROP;
 
   // global file lock
-  SpinlockCnt WLOCK_FILE; // todo
+  RwLock WLOCK_FILE; // todo
 
   // cache lock
-  SpinlockCnt WLOCK_CACHE;
+  RwLock WLOCK_CACHE;
 
   // caching
   Ext2CacheObject *firstCacheObj;
+
+  // page cache for mmap(): page index -> physical frame (AVL)
+  Spinlock     LOCK_PAGES;
+  void        *firstPage;
+  CachingEntry pagesLru; // all of the pages, as one entry
 } Ext2FoundObject;
 
 typedef struct Ext2 {
@@ -219,7 +233,7 @@ typedef struct Ext2 {
   Spinlock LOCK_BGDT_WRITE;
   Spinlock LOCK_SUPERBLOCK_WRITE;
 
-  Spinlock LOCK_DIRALLOC;
+  Mutex LOCK_DIRALLOC; // held for whole directory scans (disk I/O)
 } Ext2;
 
 typedef struct Ext2LookupControl {
@@ -268,6 +282,7 @@ size_t ext2Open(char *filename, int flags, int mode, OpenFile *fd,
 bool   ext2Close(OpenFile *fd);
 size_t ext2Read(OpenFile *fd, uint8_t *buff, size_t limit);
 size_t ext2ReadInner(OpenFile *fd, uint8_t *buff, size_t limit);
+size_t ext2Write(OpenFile *fd, uint8_t *buff, size_t limit);
 bool   ext2Stat(MountPoint *mnt, char *filename, struct stat *target,
                 char **symlinkResolve);
 bool   ext2Lstat(MountPoint *mnt, char *filename, struct stat *target,
@@ -335,6 +350,13 @@ bool ext2DirRemove(Ext2 *ext2, Ext2Inode *parentDirInode,
 void ext2CacheAddSecurely(MountPoint *mnt, Ext2FoundObject *global,
                           uint8_t *buff, size_t blockIndex, size_t blocks);
 void ext2CachePush(Ext2 *ext2, Ext2OpenFd *fd);
+void ext2CacheDrop(Ext2FoundObject *global);
+
+size_t ext2MmapPage(OpenFile *fd, size_t offset);
+void   ext2MmapSync(OpenFile *fd, size_t offset, size_t length);
+void   ext2PageCacheWrite(Ext2FoundObject *global, size_t offset, uint8_t *buff,
+                          size_t length);
+void   ext2PageCacheDrop(MountPoint *mnt, Ext2FoundObject *global);
 
 // finale
 VfsHandlers ext2Handlers;
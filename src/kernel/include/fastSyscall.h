@@ -6,5 +6,6 @@
 void initiateSyscallInst();
 
 extern void syscall_entry();
+extern void syscall_reentry();
 
 #endif
\ No newline at end of file
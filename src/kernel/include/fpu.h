@@ -0,0 +1,42 @@
+#include "task.h"
+#include "types.h"
+
+#ifndef FPU_H
+#define FPU_H
+
+// FPU/SSE/AVX state gets switched lazily: CR0.TS stays set until the running
+// task touches the FPU, at which point #NM brings its state in. Whatever's in
+// the registers is left alone until someone else needs them, so tasks that
+// never use the FPU (or get back to a CPU still holding theirs) cost nothing.
+
+#define CR0_TS (1 << 3)
+#define CR4_OSXSAVE (1 << 18)
+
+#define FPU_CPU_NONE ((uint32_t)-1)
+
+// XCR0 state components
+#define XFEATURE_X87 (1 << 0)
+#define XFEATURE_SSE (1 << 1)
+#define XFEATURE_AVX (1 << 2)
+#define XFEATURE_AVX512 (0b111 << 5) // opmask, ZMM_Hi256 & Hi16_ZMM
+
+#define FPU_LEGACY_SIZE 512 // fxsave area, where the XSAVE header starts
+
+size_t   fpuSize;      // per-task save area (fxsave or xsave, 64 byte aligned)
+uint64_t fpuXfeatures; // enabled in XCR0, 0 without XSAVE
+
+void fpuTaskInit(Task *task);
+void fpuTaskFree(Task *task);
+void fpuSwitch(CpuInfo *local, Task *old, Task *next);
+bool fpuHandleNm();
+
+void fpuSave(Task *task);
+void fpuDrop(Task *task);
+
+size_t fpuSignalSize();
+void   fpuSignalSave(Task *task, void *frame);
+void   fpuSignalRestore(Task *task, void *frame);
+
+void initiateFpuCpu();
+
+#endif
@@ -63,5 +63,6 @@ typedef struct GDTPtr {
 #define GDT_TSS 80
 
 void initiateGDT();
+void gdt_load(GDTEntries *cpuGdt, GDTPtr *cpuGdtr, TSSPtr *cpuTss);
 
 #endif
\ No newline at end of file
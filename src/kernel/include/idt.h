@@ -19,6 +19,7 @@ typedef struct {
 } __attribute__((packed)) idt_register_t;
 
 void set_idt_gate(int n, uint64_t handler, uint8_t flags);
+void set_idt_ist(int n, uint8_t ist);
 void set_idt();
 
 #endif
@@ -7,6 +7,7 @@
 #define MSRID_GSBASE 0xC0000101
 
 #define MSRID_KERNEL_GSBASE 0xC0000102
+#define MSRID_TSC_AUX 0xC0000103
 
 #define MSRID_EFER 0xC0000080
 #define MSRID_STAR 0xC0000081
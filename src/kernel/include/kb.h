@@ -19,6 +19,7 @@ void     kbIrq();
 bool     kbTaskRead(uint32_t taskId, char *buff, uint32_t limit,
                     bool changeTaskState);
 bool     kbIsOccupied();
+bool     kbHasInput();
 
 DevInputEvent *kbEvent;
 
@@ -7,8 +7,10 @@
 Task *netHelperTask;
 void  kernelHelpEntry();
 
+Task *kswapdTask; // trims cached file data (see caching.c)
+
 Spinlock LOCK_REAPER;
-Task    *reaperTask;
+Task    *firstReaperTask; // dead tasks waiting to be cleaned up
 
 void initiateKernelThreads();
 
@@ -1,3 +1,4 @@
+#include "slab.h"
 #include "util.h"
 
 #ifndef LINKED_LIST_H
@@ -17,4 +18,7 @@ bool  LinkedListDuplicate(void **LLfirstPtrSource, void **LLfirstPtrTarget,
                           uint32_t structSize);
 void  LinkedListPushFrontUnsafe(void **LLfirstPtr, void *LLtarget);
 
+void *LinkedListAllocateSlab(void **LLfirstPtr, SlabCache *cache);
+bool  LinkedListRemoveSlab(void **LLfirstPtr, SlabCache *cache, void *LLtarget);
+
 #endif
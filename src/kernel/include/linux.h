@@ -237,6 +237,11 @@ typedef struct timeval {
   int64_t tv_usec; /* Microseconds */
 } timeval;
 
+struct timezone {
+  int tz_minuteswest; /* Minutes west of GMT */
+  int tz_dsttime;     /* Nonzero if DST is ever in effect */
+};
+
 // /usr/include/bits/types/struct_rusage.h
 typedef struct rusage {
   timeval ru_utime;    /* user CPU time used */
@@ -473,6 +478,8 @@ typedef struct rusage {
 #define MAP_ANONYMOUS 0x20 /* Don't use a file.  */
 #endif
 #define MAP_ANON MAP_ANONYMOUS
+#define MAP_NORESERVE 0x04000 /* Don't check for reservations.  */
+#define MAP_POPULATE 0x08000  /* Populate (prefault) pagetables.  */
 /* When MAP_HUGETLB is set bits [26:31] encode the log2 of the huge page size.
  */
 #define MAP_HUGE_SHIFT 26
@@ -483,6 +490,14 @@ typedef struct rusage {
 #define MS_SYNC 4       /* Synchronous memory sync.  */
 #define MS_INVALIDATE 2 /* Invalidate the caches.  */
 
+/* Advice to `madvise'.  */
+#define MADV_NORMAL 0     /* No further special treatment.  */
+#define MADV_RANDOM 1     /* Expect random page references.  */
+#define MADV_SEQUENTIAL 2 /* Expect sequential page references.  */
+#define MADV_WILLNEED 3   /* Will need these pages.  */
+#define MADV_DONTNEED 4   /* Don't need these pages.  */
+#define MADV_FREE 8       /* Free pages only if memory pressure.  */
+
 // /usr/include/linux/time.h
 // Standard POSIX clocks
 #define CLOCK_REALTIME                                                         \
@@ -1283,6 +1298,18 @@ struct sigaction {
 };
 
 // include/asm/sigcontext.h & valgrind sources
+#define FP_XSTATE_MAGIC1 0x46505853U
+#define FP_XSTATE_MAGIC2 0x46505845U
+#define FP_XSTATE_MAGIC2_SIZE sizeof(uint32_t)
+
+struct _fpx_sw_bytes {
+  uint32_t magic1;        /* FP_XSTATE_MAGIC1 */
+  uint32_t extended_size; /* xstate_size + FP_XSTATE_MAGIC2_SIZE */
+  uint64_t xfeatures;     /* XCR0 features in the frame */
+  uint32_t xstate_size;   /* without FP_XSTATE_MAGIC2 */
+  uint32_t padding[7];
+};
+
 struct fpstate {
   uint16_t cwd;
   uint16_t swd;
@@ -1294,7 +1321,8 @@ struct fpstate {
   uint32_t mxcsr_mask;
   uint32_t st_space[32];  /* 8*16 bytes for each FP-reg */
   uint32_t xmm_space[64]; /* 16*16 bytes for each XMM-reg  */
-  uint32_t reserved2[24];
+  uint32_t reserved2[12];
+  struct _fpx_sw_bytes sw_reserved; /* XSAVE frames, see FP_XSTATE_MAGIC1 */
 };
 
 struct sigcontext {
@@ -1553,4 +1581,6 @@ typedef struct termios {
   (FUTEX_WAIT_REQUEUE_PI | FUTEX_PRIVATE_FLAG)
 #define FUTEX_CMP_REQUEUE_PI_PRIVATE (FUTEX_CMP_REQUEUE_PI | FUTEX_PRIVATE_FLAG)
 
+#define FUTEX_BITSET_MATCH_ANY 0xffffffff
+
 #endif
@@ -0,0 +1,54 @@
+#include "types.h"
+
+#ifndef LOCK_STAT_H
+#define LOCK_STAT_H
+
+// Contention statistics for a handful of named locks (see initiateLockStat()),
+// exposed as a table at /proc/lock_stat. Every acquisition has to look the
+// lock up, hence it's only built in when debugging.
+#define LOCK_STAT 0
+#define LOCK_STAT_MAX 32
+
+typedef enum LockStatKind {
+  LOCK_STAT_SPINLOCK = 0,
+  LOCK_STAT_CNT = 1, // SpinlockCnt
+  LOCK_STAT_RWLOCK = 2,
+  LOCK_STAT_MUTEX = 3,
+} LockStatKind;
+
+typedef struct LockStat {
+  const char  *name;
+  void        *lock;
+  LockStatKind kind; // locks that start with one share its address
+
+  uint64_t acquisitions;
+  uint64_t contended; // acquisitions that had to wait at all
+  uint64_t waits;     // spin, yield & sleep iterations spent waiting
+
+  // for shared locks that's how long it was kept from writers instead
+  uint64_t heldSince; // ns, only meaningful while held
+  uint64_t holdMax;   // ns
+} LockStat;
+
+void initiateLockStat();
+void lockStatRegister(void *lock, LockStatKind kind, const char *name);
+
+// Hooks for spinlock.c, all of which take what lockStatFind() returned & do
+// nothing for 0 (untracked locks). Compiled away entirely when disabled
+#if LOCK_STAT
+LockStat *lockStatFind(void *lock, LockStatKind kind);
+void      lockStatAcquired(LockStat *stat, size_t waits);
+void      lockStatHeld(LockStat *stat);
+void      lockStatUnheld(LockStat *stat);
+#else
+static inline LockStat *lockStatFind(void *lock, LockStatKind kind) {
+  return 0;
+}
+static inline void lockStatAcquired(LockStat *stat, size_t waits) {}
+static inline void lockStatHeld(LockStat *stat) {}
+static inline void lockStatUnheld(LockStat *stat) {}
+#endif
+
+size_t lockStatPrint(char *out, size_t size);
+
+#endif
@@ -1,3 +1,4 @@
+#include "spinlock.h"
 #include "types.h"
 
 #ifndef PAGING_H
@@ -15,8 +16,18 @@
 #define PF_PAT (1 << 7)     // Page Attribute Table (valid for PT only)
 #define PF_GLOBAL (1 << 8)  // Indicates the page is globally cached
 #define PF_SHARED (1 << 9)  // Userland page is shared
+#define PF_COW (1 << 10)    // Writable, but copied on first write (fork)
+#define PF_PROTNONE (1 << 11) // Userland page, made inaccessible (mprotect)
 // #define PF_SYSTEM (1 << 9)  // Page used by the kernel
 
+// Large (PS) entries keep their PAT bit here, as bit 7 is PF_PS for them
+#define PF_PAT_LARGE (1 << 12)
+
+// Page fault error code
+#define PFERR_PRESENT (1 << 0) // Caused by a protection violation
+#define PFERR_WRITE (1 << 1)   // Caused by a write access
+#define PFERR_USER (1 << 2)    // Happened while on CPL==3
+
 // Region caching (following the Limine protocol)
 #define PF_CACHE_WC (PF_PAT | PF_PWT)
 
@@ -49,6 +60,9 @@
 #define PTE_GET_ADDR(VALUE) ((VALUE) & PTE_ADDR_MASK)
 #define PTE_GET_FLAGS(VALUE) ((VALUE) & ~PTE_ADDR_MASK)
 
+#define PTE_LARGE_ADDR_MASK 0x000fffffffe00000 // 2MiB entries (PD w/PS)
+#define PTE_HUGE_ADDR_MASK 0x000fffffc0000000  // 1GiB entries (PDPT w/PS)
+
 #define PAGE_MASK(x) ((1 << (x)) - 1)
 
 // Sizes & lengths
@@ -56,6 +70,7 @@
 #define PAGE_SIZE 0x1000
 #define PAGE_SIZE_LARGE 0x200000
 #define PAGE_SIZE_HUGE 0x40000000
+#define PAGES_PER_LARGE (PAGE_SIZE_LARGE / PAGE_SIZE)
 
 // Dummy pagefault system (see system.h)
 #define SCHED_PAGE_FAULT_MAGIC_ADDRESS 0x5FFFFFFFF000
@@ -67,26 +82,56 @@
 
 #define P_PHYS_ADDR(x) ((x) & ~0xFFF)
 
+// Process-context identifiers (see paging.c)
+#define PCID_COUNT 4096
+#define CR3_NOFLUSH (1ULL << 63) // keep the TLB entries of the PCID loaded
+#define CR4_PGE (1 << 7)         // global pages
+#define CR4_PCIDE (1 << 17)      // PCIDs on the low bits of CR3
+
+bool pcidEnabled;
+
 void initiatePaging();
+void initiatePagingCpu();
 
 void VirtualMapL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
                  uint64_t flags);
 void VirtualMap(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+void VirtualMapLargeL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                      uint64_t flags);
+void VirtualMapLarge(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+bool VirtualMapLargeTryL(uint64_t *pagedir, uint64_t virt_addr,
+                         uint64_t phys_addr, uint64_t flags);
+bool VirtualLargeVacantL(uint64_t *pagedir, uint64_t virt_addr);
+void VirtualMapRegionL(uint64_t *pagedir, uint64_t virt_addr,
+                       uint64_t phys_addr, uint64_t length, uint64_t flags);
+void VirtualPopulateRegionL(uint64_t *pagedir, uint64_t virt_addr,
+                            uint64_t length, uint64_t flags);
+void VirtualUnmapRegionL(uint64_t *pagedir, uint64_t virt_addr,
+                         uint64_t length);
+void VirtualProtectRegionL(uint64_t *pagedir, uint64_t virt_addr,
+                           uint64_t length, uint64_t flags);
 // uint32_t VirtualUnmap(uint32_t virt_addr);
 size_t VirtualToPhysicalL(uint64_t *pagedir, size_t virt_addr);
 size_t VirtualToPhysical(size_t virt_addr);
+size_t VirtualToPhysicalWritableL(uint64_t *pagedir, size_t virt_addr);
+
+bool VirtualHandleFault(uint64_t *pagedir, size_t virt_addr, uint64_t error);
 
 uint64_t *GetPageDirectory();
 uint64_t *GetTaskPageDirectory(const void *task);
 void      ChangePageDirectory(uint64_t *pd);
 void      ChangePageDirectoryUnsafe(uint64_t *pd);
-void      ChangePageDirectoryFake(uint64_t *pd);
+uint64_t  ChangePageDirectoryFake(uint64_t *pd, uint16_t pcid);
+uint16_t  PagingPcidFind(uint64_t *pagedir);
 
 uint64_t *PageDirectoryAllocate();
 void      PageDirectoryFree(uint64_t *page_dir);
 
 void PageDirectoryUserDuplicate(uint64_t *source, uint64_t *target);
 
+RwLock WLOCK_PAGING; // every page directory's tables
+
 void invalidate(uint64_t vaddr);
+bool PagingShootdownHandle(void *cpuPtr);
 
 #endif
\ No newline at end of file
@@ -2,13 +2,77 @@
 #define PMM_H
 
 #include "bitmap.h"
+#include "spinlock.h"
 #include "types.h"
 
-DS_Bitmap physical;
+// Binary buddy allocator: free memory is kept as naturally aligned blocks of
+// 2^order pageframes, each order with its own (doubly linked) free list.
+#define PMM_MAX_ORDER 16 // 2^15 pageframes (128MiB) max per allocation
+#define PMM_NONE ((uint32_t)-1)
+
+// Free pageframes get zeroed ahead of time by the idle task (see
+// PhysicalScrub()), a few at a time
+#define PMM_FRAME_ZEROED (1 << 0) // Free & known to be filled with zeroes
+#define PMM_SCRUB_BATCH 8         // pageframes zeroed per PhysicalScrub()
+#define PMM_SCRUB_SCAN 512        // pageframes looked at per PhysicalScrub()
+#define PMM_ZEROED_SCAN 32        // free blocks looked at for a zeroed one
+
+// Free memory watermarks for reclaiming cached file data (see caching.c).
+// Allocations below the low one reclaim synchronously, whereas kswapd trims
+// in the background up until the high one.
+#define PMM_WATERMARK_LOW_DIV 128 // fraction of usable memory
+#define PMM_WATERMARK_LOW_MIN 64  // pageframes
+#define PMM_RECLAIM_RETRIES 4096  // waits on someone else's reclaiming
+
+typedef struct PhysicalFrame {
+  union {
+    struct {
+      uint32_t next; // free list links (pageframe numbers)
+      uint32_t prev;
+    };
+    uint16_t pcid; // page directories, once allocated (see paging.c)
+  };
+  uint16_t refs;  // reference counter (see PhysicalReference())
+  uint8_t  order; // order + 1 on free block heads, 0 otherwise
+  uint8_t  flags; // PMM_FRAME_*
+} PhysicalFrame;
+
+typedef struct PhysicalMemory {
+  PhysicalFrame *frames;
+  size_t         framesCnt;
+
+  uint32_t freeLists[PMM_MAX_ORDER];
+  size_t   freeBlocks[PMM_MAX_ORDER];
+
+  size_t usableFrames;
+  size_t freeFrames;
+
+  size_t zeroedFrames; // free ones, already zeroed
+  size_t zeroedHits;   // PhysicalAllocateZeroed() pageframes that were ready
+  size_t zeroedMisses; // ones that had to be zeroed on the spot
+  size_t scrubCursor;
+
+  size_t lowFrames; // watermarks (high is twice the low one)
+  size_t highFrames;
+
+  bool ready; // has been initiated
+} PhysicalMemory;
+
+PhysicalMemory physical;
+
+Spinlock LOCK_PMM;
 
 void initiatePMM();
 
 size_t PhysicalAllocate(int pages);
+size_t PhysicalAllocateTry(int pages);
+size_t PhysicalAllocateZeroed(int pages);
+bool   PhysicalScrub();
 void   PhysicalFree(size_t ptr, int pages);
+void   PhysicalDump();
+
+uint16_t PhysicalReferenceCount(size_t phys);
+void     PhysicalReference(size_t phys);
+bool     PhysicalDereference(size_t phys);
 
 #endif
@@ -26,6 +26,10 @@ typedef struct Epoll {
 Spinlock LOCK_LL_EPOLL;
 Epoll   *firstEpoll;
 
+// poll()/epoll_wait() sleep here, see pollWake()
+Blocking pollBlocking;
+void     pollWake();
+
 size_t epollCreate1(int flags);
 size_t epollCtl(OpenFile *epollFd, int op, int fd, struct epoll_event *event);
 size_t epollWait(OpenFile *epollFd, struct epoll_event *events, int maxevents,
@@ -3,7 +3,14 @@
 #ifndef SCHEDULE_H
 #define SCHEDULE_H
 
+#define SCHEDULE_SLICE 1 // ms a task gets when others are waiting
+
 uint64_t rsp_fix(uint64_t rsp);
 void     schedule(uint64_t rsp);
+void     scheduleWake(void *taskPtr);
+void     scheduleRemove(void *taskPtr);
+void     scheduleBlockUntil(uint8_t state, uint64_t wakeAt);
+void     scheduleKick(void *taskPtr);
+bool     scheduleHasWork();
 
 #endif
\ No newline at end of file
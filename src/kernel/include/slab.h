@@ -0,0 +1,71 @@
+#include "spinlock.h"
+#include "types.h"
+
+#ifndef SLAB_H
+#define SLAB_H
+
+// Object caches for hot, fixed-size kernel structures. Every slab is a
+// naturally aligned run of pageframes: a SlabPage header followed by the
+// objects, with freed ones kept on a per-slab free list for quick reuse.
+
+#define SLAB_MIN_OBJECTS 8 // per slab, grows the slab size for big objects
+#define SLAB_SPARE_EMPTY 1 // empty slabs kept around before releasing them
+
+typedef void (*SlabConstructor)(void *obj);
+
+typedef struct SlabCache SlabCache;
+
+typedef struct SlabPage SlabPage;
+struct SlabPage {
+  SlabPage *next;
+  SlabPage *prev;
+
+  SlabCache *cache;
+  void      *freelist;
+  uint32_t   inuse;
+};
+
+struct SlabCache {
+  SlabCache *next; // registered caches (see /proc/slabinfo)
+
+  char           *name;
+  size_t          size;
+  size_t          align;
+  SlabConstructor ctor; // ran once per object, when its slab gets created
+
+  Spinlock LOCK_CACHE;
+  bool     ready;
+
+  size_t stride;     // object size, including the free pointer (if separate)
+  size_t freeOffset; // where the free pointer lives inside the object
+  size_t pagesPerSlab;
+  size_t objsPerSlab;
+
+  SlabPage *firstPartial;
+  SlabPage *firstFull;
+  SlabPage *firstEmpty;
+
+  // statistics
+  size_t activeObjs;
+  size_t totalObjs;
+  size_t slabsCnt;
+  size_t emptyCnt;
+};
+
+// Caches without a constructor hand out zeroed objects (like calloc()), while
+// objects of ones with a constructor have to be freed in their constructed
+// state. Caches set themselves up on their first allocation.
+#define SLAB_CACHE_INIT(cacheName, type, constructor)                          \
+  {.name = cacheName,                                                          \
+   .size = sizeof(type),                                                       \
+   .align = _Alignof(type),                                                    \
+   .ctor = constructor,                                                        \
+   .LOCK_CACHE = ATOMIC_FLAG_INIT}
+
+SlabCache *firstSlabCache;
+Spinlock   LOCK_SLAB_CACHES;
+
+void *slabAlloc(SlabCache *cache);
+void  slabFree(SlabCache *cache, void *obj);
+
+#endif
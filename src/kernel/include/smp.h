@@ -0,0 +1,100 @@
+#include "gdt.h"
+#include "paging.h"
+#include "system.h"
+#include "timer.h"
+#include "types.h"
+
+#ifndef SMP_H
+#define SMP_H
+
+// Every CPU gets one of these, reached through GS while in kernel mode. The
+// user's GS base waits in KERNEL_GSBASE meanwhile & gets swapped back in on
+// the way out (see isr.asm). Indexed by the bootloader's CPU numbering.
+
+#define SMP_MAX_CPUS 64
+
+// Interrupt stack table slots (TSS ist1-7): vectors that can come in on any
+// stack at all, even the user's (NMIs around syscall_entry) or a broken one
+// (double faults), get switched onto stacks of their own
+#define SMP_IST_NMI 1
+#define SMP_IST_DF 2
+#define SMP_IST_STACK_SIZE 16384
+
+typedef struct CpuInfo {
+  // isr.asm relies on the offsets of these (checked in smp.c)
+  ThreadInfo      threadInfo;   // syscall_entry takes its stack off of gs:0
+  struct CpuInfo *self;         // see cpuLocal()
+  uint64_t        switching;    // between publishing pagedir & loading it
+  uint64_t        flushPending; // a shootdown came in meanwhile (paging.c)
+
+  uint32_t id;
+  bool     bsp;
+  bool     online;
+
+  GDTEntries gdt;
+  GDTPtr     gdtr;
+  TSSPtr     tss;
+
+  // the IST stacks themselves (see SMP_IST_*)
+  uint8_t istNmi[SMP_IST_STACK_SIZE] __attribute__((aligned(16)));
+  uint8_t istDf[SMP_IST_STACK_SIZE] __attribute__((aligned(16)));
+
+  struct Task *current;  // currentTask (see task.h)
+  struct Task *idleTask; // ran whenever there's nothing else to
+
+  // run queue (see schedule.c), guarded by LOCK_SCHED
+  struct Task *firstRunnable;
+  struct Task *lastRunnable;
+  size_t       runnableCnt;
+
+  // TLB state (see paging.c)
+  uint64_t *pagedir; // loaded page directory
+  uint8_t   shootdownPending;
+  uint8_t   pcidStale[PCID_COUNT]; // flushed on their next load
+
+  // timers (see timer.c), the wheel's only ever armed onto by its own CPU
+  TimerWheel wheel;
+  uint64_t   sliceEnd;   // when the current task gives the CPU up, if ever
+  uint64_t   programmed; // what the LAPIC timer's armed for, 0 if nothing
+
+  // lazy FPU switching (see fpu.c)
+  struct Task *fpuOwner;  // whose state the registers hold, if anyone's
+  bool         fpuActive; // CR0.TS clear, the current task's state is loaded
+} CpuInfo;
+
+CpuInfo *cpus[SMP_MAX_CPUS];
+
+// The calling CPU's area. Tasks can move between CPUs at any point interrupts
+// are on, so anything other than what's read through the helpers below should
+// only be touched with them off!
+static inline CpuInfo *cpuLocal() {
+  CpuInfo *ret;
+  asm volatile("movq %%gs:%c1, %0"
+               : "=r"(ret)
+               : "i"(offsetof(CpuInfo, self)));
+  return ret;
+}
+
+// These read a single field in one go, so they stay right even if the task
+// gets moved to another CPU halfway through (which cpuLocal()->... wouldn't)
+static inline struct Task *cpuCurrentTask() {
+  struct Task *ret;
+  asm volatile("movq %%gs:%c1, %0"
+               : "=r"(ret)
+               : "i"(offsetof(CpuInfo, current)));
+  return ret;
+}
+
+static inline uint64_t *cpuPagedir() {
+  uint64_t *ret;
+  asm volatile("movq %%gs:%c1, %0"
+               : "=r"(ret)
+               : "i"(offsetof(CpuInfo, pagedir)));
+  return ret;
+}
+
+void initiateSmpBsp();
+void initiateSmp();
+bool smpHandleNmi();
+
+#endif
@@ -12,8 +12,29 @@
 
 typedef atomic_flag Spinlock;
 
+// Tasks waiting for something (see taskBlockPrepare() in task.c). Entries are
+// the waiters' own, usually on their stacks
+typedef struct BlockedTask {
+  struct BlockedTask *next;
+  struct BlockedTask *prev;
+
+  struct Task *task;
+  void        *key;    // told apart by, on shared ones (see spinlock.c)
+  bool         woken;  // taken off by whoever woke it up
+  bool         queued; // still on the list
+} BlockedTask;
+
+typedef struct Blocking {
+  // also needs a parent lock to be reliable! this is just for the LL. only
+  // ever held with interrupts off (so it can be woken from interrupts)
+  Spinlock     LOCK_LL_BLOCKED;
+  BlockedTask *firstBlockedTask;
+  BlockedTask *lastBlockedTask;
+} Blocking;
+
 void spinlockAcquire(Spinlock *lock);
 void spinlockRelease(Spinlock *lock);
+bool spinlockTryAcquire(Spinlock *lock);
 
 typedef struct SpinlockCnt {
   Spinlock LOCK;
@@ -24,15 +45,48 @@ typedef struct Semaphore {
   Spinlock LOCK;
   uint32_t cnt;
   uint8_t  invalid;
+  Blocking blocking;
 } Semaphore;
 
+// Sleeping locks, for whatever gets held for long (think disk I/O). Waiters
+// are queued & the lock gets handed straight over to them when let go of, so
+// nobody can sneak in front. Neither may be taken under LOCK_SCHED, the timer
+// wheels or a Blocking's LL lock (releasing wakes the waiters up).
+typedef struct Mutex {
+  Spinlock LOCK;
+  bool     locked;
+  Blocking blocking;
+} Mutex;
+
+// Writer-preferring: once a writer is waiting, new readers queue up behind it.
+// Readers can't nest (a writer that came in between would never get anywhere)
+typedef struct RwLock {
+  Spinlock LOCK;
+  int64_t  cnt; // readers inside, -1 for a writer
+  size_t   writersWaiting;
+  Blocking blockingRead;
+  Blocking blockingWrite;
+} RwLock;
+
 void spinlockCntReadAcquire(SpinlockCnt *lock);
 void spinlockCntReadRelease(SpinlockCnt *lock);
 
 void spinlockCntWriteAcquire(SpinlockCnt *lock);
+bool spinlockCntWriteTryAcquire(SpinlockCnt *lock);
 void spinlockCntWriteRelease(SpinlockCnt *lock);
 
 bool semaphoreWait(Semaphore *sem, uint32_t timeout);
 void semaphorePost(Semaphore *sem);
 
+void mutexAcquire(Mutex *mutex);
+bool mutexTryAcquire(Mutex *mutex);
+void mutexRelease(Mutex *mutex);
+
+void rwlockReadAcquire(RwLock *lock);
+void rwlockReadRelease(RwLock *lock);
+
+void rwlockWriteAcquire(RwLock *lock);
+bool rwlockWriteTryAcquire(RwLock *lock);
+void rwlockWriteRelease(RwLock *lock);
+
 #endif
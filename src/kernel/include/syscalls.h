@@ -115,6 +115,7 @@ void   signalsPendingHandleSched(void *taskPtr);
 size_t signalsSigreturnSyscall(void *taskPtr);
 bool   signalsPendingQuick(void *taskPtr);
 bool   signalsRevivableState(int state);
+void   signalsRevive(void *taskPtr);
 
 #if DEBUG_SIGNALS_HITS
 #define dbgSigHitf debugf
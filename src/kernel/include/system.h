@@ -20,6 +20,9 @@ void     outportl(uint16_t portid, uint32_t value);
 uint64_t rdmsr(uint32_t msrid);
 uint64_t wrmsr(uint32_t msrid, uint64_t value);
 
+// Time Stamp Counter
+uint64_t rdtsc();
+
 // Streaming SIMD Extensions
 void initiateSSE();
 
@@ -43,8 +46,8 @@ bool systemDiskInit;
 // Hand down control to the scheduler
 void handControl();
 
-// Switch contexts
-extern void asm_finalize(uint64_t rsp, uint64_t cr3);
+// Switch contexts (released gets cleared once off of the old task's stack)
+extern void asm_finalize(uint64_t rsp, uint64_t cr3, uint8_t *released);
 
 // Endianness
 uint16_t switch_endian_16(uint16_t val);
@@ -55,14 +58,11 @@ extern uint64_t kernel_start;
 extern uint64_t kernel_end;
 uint32_t        stack_bottom;
 
-// Thread Info
-// todo: make all of this SMP-friendly (along with fastSyscall.c)
+// Thread Info (one per CPU, see smp.h)
 typedef struct ThreadInfo {
   uint64_t syscall_stack;
   uint64_t lapic_id;
   // [...]
 } ThreadInfo;
 
-ThreadInfo threadInfo;
-
 #endif
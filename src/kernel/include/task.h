@@ -1,4 +1,6 @@
 #include "isr.h"
+#include "slab.h"
+#include "smp.h"
 #include "system.h"
 #include "types.h"
 #include "vfs.h"
@@ -15,6 +17,7 @@
 #define helperCmdline ("kernel")
 #define dummyCmdline ("dummy")
 #define lwipCmdline ("lwip")
+#define kswapdCmdline ("kswapd")
 
 typedef struct {
   uint64_t edi;
@@ -36,6 +39,7 @@ typedef enum TASK_STATE {
   TASK_STATE_BLOCKED = 8,
   TASK_STATE_SIGKILLED = 9,
   TASK_STATE_FUTEX = 10,
+  TASK_STATE_INTERRUPTIBLE = 11, // in taskBlockSleep(), signals wake it up
   TASK_STATE_DUMMY = 69,
 } TASK_STATE;
 
@@ -68,10 +72,12 @@ typedef struct TaskInfoPagedir {
   uint64_t heap_start;
   uint64_t heap_end;
 
-  uint64_t mmap_start;
-  uint64_t mmap_end;
+  uint64_t mmap_start; // base of mmap() placement (see vmaPlace())
+
+  void *vmaTree; // lazily filled regions, an AVL tree (see vma.h)
 
   uint64_t *pagedir;
+  uint16_t  pcid; // TLB tag of pagedir, 0 if it has none (see paging.c)
 } TaskInfoPagedir;
 
 TaskInfoPagedir *taskInfoPdAllocate(bool pagedir);
@@ -79,8 +85,9 @@ TaskInfoPagedir *taskInfoPdClone(TaskInfoPagedir *old);
 void             taskInfoPdDiscard(TaskInfoPagedir *target);
 
 typedef struct IntTimerInternal {
-  uint64_t at;    // checked agains timerTicks (ms)
+  Timer    timer; // its expiry is the timer's
   uint64_t reset; // reset value (ms)
+  void    *task;  // who gets the signal
 } IntTimerInternal;
 
 typedef struct TaskInfoSignal {
@@ -96,8 +103,8 @@ TaskInfoSignal *taskInfoSignalClone(TaskInfoSignal *old);
 void            taskInfoSignalDiscard(TaskInfoSignal *target);
 
 typedef struct TaskInfoFiles {
-  SpinlockCnt WLOCK_FILES;
-  int         utilizedBy;
+  RwLock WLOCK_FILES;
+  int    utilizedBy;
 
   size_t rlimitFdsSoft;
   size_t rlimitFdsHard;
@@ -171,8 +178,8 @@ struct Task {
   TaskInfoFiles   *infoFiles;
   TaskInfoSignal  *infoSignals;
 
-  __attribute__((aligned(16))) uint8_t fpuenv[512];
-  uint32_t                             mxcsr;
+  uint8_t *fpuenv; // fxsave/xsave area, fpuSize long (see fpu.h)
+  uint32_t fpuCpu; // whose registers it was last loaded into (see fpu.c)
 
   bool noInformParent;
 
@@ -183,36 +190,55 @@ struct Task {
 
   Task *parent;
   Task *next;
+  Task *prev;
+  Task *nextPid;    // pid hash chain (see taskGet())
+  Task *nextReaper; // see taskCallReaper()
+
+  bool pidKept; // freed once the parent reaps it instead (see taskPidFree())
+
+  Timer wakeTimer; // fires at forcefulWakeupTimeUnsafe (see schedule.c)
+
+  // scheduler queues (see schedule.c), guarded by LOCK_SCHED
+  Task    *nextRunnable;
+  Task    *prevRunnable;
+  bool     runnable;
+  uint32_t cpu;     // whose run queue it goes on
+  bool     running; // someone's currentTask
+
+  // set while a CPU is on the task's stacks, cleared by asm_finalize() once
+  // it's off of them. Nobody else may pick it up (or free it) until then!
+  uint8_t onCpu;
 };
 
 SpinlockCnt TASK_LL_MODIFY;
 
 Task *firstTask;
-Task *currentTask;
+
+// what the calling CPU is running (see smp.h)
+#define currentTask (cpuCurrentTask())
 
 Task *dummyTask;
 
 bool tasksInitiated;
 
-typedef struct BlockedTask {
-  struct BlockedTask *next;
-
-  Task *task;
-} BlockedTask;
-
-typedef struct Blocking {
-  // also needs a parent lock to be reliable! this is just for the LL
-  Spinlock     LOCK_LL_BLOCKED;
-  BlockedTask *firstBlockedTask;
-} Blocking;
-
 // needed for libraries that still depend on some sort of errno
 // should be safe as it's per-thread
 #define errno (currentTask->kernelErrno)
 
-void taskBlock(Blocking *blocking, Task *task, Spinlock *releaseAfter,
-               bool apply);
+// What taskBlockSleep() returns
+#define BLOCK_WOKEN 0
+#define BLOCK_TIMEOUT 1
+#define BLOCK_INTERRUPTED 2
+
+void taskBlockPrepare(Blocking *blocking, BlockedTask *entry, void *key);
+void taskBlockCancel(Blocking *blocking, BlockedTask *entry);
+int  taskBlockSleep(Blocking *blocking, BlockedTask *entry,
+                    Spinlock *releaseAfter, uint64_t wakeAt,
+                    bool interruptible);
+int  taskBlockWait(Blocking *blocking, Spinlock *releaseAfter, uint64_t wakeAt,
+                   bool interruptible);
 void taskUnblock(Blocking *blocking);
+bool taskUnblockOne(Blocking *blocking, void *key);
 void taskSpinlockExit(Task *task, Spinlock *lock);
 
 void initiateTasks();
@@ -220,13 +246,23 @@ void initiateTasks();
 Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
                  uint32_t argc, char **argv);
 Task *taskCreateKernel(uint64_t rip, uint64_t rdi);
+Task *taskCreateIdle();
 void  taskNameKernel(Task *target, const char *str, int len);
 void  taskCreateFinish(Task *task);
 
 void taskAdjustHeap(Task *task, size_t new_heap_end, size_t *start,
                     size_t *end);
 
+// Pids are handed out by a bitmap allocator, moving on from wherever it last
+// left off & wrapping around at TASK_PID_MAX
+#define TASK_PID_MAX 32768
+#define TASK_PID_BUCKETS 1024
+#define TASK_PID_NONE ((uint32_t)-1) // taskGenerateId() ran out
+
 Task *taskGet(uint32_t id);
+void  taskPidSet(Task *task, uint32_t id);
+void  taskPidSwap(Task *a, Task *b);
+void  taskPidFree(uint32_t id);
 void  taskKill(uint32_t id, uint16_t ret);
 void  taskFreeChildren(Task *task);
 
@@ -241,4 +277,10 @@ void  taskListDestroy(Task *target);
 uint64_t taskGenerateId();
 void     taskCallReaper(Task *target);
 
+void kernelDummyEntry();
+
+// object caches, defined in task.c
+extern SlabCache cacheKilledInfo;
+extern SlabCache cacheTaskSysInterrupted;
+
 #endif
@@ -1,3 +1,6 @@
 #include "./types.h"
 
-void testingInit();
\ No newline at end of file
+void testingInit();
+void testingEarly();
+void testingPmm();
+void testingScheduler();
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include "spinlock.h"
 #include "types.h"
 
 #define TIMER_ACCURANCY 1193182
@@ -5,14 +6,68 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+// Time is kept by the TSC (calibrated against the PIT on boot, see
+// clocksource.h), so nothing has to tick for it to move forward. Timers live
+// on per-CPU hierarchical timer wheels & the LAPIC timer is only ever armed
+// (one-shot) for whatever's due first: the earliest timer, or the end of the
+// current slice if other tasks are waiting for the CPU (see schedule.c).
+
 uint32_t timerFrequency;
-uint64_t timerTicks;
 uint64_t timerBootUnix;
 
-uint64_t apicFreq;
+uint64_t apicFreq; // LAPIC timer ticks per ms (0 until calibrated)
+uint8_t  timerVector;
+
+// ms since boot (clockMonotonic() has it in ns)
+#define timerTicks (timerNow())
+
+// 4 levels of 64 slots, each level 64 times coarser than the one below it.
+// Anything further away than the wheel reaches just fires (& gets put back)
+// early.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_RANGE (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct TimerWheel TimerWheel;
+
+typedef struct Timer Timer;
+struct Timer {
+  Timer      *next;
+  Timer      *prev;
+  uint64_t    expires; // timerTicks
+  TimerWheel *wheel;   // the (CPU's) one it's been armed on last
+  uint8_t     level;
+  uint8_t     slot;
+  bool        armed;
+
+  // ran on the CPU the timer got armed on, from its timer interrupt & with its
+  // wheel locked (so no timerArm()/timerDisarm() in here!). returns when to
+  // fire again, or 0 to be done with it
+  uint64_t (*callback)(Timer *timer);
+  void *data;
+};
+
+struct TimerWheel {
+  Spinlock LOCK_WHEEL;
+  uint64_t next;     // first ms that hasn't been gone through yet
+  uint64_t deadline; // next thing that needs looking at, 0 if nothing
+  size_t   pending;
+  uint64_t occupied[TIMER_WHEEL_LEVELS]; // one bit per non-empty slot
+  Timer   *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+uint64_t timerNow();
+
+// Neither may be called with LOCK_SCHED held, callbacks take it
+void timerArm(Timer *timer, uint64_t expires);
+void timerDisarm(Timer *timer);
+void timerProgram();
 
 void     timerTick(uint64_t rsp);
 uint32_t sleep(uint32_t time);
 void     initiateApicTimer();
+void     initiateApicTimerAp();
 
-#endif
\ No newline at end of file
+#endif
@@ -19,6 +19,7 @@ VfsHandlers unixAcceptHandlers;
 typedef struct UnixSocketPair {
   // common mutex
   Spinlock LOCK_PAIR;
+  Blocking blocking; // both ends, see unixSocketPairWake()
 
   // accept()/server
   bool     established;
@@ -46,7 +47,8 @@ typedef struct UnixSocket {
   int      timesOpened;
 
   // accept()
-  bool acceptWouldBlock;
+  bool     acceptWouldBlock;
+  Blocking blockingAccept;
 
   // bind()
   char *bindAddr;
@@ -0,0 +1,37 @@
+#include "paging.h"
+#include "types.h"
+
+#ifndef VDSO_H
+#define VDSO_H
+
+// The vDSO (see vdso.asm) gets mapped into every process along with a page of
+// timekeeping data, letting clock_gettime() & co read the TSC by themselves
+// instead of going through a syscall. Userland finds it via AT_SYSINFO_EHDR.
+
+#define USER_VDSO_IMAGE (USER_MMAP_START - 0x10000)
+#define USER_VDSO_DATA (USER_VDSO_IMAGE + PAGE_SIZE)
+
+#define VDSO_CLOCK_NONE 0 // not readable from userland, make a syscall
+#define VDSO_CLOCK_TSC 1
+
+// vdso.asm relies on the offsets of these (checked in vdso.c). Readers retry
+// for as long as seq is odd or changes underneath them.
+typedef struct VdsoData {
+  uint32_t seq;
+  uint32_t clockMode;  // VDSO_CLOCK_*
+  uint64_t baseNs;     // clockMonotonic() at baseCycles
+  uint64_t baseCycles; // where the clocksource took over
+  uint64_t mult;       // see clocksource.h
+  uint64_t realtimeNs; // added onto the monotonic time for CLOCK_REALTIME
+  uint32_t rdtscp;     // TSC_AUX holds the CPU's index (for getcpu())
+} VdsoData;
+
+VdsoData *vdsoData; // 0 until initiated
+
+void     initiateVdso();
+uint64_t vdsoMap(uint64_t *pagedir);
+void     vdsoClockUpdate(uint32_t mode, uint64_t baseNs, uint64_t baseCycles,
+                         uint64_t mult);
+bool     vdsoRdtscpSupported();
+
+#endif
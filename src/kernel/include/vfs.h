@@ -60,6 +60,8 @@ typedef size_t (*SpecialIoctlHandler)(OpenFile *fd, uint64_t request,
 typedef size_t (*SpecialStatHandler)(OpenFile *fd, stat *stat);
 typedef size_t (*SpecialMmapHandler)(size_t addr, size_t length, int prot,
                                      int flags, OpenFile *fd, size_t pgoffset);
+typedef size_t (*SpecialMmapPage)(OpenFile *fd, size_t offset);
+typedef void (*SpecialMmapSync)(OpenFile *fd, size_t offset, size_t length);
 typedef bool (*SpecialDuplicate)(OpenFile *original, OpenFile *orphan);
 typedef size_t (*SpecialGetdents64)(OpenFile *fd, struct linux_dirent64 *dirp,
                                     unsigned int count);
@@ -98,6 +100,8 @@ typedef struct VfsHandlers {
   SpecialIoctlHandler ioctl;
   SpecialStatHandler  stat;
   SpecialMmapHandler  mmap;
+  SpecialMmapPage     mmapPage; // referenced frame for a demand-paged mapping
+  SpecialMmapSync     mmapSync; // writes MAP_SHARED modifications back
   SpecialGetdents64   getdents64;
   SpecialGetFilesize  getFilesize;
   SpecialPoll         poll;
@@ -149,9 +153,6 @@ struct MountPoint {
   uint8_t   partition; // mbr allows for 4 partitions / disk
   CONNECTOR connector;
 
-  // essential for mm
-  size_t blocksCached;
-
   FS filesystem;
 
   VfsHandlers *handlers;
@@ -220,6 +221,9 @@ OpenFile *fsUserGetNode(void *task, int fd);
 OpenFile *fsUserDuplicateNode(void *taskPtr, OpenFile *original, size_t suggid);
 bool      fsUserDuplicateNodeUnsafe(OpenFile *original, OpenFile *orphan);
 
+OpenFile *fsOrphanDuplicate(OpenFile *original);
+void      fsOrphanClose(OpenFile *orphan);
+
 size_t fsRead(OpenFile *file, uint8_t *out, uint32_t limit);
 size_t fsWrite(OpenFile *file, uint8_t *in, uint32_t limit);
 size_t fsReadlink(void *task, char *path, char *buf, int size);
@@ -0,0 +1,47 @@
+#include "task.h"
+#include "types.h"
+#include "vfs.h"
+
+#ifndef VMA_H
+#define VMA_H
+
+// Userland regions that are filled in lazily, when first accessed. Every
+// address space keeps them in an AVL tree (keyed by start) & they never
+// overlap each other.
+
+typedef struct VmArea {
+  size_t   start; // page aligned, inclusive
+  size_t   end;   // page aligned, exclusive
+  uint64_t flags; // PF_* flags used when mapping pages in (0 for PROT_NONE)
+
+  // file-backed regions (anonymous ones have no file)
+  OpenFile *file; // orphan reference, see fsOrphanDuplicate()
+  size_t    pgoffset;
+  bool      shared; // MAP_SHARED, otherwise writes are copy-on-write
+} VmArea;
+
+// Where mmap() places regions without a (usable) address hint
+#define VMA_MMAP_END (USER_STACK_BOTTOM - USER_STACK_PAGES * PAGE_SIZE)
+
+uint64_t vmaProtFlags(int prot);
+
+VmArea *vmaAdd(TaskInfoPagedir *info, size_t start, size_t end,
+               uint64_t flags);
+VmArea *vmaAddFile(TaskInfoPagedir *info, size_t start, size_t end,
+                   uint64_t flags, OpenFile *file, size_t pgoffset,
+                   bool shared);
+void    vmaRemove(TaskInfoPagedir *info, size_t start, size_t end);
+void    vmaProtect(TaskInfoPagedir *info, size_t start, size_t end,
+                   uint64_t flags);
+size_t  vmaPlace(TaskInfoPagedir *info, size_t hint, size_t length);
+VmArea *vmaFind(TaskInfoPagedir *info, size_t addr);
+VmArea *vmaFirstFrom(TaskInfoPagedir *info, size_t addr);
+VmArea *vmaNext(TaskInfoPagedir *info, VmArea *vma);
+void    vmaPopulate(TaskInfoPagedir *info, size_t start, size_t end);
+void    vmaDropPages(TaskInfoPagedir *info, size_t start, size_t end);
+bool    vmaHandleFault(TaskInfoPagedir *info, size_t addr, uint64_t error);
+
+void vmaClone(TaskInfoPagedir *source, TaskInfoPagedir *target);
+void vmaDiscard(TaskInfoPagedir *info);
+
+#endif
@@ -4,12 +4,22 @@
 #ifndef VMM_H
 #define VMM_H
 
+// Alignment of the vmalloc region (one PML4 entry's worth)
+#define VMM_REGION_ALIGN (1UL << 39)
+
+// Pages from which on VirtualAllocateScattered() actually scatters
+#define VMM_SCATTER_MIN 16
+
 DS_Bitmap virtual;
 
 void initiateVMM();
 
 void *VirtualAllocate(int pages);
+void *VirtualAllocateZeroed(int pages);
 void *VirtualAllocatePhysicallyContiguous(int pages);
+void *VirtualAllocateScattered(int pages);
+void *VirtualMapDevice(size_t phys, size_t length, uint64_t flags);
+bool  VirtualIsScattered(void *ptr);
 bool  VirtualFree(void *ptr, int pages);
 
 #endif
\ No newline at end of file
@@ -1,16 +1,118 @@
 #include <caching.h>
+#include <paging.h>
+#include <pmm.h>
 #include <system.h>
-#include <vfs.h>
+#include <timer.h>
 
-size_t cachingInfoBlocks() {
+// Global LRU over cached file data, trimmed when memory runs low
+// Copyright (C) 2025 Panagiotis
+
+// Lock order: owner locks -> LOCK_CACHING. Reclaim goes the other way around,
+// which is why evict() handlers only ever try-lock.
+
+Spinlock      LOCK_CACHING = ATOMIC_FLAG_INIT;
+CachingEntry *firstCachingEntry = 0;
+CachingEntry *lastCachingEntry = 0;
+
+// Expects LOCK_CACHING to be held
+void cachingLruUnlink(CachingEntry *entry) {
+  if (!entry->linked)
+    return;
+
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    firstCachingEntry = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    lastCachingEntry = entry->prev;
+
+  entry->next = 0;
+  entry->prev = 0;
+  entry->linked = false;
+}
+
+// Puts the entry on the front of the LRU (also used to mark it as accessed)
+void cachingLruInsert(CachingEntry *entry) {
+  spinlockAcquire(&LOCK_CACHING);
+  if (firstCachingEntry == entry)
+    goto cleanup;
+
+  cachingLruUnlink(entry);
+  entry->next = firstCachingEntry;
+  if (firstCachingEntry)
+    firstCachingEntry->prev = entry;
+  else
+    lastCachingEntry = entry;
+  firstCachingEntry = entry;
+  entry->linked = true;
+
+cleanup:
+  spinlockRelease(&LOCK_CACHING);
+}
+
+void cachingLruRemove(CachingEntry *entry) {
+  spinlockAcquire(&LOCK_CACHING);
+  cachingLruUnlink(entry);
+  spinlockRelease(&LOCK_CACHING);
+}
+
+// Evicts the least recently used entries until target pageframes are freed.
+// Gets called from inside allocations (with whatever locks held), so it
+// never waits on anything & just skips entries that are busy. Returns
+// CACHING_RECLAIM_BUSY if somebody else is in the middle of reclaiming.
+size_t cachingReclaim(size_t target) {
+  if (!spinlockTryAcquire(&LOCK_CACHING))
+    return CACHING_RECLAIM_BUSY;
+
+  size_t        freed = 0;
+  CachingEntry *browse = lastCachingEntry;
+  while (browse && freed < target) {
+    CachingEntry *prev = browse->prev; // browse might be gone afterwards
+    freed += browse->evict(browse);
+    browse = prev;
+  }
+
+  spinlockRelease(&LOCK_CACHING);
+  return freed;
+}
+
+// Background trimming, keeps free memory above the high watermark so that
+// allocations rarely have to reclaim by themselves
+void kswapdEntry() {
+  while (true) {
+    size_t free = physical.freeFrames;
+    if (free < physical.highFrames)
+      cachingReclaim(physical.highFrames - free);
+    sleep(CACHING_KSWAPD_PERIOD);
+  }
+}
+
+size_t cachingInfoPages() {
+  size_t ret = 0;
+
+  spinlockAcquire(&LOCK_CACHING);
+  CachingEntry *browse = firstCachingEntry;
+  while (browse) {
+    ret += browse->pages;
+    browse = browse->next;
+  }
+  spinlockRelease(&LOCK_CACHING);
+
+  return ret;
+}
+
+size_t cachingInfoReclaimable() {
   size_t ret = 0;
 
-  // filesystem cache
-  MountPoint *fs = firstMountPoint;
-  while (fs) {
-    ret += fs->blocksCached;
-    fs = fs->next;
+  spinlockAcquire(&LOCK_CACHING);
+  CachingEntry *browse = firstCachingEntry;
+  while (browse) {
+    ret += browse->reclaimable ? browse->reclaimable(browse) : browse->pages;
+    browse = browse->next;
   }
+  spinlockRelease(&LOCK_CACHING);
 
   return ret;
 }
@@ -1,4 +1,6 @@
+#include <bootloader.h>
 #include <malloc_glue.h>
+#include <pmm.h>
 #include <system.h>
 #include <util.h>
 #include <vmm.h>
@@ -16,8 +18,15 @@ void *sbrk(long increment) {
     return last;
   // return 0;
 
+  // dlmalloc's lock is held here, which reclaiming cached file data might need
+  // for free()ing (see caching.c), so no reclaiming
   uint64_t blocks = DivRoundUp(increment, BLOCK_SIZE);
-  void    *virt = VirtualAllocate(blocks);
+  size_t   phys = PhysicalAllocateTry(blocks);
+  if (!phys) {
+    debugf("[dlmalloc::sbrk] Ran out of memory! blocks{%ld}\n", blocks);
+    panic();
+  }
+  void *virt = (void *)(phys + bootloader.hhdmOffset);
   memset(virt, 0, blocks * BLOCK_SIZE);
 
   last = (void *)((size_t)virt + increment);
@@ -1,3 +1,4 @@
+#include <apic.h>
 #include <bitmap.h>
 #include <bootloader.h>
 #include <fb.h>
@@ -5,6 +6,8 @@
 #include <malloc.h>
 #include <paging.h>
 #include <pmm.h>
+#include <smp.h>
+#include <stdatomic.h>
 #include <system.h>
 #include <task.h>
 #include <types.h>
@@ -24,7 +27,127 @@
 #define PAGING_DEBUG 0
 
 #define HHDMoffset (bootloader.hhdmOffset)
-uint64_t *globalPagedir = 0;
+
+// PML4 entries below this one are userland's, the rest are shared kernel ones
+#define PML4E_USER_END 256
+
+// The page directory loaded by the calling CPU (see ChangePageDirectoryFake())
+#define globalPagedir (cpuPagedir())
+
+// PCIDs (process-context identifiers) tag TLB entries with the address space
+// they came from, so switching page directories doesn't have to flush them.
+// Every page directory gets one of its own while they last; PCID 0 is left for
+// the rest & is always flushed when loaded. Every CPU keeps track of the ones
+// it has to flush on its own (see smp.h). A page directory's PCID is kept on
+// its pageframe's entry, so finding it takes no searching.
+bool pcidEnabled = false;
+
+Spinlock         LOCK_PCID = ATOMIC_FLAG_INIT;
+static uint64_t *pcidOwners[PCID_COUNT];
+static uint16_t  pcidLast = 0;
+
+// Has every CPU (apart from except) flush pcid on its next load
+static void PagingPcidStaleOn(uint16_t pcid, CpuInfo *except) {
+  for (int i = 0; i < SMP_MAX_CPUS; i++) {
+    CpuInfo *cpu = cpus[i];
+    if (cpu && cpu != except)
+      atomicWrite8(&cpu->pcidStale[pcid], 1);
+  }
+}
+
+static uint16_t *PagingPcidOf(uint64_t *pagedir) {
+  size_t frame = ((size_t)pagedir - HHDMoffset) / BLOCK_SIZE;
+  return frame < physical.framesCnt ? &physical.frames[frame].pcid : 0;
+}
+
+static uint16_t PagingPcidAllocate(uint64_t *pagedir) {
+  uint16_t *slot = PagingPcidOf(pagedir);
+  if (!pcidEnabled || !slot)
+    return 0;
+
+  uint16_t ret = 0;
+  spinlockAcquire(&LOCK_PCID);
+  for (int i = 1; i <= PCID_COUNT; i++) {
+    uint16_t pcid = (pcidLast + i) % PCID_COUNT;
+    if (!pcid || pcidOwners[pcid])
+      continue;
+    // whatever its previous owner left behind has to go first
+    pcidOwners[pcid] = pagedir;
+    PagingPcidStaleOn(pcid, 0);
+    pcidLast = pcid;
+    ret = pcid;
+    break;
+  }
+  *slot = ret;
+  spinlockRelease(&LOCK_PCID);
+  return ret;
+}
+
+// Lockless, since the scheduler needs it for page directory overrides
+uint16_t PagingPcidFind(uint64_t *pagedir) {
+  if (!pcidEnabled)
+    return 0;
+
+  uint16_t *slot = PagingPcidOf(pagedir);
+  return slot ? *slot : 0;
+}
+
+static void PagingPcidFree(uint64_t *pagedir) {
+  uint16_t pcid = PagingPcidFind(pagedir);
+  if (!pcid)
+    return;
+
+  spinlockAcquire(&LOCK_PCID);
+  pcidOwners[pcid] = 0;
+  *PagingPcidOf(pagedir) = 0;
+  spinlockRelease(&LOCK_PCID);
+}
+
+// Entries of address spaces that aren't loaded can't be invalidated one by one,
+// so all of them get dropped the next time it is instead
+static void PagingPcidStale(uint64_t *pagedir) {
+  uint16_t pcid = PagingPcidFind(pagedir);
+  if (pcid)
+    PagingPcidStaleOn(pcid, 0);
+}
+
+// CR3 value that loads the page directory at phys, keeping whatever the TLB
+// still has for its PCID (unless it might be out of date)
+static uint64_t PagingCr3(size_t phys, uint16_t pcid) {
+  if (!pcidEnabled || !pcid)
+    return phys;
+
+  uint64_t ret = phys | pcid;
+  uint8_t *stale = &cpuLocal()->pcidStale[pcid];
+  if (!atomic_exchange((volatile _Atomic uint8_t *)stale, 0))
+    ret |= CR3_NOFLUSH;
+  return ret;
+}
+
+static void PagingPcidInit() {
+  uint32_t eax = 1, ebx = 0, ecx = 0, edx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  if (!(ecx & (1 << 17))) {
+    debugf("[paging] No PCID support, the TLB gets flushed on every switch\n");
+    return;
+  }
+
+  // PCIDE can only be turned on while running under PCID 0
+  uint64_t cr3 = 0;
+  asm volatile("movq %%cr3, %0" : "=r"(cr3));
+  asm volatile("movq %0, %%cr3" ::"r"(cr3 & PTE_ADDR_MASK) : "memory");
+
+  // global entries (vmalloc, see vmm.c) are shared between all PCIDs
+  uint64_t cr4 = 0;
+  asm volatile("movq %%cr4, %0" : "=r"(cr4));
+  cr4 |= CR4_PGE | CR4_PCIDE;
+  asm volatile("movq %0, %%cr4" ::"r"(cr4) : "memory");
+  pcidEnabled = true;
+
+  uint16_t pcid = PagingPcidAllocate(globalPagedir);
+  cr3 = PagingCr3(cr3 & PTE_ADDR_MASK, pcid);
+  asm volatile("movq %0, %%cr3" ::"r"(cr3) : "memory");
+}
 
 void initiatePaging() {
   // debugf("phys{%lx} virt{%lx}\n", bootloader.kernelPhysBase,
@@ -89,44 +212,88 @@ void initiatePaging() {
   }
 
   uint64_t pdVirt = pdPhys + bootloader.hhdmOffset;
-  globalPagedir = (uint64_t *)pdVirt;
+  cpuLocal()->pagedir = (uint64_t *)pdVirt;
+
+  // the kernel half gets copied onto every new page directory, so the vmalloc
+  // region's top level entries (see vmm.c) have to be there from the start
+  size_t vmallocEnd =
+      virtual.mem_start + virtual.BitmapSizeInBlocks * BLOCK_SIZE;
+  for (size_t curr = virtual.mem_start; curr < vmallocEnd;
+       curr += VMM_REGION_ALIGN) {
+    uint64_t *pml4e = &globalPagedir[PML4E(AMD64_MM_STRIPSX(curr))];
+    if (!(*pml4e & PF_PRESENT))
+      *pml4e = PhysicalAllocateZeroed(1) | PF_PRESENT | PF_RW;
+  }
+
+  PagingPcidInit();
 
   // VirtualSeek(bootloader.hhdmOffset);
 }
 
+// Every other CPU starts off on limine's page directory, under PCID 0
+void initiatePagingCpu() {
+  uint64_t cr3 = 0;
+  asm volatile("movq %%cr3, %0" : "=r"(cr3));
+  cpuLocal()->pagedir = (uint64_t *)((cr3 & PTE_ADDR_MASK) + HHDMoffset);
+  if (!pcidEnabled)
+    return;
+
+  asm volatile("movq %0, %%cr3" ::"r"(cr3 & PTE_ADDR_MASK) : "memory");
+  uint64_t cr4 = 0;
+  asm volatile("movq %%cr4, %0" : "=r"(cr4));
+  cr4 |= CR4_PGE | CR4_PCIDE;
+  asm volatile("movq %0, %%cr4" ::"r"(cr4) : "memory");
+}
+
 void VirtualMapRegionByLength(uint64_t virt_addr, uint64_t phys_addr,
                               uint64_t length, uint64_t flags) {
 #if ELF_DEBUG
   debugf("[paging::map::region] virt{%lx} phys{%lx} len{%lx}\n", virt_addr,
          phys_addr, length);
 #endif
-  if (length == 0) return;
-  uint32_t pagesAmnt = DivRoundUp(length, PAGE_SIZE);
-  uint64_t xvirt = virt_addr;
-  uint64_t xphys = phys_addr;
-  for (uint32_t i = 0; i < pagesAmnt; i++, xvirt += PAGE_SIZE, xphys += PAGE_SIZE) {
-    VirtualMap(xvirt, xphys, flags);
-  }
+  VirtualMapRegionL(globalPagedir, virt_addr, phys_addr, length, flags);
+}
+
+// The other half of ChangePageDirectoryFake(), once CR3 has been written (also
+// done by asm_finalize())
+static void PagingSwitched(CpuInfo *local) {
+  atomicWrite64(&local->switching, 0);
+  if (atomic_exchange((volatile _Atomic uint64_t *)&local->flushPending, 0))
+    asm volatile("movq %%cr3, %%rax; movq %%rax, %%cr3" ::: "rax", "memory");
 }
 
 // Will NOT check for the current task and update it's pagedir (on the struct)!
 void ChangePageDirectoryUnsafe(uint64_t *pd) {
-  uint64_t targ = VirtualToPhysical((size_t)pd);
-  if (!targ) {
-    debugf("[paging] Could not change to pd{%lx}!\n", pd);
-    panic();
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  uint64_t targ = ChangePageDirectoryFake(pd, PagingPcidFind(pd));
+  if (targ) {
+    asm volatile("movq %0, %%cr3" ::"r"(targ) : "memory");
+    PagingSwitched(cpuLocal());
   }
-  asm volatile("movq %0, %%cr3" ::"r"(targ));
-  globalPagedir = pd;
+  if (ints)
+    asm volatile("sti");
 }
 
-// Used by the scheduler to avoid accessing globalPagedir directly
-void ChangePageDirectoryFake(uint64_t *pd) {
-  if (!VirtualToPhysical((size_t)pd)) {
+// Used by the scheduler to avoid accessing globalPagedir directly. Returns the
+// CR3 value to switch with (see asm_finalize()), or 0 if pd is already loaded
+// and CR3 can be left alone (threads sharing an address space). Expects
+// interrupts to be off until CR3 is written!
+uint64_t ChangePageDirectoryFake(uint64_t *pd, uint16_t pcid) {
+  size_t phys = VirtualToPhysical((size_t)pd);
+  if (!phys) {
     debugf("[paging] Could not (fake) change to pd{%lx}!\n", pd);
     panic();
   }
-  globalPagedir = pd;
+  CpuInfo *local = cpuLocal();
+  if (pd == local->pagedir)
+    return 0;
+
+  // shootdowns find us by pd from here on, even though it's not loaded yet
+  // (see PagingShootdownHandle())
+  atomicWrite64(&local->switching, 1);
+  atomicWrite64((uint64_t *)&local->pagedir, (uint64_t)pd);
+  return PagingCr3(phys, pcid);
 }
 
 void ChangePageDirectory(uint64_t *pd) {
@@ -152,72 +319,568 @@ inline uint64_t *GetTaskPageDirectory(const void *taskPtr) {
   return ret;
 }
 
-inline void invalidate(uint64_t vaddr) { asm volatile("invlpg %0" ::"m"(vaddr)); }
+inline void invalidate(uint64_t vaddr) {
+  asm volatile("invlpg (%0)" ::"r"(vaddr) : "memory");
+}
+
+static bool PagingKernelHalf(uint64_t virt_addr) {
+  return PML4E(AMD64_MM_STRIPSX(virt_addr)) >= PML4E_USER_END;
+}
 
-size_t PagingPhysAllocate() {
-  size_t phys = PhysicalAllocate(1);
-  void *virt = (void *)(phys + HHDMoffset);
-  memset(virt, 0, PAGE_SIZE);
-  return phys;
+// TLB shootdowns: other CPUs might still have the entries cached, those that
+// have the address space loaded (or all of them, for the kernel half) are
+// sent an NMI & waited on. NMIs get through even when the target is spinning
+// with interrupts off (likely on a lock we're holding), so this can't deadlock.
+typedef struct PagingShootdownReq {
+  uint64_t *pagedir;
+  bool      kernel;
+  uint64_t *addrs; // 0 to flush everything
+  size_t    cnt;
+  uint64_t  pending; // CPUs yet to handle it
+} PagingShootdownReq;
+
+Spinlock                  LOCK_SHOOTDOWN = ATOMIC_FLAG_INIT;
+static PagingShootdownReq shootdown = {0};
+
+static bool PagingShootdownTarget(CpuInfo *cpu, CpuInfo *local,
+                                  uint64_t *pagedir, bool kernel) {
+  if (!cpu || cpu == local || !atomicRead8((uint8_t *)&cpu->online))
+    return false;
+  return kernel || atomicRead64((uint64_t *)&cpu->pagedir) == (size_t)pagedir;
 }
 
-SpinlockCnt WLOCK_PAGING = {0};
+static void PagingShootdown(uint64_t *pagedir, bool kernel, uint64_t *addrs,
+                            size_t cnt) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  CpuInfo *local = cpuLocal();
+
+  // those without it loaded drop it on their next switch instead (has to come
+  // before looking at what they've got loaded, see ChangePageDirectoryFake())
+  uint16_t pcid = kernel ? 0 : PagingPcidFind(pagedir);
+  if (pcid)
+    PagingPcidStaleOn(pcid, local);
+
+  bool any = false;
+  for (int i = 0; i < SMP_MAX_CPUS && !any; i++)
+    any = PagingShootdownTarget(cpus[i], local, pagedir, kernel);
+  if (!any)
+    goto cleanup;
+
+  spinlockAcquire(&LOCK_SHOOTDOWN);
+  shootdown.pagedir = pagedir;
+  shootdown.kernel = kernel;
+  shootdown.addrs = addrs;
+  shootdown.cnt = cnt;
+  for (int i = 0; i < SMP_MAX_CPUS; i++) {
+    CpuInfo *cpu = cpus[i];
+    if (!PagingShootdownTarget(cpu, local, pagedir, kernel))
+      continue;
+    atomic_fetch_add((volatile _Atomic uint64_t *)&shootdown.pending, 1);
+    atomicWrite8(&cpu->shootdownPending, 1);
+    apicSendNmi(cpu->threadInfo.lapic_id);
+  }
+  while (atomicRead64(&shootdown.pending))
+    asm volatile("pause");
+  spinlockRelease(&LOCK_SHOOTDOWN);
+
+cleanup:
+  if (ints)
+    asm volatile("sti");
+}
+
+// Called from the NMI handler, which might've interrupted anything (even the
+// moments GS is the user's), so everything is reached through cpuPtr
+bool PagingShootdownHandle(void *cpuPtr) {
+  CpuInfo *cpu = (CpuInfo *)cpuPtr;
+  if (!atomic_exchange((volatile _Atomic uint8_t *)&cpu->shootdownPending, 0))
+    return false;
+
+  if (!shootdown.kernel && atomicRead64(&cpu->switching))
+    atomicWrite64(&cpu->flushPending, 1); // CR3 might not be written yet
+  else if (!shootdown.addrs && shootdown.kernel) {
+    // global entries only go away by toggling PGE
+    uint64_t cr4 = 0;
+    asm volatile("movq %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_PGE) {
+      asm volatile("movq %0, %%cr4" ::"r"(cr4 & ~CR4_PGE) : "memory");
+      asm volatile("movq %0, %%cr4" ::"r"(cr4) : "memory");
+    } else
+      asm volatile("movq %%cr3, %%rax; movq %%rax, %%cr3" ::: "rax", "memory");
+  } else if (!shootdown.addrs)
+    asm volatile("movq %%cr3, %%rax; movq %%rax, %%cr3" ::: "rax", "memory");
+  else {
+    for (size_t i = 0; i < shootdown.cnt; i++)
+      invalidate(shootdown.addrs[i]);
+  }
+
+  atomic_fetch_sub((volatile _Atomic uint64_t *)&shootdown.pending, 1);
+  return true;
+}
+
+// Kernel half entries are shared by every address space (& global, if they
+// ever change), so they can always be invalidated directly
+static void PagingInvalidateLocal(uint64_t *pagedir, uint64_t virt_addr) {
+  if (pagedir == globalPagedir || PagingKernelHalf(virt_addr))
+    invalidate(virt_addr);
+  else
+    PagingPcidStale(pagedir);
+}
+
+static void PagingInvalidate(uint64_t *pagedir, uint64_t virt_addr) {
+  PagingInvalidateLocal(pagedir, virt_addr);
+  PagingShootdown(pagedir, PagingKernelHalf(virt_addr), &virt_addr, 1);
+}
+
+size_t PagingPhysAllocate() { return PhysicalAllocateZeroed(1); }
+
+RwLock WLOCK_PAGING = {0};
 
 void VirtualMap(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
   VirtualMapL(globalPagedir, virt_addr, phys_addr, flags);
 }
 
-void VirtualMapL(uint64_t *restrict pagedir, uint64_t virt_addr, uint64_t phys_addr,
-                 uint64_t flags) {
-  if (virt_addr % PAGE_SIZE) {
-    debugf("[paging] Tried to map non-aligned address! virt{%lx} phys{%lx}\n",
-           virt_addr, phys_addr);
-    panic();
-  }
+// Walks down to the page directory entry (2MiB granularity) of virt_addr,
+// optionally creating any missing intermediate tables. Expects WLOCK_PAGING to
+// be held!
+static size_t *PagingWalkDirectory(uint64_t *pagedir, uint64_t virt_addr,
+                                   bool create) {
   virt_addr = AMD64_MM_STRIPSX(virt_addr);
 
   const uint32_t pml4_index = PML4E(virt_addr);
   const uint32_t pdp_index = PDPTE(virt_addr);
   const uint32_t pd_index = PDE(virt_addr);
-  const uint32_t pt_index = PTE(virt_addr);
 
-  spinlockCntWriteAcquire(&WLOCK_PAGING);
-  size_t *pdp, *pd, *pt;
+  size_t *pdp, *pd;
   if (!(pagedir[pml4_index] & PF_PRESENT)) {
+    if (!create)
+      return 0;
     size_t target = PagingPhysAllocate();
     pagedir[pml4_index] = target | PF_PRESENT | PF_RW | PF_USER;
   }
   pdp = (size_t *)(PTE_GET_ADDR(pagedir[pml4_index]) + HHDMoffset);
 
   if (!(pdp[pdp_index] & PF_PRESENT)) {
+    if (!create)
+      return 0;
     size_t target = PagingPhysAllocate();
     pdp[pdp_index] = target | PF_PRESENT | PF_RW | PF_USER;
+  } else if (pdp[pdp_index] & PF_PS) {
+    // 1GiB entries are only ever used by the bootloader (HHDM)
+    if (create) {
+      debugf("[paging] Tried to walk through a 1GiB entry! virt{%lx}\n",
+             virt_addr);
+      panic();
+    }
+    return 0;
   }
   pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
 
-  if (!(pd[pd_index] & PF_PRESENT)) {
-    size_t target = PagingPhysAllocate();
-    pd[pd_index] = target | PF_PRESENT | PF_RW | PF_USER;
-  }
-  pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
+  return &pd[pd_index];
+}
 
-  if (pt[pt_index] & PF_PRESENT &&
-      !(PTE_GET_ADDR(pt[pt_index]) >= fb.phys &&
-        PTE_GET_ADDR(pt[pt_index]) < fb.phys + (fb.width * fb.height * 4))) {
-    PhysicalFree(PTE_GET_ADDR(pt[pt_index]), 1);
+// Flags of a 2MiB entry, in the format 4KiB ones use
+static uint64_t PagingLargeFlags(size_t pde) {
+  uint64_t flags = pde & ~PTE_LARGE_ADDR_MASK & ~(PF_PS | PF_PAT_LARGE);
+  if (pde & PF_PAT_LARGE)
+    flags |= PF_PAT;
+  return flags;
+}
+
+// Drops the references a 2MiB entry holds on each of its pageframes
+static void PagingDropLarge(size_t pde) {
+  size_t phys = pde & PTE_LARGE_ADDR_MASK;
+  for (size_t i = 0; i < PAGES_PER_LARGE; i++)
+    PhysicalDereference(phys + i * PAGE_SIZE);
+}
+
+// Drops every userland mapping of a page table & frees the table itself
+static void PagingFreeTable(size_t pde) {
+  size_t *pt = (size_t *)(PTE_GET_ADDR(pde) + HHDMoffset);
+  for (int pt_index = 0; pt_index < 512; pt_index++) {
+    // only userland mappings hold references (see pmm.c)
+    if (pt[pt_index] & PF_PRESENT && pt[pt_index] & (PF_USER | PF_PROTNONE))
+      PhysicalDereference(PTE_GET_ADDR(pt[pt_index]));
   }
+  PhysicalFree(PTE_GET_ADDR(pde), 1);
+}
+
+// Breaks a 2MiB entry down to a page table with identical mappings (every
+// pageframe keeping the reference it had). Expects WLOCK_PAGING to be held!
+static void PagingSplitLarge(uint64_t *pagedir, size_t *pde,
+                             uint64_t virt_addr) {
+  size_t   table = PagingPhysAllocate();
+  size_t  *pt = (size_t *)(table + HHDMoffset);
+  size_t   phys = *pde & PTE_LARGE_ADDR_MASK;
+  uint64_t flags = PagingLargeFlags(*pde);
+  for (size_t i = 0; i < PAGES_PER_LARGE; i++)
+    pt[i] = (phys + i * PAGE_SIZE) | flags;
+
+  *pde = table | PF_PRESENT | PF_RW | PF_USER;
+  PagingInvalidate(pagedir, virt_addr & ~(PAGE_SIZE_LARGE - 1));
+}
+
+// Walks down to the page table entry of virt_addr, optionally creating any
+// missing intermediate tables. 2MiB entries on the way get split, as the caller
+// is after a single page. Expects WLOCK_PAGING to be held!
+static size_t *PagingWalk(uint64_t *pagedir, uint64_t virt_addr, bool create) {
+  size_t *pde = PagingWalkDirectory(pagedir, virt_addr, create);
+  if (!pde)
+    return 0;
+
+  if (!(*pde & PF_PRESENT)) {
+    if (!create)
+      return 0;
+    size_t target = PagingPhysAllocate();
+    *pde = target | PF_PRESENT | PF_RW | PF_USER;
+  } else if (*pde & PF_PS)
+    PagingSplitLarge(pagedir, pde, virt_addr);
+  size_t *pt = (size_t *)(PTE_GET_ADDR(*pde) + HHDMoffset);
+
+  return &pt[PTE(AMD64_MM_STRIPSX(virt_addr))];
+}
+
+// Same as VirtualMapL(), but expects WLOCK_PAGING to be held!
+static void VirtualMapLUnsafe(uint64_t *pagedir, uint64_t virt_addr,
+                              uint64_t phys_addr, uint64_t flags) {
+  size_t *pte = PagingWalk(pagedir, virt_addr, true);
+
+  // frames are refcounted, the framebuffer & such aren't (see pmm.c)
+  bool present = *pte & PF_PRESENT;
+  if (present)
+    PhysicalDereference(PTE_GET_ADDR(*pte));
   if (!phys_addr) // todo: proper unmapping
-    pt[pt_index] = 0;
+    *pte = 0;
   else
-    pt[pt_index] = (P_PHYS_ADDR(phys_addr)) | PF_PRESENT | flags;
+    *pte = (P_PHYS_ADDR(phys_addr)) | PF_PRESENT | flags;
 
-  invalidate(virt_addr);
-  spinlockCntWriteRelease(&WLOCK_PAGING);
+  // non-present entries never make it onto the TLB
+  if (present)
+    PagingInvalidate(pagedir, virt_addr);
+}
+
+void VirtualMapL(uint64_t *restrict pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                 uint64_t flags) {
+  if (virt_addr % PAGE_SIZE) {
+    debugf("[paging] Tried to map non-aligned address! virt{%lx} phys{%lx}\n",
+           virt_addr, phys_addr);
+    panic();
+  }
+
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  VirtualMapLUnsafe(pagedir, virt_addr, phys_addr, flags);
+  rwlockWriteRelease(&WLOCK_PAGING);
 #if ELF_DEBUG
   debugf("[paging] Mapped virt{%lx} to phys{%lx}\n", virt_addr, phys_addr);
 #endif
 }
 
+// Same as VirtualMapLargeL(), but expects WLOCK_PAGING to be held!
+static void VirtualMapLargeLUnsafe(uint64_t *pagedir, uint64_t virt_addr,
+                                   uint64_t phys_addr, uint64_t flags) {
+  size_t *pde = PagingWalkDirectory(pagedir, virt_addr, true);
+
+  // whatever used to be there gets dropped, page table included
+  size_t table = 0;
+  if (*pde & PF_PRESENT && *pde & PF_PS)
+    PagingDropLarge(*pde);
+  else if (*pde & PF_PRESENT) {
+    table = PTE_GET_ADDR(*pde);
+    size_t *pt = (size_t *)(table + HHDMoffset);
+    for (size_t i = 0; i < PAGES_PER_LARGE; i++) {
+      if (pt[i] & PF_PRESENT)
+        PhysicalDereference(PTE_GET_ADDR(pt[i]));
+    }
+  }
+
+  if (flags & PF_PAT)
+    flags = (flags & ~PF_PAT) | PF_PAT_LARGE;
+  if (!phys_addr)
+    *pde = 0;
+  else
+    *pde = (phys_addr & PTE_LARGE_ADDR_MASK) | PF_PRESENT | PF_PS | flags;
+
+  if (table) {
+    for (size_t i = 0; i < PAGES_PER_LARGE; i++)
+      PagingInvalidateLocal(pagedir, virt_addr + i * PAGE_SIZE);
+    PagingShootdown(pagedir, PagingKernelHalf(virt_addr), 0, 0);
+    PhysicalDereference(table);
+  } else
+    PagingInvalidate(pagedir, virt_addr);
+}
+
+// Maps a single 2MiB page, both addresses need to be aligned accordingly
+void VirtualMapLargeL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                      uint64_t flags) {
+  if (virt_addr % PAGE_SIZE_LARGE || phys_addr % PAGE_SIZE_LARGE) {
+    debugf("[paging] Tried to map non-aligned large page! virt{%lx} "
+           "phys{%lx}\n",
+           virt_addr, phys_addr);
+    panic();
+  }
+
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  VirtualMapLargeLUnsafe(pagedir, virt_addr, phys_addr, flags);
+  rwlockWriteRelease(&WLOCK_PAGING);
+}
+
+void VirtualMapLarge(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+  VirtualMapLargeL(globalPagedir, virt_addr, phys_addr, flags);
+}
+
+// Whether nothing at all is mapped in the 2MiB window of virt_addr
+bool VirtualLargeVacantL(uint64_t *pagedir, uint64_t virt_addr) {
+  rwlockReadAcquire(&WLOCK_PAGING);
+  size_t *pde = PagingWalkDirectory(pagedir, virt_addr, false);
+  bool    ret = !pde || !(*pde & PF_PRESENT);
+  rwlockReadRelease(&WLOCK_PAGING);
+  return ret;
+}
+
+// Like VirtualMapLargeL(), but gives up if anything is already mapped inside
+// the window instead of replacing it
+bool VirtualMapLargeTryL(uint64_t *pagedir, uint64_t virt_addr,
+                         uint64_t phys_addr, uint64_t flags) {
+  if (virt_addr % PAGE_SIZE_LARGE || phys_addr % PAGE_SIZE_LARGE)
+    return false;
+
+  bool ret = false;
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  size_t *pde = PagingWalkDirectory(pagedir, virt_addr, true);
+  if (!(*pde & PF_PRESENT)) {
+    VirtualMapLargeLUnsafe(pagedir, virt_addr, phys_addr, flags);
+    ret = true;
+  }
+  rwlockWriteRelease(&WLOCK_PAGING);
+  return ret;
+}
+
+// Range operations walk the tables once per 2MiB window (reusing the page table
+// in between) under a single lock, and batch their TLB invalidations up to a
+// point after which a full flush (CR3 reload) becomes cheaper
+#define PAGING_FLUSH_BATCH 32
+
+typedef struct PagingRange {
+  uint64_t *pagedir;
+  size_t    window; // 2MiB window of the cached page table
+  size_t   *pt;
+
+  size_t   flushCnt;
+  uint64_t flush[PAGING_FLUSH_BATCH];
+  bool     flushAll;
+  bool     kernel; // kernel half addresses were flushed
+} PagingRange;
+
+static void PagingRangeInvalidate(PagingRange *range, uint64_t virt_addr) {
+  // global entries survive full flushes, so those can't wait (locally, other
+  // CPUs get theirs in PagingRangeFlush())
+  if (PagingKernelHalf(virt_addr)) {
+    invalidate(virt_addr);
+    range->kernel = true;
+  }
+  if (range->flushCnt < PAGING_FLUSH_BATCH)
+    range->flush[range->flushCnt++] = virt_addr;
+  else
+    range->flushAll = true;
+}
+
+static void PagingRangeFlush(PagingRange *range) {
+  if (!range->flushCnt)
+    return;
+
+  // kernel half ones were dropped locally as they came
+  if (!range->kernel) {
+    if (range->pagedir != globalPagedir)
+      PagingPcidStale(range->pagedir);
+    else if (range->flushAll)
+      asm volatile("movq %%cr3, %%rax; movq %%rax, %%cr3" ::: "rax", "memory");
+    else {
+      for (size_t i = 0; i < range->flushCnt; i++)
+        invalidate(range->flush[i]);
+    }
+  }
+
+  PagingShootdown(range->pagedir, range->kernel,
+                  range->flushAll ? 0 : range->flush, range->flushCnt);
+}
+
+static size_t *PagingRangeWalk(PagingRange *range, uint64_t virt_addr,
+                               bool create) {
+  size_t window = AMD64_MM_STRIPSX(virt_addr) / PAGE_SIZE_LARGE;
+  if (!range->pt || range->window != window) {
+    size_t *pte = PagingWalk(range->pagedir, virt_addr, create);
+    if (!pte) {
+      range->pt = 0;
+      return 0;
+    }
+    range->pt = pte - PTE(AMD64_MM_STRIPSX(virt_addr));
+    range->window = window;
+  }
+  return &range->pt[PTE(AMD64_MM_STRIPSX(virt_addr))];
+}
+
+// Maps a physically contiguous region, using 2MiB pages wherever both
+// addresses line up
+void VirtualMapRegionL(uint64_t *pagedir, uint64_t virt_addr,
+                       uint64_t phys_addr, uint64_t length, uint64_t flags) {
+  PagingRange range = {.pagedir = pagedir};
+  uint64_t    end = virt_addr + DivRoundUp(length, PAGE_SIZE) * PAGE_SIZE;
+  bool large = (virt_addr % PAGE_SIZE_LARGE) == (phys_addr % PAGE_SIZE_LARGE);
+
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  while (virt_addr < end) {
+    if (large && !(virt_addr % PAGE_SIZE_LARGE) &&
+        (end - virt_addr) >= PAGE_SIZE_LARGE) {
+      VirtualMapLargeLUnsafe(pagedir, virt_addr, phys_addr, flags);
+      range.pt = 0;
+      virt_addr += PAGE_SIZE_LARGE;
+      phys_addr += PAGE_SIZE_LARGE;
+      continue;
+    }
+
+    size_t *pte = PagingRangeWalk(&range, virt_addr, true);
+    if (*pte & PF_PRESENT) {
+      PhysicalDereference(PTE_GET_ADDR(*pte));
+      PagingRangeInvalidate(&range, virt_addr);
+    }
+    *pte = P_PHYS_ADDR(phys_addr) | PF_PRESENT | flags;
+    virt_addr += PAGE_SIZE;
+    phys_addr += PAGE_SIZE;
+  }
+  PagingRangeFlush(&range);
+  rwlockWriteRelease(&WLOCK_PAGING);
+}
+
+// Backs every page of the region that isn't mapped yet with a fresh, zeroed
+// pageframe (ELF segments, stacks and such)
+void VirtualPopulateRegionL(uint64_t *pagedir, uint64_t virt_addr,
+                            uint64_t length, uint64_t flags) {
+  PagingRange range = {.pagedir = pagedir};
+  uint64_t    end = virt_addr + length;
+  virt_addr &= ~0xFFF;
+
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  for (; virt_addr < end; virt_addr += PAGE_SIZE) {
+    size_t *pte = PagingRangeWalk(&range, virt_addr, true);
+    if (*pte & PF_PRESENT)
+      continue;
+    *pte = PhysicalAllocateZeroed(1) | PF_PRESENT | flags;
+  }
+  rwlockWriteRelease(&WLOCK_PAGING);
+}
+
+// Drops every mapping inside the region, whole 2MiB pages included. Walks down
+// once per 2MiB window & goes through its page table directly from there
+void VirtualUnmapRegionL(uint64_t *pagedir, uint64_t virt_addr,
+                         uint64_t length) {
+  PagingRange range = {.pagedir = pagedir};
+  uint64_t    end = virt_addr + length;
+  virt_addr &= ~0xFFF;
+
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  while (virt_addr < end) {
+    uint64_t windowEnd = (virt_addr & ~(PAGE_SIZE_LARGE - 1)) + PAGE_SIZE_LARGE;
+    size_t  *pde = PagingWalkDirectory(pagedir, virt_addr, false);
+    if (!pde || !(*pde & PF_PRESENT)) {
+      virt_addr = windowEnd; // nothing in this entire window
+      continue;
+    }
+
+    bool whole = !(virt_addr % PAGE_SIZE_LARGE) &&
+                 (end - virt_addr) >= PAGE_SIZE_LARGE;
+    if (whole && *pde & PF_PS) {
+      PagingDropLarge(*pde);
+      *pde = 0;
+      PagingRangeInvalidate(&range, virt_addr);
+      virt_addr = windowEnd;
+      continue;
+    }
+
+    // emptied page tables get reclaimed (but never the kernel's shared ones)
+    if (whole && PML4E(AMD64_MM_STRIPSX(virt_addr)) < PML4E_USER_END) {
+      PagingFreeTable(*pde);
+      *pde = 0;
+      PagingRangeInvalidate(&range, virt_addr);
+      virt_addr = windowEnd;
+      continue;
+    }
+
+    // (partially covered 2MiB pages get split here)
+    if (*pde & PF_PS)
+      PagingSplitLarge(pagedir, pde, virt_addr);
+    size_t  *pt = (size_t *)(PTE_GET_ADDR(*pde) + HHDMoffset);
+    uint64_t until = MIN(end, windowEnd);
+    for (; virt_addr < until; virt_addr += PAGE_SIZE) {
+      size_t *pte = &pt[PTE(AMD64_MM_STRIPSX(virt_addr))];
+      if (!(*pte & PF_PRESENT))
+        continue;
+      PhysicalDereference(PTE_GET_ADDR(*pte));
+      *pte = 0;
+      PagingRangeInvalidate(&range, virt_addr);
+    }
+  }
+  PagingRangeFlush(&range);
+  rwlockWriteRelease(&WLOCK_PAGING);
+}
+
+// Applies new permissions onto an existing userland entry. Frames that are
+// still referenced elsewhere (fork, page cache) can only become copy-on-write.
+static size_t PagingProtectEntry(size_t entry, size_t phys, uint64_t flags) {
+  entry &= ~(PF_RW | PF_USER | PF_COW | PF_PROTNONE);
+  if (!(flags & PF_USER))
+    return entry | PF_PROTNONE;
+
+  entry |= PF_USER;
+  if (flags & PF_RW) {
+    if (!(entry & PF_SHARED) && PhysicalReferenceCount(phys) > 1)
+      entry |= PF_COW;
+    else
+      entry |= PF_RW;
+  }
+  return entry;
+}
+
+// Changes the permissions of everything mapped inside the region (mprotect)
+void VirtualProtectRegionL(uint64_t *pagedir, uint64_t virt_addr,
+                           uint64_t length, uint64_t flags) {
+  PagingRange range = {.pagedir = pagedir};
+  uint64_t    end = virt_addr + length;
+  virt_addr &= ~0xFFF;
+
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  while (virt_addr < end) {
+    uint64_t windowEnd = (virt_addr & ~(PAGE_SIZE_LARGE - 1)) + PAGE_SIZE_LARGE;
+    size_t  *pde = PagingWalkDirectory(pagedir, virt_addr, false);
+    if (!pde || !(*pde & PF_PRESENT)) {
+      virt_addr = windowEnd;
+      continue;
+    }
+
+    if (*pde & PF_PS && !(virt_addr % PAGE_SIZE_LARGE) &&
+        (end - virt_addr) >= PAGE_SIZE_LARGE) {
+      *pde = PagingProtectEntry(*pde, *pde & PTE_LARGE_ADDR_MASK, flags);
+      PagingRangeInvalidate(&range, virt_addr);
+      virt_addr = windowEnd;
+      continue;
+    }
+
+    // same as unmapping, once per window
+    if (*pde & PF_PS)
+      PagingSplitLarge(pagedir, pde, virt_addr);
+    size_t  *pt = (size_t *)(PTE_GET_ADDR(*pde) + HHDMoffset);
+    uint64_t until = MIN(end, windowEnd);
+    for (; virt_addr < until; virt_addr += PAGE_SIZE) {
+      size_t *pte = &pt[PTE(AMD64_MM_STRIPSX(virt_addr))];
+      if (!(*pte & PF_PRESENT))
+        continue;
+      *pte = PagingProtectEntry(*pte, PTE_GET_ADDR(*pte), flags);
+      PagingRangeInvalidate(&range, virt_addr);
+    }
+  }
+  PagingRangeFlush(&range);
+  rwlockWriteRelease(&WLOCK_PAGING);
+}
+
 // todo: maybe use atomic operations here since it's called from volatile
 // contexts (id est. scheduler or signal returns)
 size_t VirtualToPhysicalL(uint64_t *pagedir, size_t virt_addr) {
@@ -239,37 +902,33 @@ size_t VirtualToPhysicalL(uint64_t *pagedir, size_t virt_addr) {
   uint32_t pd_index = PDE(virt_addr);
   uint32_t pt_index = PTE(virt_addr);
 
-  // spinlockCntReadAcquire(&WLOCK_PAGING);
+  // rwlockReadAcquire(&WLOCK_PAGING);
   if (!(pagedir[pml4_index] & PF_PRESENT))
     goto error;
-  /*else if (pagedir[pml4_index] & PF_PRESENT &&
-           pagedir[pml4_index] & PF_PS)
-    return (void *)(PTE_GET_ADDR(pagedir[pml4_index] +
-                                 (virt_addr & PAGE_MASK(12 + 9 + 9 + 9))));*/
   size_t *pdp = (size_t *)(PTE_GET_ADDR(pagedir[pml4_index]) + HHDMoffset);
 
   if (!(pdp[pdp_index] & PF_PRESENT))
     goto error;
-  /*else if (pdp[pdp_index] & PF_PRESENT && pdp[pdp_index] & PF_PS)
-    return (void *)(PTE_GET_ADDR(pdp[pdp_index] +
-                                 (virt_addr & PAGE_MASK(12 + 9 + 9))));*/
+  else if (pdp[pdp_index] & PF_PS)
+    return (pdp[pdp_index] & PTE_HUGE_ADDR_MASK) +
+           (virt_addr_init & (PAGE_SIZE_HUGE - 1));
   size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
 
   if (!(pd[pd_index] & PF_PRESENT))
     goto error;
-  /*else if (pd[pd_index] & PF_PRESENT && pd[pd_index] & PF_PS)
-    return (
-        void *)(PTE_GET_ADDR(pd[pd_index] + (virt_addr & PAGE_MASK(12 + 9))));*/
+  else if (pd[pd_index] & PF_PS)
+    return (pd[pd_index] & PTE_LARGE_ADDR_MASK) +
+           (virt_addr_init & (PAGE_SIZE_LARGE - 1));
   size_t *pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
 
   if (pt[pt_index] & PF_PRESENT) {
-    // spinlockCntReadRelease(&WLOCK_PAGING);
+    // rwlockReadRelease(&WLOCK_PAGING);
     return (size_t)(PTE_GET_ADDR(pt[pt_index]) +
                     ((size_t)virt_addr_init & 0xFFF));
   }
 
 error:
-  // spinlockCntReadRelease(&WLOCK_PAGING);
+  // rwlockReadRelease(&WLOCK_PAGING);
   return 0;
 }
 
@@ -277,6 +936,64 @@ size_t VirtualToPhysical(size_t virt_addr) {
   return VirtualToPhysicalL(globalPagedir, virt_addr);
 }
 
+// Gives the page behind a copy-on-write entry its own frame (or just takes it
+// over if nobody else is using it anymore). Expects WLOCK_PAGING to be held!
+static void VirtualCowBreak(uint64_t *pagedir, size_t *pte, size_t virt_addr) {
+  size_t phys = PTE_GET_ADDR(*pte);
+  uint64_t flags = PTE_GET_FLAGS(*pte) & ~(PF_COW | PF_ACCESS | PF_DIRTY);
+
+  if (PhysicalReferenceCount(phys) > 1) {
+    size_t copy = PhysicalAllocate(1);
+    memcpy((void *)(copy + HHDMoffset), (void *)(phys + HHDMoffset), PAGE_SIZE);
+    PhysicalDereference(phys);
+    phys = copy;
+  }
+
+  *pte = phys | flags | PF_RW;
+  PagingInvalidate(pagedir, virt_addr & ~0xFFF);
+}
+
+// For when the kernel writes onto userland memory through the HHDM instead of
+// the task's own mappings (signal frames and such)
+size_t VirtualToPhysicalWritableL(uint64_t *pagedir, size_t virt_addr) {
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  size_t *pde = PagingWalkDirectory(pagedir, virt_addr, false);
+  size_t *pte = 0;
+  size_t  ret = 0;
+  if (pde && *pde & PF_PRESENT && *pde & PF_PS && !(*pde & PF_COW))
+    ret = (*pde & PTE_LARGE_ADDR_MASK) + (virt_addr & (PAGE_SIZE_LARGE - 1));
+  else if (pde && *pde & PF_PRESENT) // copy-on-write large pages get split
+    pte = PagingWalk(pagedir, virt_addr & ~0xFFF, false);
+
+  if (pte && *pte & PF_PRESENT) {
+    if (*pte & PF_COW)
+      VirtualCowBreak(pagedir, pte, virt_addr);
+    ret = PTE_GET_ADDR(*pte) + (virt_addr & 0xFFF);
+  }
+  rwlockWriteRelease(&WLOCK_PAGING);
+  return ret;
+}
+
+// Called on page faults; returns true if the fault got resolved and execution
+// can resume normally
+bool VirtualHandleFault(uint64_t *pagedir, size_t virt_addr, uint64_t error) {
+  if (!(error & PFERR_PRESENT) || !(error & PFERR_WRITE))
+    return false;
+
+  bool ret = false;
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  size_t *pde = PagingWalkDirectory(pagedir, virt_addr, false);
+  size_t *pte = 0;
+  if (pde && *pde & PF_PRESENT && (!(*pde & PF_PS) || *pde & PF_COW))
+    pte = PagingWalk(pagedir, virt_addr & ~0xFFF, false);
+  if (pte && *pte & PF_PRESENT && *pte & PF_COW) {
+    VirtualCowBreak(pagedir, pte, virt_addr);
+    ret = true;
+  }
+  rwlockWriteRelease(&WLOCK_PAGING);
+  return ret;
+}
+
 uint32_t VirtualUnmap(uint32_t virt_addr) {
   // not really used anywhere atm, sooooo idc
   return 0;
@@ -287,24 +1004,25 @@ uint64_t *PageDirectoryAllocate() {
     debugf("[paging] FATAL! Tried to allocate pd without tasks initiated!\n");
     panic();
   }
-  uint64_t *out = VirtualAllocate(1);
-
-  memset(out, 0, PAGE_SIZE);
+  uint64_t *out = VirtualAllocateZeroed(1);
 
+  // userland's half starts out empty & stays private (see PageDirectoryFree())
   uint64_t *model = GetTaskPageDirectory(taskGet(KERNEL_TASK_ID));
-  for (int i = 0; i < 512; i++)
+  for (int i = PML4E_USER_END; i < 512; i++)
     out[i] = model[i];
 
+  PagingPcidAllocate(out);
   return out;
 }
 
-// todo: clear orphans after a whole page level is emptied!
-// destroys any userland stuff on the page directory
+// Tears down the userland half of a page directory: every mapping, the page
+// tables below it (bottom-up) & finally the directory itself. The kernel half
+// is shared with everyone else and left alone.
 void PageDirectoryFree(uint64_t *page_dir) {
-  spinlockCntWriteAcquire(&WLOCK_PAGING);
+  rwlockWriteAcquire(&WLOCK_PAGING);
 
-  for (int pml4_index = 0; pml4_index < 512; pml4_index++) {
-    if (!(page_dir[pml4_index] & PF_PRESENT) || page_dir[pml4_index] & PF_PS)
+  for (int pml4_index = 0; pml4_index < PML4E_USER_END; pml4_index++) {
+    if (!(page_dir[pml4_index] & PF_PRESENT))
       continue;
     size_t *pdp = (size_t *)(PTE_GET_ADDR(page_dir[pml4_index]) + HHDMoffset);
 
@@ -314,32 +1032,48 @@ void PageDirectoryFree(uint64_t *page_dir) {
       size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
 
       for (int pd_index = 0; pd_index < 512; pd_index++) {
-        if (!(pd[pd_index] & PF_PRESENT) || pd[pd_index] & PF_PS)
+        if (!(pd[pd_index] & PF_PRESENT))
+          continue;
+        if (pd[pd_index] & PF_PS) {
+          if (pd[pd_index] & (PF_USER | PF_PROTNONE))
+            PagingDropLarge(pd[pd_index]);
           continue;
-        size_t *pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
-
-        for (int pt_index = 0; pt_index < 512; pt_index++) {
-          if (!(pt[pt_index] & PF_PRESENT) || pt[pt_index] & PF_PS)
-            continue;
-
-          // we only free mappings related to userland (ones from ELF)
-          if (!(pt[pt_index] & PF_USER))
-            continue;
-
-          uint64_t phys = PTE_GET_ADDR(pt[pt_index]);
-          PhysicalFree(phys, 1);
-          pt[pt_index] = 0;
         }
+        PagingFreeTable(pd[pd_index]);
       }
+      PhysicalFree(PTE_GET_ADDR(pdp[pdp_index]), 1);
     }
+    PhysicalFree(PTE_GET_ADDR(page_dir[pml4_index]), 1);
+    page_dir[pml4_index] = 0;
   }
 
-  spinlockCntWriteRelease(&WLOCK_PAGING);
+  rwlockWriteRelease(&WLOCK_PAGING);
+  PagingPcidFree(page_dir);
+  VirtualFree(page_dir, 1);
+}
+
+// Shares a userland 2MiB page, the same way PageDirectoryUserDuplicate() does
+// for normal ones. It only gets split once written to.
+static void PageDirectoryDuplicateLarge(size_t *pde, uint64_t *target,
+                                        size_t virt) {
+  size_t phys = *pde & PTE_LARGE_ADDR_MASK;
+  if (!(*pde & PF_SHARED) && *pde & PF_RW && PhysicalReferenceCount(phys))
+    *pde = (*pde & ~PF_RW) | PF_COW;
+
+  for (size_t i = 0; i < PAGES_PER_LARGE; i++)
+    PhysicalReference(phys + i * PAGE_SIZE);
+
+  uint64_t flags =
+      PagingLargeFlags(*pde) & ~(PF_PRESENT | PF_ACCESS | PF_DIRTY);
+  VirtualMapLargeLUnsafe(target, virt, phys, flags);
 }
 
+// Userland pages are not copied, but shared between the two directories.
+// Writable ones become read-only & copy-on-write (PF_COW) on both ends, with
+// VirtualHandleFault() handing out private copies once they're written to.
 void PageDirectoryUserDuplicate(uint64_t *source, uint64_t *target) {
-  spinlockCntReadAcquire(&WLOCK_PAGING);
-  for (int pml4_index = 0; pml4_index < 512; pml4_index++) {
+  rwlockWriteAcquire(&WLOCK_PAGING);
+  for (int pml4_index = 0; pml4_index < PML4E_USER_END; pml4_index++) {
     if (!(source[pml4_index] & PF_PRESENT) || source[pml4_index] & PF_PS)
       continue;
     size_t *pdp = (size_t *)(PTE_GET_ADDR(source[pml4_index]) + HHDMoffset);
@@ -350,37 +1084,49 @@ void PageDirectoryUserDuplicate(uint64_t *source, uint64_t *target) {
       size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
 
       for (int pd_index = 0; pd_index < 512; pd_index++) {
-        if (!(pd[pd_index] & PF_PRESENT) || pd[pd_index] & PF_PS)
+        if (!(pd[pd_index] & PF_PRESENT))
           continue;
+        if (pd[pd_index] & PF_PS) {
+          if (pd[pd_index] & (PF_USER | PF_PROTNONE))
+            PageDirectoryDuplicateLarge(
+                &pd[pd_index], target,
+                BITS_TO_VIRT_ADDR(pml4_index, pdp_index, pd_index, 0));
+          continue;
+        }
         size_t *pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
 
         for (int pt_index = 0; pt_index < 512; pt_index++) {
-          if (!(pt[pt_index] & PF_PRESENT) || pt[pt_index] & PF_PS)
+          if (!(pt[pt_index] & PF_PRESENT))
             continue;
 
           // we only duplicate mappings related to userland (ones from ELF)
-          if (!(pt[pt_index] & PF_USER))
+          if (!(pt[pt_index] & (PF_USER | PF_PROTNONE)))
             continue;
 
-          size_t physSource = PTE_GET_ADDR(pt[pt_index]);
-          size_t physTarget =
-              (pt[pt_index] & PF_SHARED) ? physSource : PagingPhysAllocate();
-
+          size_t phys = PTE_GET_ADDR(pt[pt_index]);
           size_t virt =
               BITS_TO_VIRT_ADDR(pml4_index, pdp_index, pd_index, pt_index);
 
-          void *ptrSource = (void *)(physSource + HHDMoffset);
-          void *ptrTarget = (void *)(physTarget + HHDMoffset);
+          // untracked frames (framebuffer) & shared mappings stay as they are
+          if (!(pt[pt_index] & PF_SHARED) && pt[pt_index] & PF_RW &&
+              PhysicalReferenceCount(phys))
+            pt[pt_index] = (pt[pt_index] & ~PF_RW) | PF_COW;
 
-          memcpy(ptrTarget, ptrSource, PAGE_SIZE);
-
-          spinlockCntReadRelease(&WLOCK_PAGING);
-          VirtualMapL(target, virt, physTarget, PF_RW | PF_USER);
-          spinlockCntReadAcquire(&WLOCK_PAGING);
+          uint64_t flags = PTE_GET_FLAGS(pt[pt_index]) &
+                           ~(PF_PRESENT | PF_ACCESS | PF_DIRTY);
+          PhysicalReference(phys);
+          VirtualMapLUnsafe(target, virt, phys, flags);
         }
       }
     }
   }
 
-  spinlockCntReadRelease(&WLOCK_PAGING);
+  // source's entries lost their write permissions
+  if (source == globalPagedir)
+    asm volatile("movq %%cr3, %%rax; movq %%rax, %%cr3" ::: "rax", "memory");
+  else
+    PagingPcidStale(source);
+  PagingShootdown(source, false, 0, 0);
+
+  rwlockWriteRelease(&WLOCK_PAGING);
 }
@@ -1,4 +1,5 @@
 #include <bootloader.h>
+#include <caching.h>
 #include <paging.h>
 #include <pmm.h>
 #include <system.h>
@@ -8,63 +9,263 @@
 // Physical memory space manager/allocator
 // Copyright (C) 2024 Panagiotis
 
+// Binary buddy allocator. Every pageframe has a PhysicalFrame entry; free
+// blocks are linked by the entry of their first pageframe, which also stores
+// the block's order. A block's buddy is found by flipping the order bit of its
+// pageframe number, which makes allocation, freeing and coalescing O(log n).
+
+Spinlock LOCK_PMM = ATOMIC_FLAG_INIT;
+
+static size_t PhysicalOrderOf(size_t pages) {
+  size_t order = 0;
+  while ((1UL << order) < pages)
+    order++;
+  return order;
+}
+
+static void PhysicalListPush(size_t frame, size_t order) {
+  PhysicalFrame *entry = &physical.frames[frame];
+  entry->order = order + 1;
+  entry->prev = PMM_NONE;
+  entry->next = physical.freeLists[order];
+  if (entry->next != PMM_NONE)
+    physical.frames[entry->next].prev = frame;
+  physical.freeLists[order] = frame;
+  physical.freeBlocks[order]++;
+}
+
+static void PhysicalListRemove(size_t frame, size_t order) {
+  PhysicalFrame *entry = &physical.frames[frame];
+  if (entry->prev != PMM_NONE)
+    physical.frames[entry->prev].next = entry->next;
+  else
+    physical.freeLists[order] = entry->next;
+  if (entry->next != PMM_NONE)
+    physical.frames[entry->next].prev = entry->prev;
+  entry->order = 0;
+  physical.freeBlocks[order]--;
+}
+
+// Puts an aligned block back, merging it with its buddy for as long as the
+// latter is free as a whole
+static void PhysicalFreeBlock(size_t frame, size_t order) {
+  while (order < PMM_MAX_ORDER - 1) {
+    size_t buddy = frame ^ (1UL << order);
+    if (buddy >= physical.framesCnt ||
+        physical.frames[buddy].order != order + 1)
+      break;
+    PhysicalListRemove(buddy, order);
+    frame &= ~(1UL << order);
+    order++;
+  }
+  PhysicalListPush(frame, order);
+}
+
+// Frees an arbitrary range by splitting it into the biggest aligned blocks
+static void PhysicalFreeRange(size_t frame, size_t count) {
+  physical.freeFrames += count;
+  while (count) {
+    size_t order = 0;
+    while (order < PMM_MAX_ORDER - 1 && !(frame & ((2UL << order) - 1)) &&
+           (2UL << order) <= count)
+      order++;
+    PhysicalFreeBlock(frame, order);
+    frame += 1UL << order;
+    count -= 1UL << order;
+  }
+}
+
+// Looks through the first few free blocks of every order from the requested
+// one on, for one that PhysicalScrub() has already gone over
+static size_t PhysicalFindZeroed(size_t order, size_t *found) {
+  size_t scanned = 0;
+  for (size_t current = order; current < PMM_MAX_ORDER; current++) {
+    size_t frame = physical.freeLists[current];
+    while (frame != PMM_NONE && scanned++ < PMM_ZEROED_SCAN) {
+      if (physical.frames[frame].flags & PMM_FRAME_ZEROED) {
+        *found = current;
+        return frame;
+      }
+      frame = physical.frames[frame].next;
+    }
+    if (scanned >= PMM_ZEROED_SCAN)
+      break;
+  }
+  return PMM_NONE;
+}
+
+// Takes a block of the requested order, splitting bigger ones when needed.
+// When the contents are to be zeroed, already zeroed blocks are preferred.
+static size_t PhysicalAllocateBlock(size_t order, bool zeroed) {
+  size_t current = order;
+  size_t frame = zeroed && physical.zeroedFrames
+                     ? PhysicalFindZeroed(order, &current)
+                     : PMM_NONE;
+  if (frame == PMM_NONE) {
+    current = order;
+    while (current < PMM_MAX_ORDER && physical.freeLists[current] == PMM_NONE)
+      current++;
+    if (current >= PMM_MAX_ORDER)
+      return PMM_NONE;
+    frame = physical.freeLists[current];
+  }
+
+  PhysicalListRemove(frame, current);
+  while (current > order) {
+    current--;
+    PhysicalListPush(frame + (1UL << current), current);
+  }
+
+  physical.freeFrames -= 1UL << order;
+  return frame;
+}
+
 void initiatePMM() {
-  DS_Bitmap *bitmap = &physical; // pointer to pmm bitmap (used later)
-  bitmap->ready = false;         // for bitmap dependency of vmm
+  physical.ready = false; // for pmm dependency of vmm
+
+  // the metadata array has to cover the highest usable address
+  size_t highest = 0;
+  for (int i = 0; i < bootloader.mmEntryCnt; i++) {
+    struct limine_memmap_entry *entry = bootloader.mmEntries[i];
+    if (entry->type == LIMINE_MEMMAP_USABLE)
+      highest = MAX(highest, entry->base + entry->length);
+  }
 
-  physical.BitmapSizeInBlocks = DivRoundUp(bootloader.mmTotal, BLOCK_SIZE);
-  physical.BitmapSizeInBytes = DivRoundUp(physical.BitmapSizeInBlocks, 8);
+  physical.framesCnt = highest / BLOCK_SIZE;
+  size_t metadataSize =
+      DivRoundUp(physical.framesCnt * sizeof(PhysicalFrame), BLOCK_SIZE) *
+      BLOCK_SIZE;
 
   struct limine_memmap_entry *mm = 0;
 
   for (int i = 0; i < bootloader.mmEntryCnt; i++) {
     struct limine_memmap_entry *entry = bootloader.mmEntries[i];
-    if (entry->type != LIMINE_MEMMAP_USABLE ||
-        entry->length < physical.BitmapSizeInBytes)
+    if (entry->type != LIMINE_MEMMAP_USABLE || entry->length < metadataSize)
       continue;
     mm = entry;
     break;
   }
 
-  if (!mm) {
-    debugf("[pmm] Not enough memory: required{%lx}!\n",
-           physical.BitmapSizeInBytes);
+  if (!mm || physical.framesCnt >= PMM_NONE) {
+    debugf("[pmm] Not enough memory: required{%lx}!\n", metadataSize);
     panic();
     return;
   }
 
-  size_t bitmapStartPhys = mm->base;
-  physical.Bitmap = (uint8_t *)(bitmapStartPhys + bootloader.hhdmOffset);
-
-  memset(physical.Bitmap, 0xff, physical.BitmapSizeInBytes);
-  for (int i = 0; i < bootloader.mmEntryCnt; i++) {
-    struct limine_memmap_entry *entry = bootloader.mmEntries[i];
-    if (entry->type == LIMINE_MEMMAP_USABLE)
-      MarkRegion(bitmap, (void *)entry->base, entry->length, 0);
+  physical.frames = (PhysicalFrame *)(mm->base + bootloader.hhdmOffset);
+  memset(physical.frames, 0, physical.framesCnt * sizeof(PhysicalFrame));
+  for (int i = 0; i < PMM_MAX_ORDER; i++) {
+    physical.freeLists[i] = PMM_NONE;
+    physical.freeBlocks[i] = 0;
   }
+
+  physical.usableFrames = 0;
+  physical.freeFrames = 0;
+  physical.zeroedFrames = 0;
+  physical.scrubCursor = 0;
   for (int i = 0; i < bootloader.mmEntryCnt; i++) {
     struct limine_memmap_entry *entry = bootloader.mmEntries[i];
     if (entry->type != LIMINE_MEMMAP_USABLE)
-      MarkRegion(bitmap, (void *)entry->base, entry->length, 1);
+      continue;
+
+    size_t start = DivRoundUp(entry->base, BLOCK_SIZE);
+    size_t end = (entry->base + entry->length) / BLOCK_SIZE;
+    if (entry == mm)
+      start += metadataSize / BLOCK_SIZE;
+    if (!start)
+      start++; // a physical address of 0 means failure
+    if (end <= start)
+      continue;
+
+    PhysicalFreeRange(start, end - start);
+    physical.usableFrames += end - start;
   }
 
-  MarkRegion(bitmap, (void *)bitmapStartPhys, physical.BitmapSizeInBytes, 1);
-  physical.allocatedSizeInBlocks = 0;
+  physical.lowFrames = MAX(physical.usableFrames / PMM_WATERMARK_LOW_DIV,
+                           PMM_WATERMARK_LOW_MIN);
+  physical.highFrames = physical.lowFrames * 2;
 
-  debugf("[pmm] Bitmap initiated: bitmapStartPhys{0x%lx} size{%lx}\n",
-         bitmapStartPhys, physical.BitmapSizeInBytes);
+  debugf("[pmm] Buddy allocator initiated: metadataPhys{0x%lx} size{%lx} "
+         "free{%ld}\n",
+         mm->base, metadataSize, physical.freeFrames);
 
-  // BitmapDumpBlocks(bitmap);
-  bitmap->ready = true;
+  // PhysicalDump();
+  physical.ready = true;
 }
 
-Spinlock LOCK_PMM = ATOMIC_FLAG_INIT;
+// Common path of every allocation. When asked to, fills the pageframes with
+// zeroes (skipping the ones PhysicalScrub() got to first). Either way, they
+// lose PMM_FRAME_ZEROED on their way out, as the flag only concerns free ones.
+// Unless told otherwise, cached file data gets reclaimed when running low.
+static size_t PhysicalAllocateFrames(int pages, bool zeroed, bool reclaim) {
+  size_t order = PhysicalOrderOf(pages);
+  if (order >= PMM_MAX_ORDER)
+    return 0;
 
-size_t PhysicalAllocate(int pages) {
+  if (reclaim && physical.freeFrames < physical.lowFrames + (1UL << order))
+    cachingReclaim(CACHING_RECLAIM_BATCH);
+
+  size_t busy = 0;
   spinlockAcquire(&LOCK_PMM);
-  size_t phys = (size_t)BitmapAllocate(&physical, pages);
+  size_t frame = PhysicalAllocateBlock(order, zeroed);
+  while (frame == PMM_NONE) {
+    spinlockRelease(&LOCK_PMM);
+    if (!reclaim)
+      return 0;
+
+    size_t freed = cachingReclaim(1UL << order);
+    if (freed == CACHING_RECLAIM_BUSY) {
+      // kswapd (or another allocation) is already on it, so whatever it frees
+      // up might as well be ours. Bounded, in case it's our caller after all
+      if (++busy > PMM_RECLAIM_RETRIES)
+        return 0;
+      if (checkInterrupts())
+        handControl();
+      else
+        asm volatile("pause");
+    } else if (!freed)
+      return 0;
+
+    spinlockAcquire(&LOCK_PMM);
+    frame = PhysicalAllocateBlock(order, zeroed);
+  }
+
+  // hand the unused tail of the block back
+  if ((1UL << order) > (size_t)pages)
+    PhysicalFreeRange(frame + pages, (1UL << order) - pages);
+
+  size_t ready = 0;
+  for (int i = 0; i < pages; i++) {
+    if (physical.frames[frame + i].flags & PMM_FRAME_ZEROED)
+      ready++;
+  }
+  physical.zeroedFrames -= ready;
+  if (zeroed) {
+    physical.zeroedHits += ready;
+    physical.zeroedMisses += pages - ready;
+  }
   spinlockRelease(&LOCK_PMM);
 
+  // allocated pageframes aren't looked at by PhysicalScrub() anymore
+  for (int i = 0; i < pages; i++) {
+    PhysicalFrame *entry = &physical.frames[frame + i];
+    if (zeroed && !(entry->flags & PMM_FRAME_ZEROED))
+      memset((void *)((frame + i) * BLOCK_SIZE + bootloader.hhdmOffset), 0,
+             BLOCK_SIZE);
+    entry->flags &= ~PMM_FRAME_ZEROED;
+    atomicWrite16(&entry->refs, 1);
+  }
+
+  return frame * BLOCK_SIZE;
+}
+
+size_t PhysicalAllocate(int pages) {
+  if (PhysicalOrderOf(pages) >= PMM_MAX_ORDER) {
+    debugf("[pmm::alloc] Contiguous allocation too large! pages{%d}\n", pages);
+    panic();
+  }
+
+  size_t phys = PhysicalAllocateFrames(pages, false, true);
   if (!phys) {
     debugf("[vmm::alloc] Physical kernel memory ran out!\n");
     panic();
@@ -73,10 +274,132 @@ size_t PhysicalAllocate(int pages) {
   return phys;
 }
 
+// Same as PhysicalAllocate(), but returns 0 instead of panicking when there's
+// no block big enough (for opportunistic allocations). Never reclaims, so it's
+// also safe for allocators that hold their own locks while growing.
+size_t PhysicalAllocateTry(int pages) {
+  return PhysicalAllocateFrames(pages, false, false);
+}
+
+// Same as PhysicalAllocate(), but the pageframes come filled with zeroes.
+// Free blocks already zeroed by PhysicalScrub() are preferred.
+size_t PhysicalAllocateZeroed(int pages) {
+  size_t phys = PhysicalAllocateFrames(pages, true, true);
+  if (!phys) {
+    debugf("[pmm::alloc] Ran out of memory! pages{%d}\n", pages);
+    panic();
+  }
+
+  return phys;
+}
+
+// Whether the pageframe is part of a free block
+static bool PhysicalIsFree(size_t frame) {
+  for (size_t order = 0; order < PMM_MAX_ORDER; order++) {
+    size_t head = frame & ~((1UL << order) - 1);
+    if (physical.frames[head].order == order + 1)
+      return true;
+  }
+  return false;
+}
+
+// Zeroes a few free pageframes in advance, for PhysicalAllocateZeroed() to
+// pick up later. Meant for the idle task; returns false when there was
+// nothing left to do.
+bool PhysicalScrub() {
+  if (!physical.ready || physical.zeroedFrames >= physical.freeFrames)
+    return false;
+
+  // the idle task only runs when nobody else can, so it mustn't get preempted
+  // while holding the lock (others would spin on it forever)
+  asm volatile("cli");
+  if (!spinlockTryAcquire(&LOCK_PMM)) {
+    asm volatile("sti");
+    return false;
+  }
+
+  size_t zeroed = 0;
+  for (size_t i = 0; i < PMM_SCRUB_SCAN && zeroed < PMM_SCRUB_BATCH; i++) {
+    size_t         frame = physical.scrubCursor;
+    PhysicalFrame *entry = &physical.frames[frame];
+    physical.scrubCursor = (frame + 1) % physical.framesCnt;
+    if (entry->flags & PMM_FRAME_ZEROED || !PhysicalIsFree(frame))
+      continue;
+
+    memset((void *)(frame * BLOCK_SIZE + bootloader.hhdmOffset), 0,
+           BLOCK_SIZE);
+    entry->flags |= PMM_FRAME_ZEROED;
+    physical.zeroedFrames++;
+    zeroed++;
+  }
+
+  spinlockRelease(&LOCK_PMM);
+  asm volatile("sti");
+  return true;
+}
+
 void PhysicalFree(size_t ptr, int pages) {
-  // maybe verify no double-frees are occuring..
+  size_t frame = ptr / BLOCK_SIZE;
+  if (frame + pages > physical.framesCnt) {
+    debugf("[pmm::free] Out of bounds! ptr{%lx} pages{%d}\n", ptr, pages);
+    panic();
+  }
+
+  for (int i = 0; i < pages; i++)
+    atomicWrite16(&physical.frames[frame + i].refs, 0);
+
+  spinlockAcquire(&LOCK_PMM);
+  PhysicalFreeRange(frame, pages);
+  spinlockRelease(&LOCK_PMM);
+}
+
+void PhysicalDump() {
+  spinlockAcquire(&LOCK_PMM);
+  debugf("[pmm] usable{%ld} free{%ld} zeroed{%ld}\n", physical.usableFrames,
+         physical.freeFrames, physical.zeroedFrames);
+  for (int i = 0; i < PMM_MAX_ORDER; i++)
+    debugf("[pmm] order{%d} blocks{%ld}\n", i, physical.freeBlocks[i]);
+  spinlockRelease(&LOCK_PMM);
+}
+
+// Pageframe reference counting, used for frames that end up on multiple
+// address spaces (copy-on-write, shared mappings). Frames with a count of zero
+// weren't handed out by PhysicalAllocate() (framebuffer, MMIO, etc) and are
+// therefore never freed from here.
+
+static inline volatile _Atomic uint16_t *PhysicalRefsGet(size_t phys) {
+  size_t frame = phys / BLOCK_SIZE;
+  if (frame >= physical.framesCnt)
+    return 0;
+  return (volatile _Atomic uint16_t *)&physical.frames[frame].refs;
+}
+
+uint16_t PhysicalReferenceCount(size_t phys) {
+  volatile _Atomic uint16_t *refs = PhysicalRefsGet(phys);
+  return refs ? atomic_load(refs) : 0;
+}
+
+void PhysicalReference(size_t phys) {
+  volatile _Atomic uint16_t *refs = PhysicalRefsGet(phys);
+  if (!refs || !atomic_load(refs))
+    return;
+  if (atomic_fetch_add(refs, 1) == UINT16_MAX) {
+    debugf("[pmm::refs] Reference counter overflow! phys{%lx}\n", phys);
+    panic();
+  }
+}
+
+// Drops a reference, freeing the frame once nothing points to it anymore.
+// Returns whether the frame got freed.
+bool PhysicalDereference(size_t phys) {
+  volatile _Atomic uint16_t *refs = PhysicalRefsGet(phys);
+  if (!refs || !atomic_load(refs))
+    return false;
+  if (atomic_fetch_sub(refs, 1) != 1)
+    return false;
 
   spinlockAcquire(&LOCK_PMM);
-  MarkRegion(&physical, (void *)ptr, pages * BLOCK_SIZE, 0);
+  PhysicalFreeRange(phys / BLOCK_SIZE, 1);
   spinlockRelease(&LOCK_PMM);
+  return true;
 }
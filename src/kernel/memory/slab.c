@@ -0,0 +1,165 @@
+#include <paging.h>
+#include <slab.h>
+#include <system.h>
+#include <util.h>
+#include <vmm.h>
+
+// Slab allocator, object caches for frequently (de)allocated structures
+// Copyright (C) 2025 Panagiotis
+
+static size_t slabObjectsStart(SlabCache *cache) {
+  return DivRoundUp(sizeof(SlabPage), cache->align) * cache->align;
+}
+
+static void slabListPush(SlabPage **first, SlabPage *slab) {
+  slab->prev = 0;
+  slab->next = *first;
+  if (slab->next)
+    slab->next->prev = slab;
+  *first = slab;
+}
+
+static void slabListRemove(SlabPage **first, SlabPage *slab) {
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *first = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+  slab->next = 0;
+  slab->prev = 0;
+}
+
+static inline void **slabFreePointer(SlabCache *cache, void *obj) {
+  return (void **)((size_t)obj + cache->freeOffset);
+}
+
+// Figures out the slab geometry, ran once with the cache lock held
+static void slabCacheSetup(SlabCache *cache) {
+  cache->align = MAX(cache->align, 16);
+  cache->stride = DivRoundUp(cache->size, cache->align) * cache->align;
+  cache->freeOffset = 0;
+  if (cache->ctor) {
+    // constructed state has to survive, keep the free pointer out of the way
+    cache->freeOffset = cache->stride;
+    cache->stride = DivRoundUp(cache->stride + sizeof(void *), cache->align) *
+                    cache->align;
+  }
+
+  // power of two, so the buddy allocator keeps slabs naturally aligned
+  size_t start = slabObjectsStart(cache);
+  cache->pagesPerSlab = 1;
+  while (cache->pagesPerSlab * BLOCK_SIZE - start <
+         SLAB_MIN_OBJECTS * cache->stride)
+    cache->pagesPerSlab *= 2;
+  cache->objsPerSlab =
+      (cache->pagesPerSlab * BLOCK_SIZE - start) / cache->stride;
+
+  spinlockAcquire(&LOCK_SLAB_CACHES);
+  cache->next = firstSlabCache;
+  firstSlabCache = cache;
+  spinlockRelease(&LOCK_SLAB_CACHES);
+
+  cache->ready = true;
+}
+
+static SlabPage *slabGrow(SlabCache *cache) {
+  SlabPage *slab = (SlabPage *)VirtualAllocate(cache->pagesPerSlab);
+  memset(slab, 0, sizeof(SlabPage));
+  slab->cache = cache;
+
+  // thread the free list in address order
+  size_t start = (size_t)slab + slabObjectsStart(cache);
+  void **link = &slab->freelist;
+  for (size_t i = 0; i < cache->objsPerSlab; i++) {
+    void *obj = (void *)(start + i * cache->stride);
+    if (cache->ctor)
+      cache->ctor(obj);
+    *link = obj;
+    link = slabFreePointer(cache, obj);
+  }
+  *link = 0;
+
+  return slab;
+}
+
+void *slabAlloc(SlabCache *cache) {
+  spinlockAcquire(&cache->LOCK_CACHE);
+  if (!cache->ready)
+    slabCacheSetup(cache);
+
+  if (!cache->firstPartial && !cache->firstEmpty) {
+    // grown without the lock, since allocating might reclaim cached file data
+    // which in turn frees objects (maybe onto this very cache)
+    spinlockRelease(&cache->LOCK_CACHE);
+    SlabPage *fresh = slabGrow(cache);
+    spinlockAcquire(&cache->LOCK_CACHE);
+
+    slabListPush(&cache->firstEmpty, fresh);
+    cache->emptyCnt++;
+    cache->slabsCnt++;
+    cache->totalObjs += cache->objsPerSlab;
+  }
+
+  SlabPage *slab = cache->firstPartial;
+  if (!slab) {
+    slab = cache->firstEmpty;
+    slabListRemove(&cache->firstEmpty, slab);
+    cache->emptyCnt--;
+    slabListPush(&cache->firstPartial, slab);
+  }
+
+  void *obj = slab->freelist;
+  slab->freelist = *slabFreePointer(cache, obj);
+  slab->inuse++;
+  cache->activeObjs++;
+  if (slab->inuse == cache->objsPerSlab) {
+    slabListRemove(&cache->firstPartial, slab);
+    slabListPush(&cache->firstFull, slab);
+  }
+  spinlockRelease(&cache->LOCK_CACHE);
+
+  if (!cache->ctor)
+    memset(obj, 0, cache->size);
+  return obj;
+}
+
+void slabFree(SlabCache *cache, void *obj) {
+  if (!obj)
+    return;
+
+  size_t    slabSize = cache->pagesPerSlab * BLOCK_SIZE;
+  SlabPage *slab = (SlabPage *)((size_t)obj & ~(slabSize - 1));
+  if (!cache->ready || slab->cache != cache) {
+    debugf("[slab] Object doesn't belong to cache! cache{%s} obj{%lx}\n",
+           cache->name, obj);
+    panic();
+  }
+
+  SlabPage *release = 0;
+  spinlockAcquire(&cache->LOCK_CACHE);
+  *slabFreePointer(cache, obj) = slab->freelist;
+  slab->freelist = obj;
+  if (slab->inuse == cache->objsPerSlab) {
+    slabListRemove(&cache->firstFull, slab);
+    slabListPush(&cache->firstPartial, slab);
+  }
+  slab->inuse--;
+  cache->activeObjs--;
+
+  if (!slab->inuse) {
+    slabListRemove(&cache->firstPartial, slab);
+    if (cache->emptyCnt < SLAB_SPARE_EMPTY) {
+      slabListPush(&cache->firstEmpty, slab);
+      cache->emptyCnt++;
+    } else {
+      release = slab;
+      cache->slabsCnt--;
+      cache->totalObjs -= cache->objsPerSlab;
+    }
+  }
+  spinlockRelease(&cache->LOCK_CACHE);
+
+  if (release)
+    VirtualFree(release, cache->pagesPerSlab);
+}
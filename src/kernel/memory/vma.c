@@ -0,0 +1,308 @@
+#include <avl_tree.h>
+#include <bootloader.h>
+#include <linux.h>
+#include <malloc.h>
+#include <paging.h>
+#include <pmm.h>
+#include <slab.h>
+#include <system.h>
+#include <task.h>
+#include <util.h>
+#include <vma.h>
+
+// Demand-paged userland memory regions
+// Copyright (C) 2024 Panagiotis
+
+// All of these (except vmaHandleFault()) expect info->LOCK_PD to be held!
+
+#define VMA_DEBUG 0
+
+SlabCache cacheVmArea = SLAB_CACHE_INIT("vm_area", VmArea, 0);
+
+// mmap()/mprotect() protection bits to the flags pages get mapped with
+uint64_t vmaProtFlags(int prot) {
+  if (prot == PROT_NONE)
+    return 0;
+  uint64_t flags = PF_USER;
+  if (prot & PROT_WRITE)
+    flags |= PF_RW;
+  // read & execute don't have to be specified..
+  return flags;
+}
+
+VmArea *vmaFind(TaskInfoPagedir *info, size_t addr) {
+  VmArea *vma = (VmArea *)AVLLookupFloor(info->vmaTree, addr);
+  if (vma && addr < vma->end)
+    return vma;
+  return 0;
+}
+
+// The region containing addr, or the first one after it
+VmArea *vmaFirstFrom(TaskInfoPagedir *info, size_t addr) {
+  VmArea *vma = vmaFind(info, addr);
+  if (vma)
+    return vma;
+  return (VmArea *)AVLLookupCeil(info->vmaTree, addr);
+}
+
+VmArea *vmaNext(TaskInfoPagedir *info, VmArea *vma) {
+  return (VmArea *)AVLLookupCeil(info->vmaTree, vma->end);
+}
+
+static VmArea *vmaInsert(TaskInfoPagedir *info, size_t start, size_t end,
+                         uint64_t flags) {
+  if (start % PAGE_SIZE || end % PAGE_SIZE || start >= end) {
+    debugf("[vma] Tried to add an invalid region! start{%lx} end{%lx}\n", start,
+           end);
+    panic();
+  }
+
+  // whatever used to be there gets replaced
+  vmaRemove(info, start, end);
+
+  VmArea *vma = slabAlloc(&cacheVmArea);
+  vma->start = start;
+  vma->end = end;
+  vma->flags = flags;
+  AVLAllocate(&info->vmaTree, start, (avlval)vma);
+  return vma;
+}
+
+VmArea *vmaAdd(TaskInfoPagedir *info, size_t start, size_t end,
+               uint64_t flags) {
+  // consecutive heap/mmap() growths end up in a single region
+  VmArea *prev = start ? vmaFind(info, start - 1) : 0;
+  if (prev && !prev->file && prev->flags == flags && end > prev->end) {
+    vmaRemove(info, prev->end, end);
+    prev->end = end;
+    return prev;
+  }
+
+  VmArea *vma = vmaInsert(info, start, end, flags);
+#if VMA_DEBUG
+  debugf("[vma] New region: start{%lx} end{%lx}\n", start, end);
+#endif
+  return vma;
+}
+
+VmArea *vmaAddFile(TaskInfoPagedir *info, size_t start, size_t end,
+                   uint64_t flags, OpenFile *file, size_t pgoffset,
+                   bool shared) {
+  OpenFile *orphan = fsOrphanDuplicate(file);
+  if (!orphan)
+    return 0;
+
+  VmArea *vma = vmaInsert(info, start, end, flags);
+  vma->file = orphan;
+  vma->pgoffset = pgoffset;
+  vma->shared = shared;
+#if VMA_DEBUG
+  debugf("[vma] New file region: start{%lx} end{%lx} offset{%lx}\n", start,
+         end, pgoffset);
+#endif
+  return vma;
+}
+
+// Cuts vma in two at addr, returning the upper half
+static VmArea *vmaSplit(TaskInfoPagedir *info, VmArea *vma, size_t addr) {
+  VmArea *upper = slabAlloc(&cacheVmArea);
+  memcpy(upper, vma, sizeof(VmArea));
+  upper->start = addr;
+  if (vma->file) {
+    upper->file = fsOrphanDuplicate(vma->file);
+    if (!upper->file) {
+      debugf("[vma] Couldn't split file region! start{%lx} addr{%lx}\n",
+             vma->start, addr);
+      panic();
+    }
+    upper->pgoffset += addr - vma->start;
+  }
+
+  vma->end = addr;
+  AVLAllocate(&info->vmaTree, addr, (avlval)upper);
+  return upper;
+}
+
+static void vmaFree(VmArea *vma) {
+  OpenFile *file = vma->file;
+  if (file) {
+    if (vma->shared && vma->flags & PF_RW && file->handlers->mmapSync) {
+      spinlockAcquire(&file->LOCK_OPERATIONS);
+      file->handlers->mmapSync(file, vma->pgoffset, vma->end - vma->start);
+      spinlockRelease(&file->LOCK_OPERATIONS);
+    }
+    fsOrphanClose(file);
+  }
+  slabFree(&cacheVmArea, vma);
+}
+
+// Forgets about [start, end), splitting regions that are only partially
+// covered. Pages that were already faulted in have to be dropped separately!
+void vmaRemove(TaskInfoPagedir *info, size_t start, size_t end) {
+  VmArea *vma = vmaFind(info, start);
+  if (vma && vma->start < start)
+    vmaSplit(info, vma, start);
+
+  vma = vmaFirstFrom(info, start);
+  while (vma && vma->start < end) {
+    if (vma->end > end)
+      vmaSplit(info, vma, end);
+    VmArea *next = vmaNext(info, vma);
+    AVLFree(&info->vmaTree, vma->start);
+    vmaFree(vma);
+    vma = next;
+  }
+}
+
+// Gives [start, end) new flags (mprotect), splitting regions that are only
+// partially covered. Gaps in between are left alone.
+void vmaProtect(TaskInfoPagedir *info, size_t start, size_t end,
+                uint64_t flags) {
+  VmArea *vma = vmaFind(info, start);
+  if (vma && vma->start < start)
+    vmaSplit(info, vma, start);
+
+  for (vma = vmaFirstFrom(info, start); vma && vma->start < end;
+       vma = vmaNext(info, vma)) {
+    if (vma->end > end)
+      vmaSplit(info, vma, end);
+    vma->flags = flags;
+  }
+}
+
+// First-fit search for a free range above info->mmap_start. The hint is used
+// as is if nothing's there yet. Returns 0 if there's no room left.
+size_t vmaPlace(TaskInfoPagedir *info, size_t hint, size_t length) {
+  if (hint >= info->mmap_start && (hint + length) > hint &&
+      (hint + length) <= VMA_MMAP_END) {
+    VmArea *vma = vmaFirstFrom(info, hint);
+    if (!vma || vma->start >= (hint + length))
+      return hint;
+  }
+
+  size_t cursor = info->mmap_start;
+  for (VmArea *vma = vmaFirstFrom(info, cursor); vma;
+       vma = vmaNext(info, vma)) {
+    if (vma->start >= (cursor + length))
+      break;
+    cursor = MAX(cursor, vma->end);
+  }
+
+  if ((cursor + length) > VMA_MMAP_END)
+    return 0;
+  return cursor;
+}
+
+// Anonymous regions spanning a whole 2MiB window get a single large page, as
+// long as nothing has been faulted in there yet & memory isn't too fragmented
+static bool vmaFaultLarge(TaskInfoPagedir *info, VmArea *vma, size_t virt) {
+  size_t base = virt & ~(PAGE_SIZE_LARGE - 1);
+  if (base < vma->start || (base + PAGE_SIZE_LARGE) > vma->end)
+    return false;
+
+  if (!VirtualLargeVacantL(info->pagedir, base))
+    return false;
+
+  size_t phys = PhysicalAllocateTry(PAGES_PER_LARGE);
+  if (!phys)
+    return false;
+  memset((void *)(phys + bootloader.hhdmOffset), 0, PAGE_SIZE_LARGE);
+  if (!VirtualMapLargeTryL(info->pagedir, base, phys, vma->flags)) {
+    PhysicalFree(phys, PAGES_PER_LARGE);
+    return false;
+  }
+
+  return true;
+}
+
+static bool vmaFaultPage(TaskInfoPagedir *info, VmArea *vma, size_t virt) {
+  if (VirtualToPhysicalL(info->pagedir, virt))
+    return true; // already there (another thread beat us to it)
+
+  if (!vma->file) {
+    if (vmaFaultLarge(info, vma, virt))
+      return true;
+
+    size_t phys = PhysicalAllocateZeroed(1);
+    VirtualMapL(info->pagedir, virt, phys, vma->flags);
+    return true;
+  }
+
+  // file pages come straight out of the page cache
+  OpenFile *file = vma->file;
+  size_t    offset = vma->pgoffset + (virt - vma->start);
+  spinlockAcquire(&file->LOCK_OPERATIONS);
+  size_t phys = file->handlers->mmapPage(file, offset);
+  spinlockRelease(&file->LOCK_OPERATIONS);
+  if (!phys)
+    return false;
+
+  uint64_t flags = vma->flags;
+  if (vma->shared)
+    flags |= PF_SHARED;
+  else if (flags & PF_RW)
+    flags = (flags & ~PF_RW) | PF_COW;
+  VirtualMapL(info->pagedir, virt, phys, flags);
+  return true;
+}
+
+// For MAP_POPULATE and such, maps everything right away
+void vmaPopulate(TaskInfoPagedir *info, size_t start, size_t end) {
+  start &= ~0xFFF;
+  for (VmArea *vma = vmaFirstFrom(info, start); vma && vma->start < end;
+       vma = vmaNext(info, vma)) {
+    if (!(vma->flags & PF_USER))
+      continue; // PROT_NONE
+
+    size_t runStart = MAX(start, vma->start);
+    size_t runEnd = MIN(end, vma->end);
+    if (!vma->file) {
+      // anonymous memory is filled in one go
+      VirtualPopulateRegionL(info->pagedir, runStart, runEnd - runStart,
+                             vma->flags);
+      continue;
+    }
+
+    for (size_t virt = runStart; virt < runEnd; virt += PAGE_SIZE)
+      vmaFaultPage(info, vma, virt);
+  }
+}
+
+// Unmaps whatever has already been faulted in
+void vmaDropPages(TaskInfoPagedir *info, size_t start, size_t end) {
+  start &= ~0xFFF;
+  if (end > start)
+    VirtualUnmapRegionL(info->pagedir, start, end - start);
+}
+
+bool vmaHandleFault(TaskInfoPagedir *info, size_t addr, uint64_t error) {
+  if (error & PFERR_PRESENT)
+    return false; // protection violation, not ours
+
+  bool ret = false;
+  spinlockAcquire(&info->LOCK_PD);
+  VmArea *vma = vmaFind(info, addr);
+  if (vma && vma->flags & PF_USER &&
+      (!(error & PFERR_WRITE) || vma->flags & PF_RW))
+    ret = vmaFaultPage(info, vma, addr & ~0xFFF);
+  spinlockRelease(&info->LOCK_PD);
+  return ret;
+}
+
+void vmaClone(TaskInfoPagedir *source, TaskInfoPagedir *target) {
+  for (VmArea *browse = vmaFirstFrom(source, 0); browse;
+       browse = vmaNext(source, browse)) {
+    VmArea *vma = slabAlloc(&cacheVmArea);
+    memcpy(vma, browse, sizeof(VmArea));
+    vma->file = browse->file ? fsOrphanDuplicate(browse->file) : 0;
+    AVLAllocate(&target->vmaTree, vma->start, (avlval)vma);
+  }
+}
+
+void vmaDiscard(TaskInfoPagedir *info) {
+  while (info->vmaTree) {
+    VmArea *vma = (VmArea *)((AVLheader *)info->vmaTree)->value;
+    AVLFree(&info->vmaTree, vma->start);
+    vmaFree(vma);
+  }
+}
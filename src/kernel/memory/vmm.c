@@ -14,16 +14,23 @@
 // HHDM might be mapped as a full-GB entry, so we have to be careful!
 #define VMM_POS_ENSURE 0x40000000
 
+Spinlock LOCK_VIRTUAL = ATOMIC_FLAG_INIT;
+
+// The virtual bitmap manages the vmalloc region: kernel address space right
+// after the HHDM (on its own PML4 entries), where scattered pageframes get
+// mapped contiguously. It spans as much as there is memory.
 void initiateVMM() {
+  size_t hhdmEnd =
+      bootloader.hhdmOffset + MAX(bootloader.mmTotal, UINT32_MAX) + 1;
   size_t targetPosition =
-      DivRoundUp(bootloader.hhdmOffset - bootloader.mmTotal - VMM_POS_ENSURE,
-                 PAGE_SIZE) *
-      PAGE_SIZE;
+      DivRoundUp(hhdmEnd + VMM_POS_ENSURE, VMM_REGION_ALIGN) * VMM_REGION_ALIGN;
 
   virtual.ready = false;
   virtual.mem_start = targetPosition;
   virtual.BitmapSizeInBlocks = DivRoundUp(bootloader.mmTotal, BLOCK_SIZE);
   virtual.BitmapSizeInBytes = DivRoundUp(virtual.BitmapSizeInBlocks, 8);
+  virtual.allocatedSizeInBlocks = 0;
+  virtual.lastDeepFragmented = 0;
 
   uint64_t pagesRequired = DivRoundUp(virtual.BitmapSizeInBytes, BLOCK_SIZE);
   virtual.Bitmap = (uint8_t *)VirtualAllocate(pagesRequired);
@@ -45,12 +52,85 @@ void *VirtualAllocate(int pages) {
   return (void *)(output);
 }
 
+// Pageframes come filled with zeroes (see PhysicalAllocateZeroed())
+void *VirtualAllocateZeroed(int pages) {
+  size_t phys = PhysicalAllocateZeroed(pages);
+  return (void *)(phys + bootloader.hhdmOffset);
+}
+
 // it's all contiguous already!
 void *VirtualAllocatePhysicallyContiguous(int pages) {
   return VirtualAllocate(pages);
 }
 
+// For big buffers that don't need to be physically contiguous (no DMA that
+// doesn't go page by page), so that they never depend on finding a large
+// enough buddy block. Comes filled with zeroes & followed by a guard page.
+// Small ones are taken straight off the HHDM, as those blocks are easy to find.
+void *VirtualAllocateScattered(int pages) {
+  if (pages < VMM_SCATTER_MIN)
+    return VirtualAllocateZeroed(pages);
+
+  spinlockAcquire(&LOCK_VIRTUAL);
+  void *virt = BitmapAllocate(&virtual, pages + 1);
+  spinlockRelease(&LOCK_VIRTUAL);
+  if (!virt) {
+    debugf("[vmm::alloc] Out of vmalloc space! pages{%d}\n", pages);
+    panic();
+  }
+
+  // global, as these get remapped while every PCID might be caching them
+  VirtualPopulateRegionL(GetPageDirectory(), (size_t)virt, pages * PAGE_SIZE,
+                         PF_RW | PF_GLOBAL);
+#if VMM_DEBUG
+  debugf("[vmm::alloc] Scattered region: out{%lx} pages{%d}\n", virt, pages);
+#endif
+  return virt;
+}
+
+// Device memory (framebuffers & such) goes on the vmalloc region as well, so
+// that it's reachable from every address space. These never get unmapped
+void *VirtualMapDevice(size_t phys, size_t length, uint64_t flags) {
+  int pages = DivRoundUp(length, PAGE_SIZE);
+
+  spinlockAcquire(&LOCK_VIRTUAL);
+  void *virt = BitmapAllocate(&virtual, pages + 1);
+  spinlockRelease(&LOCK_VIRTUAL);
+  if (!virt) {
+    debugf("[vmm::map] Out of vmalloc space! pages{%d}\n", pages);
+    panic();
+  }
+
+  VirtualMapRegionL(GetPageDirectory(), (size_t)virt, phys, pages * PAGE_SIZE,
+                    flags | PF_GLOBAL);
+#if VMM_DEBUG
+  debugf("[vmm::map] Device region: out{%lx} phys{%lx} pages{%d}\n", virt, phys,
+         pages);
+#endif
+  return virt;
+}
+
+bool VirtualIsScattered(void *ptr) {
+  size_t addr = (size_t)ptr;
+  return addr >= virtual.mem_start &&
+         addr < virtual.mem_start + virtual.BitmapSizeInBlocks * BLOCK_SIZE;
+}
+
+static void VirtualFreeScattered(void *ptr, int pages) {
+  // pageframes go along with the mappings (see VirtualUnmapRegionL())
+  VirtualUnmapRegionL(GetPageDirectory(), (size_t)ptr, pages * PAGE_SIZE);
+
+  spinlockAcquire(&LOCK_VIRTUAL);
+  MarkBlocks(&virtual, ToBlock(&virtual, ptr), pages + 1, 0);
+  spinlockRelease(&LOCK_VIRTUAL);
+}
+
 bool VirtualFree(void *ptr, int pages) {
+  if (VirtualIsScattered(ptr)) {
+    VirtualFreeScattered(ptr, pages);
+    return true;
+  }
+
   size_t phys = VirtualToPhysical((size_t)ptr);
   if (!phys) {
     debugf("[vmm::free] Could not find physical address! virt{%lx}\n", ptr);
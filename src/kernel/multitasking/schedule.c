@@ -1,4 +1,6 @@
+#include <apic.h>
 #include <bootloader.h>
+#include <fpu.h>
 #include <gdt.h>
 #include <isr.h>
 #include <malloc.h>
@@ -16,103 +18,314 @@
 
 #define SCHEDULE_DEBUG 0
 
-extern TSSPtr *tssPtr;
+// Runnable tasks wait on FIFO run queues (round robin), one per CPU, & blocked
+// ones stay off of them. Those with a wakeup time (forcefulWakeupTimeUnsafe)
+// have their wakeTimer armed for it. CPUs with nothing left to run steal from
+// the busiest queue before falling back to their idle task. Tasks that stop
+// being ready while queued (killed) just get skipped.
+// There's no periodic tick: a task only gets a slice (SCHEDULE_SLICE) when
+// others are waiting for its CPU, & CPUs that are busy with a single task get
+// poked (through their timer vector) once something's queued up behind it.
+Spinlock LOCK_SCHED = ATOMIC_FLAG_INIT;
+
+// Outside of the scheduler, interrupts have to be off while LOCK_SCHED is held
+static bool scheduleLock() {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  spinlockAcquire(&LOCK_SCHED);
+  return ints;
+}
+
+static void scheduleUnlock(bool ints) {
+  spinlockRelease(&LOCK_SCHED);
+  if (ints)
+    asm volatile("sti");
+}
+
+// Tasks go on the queue of the CPU they last ran on (task->cpu)
+static void scheduleRunnablePush(Task *task) {
+  if (task->runnable || task->state == TASK_STATE_DUMMY)
+    return;
+
+  CpuInfo *queue = cpus[task->cpu];
+  task->nextRunnable = 0;
+  task->prevRunnable = queue->lastRunnable;
+  if (queue->lastRunnable)
+    queue->lastRunnable->nextRunnable = task;
+  else
+    queue->firstRunnable = task;
+  queue->lastRunnable = task;
+  queue->runnableCnt++;
+  task->runnable = true;
+
+  // whoever's running there has to start sharing (idle CPUs look by
+  // themselves, see scheduleHasWork())
+  if (queue->current == queue->idleTask || queue->current == task ||
+      queue->sliceEnd)
+    return;
+  if (queue == cpuLocal()) {
+    queue->sliceEnd = timerTicks + SCHEDULE_SLICE;
+    timerProgram();
+  } else
+    apicSendIpi(queue->threadInfo.lapic_id, timerVector);
+}
+
+static void scheduleRunnableUnlink(Task *task) {
+  if (!task->runnable)
+    return;
+
+  CpuInfo *queue = cpus[task->cpu];
+  if (task->prevRunnable)
+    task->prevRunnable->nextRunnable = task->nextRunnable;
+  else
+    queue->firstRunnable = task->nextRunnable;
+  if (task->nextRunnable)
+    task->nextRunnable->prevRunnable = task->prevRunnable;
+  else
+    queue->lastRunnable = task->prevRunnable;
+
+  task->nextRunnable = 0;
+  task->prevRunnable = 0;
+  queue->runnableCnt--;
+  task->runnable = false;
+}
+
+// Next ready task off of the queue. Ones some CPU is still switching away
+// from have to be left alone until it's done (apart from our own old one).
+static Task *scheduleRunnablePop(CpuInfo *queue, Task *old) {
+  Task *browse = queue->firstRunnable;
+  while (browse) {
+    Task *next = browse->nextRunnable;
+    if (browse->state != TASK_STATE_READY)
+      scheduleRunnableUnlink(browse);
+    else if (browse == old || !atomicRead8(&browse->onCpu)) {
+      scheduleRunnableUnlink(browse);
+      return browse;
+    }
+    browse = next;
+  }
+  return 0;
+}
+
+static bool scheduleCpuOnline(CpuInfo *cpu) {
+  return cpu && atomicRead8((uint8_t *)&cpu->online);
+}
+
+// Takes work off of the busiest other CPU
+static Task *scheduleSteal(CpuInfo *local) {
+  CpuInfo *busiest = 0;
+  for (int i = 0; i < SMP_MAX_CPUS; i++) {
+    CpuInfo *cpu = cpus[i];
+    if (cpu == local || !scheduleCpuOnline(cpu) || !cpu->runnableCnt)
+      continue;
+    if (!busiest || cpu->runnableCnt > busiest->runnableCnt)
+      busiest = cpu;
+  }
+  return busiest ? scheduleRunnablePop(busiest, 0) : 0;
+}
+
+// Expects LOCK_SCHED to be held
+static Task *scheduleNext(CpuInfo *local, Task *old) {
+  Task *next = scheduleRunnablePop(local, old);
+  if (!next)
+    next = scheduleSteal(local);
+  if (!next)
+    next = local->idleTask;
+
+  next->running = true;
+  next->cpu = local->id;
+  if (next != old)
+    atomicWrite8(&next->onCpu, 1);
+  return next;
+}
+
+// Where a task that hasn't ran anywhere yet should go
+static uint32_t scheduleLeastLoaded() {
+  CpuInfo *target = cpuLocal();
+  for (int i = 0; i < SMP_MAX_CPUS; i++) {
+    CpuInfo *cpu = cpus[i];
+    if (scheduleCpuOnline(cpu) && cpu->runnableCnt < target->runnableCnt)
+      target = cpu;
+  }
+  return target->id;
+}
+
+// Expects LOCK_SCHED to be held
+static void scheduleWakeUnsafe(Task *task) {
+  if (task->state == TASK_STATE_DUMMY)
+    return;
+
+  task->forcefulWakeupTimeUnsafe = 0;
+  if (task->state == TASK_STATE_CREATED)
+    task->cpu = scheduleLeastLoaded();
+  task->state = TASK_STATE_READY;
+  if (!task->running) // goes back on the queue once switched away from
+    scheduleRunnablePush(task);
+}
+
+// Makes a blocked (or newly created) task runnable, dropping any wakeup time
+void scheduleWake(void *taskPtr) {
+  Task *task = (Task *)taskPtr;
+  bool  ints = scheduleLock();
+  scheduleWakeUnsafe(task);
+  scheduleUnlock(ints);
+}
+
+// Takes the task off every queue, before it gets freed
+void scheduleRemove(void *taskPtr) {
+  Task *task = (Task *)taskPtr;
+  timerDisarm(&task->wakeTimer);
+  bool ints = scheduleLock();
+  scheduleRunnableUnlink(task);
+  scheduleUnlock(ints);
+}
+
+// Fires at forcefulWakeupTimeUnsafe, unless something else woke the task up
+// first (which zeroes it). Tasks still on their way out of a CPU get another
+// go a ms later, as they might still have locks to let go of (see below).
+static uint64_t scheduleWakeTimer(Timer *timer) {
+  Task    *task = (Task *)timer->data;
+  uint64_t again = 0;
+
+  spinlockAcquire(&LOCK_SCHED);
+  uint64_t at = task->forcefulWakeupTimeUnsafe;
+  if (!at || task->state == TASK_STATE_DEAD ||
+      task->state == TASK_STATE_SIGKILLED)
+    ;
+  else if (task->running || at > timerTicks)
+    again = at;
+  else
+    scheduleWakeUnsafe(task);
+  spinlockRelease(&LOCK_SCHED);
+
+  return again;
+}
+
+// Puts the current task in state until wakeAt (timerTicks), if non-zero, or
+// until someone wakes it up earlier. Still has to handControl() afterwards!
+void scheduleBlockUntil(uint8_t state, uint64_t wakeAt) {
+  bool  ints = checkInterrupts();
+  Task *task = currentTask;
+  // the timer fires on this CPU, so it can't beat us to the state change
+  asm volatile("cli");
+  if (wakeAt) {
+    task->wakeTimer.callback = scheduleWakeTimer;
+    task->wakeTimer.data = task;
+    task->forcefulWakeupTimeUnsafe = wakeAt;
+    timerArm(&task->wakeTimer, wakeAt);
+  }
+  task->state = state;
+  if (ints)
+    asm volatile("sti");
+}
+
+// Has a task that's running on another CPU go through the scheduler (to notice
+// signals), as nothing would make it otherwise
+void scheduleKick(void *taskPtr) {
+  Task    *task = (Task *)taskPtr;
+  bool     ints = scheduleLock();
+  CpuInfo *cpu = cpus[task->cpu];
+  if (task->running && cpu != cpuLocal())
+    apicSendIpi(cpu->threadInfo.lapic_id, timerVector);
+  scheduleUnlock(ints);
+}
+
+// Whether there's anything an idle CPU could pick up
+bool scheduleHasWork() {
+  for (int i = 0; i < SMP_MAX_CPUS; i++) {
+    CpuInfo *cpu = cpus[i];
+    if (scheduleCpuOnline(cpu) && cpu->runnableCnt)
+      return true;
+  }
+  return false;
+}
 
 void schedule(uint64_t rsp) {
   if (!tasksInitiated)
     return;
 
   AsmPassedInterrupt *cpu = (AsmPassedInterrupt *)rsp;
-  Task *next = currentTask->next ? currentTask->next : firstTask;
-  int fullRun = 0;
-
-  // Fast path: if next is ready, skip loop
-  while (next->state != TASK_STATE_READY) {
-    if (signalsRevivableState(next->state) && signalsPendingQuick(next)) {
-      assert(next->registers.cs & GDT_KERNEL_CODE);
-      next->forcefulWakeupTimeUnsafe = 0;
-      next->state = TASK_STATE_READY;
-      break;
-    }
-    if (next->forcefulWakeupTimeUnsafe && next->forcefulWakeupTimeUnsafe <= timerTicks) {
-      next->state = TASK_STATE_READY;
-      next->forcefulWakeupTimeUnsafe = 0;
-      break;
-    }
-    next = next->next ? next->next : firstTask;
-    if (++fullRun > 2) break;
+  CpuInfo            *local = cpuLocal();
+  Task               *old = local->current;
+  if (!old)
+    return; // not done coming up yet
+  spinlockAcquire(&LOCK_SCHED);
+
+  // Whatever we're switching away from goes back on the queue, if it's still
+  // ready. Signals (already) pending interrupt waits.
+  old->running = false;
+  if (old->state != TASK_STATE_READY && signalsRevivableState(old->state) &&
+      signalsPendingQuick(old)) {
+    old->forcefulWakeupTimeUnsafe = 0;
+    old->state = TASK_STATE_READY;
   }
+  if (old->state == TASK_STATE_READY)
+    scheduleRunnablePush(old);
+
+  Task *next = scheduleNext(local, old);
+  spinlockRelease(&LOCK_SCHED);
 
-  if (!next) next = dummyTask;
-  Task *old = currentTask;
-  currentTask = next;
+  local->current = next;
 
   if (old->state != TASK_STATE_READY && old->spinlockQueueEntry) {
     spinlockRelease(old->spinlockQueueEntry);
     old->spinlockQueueEntry = 0;
   }
 
-  if (!next->kernel_task) {
-    // Optimize timer checks: only read atomic values once
-    struct {
-      uint64_t at, reset;
-    } itimerReal = {
-      .at = atomicRead64(&next->infoSignals->itimerReal.at),
-      .reset = atomicRead64(&next->infoSignals->itimerReal.reset)
-    };
-    if (itimerReal.at && itimerReal.at <= timerTicks) {
-      atomicBitmapSet(&next->sigPendingList, SIGALRM);
-      atomicWrite64(&next->infoSignals->itimerReal.at,
-        itimerReal.reset ? timerTicks + itimerReal.reset : 0);
-    }
+  while (true) {
+    // Handle signals before context switch
+    if (next->kernel_task || (next->registers.cs & GDT_KERNEL_CODE))
+      break;
+    signalsPendingHandleSched(next);
+    if (next->state != TASK_STATE_SIGKILLED)
+      break;
+
+    // got killed, let go of it & pick something else
+    spinlockAcquire(&LOCK_SCHED);
+    next->running = false;
+    if (next != old)
+      atomicWrite8(&next->onCpu, 0);
+    next = scheduleNext(local, old);
+    spinlockRelease(&LOCK_SCHED);
+    local->current = next;
   }
 
+  // Only share the CPU when someone's actually waiting for it
+  local->sliceEnd = local->runnableCnt ? timerTicks + SCHEDULE_SLICE : 0;
+  timerProgram();
+
 #if SCHEDULE_DEBUG
   debugf("[scheduler] Switching context: id{%d} -> id{%d}\n", old->id, next->id);
   debugf("cpu->usermode_rsp{%lx} rip{%lx} fsbase{%lx} gsbase{%lx}\n",
          next->registers.usermode_rsp, next->registers.rip, old->fsbase, old->gsbase);
 #endif
 
-  // Handle signals before context switch
-  if (!next->kernel_task && !(next->registers.cs & GDT_KERNEL_CODE)) {
-    signalsPendingHandleSched(next);
-    if (next->state == TASK_STATE_SIGKILLED) {
-      currentTask = old;
-      return schedule(rsp);
-    }
-  }
-
   // Change TSS rsp0 and syscall stack
-  tssPtr->rsp0 = next->whileTssRsp;
-  threadInfo.syscall_stack = next->whileSyscallRsp;
+  local->tss.rsp0 = next->whileTssRsp;
+  local->threadInfo.syscall_stack = next->whileSyscallRsp;
 
-  // Apply new MSRIDs
+  // Apply new MSRIDs (userland's GS base gets swapped in on the way out)
   wrmsr(MSRID_FSBASE, next->fsbase);
-  wrmsr(MSRID_GSBASE, next->gsbase);
-  wrmsr(MSRID_KERNEL_GSBASE, (size_t)&threadInfo);
+  wrmsr(MSRID_KERNEL_GSBASE, next->gsbase);
 
   // Save registers
   memcpy(&old->registers, cpu, sizeof(AsmPassedInterrupt));
 
-  // Save/load FPU state only for user tasks
-  if (!old->kernel_task) {
-    asm volatile(" fxsave %0 " ::"m"(old->fpuenv));
-    asm("stmxcsr (%%rax)" : : "a"(&old->mxcsr));
-  }
-  if (!next->kernel_task) {
-    asm volatile(" fxrstor %0 " ::"m"(next->fpuenv));
-    asm("ldmxcsr (%%rax)" : : "a"(&next->mxcsr));
-  }
+  // FPU state only gets saved if it got used & loaded once it's used again
+  fpuSwitch(local, old, next);
 
   // Prepare iretq stack
   AsmPassedInterrupt *iretqRsp =
       (AsmPassedInterrupt *)(next->whileTssRsp - sizeof(AsmPassedInterrupt));
   memcpy(iretqRsp, &next->registers, sizeof(AsmPassedInterrupt));
 
-  // Update pagedir pointer (no full switch, just update global)
+  // Update pagedir pointer (no full switch, just update global). CR3 is only
+  // written if the address space actually changes
   uint64_t *pagedir = next->pagedirOverride ? next->pagedirOverride : next->infoPd->pagedir;
-  ChangePageDirectoryFake(pagedir);
+  uint16_t  pcid =
+      next->pagedirOverride ? PagingPcidFind(pagedir) : next->infoPd->pcid;
+  uint64_t  cr3 = ChangePageDirectoryFake(pagedir, pcid);
 
-  // Finalize context switch
-  asm_finalize((size_t)iretqRsp, VirtualToPhysical((size_t)pagedir));
+  // Finalize context switch, others can pick up old once we're off its stack
+  asm_finalize((size_t)iretqRsp, cr3, next != old ? &old->onCpu : 0);
 }
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <system.h>
 #include <util.h>
+#include <vdso.h>
 
 // Stack creation for userland & kernelspace tasks
 // Copyright (C) 2024 Panagiotis
@@ -17,12 +18,9 @@ void stackGenerateMutual(Task *task) {
   // }
 
   // Map the user stack (for variables & such)
-  for (int i = 0; i < USER_STACK_PAGES; i++) {
-    size_t virt_addr =
-        USER_STACK_BOTTOM - USER_STACK_PAGES * 0x1000 + i * 0x1000;
-    VirtualMap(virt_addr, PhysicalAllocate(1), PF_USER | PF_RW);
-    memset((void *)virt_addr, 0, PAGE_SIZE);
-  }
+  VirtualPopulateRegionL(GetPageDirectory(),
+                         USER_STACK_BOTTOM - USER_STACK_PAGES * PAGE_SIZE,
+                         USER_STACK_PAGES * PAGE_SIZE, PF_USER | PF_RW);
 }
 
 typedef struct StackStorePtrStyle {
@@ -96,6 +94,10 @@ void stackGenerateUser(Task *target, uint32_t argc, char **argv, uint32_t envc,
   // aux: AT_NULL
   PUSH_TO_STACK(target->registers.usermode_rsp, size_t, (size_t)0);
   PUSH_TO_STACK(target->registers.usermode_rsp, size_t, (size_t)0);
+  // aux: AT_SYSINFO_EHDR
+  PUSH_TO_STACK(target->registers.usermode_rsp, uint64_t,
+                vdsoMap(target->infoPd->pagedir));
+  PUSH_TO_STACK(target->registers.usermode_rsp, uint64_t, 33);
   // aux: AT_RANDOM
   PUSH_TO_STACK(target->registers.usermode_rsp, size_t,
                 (size_t)randomByteStart);
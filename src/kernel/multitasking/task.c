@@ -1,3 +1,4 @@
+#include <fpu.h>
 #include <gdt.h>
 #include <isr.h>
 #include <kernel_helper.h>
@@ -7,6 +8,7 @@
 #include <paging.h>
 #include <pmm.h>
 #include <schedule.h>
+#include <slab.h>
 #include <stack.h>
 #include <string.h>
 #include <syscalls.h>
@@ -19,6 +21,46 @@
 
 SpinlockCnt TASK_LL_MODIFY = {0};
 
+static Task *lastTask = 0;
+
+// Tasks are hashed by pid (guarded by TASK_LL_MODIFY as well), the task list
+// is only there for going through all of them. Dead tasks stay hashed until
+// they're destroyed, so pids that got freed (& reused) before that can be on
+// there twice: newer ones go in front, hence they're found first.
+static Task *taskPidHash[TASK_PID_BUCKETS] = {0};
+
+// Allocated pids, handed out in a circle (see taskGenerateId()) so freed ones
+// don't get reused right away. Bit 0 is KERNEL_TASK_ID's
+Spinlock        LOCK_PID_BITMAP = ATOMIC_FLAG_INIT;
+static uint64_t taskPidBitmap[TASK_PID_MAX / 64] = {1};
+static size_t   taskPidNext = 1;
+
+static Task **taskPidBucket(uint32_t id) {
+  return &taskPidHash[id % TASK_PID_BUCKETS];
+}
+
+// Expects TASK_LL_MODIFY to be held for writing
+static void taskPidHashInsert(Task *task) {
+  Task **bucket = taskPidBucket(task->id);
+  task->nextPid = *bucket;
+  *bucket = task;
+}
+
+// Expects TASK_LL_MODIFY to be held for writing
+static void taskPidUnhash(Task *task) {
+  Task **browse = taskPidBucket(task->id);
+  while (*browse && *browse != task)
+    browse = &(*browse)->nextPid;
+  if (*browse)
+    *browse = task->nextPid;
+  task->nextPid = 0;
+}
+
+SlabCache cacheTask = SLAB_CACHE_INIT("task", Task, 0);
+SlabCache cacheKilledInfo = SLAB_CACHE_INIT("killed_info", KilledInfo, 0);
+SlabCache cacheTaskSysInterrupted =
+    SLAB_CACHE_INIT("task_sys_interrupted", TaskSysInterrupted, 0);
+
 void taskAttachDefTermios(Task *task) {
   memset(&task->term, 0, sizeof(termios));
   task->term.c_iflag = BRKINT | ICRNL | INPCK | ISTRIP | IXON;
@@ -48,18 +90,12 @@ void taskAttachDefTermios(Task *task) {
 // although there are locks on these two functions, they are EXTREMELY unsafe!
 Task *taskListAllocate() {
   spinlockCntWriteAcquire(&TASK_LL_MODIFY);
-  Task *target = (Task *)malloc(sizeof(Task));
-  memset(target, 0, sizeof(Task)); // TASK_STATE_DEAD is 0 too
+  Task *target = (Task *)slabAlloc(&cacheTask); // TASK_STATE_DEAD is 0 too
   asm volatile("cli");
-  Task *browse = firstTask;
-  while (browse) {
-    if (!browse->next)
-      break; // found final
-    browse = browse->next;
-  }
-
-  assert(browse);
-  browse->next = target;
+  assert(lastTask);
+  target->prev = lastTask;
+  lastTask->next = target;
+  lastTask = target;
   asm volatile("sti");
   spinlockCntWriteRelease(&TASK_LL_MODIFY);
   return target;
@@ -68,23 +104,40 @@ Task *taskListAllocate() {
 // will NEVER be the first one
 void taskListDestroy(Task *target) {
   spinlockCntWriteAcquire(&TASK_LL_MODIFY);
+  taskPidUnhash(target);
   asm volatile("cli");
-  Task *prev = firstTask;
-  while (prev) {
-    if (prev->next == target)
-      break;
-    prev = prev->next;
-  }
-  assert(prev);
-
-  prev->next = target->next;
+  assert(target->prev);
+  target->prev->next = target->next;
+  if (target->next)
+    target->next->prev = target->prev;
+  else
+    lastTask = target->prev;
   asm volatile("sti");
   spinlockCntWriteRelease(&TASK_LL_MODIFY);
-  free(target); // finally, destroy it
+
+  if (!target->pidKept)
+    taskPidFree(target->id);
+  // children it never got to reap won't be anymore
+  while (target->firstChildTerminated) {
+    KilledInfo *info = target->firstChildTerminated;
+    target->firstChildTerminated = info->next;
+    if (!target->kernel_task) // (see taskKill())
+      taskPidFree(info->pid);
+    slabFree(&cacheKilledInfo, info);
+  }
+
+  scheduleRemove(target);
+  fpuTaskFree(target);
+  slabFree(&cacheTask, target); // finally, destroy it
 }
 
 Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
                  uint32_t argc, char **argv) {
+  if (id == TASK_PID_NONE) {
+    debugf("[tasks] No pid to create the task with!\n");
+    panic();
+  }
+
   Task *target = taskListAllocate();
 
   uint64_t code_selector =
@@ -100,7 +153,7 @@ Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
   target->registers.rflags = 0x200; // enable interrupts
   target->registers.rip = rip;
 
-  target->id = id;
+  taskPidSet(target, id);
   target->tgid = id;
   target->sid = 1; // to dummy
   target->ctrlPty = -1;
@@ -109,24 +162,21 @@ Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
   // target->pagedir = pagedir;
   target->infoPd = taskInfoPdAllocate(false);
   target->infoPd->pagedir = pagedir; // no lock cause only we use it
+  target->infoPd->pcid = PagingPcidFind(pagedir);
 
-  void  *tssRsp = VirtualAllocate(USER_STACK_PAGES);
+  void  *tssRsp = VirtualAllocateZeroed(USER_STACK_PAGES);
   size_t tssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(tssRsp, 0, tssRspSize);
   target->whileTssRsp = (uint64_t)tssRsp + tssRspSize;
 
-  void  *syscalltssRsp = VirtualAllocate(USER_STACK_PAGES);
+  void  *syscalltssRsp = VirtualAllocateZeroed(USER_STACK_PAGES);
   size_t syscalltssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(syscalltssRsp, 0, syscalltssRspSize);
   target->whileSyscallRsp = (uint64_t)syscalltssRsp + syscalltssRspSize;
 
   target->infoFs = taskInfoFsAllocate();
   target->infoFiles = taskInfoFilesAllocate();
   target->infoSignals = taskInfoSignalAllocate();
 
-  memset(target->fpuenv, 0, 512);
-  ((uint16_t *)target->fpuenv)[0] = 0x37f;
-  target->mxcsr = 0x1f80;
+  fpuTaskInit(target);
 
   taskAttachDefTermios(target);
 
@@ -144,13 +194,23 @@ Task *taskCreateKernel(uint64_t rip, uint64_t rdi) {
   return target;
 }
 
+// What a CPU runs when there's nothing else to, it never goes on a run queue
+Task *taskCreateIdle() {
+  Task *target = taskCreate(taskGenerateId(), (uint64_t)kernelDummyEntry, true,
+                            PageDirectoryAllocate(), 0, 0);
+  stackGenerateKernel(target, 0);
+  target->state = TASK_STATE_DUMMY;
+  taskNameKernel(target, dummyCmdline, sizeof(dummyCmdline));
+  return target;
+}
+
 void taskNameKernel(Task *target, const char *str, int len) {
   target->cmdline = malloc(len);
   memcpy(target->cmdline, str, len);
   target->cmdlineLen = len;
 }
 
-void taskCreateFinish(Task *task) { task->state = TASK_STATE_READY; }
+void taskCreateFinish(Task *task) { scheduleWake(task); }
 
 void taskAdjustHeap(Task *task, size_t new_heap_end, size_t *start,
                     size_t *end) {
@@ -166,18 +226,8 @@ void taskAdjustHeap(Task *task, size_t new_heap_end, size_t *start,
 
   if (new_page_top > old_page_top) {
     size_t num = new_page_top - old_page_top;
-
-    for (size_t i = 0; i < num; i++) {
-      size_t virt = old_page_top * PAGE_SIZE + i * PAGE_SIZE;
-      if (VirtualToPhysical(virt))
-        continue;
-
-      size_t phys = PhysicalAllocate(1);
-
-      VirtualMap(virt, phys, PF_RW | PF_USER);
-
-      memset((void *)virt, 0, PAGE_SIZE);
-    }
+    VirtualPopulateRegionL(GetPageDirectory(), old_page_top * PAGE_SIZE,
+                           num * PAGE_SIZE, PF_RW | PF_USER);
   } else if (new_page_top < old_page_top) {
     debugf("[task] New page is lower than old page: id{%d}\n", task->id);
     taskKill(task->id, 139);
@@ -187,17 +237,13 @@ void taskAdjustHeap(Task *task, size_t new_heap_end, size_t *start,
   *end = new_heap_end;
 }
 
+// Queues the task up for the helper thread to clean after (see
+// helperReaper()), so dying never has to wait on it
 void taskCallReaper(Task *target) {
-  while (true) {
-    spinlockAcquire(&LOCK_REAPER);
-    if (!reaperTask) {
-      // there is space!
-      reaperTask = target;
-      spinlockRelease(&LOCK_REAPER);
-      return;
-    }
-    spinlockRelease(&LOCK_REAPER);
-  }
+  spinlockAcquire(&LOCK_REAPER);
+  target->nextReaper = firstReaperTask;
+  firstReaperTask = target;
+  spinlockRelease(&LOCK_REAPER);
 }
 
 void taskKill(uint32_t id, uint16_t ret) {
@@ -206,41 +252,45 @@ void taskKill(uint32_t id, uint16_t ret) {
     return;
 
   // Notify that poor parent... they must've been searching all over the
-  // place!
-  if (task->parent && !task->noInformParent) {
+  // place! (not for threads, nobody waits on those & their pid goes right away)
+  if (task->parent && !task->noInformParent && task->tgid == task->id) {
     spinlockAcquire(&task->parent->LOCK_CHILD_TERM);
-    KilledInfo *info = (KilledInfo *)LinkedListAllocate(
-        (void **)(&task->parent->firstChildTerminated), sizeof(KilledInfo));
+    KilledInfo *info = (KilledInfo *)LinkedListAllocateSlab(
+        (void **)(&task->parent->firstChildTerminated), &cacheKilledInfo);
     info->pid = task->id;
     info->ret = ret;
+    // kernel tasks never wait4(), so the pid would never be freed
+    task->pidKept = !task->parent->kernel_task;
     task->parent->childrenTerminatedAmnt++;
     if (task->parent->state == TASK_STATE_WAITING_CHILD ||
         (task->parent->state == TASK_STATE_WAITING_CHILD_SPECIFIC &&
          task->parent->waitingForPid == task->id))
-      task->parent->state = TASK_STATE_READY;
+      scheduleWake(task->parent);
     spinlockRelease(&task->parent->LOCK_CHILD_TERM);
     atomicBitmapSet(&task->parent->sigPendingList, SIGCHLD);
+    signalsRevive(task->parent);
   }
 
   // vfork() children need to notify parents no matter what
   if (task->parent->state == TASK_STATE_WAITING_VFORK)
-    task->parent->state = TASK_STATE_READY;
+    scheduleWake(task->parent);
 
   if (task->tidptr) {
     // *task->tidptr = 0;
     atomicWrite32((uint32_t *)task->tidptr, 0);
+    // (keyed the same as a private wakeup, unless it's MAP_SHARED memory)
     futexSyscall((uint32_t *)task->tidptr, FUTEX_WAKE, 1, 0, 0, 0);
   }
 
   // close any left open files
   taskInfoFilesDiscard(task->infoFiles, task);
 
-  // if (!parentVfork)
-  //   PageDirectoryFree(task->pagedir);
-  taskInfoPdDiscard(task->infoPd);
-  // ^ only changes userspace locations so we don't need to change our pagedir
+  // nobody to take its SIGALRMs anymore
+  if (task->infoSignals && task->infoSignals->itimerReal.task == task)
+    timerDisarm(&task->infoSignals->itimerReal.timer);
 
-  // the "reaper" thread will finish everything in a safe context
+  // the "reaper" thread will finish everything in a safe context, address
+  // space included (we might still be running on it!)
   taskCallReaper(task);
   task->state = TASK_STATE_DEAD;
 
@@ -279,18 +329,68 @@ void taskFreeChildren(Task *task) {
 
 Task *taskGet(uint32_t id) {
   spinlockCntReadAcquire(&TASK_LL_MODIFY);
-  Task *browse = firstTask;
+  Task *browse = *taskPidBucket(id);
   while (browse) {
     if (browse->id == id)
       break;
-    browse = browse->next;
+    browse = browse->nextPid;
   }
   spinlockCntReadRelease(&TASK_LL_MODIFY);
   return browse;
 }
 
-uint64_t taskIdCurr = 1;
-uint64_t taskGenerateId() { return taskIdCurr++; }
+// (Re)assigns the task's pid, which has to come off of taskGenerateId()
+void taskPidSet(Task *task, uint32_t id) {
+  spinlockCntWriteAcquire(&TASK_LL_MODIFY);
+  taskPidUnhash(task);
+  task->id = id;
+  taskPidHashInsert(task);
+  spinlockCntWriteRelease(&TASK_LL_MODIFY);
+}
+
+void taskPidSwap(Task *a, Task *b) {
+  spinlockCntWriteAcquire(&TASK_LL_MODIFY);
+  taskPidUnhash(a);
+  taskPidUnhash(b);
+  uint64_t tmp = a->id;
+  a->id = b->id;
+  b->id = tmp;
+  taskPidHashInsert(a);
+  taskPidHashInsert(b);
+  spinlockCntWriteRelease(&TASK_LL_MODIFY);
+}
+
+uint64_t taskGenerateId() {
+  spinlockAcquire(&LOCK_PID_BITMAP);
+  size_t   words = TASK_PID_MAX / 64;
+  size_t   word = taskPidNext / 64;
+  uint64_t mask = ~0ULL << (taskPidNext % 64); // skip what's behind us
+  // (+1 for the first one's lower half, when wrapping around)
+  for (size_t i = 0; i <= words; i++) {
+    uint64_t vacant = ~taskPidBitmap[word] & mask;
+    if (vacant) {
+      size_t id = word * 64 + __builtin_ctzll(vacant);
+      taskPidBitmap[word] |= 1ULL << (id % 64);
+      taskPidNext = (id + 1) % TASK_PID_MAX;
+      spinlockRelease(&LOCK_PID_BITMAP);
+      return id;
+    }
+    word = (word + 1) % words;
+    mask = ~0ULL;
+  }
+  spinlockRelease(&LOCK_PID_BITMAP);
+
+  debugf("[tasks] Ran out of pids! max{%d}\n", TASK_PID_MAX);
+  return TASK_PID_NONE;
+}
+
+void taskPidFree(uint32_t id) {
+  assert(id != KERNEL_TASK_ID && id < TASK_PID_MAX);
+  spinlockAcquire(&LOCK_PID_BITMAP);
+  assert(taskPidBitmap[id / 64] & (1ULL << (id % 64)));
+  taskPidBitmap[id / 64] &= ~(1ULL << (id % 64));
+  spinlockRelease(&LOCK_PID_BITMAP);
+}
 
 size_t taskChangeCwd(char *newdir) {
   stat stat = {0};
@@ -335,21 +435,26 @@ void taskFilesCopyInorder(AVLheader *root, taskFilesInorderArgs *args) {
 void taskFilesCopy(Task *original, Task *target, bool respectCOE) {
   TaskInfoFiles *originalInfo = original->infoFiles;
   TaskInfoFiles *targetInfo = target->infoFiles;
-  spinlockCntReadAcquire(&originalInfo->WLOCK_FILES);
-  spinlockCntWriteAcquire(&targetInfo->WLOCK_FILES);
+  rwlockReadAcquire(&originalInfo->WLOCK_FILES);
+  rwlockWriteAcquire(&targetInfo->WLOCK_FILES);
   targetInfo->rlimitFdsHard = originalInfo->rlimitFdsHard;
   targetInfo->rlimitFdsSoft = originalInfo->rlimitFdsSoft;
   targetInfo->fdBitmap = malloc(targetInfo->rlimitFdsHard / 8);
   memcpy(targetInfo->fdBitmap, originalInfo->fdBitmap,
          targetInfo->rlimitFdsHard / 8);
-  spinlockCntWriteRelease(&targetInfo->WLOCK_FILES); // inorder will manage this
+  rwlockWriteRelease(&targetInfo->WLOCK_FILES); // inorder will manage this
   taskFilesInorderArgs args = {.respectCOE = respectCOE, .target = target};
   taskFilesCopyInorder((void *)originalInfo->firstFile, &args);
-  spinlockCntReadRelease(&originalInfo->WLOCK_FILES);
+  rwlockReadRelease(&originalInfo->WLOCK_FILES);
 }
 
+// Returns 0 if there's no pid left to give it
 Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
                bool spinup) {
+  uint32_t id = taskGenerateId();
+  if (id == TASK_PID_NONE)
+    return 0;
+
   Task *target = taskListAllocate();
 
   if (!(cloneFlags & CLONE_VM)) {
@@ -362,7 +467,7 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
     target->infoPd = share; // share it yk!
   }
 
-  target->id = taskGenerateId();
+  taskPidSet(target, id);
   target->tgid = target->id;
   target->pgid = currentTask->pgid;
   target->sid = currentTask->sid;
@@ -379,14 +484,12 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
 
   // target->registers = currentTask->registers;
   memcpy(&target->registers, cpu, sizeof(AsmPassedInterrupt));
-  void  *tssRsp = VirtualAllocate(USER_STACK_PAGES);
+  void  *tssRsp = VirtualAllocateZeroed(USER_STACK_PAGES);
   size_t tssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(tssRsp, 0, tssRspSize);
   target->whileTssRsp = (uint64_t)tssRsp + tssRspSize;
 
-  void  *syscalltssRsp = VirtualAllocate(USER_STACK_PAGES);
+  void  *syscalltssRsp = VirtualAllocateZeroed(USER_STACK_PAGES);
   size_t syscalltssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(syscalltssRsp, 0, syscalltssRspSize);
   target->whileSyscallRsp = (uint64_t)syscalltssRsp + syscalltssRspSize;
 
   target->fsbase = currentTask->fsbase;
@@ -417,9 +520,9 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
     taskFilesCopy(currentTask, target, false);
   } else {
     TaskInfoFiles *share = currentTask->infoFiles;
-    spinlockCntWriteAcquire(&share->WLOCK_FILES);
+    rwlockWriteAcquire(&share->WLOCK_FILES);
     share->utilizedBy++;
-    spinlockCntWriteRelease(&share->WLOCK_FILES);
+    rwlockWriteRelease(&share->WLOCK_FILES);
     target->infoFiles = share;
   }
 
@@ -448,16 +551,14 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
   target->registers.usermode_ss = GDT_USER_DATA | DPL_USER;
 
   // since the scheduler, our fpu state might've changed
-  asm volatile(" fxsave %0 " ::"m"(currentTask->fpuenv));
-  asm("stmxcsr (%%rax)" : : "a"(&currentTask->mxcsr));
+  fpuSave(currentTask);
 
   // yk
   target->parent = currentTask;
   target->pgid = currentTask->pgid;
 
   // fpu stuff
-  memcpy(target->fpuenv, currentTask->fpuenv, 512);
-  target->mxcsr = currentTask->mxcsr;
+  memcpy(target->fpuenv, currentTask->fpuenv, fpuSize);
 
   if (spinup)
     taskCreateFinish(target);
@@ -465,48 +566,145 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
   return target;
 }
 
-void taskBlock(Blocking *blocking, Task *task, Spinlock *releaseAfter,
-               bool apply) {
-  assert(task == currentTask); // otherwise, it exits with ptr dangling
-  if (!apply)
-    assert(!releaseAfter);
-  spinlockAcquire(&blocking->LOCK_LL_BLOCKED);
+// Wait queues: a task queues itself up (taskBlockPrepare()), checks whatever
+// it's waiting for & goes to sleep (taskBlockSleep()) until it's woken up
+// (taskUnblock*()), its wakeAt passes or, if interruptible, a signal comes in.
+// Wakeups that happen in between are remembered, so none are ever lost.
+// Lock order: Blocking -> timer wheel -> LOCK_SCHED
 
-  // it's rare enough more than one task is blocked together, go through it
-  BlockedTask *browse = blocking->firstBlockedTask;
-  while (browse) {
-    if (browse->task == task)
-      debugf("[task::blocking] WARNING! Duplicate task!\n");
-    browse = browse->next;
-  }
+static bool taskBlockingLock(Blocking *blocking) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  spinlockAcquire(&blocking->LOCK_LL_BLOCKED);
+  return ints;
+}
 
-  BlockedTask *blockedTask = LinkedListAllocate(
-      (void **)(&blocking->firstBlockedTask), sizeof(BlockedTask));
-  blockedTask->task = task;
+static void taskBlockingUnlock(Blocking *blocking, bool ints) {
   spinlockRelease(&blocking->LOCK_LL_BLOCKED);
+  if (ints)
+    asm volatile("sti");
+}
 
-  // finally block
-  if (apply) {
+// Expects LOCK_LL_BLOCKED to be held
+static void taskBlockingUnlink(Blocking *blocking, BlockedTask *entry) {
+  if (!entry->queued)
+    return;
+
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    blocking->firstBlockedTask = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    blocking->lastBlockedTask = entry->prev;
+
+  entry->next = 0;
+  entry->prev = 0;
+  entry->queued = false;
+}
+
+// Expects LOCK_LL_BLOCKED to be held (the entry's gone as soon as it's not)
+static void taskBlockingWake(Blocking *blocking, BlockedTask *entry) {
+  Task *task = entry->task;
+  taskBlockingUnlink(blocking, entry);
+  entry->woken = true;
+  if (task->state != TASK_STATE_DEAD)
+    scheduleWake(task);
+}
+
+// Has to come before checking what's being waited for, & be followed by either
+// taskBlockSleep() or taskBlockCancel()
+void taskBlockPrepare(Blocking *blocking, BlockedTask *entry, void *key) {
+  entry->task = currentTask;
+  entry->key = key;
+  entry->woken = false;
+  entry->next = 0;
+
+  bool ints = taskBlockingLock(blocking);
+  entry->prev = blocking->lastBlockedTask;
+  if (blocking->lastBlockedTask)
+    blocking->lastBlockedTask->next = entry;
+  else
+    blocking->firstBlockedTask = entry;
+  blocking->lastBlockedTask = entry;
+  entry->queued = true;
+  taskBlockingUnlock(blocking, ints);
+}
+
+void taskBlockCancel(Blocking *blocking, BlockedTask *entry) {
+  bool ints = taskBlockingLock(blocking);
+  taskBlockingUnlink(blocking, entry);
+  taskBlockingUnlock(blocking, ints);
+}
+
+// Sleeps until woken up or wakeAt (timerTicks, if non-zero). releaseAfter (the
+// lock guarding what's waited on, if any) gets let go of once we're off the
+// CPU & isn't held on return.
+int taskBlockSleep(Blocking *blocking, BlockedTask *entry,
+                   Spinlock *releaseAfter, uint64_t wakeAt,
+                   bool interruptible) {
+  Task *task = currentTask;
+
+  bool ints = taskBlockingLock(blocking);
+  bool sleeping = !entry->woken && tasksInitiated;
+  if (sleeping) {
     if (releaseAfter)
       taskSpinlockExit(task, releaseAfter);
-    task->state = TASK_STATE_BLOCKED;
+    scheduleBlockUntil(interruptible ? TASK_STATE_INTERRUPTIBLE
+                                     : TASK_STATE_BLOCKED,
+                       wakeAt);
   }
+  taskBlockingUnlock(blocking, ints);
+
+  if (sleeping)
+    handControl();
+  // woken up (or signalled) before we even got off the CPU
+  if (task->spinlockQueueEntry) {
+    spinlockRelease(task->spinlockQueueEntry);
+    task->spinlockQueueEntry = 0;
+  } else if (!sleeping && releaseAfter)
+    spinlockRelease(releaseAfter);
+
+  ints = taskBlockingLock(blocking);
+  taskBlockingUnlink(blocking, entry);
+  bool woken = entry->woken;
+  taskBlockingUnlock(blocking, ints);
+
+  if (woken)
+    return BLOCK_WOKEN;
+  if (interruptible && signalsPendingQuick(task))
+    return BLOCK_INTERRUPTED;
+  if (wakeAt && timerTicks >= wakeAt)
+    return BLOCK_TIMEOUT;
+  return BLOCK_WOKEN; // by someone else, callers check again anyways
+}
+
+// For when releaseAfter is already held & everything's been checked under it
+int taskBlockWait(Blocking *blocking, Spinlock *releaseAfter, uint64_t wakeAt,
+                  bool interruptible) {
+  BlockedTask entry;
+  taskBlockPrepare(blocking, &entry, 0);
+  return taskBlockSleep(blocking, &entry, releaseAfter, wakeAt, interruptible);
 }
 
 void taskUnblock(Blocking *blocking) {
-  spinlockAcquire(&blocking->LOCK_LL_BLOCKED);
+  bool ints = taskBlockingLock(blocking);
+  while (blocking->firstBlockedTask)
+    taskBlockingWake(blocking, blocking->firstBlockedTask);
+  taskBlockingUnlock(blocking, ints);
+}
+
+// Wakes up the longest waiting task with key, if there's any
+bool taskUnblockOne(Blocking *blocking, void *key) {
+  bool         ints = taskBlockingLock(blocking);
   BlockedTask *browse = blocking->firstBlockedTask;
-  while (browse) {
-    BlockedTask *next = browse->next;
-    if (browse->task) {
-      Task *task = browse->task;
-      if (task->state != TASK_STATE_DEAD)
-        task->state = TASK_STATE_READY;
-    }
-    LinkedListRemove((void **)(&blocking->firstBlockedTask), browse);
-    browse = next;
-  }
-  spinlockRelease(&blocking->LOCK_LL_BLOCKED);
+  while (browse && browse->key != key)
+    browse = browse->next;
+  if (browse)
+    taskBlockingWake(blocking, browse);
+  taskBlockingUnlock(blocking, ints);
+  return browse;
 }
 
 // Will release lock when task isn't running via the kernel helper
@@ -516,19 +714,29 @@ void taskSpinlockExit(Task *task, Spinlock *lock) {
 }
 
 void kernelDummyEntry() {
-  while (true)
-    asm volatile("pause");
+  while (true) {
+    // no tick is coming to take us off, so look for work ourselves
+    if (scheduleHasWork())
+      handControl();
+    // nothing else to do, might as well zero some memory (see pmm.c)
+    else if (!PhysicalScrub())
+      asm volatile("pause");
+  }
 }
 
 void initiateTasks() {
-  firstTask = (Task *)malloc(sizeof(Task));
-  memset(firstTask, 0, sizeof(Task));
+  firstTask = (Task *)slabAlloc(&cacheTask);
+  lastTask = firstTask;
 
-  currentTask = firstTask;
-  currentTask->id = KERNEL_TASK_ID;
+  cpuLocal()->current = firstTask;
+  taskPidSet(currentTask, KERNEL_TASK_ID);
   currentTask->state = TASK_STATE_READY;
+  currentTask->cpu = cpuLocal()->id;
+  currentTask->running = true;
+  currentTask->onCpu = 1;
   currentTask->infoPd = taskInfoPdAllocate(false);
   currentTask->infoPd->pagedir = GetPageDirectory();
+  currentTask->infoPd->pcid = PagingPcidFind(currentTask->infoPd->pagedir);
   currentTask->kernel_task = true;
   currentTask->infoFs = taskInfoFsAllocate();
   currentTask->infoFiles = taskInfoFilesAllocate();
@@ -536,9 +744,8 @@ void initiateTasks() {
   currentTask->infoSignals = 0; // no, just no!
   taskNameKernel(currentTask, entryCmdline, sizeof(entryCmdline));
 
-  void  *tssRsp = VirtualAllocate(USER_STACK_PAGES);
+  void  *tssRsp = VirtualAllocateZeroed(USER_STACK_PAGES);
   size_t tssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(tssRsp, 0, tssRspSize);
   currentTask->whileTssRsp = (uint64_t)tssRsp + tssRspSize;
   taskAttachDefTermios(currentTask);
 
@@ -547,8 +754,8 @@ void initiateTasks() {
 
   // task 0 represents the execution we're in right now
 
-  // create a dummy task in case the scheduler has nothing to do
-  dummyTask = taskCreateKernel((uint64_t)kernelDummyEntry, 0);
-  dummyTask->state = TASK_STATE_DUMMY;
-  taskNameKernel(dummyTask, dummyCmdline, sizeof(dummyCmdline));
+  // create a dummy task in case the scheduler has nothing to do (every other
+  // CPU gets its own, see smp.c)
+  dummyTask = taskCreateIdle();
+  cpuLocal()->idleTask = dummyTask;
 }
\ No newline at end of file
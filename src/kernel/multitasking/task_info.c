@@ -12,6 +12,7 @@
 #include <syscalls.h>
 #include <task.h>
 #include <util.h>
+#include <vma.h>
 #include <vmm.h>
 
 // Spliting struct Task into smaller chunks to allow sharing
@@ -55,13 +56,14 @@ TaskInfoFs *taskInfoFsClone(TaskInfoFs *old) {
 TaskInfoPagedir *taskInfoPdAllocate(bool pagedir) {
   TaskInfoPagedir *target = calloc(sizeof(TaskInfoPagedir), 1);
   target->utilizedBy = 1;
-  if (pagedir)
+  if (pagedir) {
     target->pagedir = PageDirectoryAllocate();
+    target->pcid = PagingPcidFind(target->pagedir);
+  }
   target->heap_start = USER_HEAP_START;
   target->heap_end = USER_HEAP_START;
 
   target->mmap_start = USER_MMAP_START;
-  target->mmap_end = USER_MMAP_START;
   return target;
 }
 
@@ -74,22 +76,21 @@ TaskInfoPagedir *taskInfoPdClone(TaskInfoPagedir *old) {
   new->heap_end = old->heap_end;
 
   new->mmap_start = old->mmap_start;
-  new->mmap_end = old->mmap_end;
+
+  vmaClone(old, new);
   spinlockRelease(&old->LOCK_PD);
 
   return new;
 }
 
+// Called by the reaper, once the task is guaranteed to be off the CPU
 void taskInfoPdDiscard(TaskInfoPagedir *target) {
   spinlockAcquire(&target->LOCK_PD);
   target->utilizedBy--;
   if (!target->utilizedBy) {
+    vmaDiscard(target);
     PageDirectoryFree(target->pagedir);
-    // todo: find a safe way to free target
-    // cannot be done w/the current layout as it's done inside taskKill and the
-    // scheduler needs it in case it's switched in between (will point to
-    // invalid/unsafe memory). maybe with overrides but we'll see later when the
-    // system is more stable.
+    free(target);
   } else
     spinlockRelease(&target->LOCK_PD);
 }
@@ -108,17 +109,17 @@ TaskInfoFiles *taskInfoFilesAllocate() {
 // TaskInfoFiles *taskInfoFilesClone(TaskInfoFiles *old);
 
 void taskInfoFilesDiscard(TaskInfoFiles *target, void *task) {
-  spinlockCntWriteAcquire(&target->WLOCK_FILES);
+  rwlockWriteAcquire(&target->WLOCK_FILES);
   target->utilizedBy--;
   if (!target->utilizedBy) {
     // we don't care about locks anymore (we are alone in the darkness)
-    spinlockCntWriteRelease(&target->WLOCK_FILES);
+    rwlockWriteRelease(&target->WLOCK_FILES);
     while (target->firstFile)
       fsUserClose(task, target->firstFile->key);
     free(target->fdBitmap);
     free(target);
   } else
-    spinlockCntWriteRelease(&target->WLOCK_FILES);
+    rwlockWriteRelease(&target->WLOCK_FILES);
 }
 
 // Signal stuff
@@ -0,0 +1,268 @@
+bits 64
+
+; The vDSO: a tiny shared object mapped into every process (see vdso.c), so
+; that time & CPU queries don't have to go through a syscall. It's assembled
+; by hand, ELF structures included, as nothing for userland gets built along
+; with the kernel. The data page (VdsoData) gets mapped right after it.
+
+%define VDSO_CLOCK_TSC 1
+
+; VdsoData offsets (checked in vdso.c)
+%define VVAR_SEQ 0
+%define VVAR_MODE 4
+%define VVAR_BASE_NS 8
+%define VVAR_BASE_CYCLES 16
+%define VVAR_MULT 24
+%define VVAR_REALTIME_NS 32
+%define VVAR_RDTSCP 40
+
+%define SYSCALL_CLOCK_GETTIME 228
+%define SYSCALL_GETTIMEOFDAY 96
+%define SYSCALL_TIME 201
+%define SYSCALL_GETCPU 309
+
+%define NS_PER_SEC 1000000000
+
+%macro VDSO_SYMBOL 2 ; name, function
+  dd %1 - vdso_strtab ; st_name
+  db 0x12             ; st_info: STB_GLOBAL, STT_FUNC
+  db 0                ; st_other
+  dw 1                ; st_shndx: anything but SHN_UNDEF
+  dq %2 - vdso_image_start
+  dq 0
+%endmacro
+
+section .rodata align=4096
+
+global vdso_image_start
+global vdso_image_end
+
+vdso_image_start:
+  ; ELF header
+  db 0x7f, "ELF", 2, 1, 1, 0 ; 64-bit, little endian, current, SysV
+  times 8 db 0
+  dw 3                       ; ET_DYN
+  dw 62                      ; EM_X86_64
+  dd 1                       ; EV_CURRENT
+  dq 0                       ; e_entry
+  dq vdso_phdrs - vdso_image_start
+  dq 0                       ; e_shoff
+  dd 0                       ; e_flags
+  dw 64                      ; e_ehsize
+  dw 56                      ; e_phentsize
+  dw 2                       ; e_phnum
+  dw 64                      ; e_shentsize
+  dw 0                       ; e_shnum
+  dw 0                       ; e_shstrndx
+
+vdso_phdrs:
+  ; PT_LOAD, the whole image
+  dd 1
+  dd 5 ; PF_R | PF_X
+  dq 0
+  dq 0
+  dq 0
+  dq vdso_image_end - vdso_image_start
+  dq vdso_image_end - vdso_image_start
+  dq 0x1000
+  ; PT_DYNAMIC
+  dd 2
+  dd 4 ; PF_R
+  dq vdso_dynamic - vdso_image_start
+  dq vdso_dynamic - vdso_image_start
+  dq vdso_dynamic - vdso_image_start
+  dq vdso_dynamic_end - vdso_dynamic
+  dq vdso_dynamic_end - vdso_dynamic
+  dq 8
+
+align 8
+vdso_dynamic:
+  dq 4, vdso_hash - vdso_image_start   ; DT_HASH
+  dq 5, vdso_strtab - vdso_image_start ; DT_STRTAB
+  dq 6, vdso_symtab - vdso_image_start ; DT_SYMTAB
+  dq 10, vdso_strtab_end - vdso_strtab ; DT_STRSZ
+  dq 11, 24                            ; DT_SYMENT
+  dq 14, vdso_str_soname - vdso_strtab ; DT_SONAME
+  dq 0, 0                              ; DT_NULL
+vdso_dynamic_end:
+
+; SysV hash table with a single bucket, chaining every symbol
+align 4
+vdso_hash:
+  dd 1, 5          ; nbucket, nchain (symbols)
+  dd 1             ; bucket[0]
+  dd 0, 2, 3, 4, 0 ; chain[]
+
+align 8
+vdso_symtab:
+  times 24 db 0 ; STN_UNDEF
+  VDSO_SYMBOL vdso_str_clock_gettime, __vdso_clock_gettime
+  VDSO_SYMBOL vdso_str_gettimeofday, __vdso_gettimeofday
+  VDSO_SYMBOL vdso_str_time, __vdso_time
+  VDSO_SYMBOL vdso_str_getcpu, __vdso_getcpu
+
+vdso_strtab:
+  db 0
+vdso_str_soname:
+  db "linux-vdso.so.1", 0
+vdso_str_clock_gettime:
+  db "__vdso_clock_gettime", 0
+vdso_str_gettimeofday:
+  db "__vdso_gettimeofday", 0
+vdso_str_time:
+  db "__vdso_time", 0
+vdso_str_getcpu:
+  db "__vdso_getcpu", 0
+vdso_strtab_end:
+
+; rax = the time of clock edi in ns, with carry set if the kernel has to be
+; asked instead. Mirrors clockMonotonic() & clockRealtime() (clocksource.c).
+; Clobbers rdx, r8, r9, r10.
+align 16
+vdso_read_ns:
+  xor r10d, r10d ; realtime?
+  cmp edi, 0     ; CLOCK_REALTIME
+  je .realtime
+  cmp edi, 5     ; CLOCK_REALTIME_COARSE
+  je .realtime
+  cmp edi, 1     ; CLOCK_MONOTONIC
+  je .read
+  cmp edi, 4     ; CLOCK_MONOTONIC_RAW
+  je .read
+  cmp edi, 6     ; CLOCK_MONOTONIC_COARSE
+  je .read
+  cmp edi, 7     ; CLOCK_BOOTTIME
+  je .read
+  stc
+  ret
+
+.realtime:
+  mov r10d, 1
+.read:
+  lea r8, [rel vdso_data]
+.retry:
+  mov r9d, [r8 + VVAR_SEQ]
+  test r9d, 1 ; odd while the kernel's writing to it
+  jnz .busy
+  cmp dword [r8 + VVAR_MODE], VDSO_CLOCK_TSC
+  jne .unsupported
+
+  rdtsc
+  shl rdx, 32
+  or rax, rdx
+  sub rax, [r8 + VVAR_BASE_CYCLES]
+  jae .ahead
+  xor eax, eax ; another CPU's TSC, a hair behind
+.ahead:
+  mul qword [r8 + VVAR_MULT]
+  shrd rax, rdx, 32 ; CLOCKSOURCE_SHIFT
+  add rax, [r8 + VVAR_BASE_NS]
+  test r10d, r10d
+  jz .done
+  add rax, [r8 + VVAR_REALTIME_NS]
+.done:
+  cmp r9d, [r8 + VVAR_SEQ]
+  jne .retry
+  clc
+  ret
+
+.busy:
+  pause
+  jmp .retry
+.unsupported:
+  stc
+  ret
+
+; int clock_gettime(clockid_t clock, struct timespec *ts)
+align 16
+__vdso_clock_gettime:
+  call vdso_read_ns
+  jc .syscall
+  xor edx, edx
+  mov ecx, NS_PER_SEC
+  div rcx
+  mov [rsi], rax     ; tv_sec
+  mov [rsi + 8], rdx ; tv_nsec
+  xor eax, eax
+  ret
+.syscall:
+  mov eax, SYSCALL_CLOCK_GETTIME
+  syscall
+  ret
+
+; int gettimeofday(struct timeval *tv, struct timezone *tz)
+align 16
+__vdso_gettimeofday:
+  mov r11, rdi
+  xor edi, edi ; CLOCK_REALTIME
+  call vdso_read_ns
+  mov rdi, r11
+  jc .syscall
+  test rdi, rdi
+  jz .zone
+  xor edx, edx
+  mov ecx, 1000
+  div rcx ; us
+  xor edx, edx
+  mov ecx, 1000000
+  div rcx
+  mov [rdi], rax     ; tv_sec
+  mov [rdi + 8], rdx ; tv_usec
+.zone:
+  test rsi, rsi
+  jz .done
+  mov qword [rsi], 0 ; UTC, no DST
+.done:
+  xor eax, eax
+  ret
+.syscall:
+  mov eax, SYSCALL_GETTIMEOFDAY
+  syscall
+  ret
+
+; time_t time(time_t *tloc)
+align 16
+__vdso_time:
+  mov r11, rdi
+  xor edi, edi ; CLOCK_REALTIME
+  call vdso_read_ns
+  mov rdi, r11
+  jc .syscall
+  xor edx, edx
+  mov ecx, NS_PER_SEC
+  div rcx
+  test rdi, rdi
+  jz .done
+  mov [rdi], rax
+.done:
+  ret
+.syscall:
+  mov eax, SYSCALL_TIME
+  syscall
+  ret
+
+; int getcpu(unsigned *cpu, unsigned *node, void *cache)
+align 16
+__vdso_getcpu:
+  lea r8, [rel vdso_data]
+  cmp dword [r8 + VVAR_RDTSCP], 0
+  je .syscall
+  rdtscp ; ecx = TSC_AUX, the CPU's index (see smp.c)
+  test rdi, rdi
+  jz .node
+  mov [rdi], ecx
+.node:
+  test rsi, rsi
+  jz .done
+  mov dword [rsi], 0
+.done:
+  xor eax, eax
+  ret
+.syscall:
+  mov eax, SYSCALL_GETCPU
+  syscall
+  ret
+
+  times 0x1000 - ($ - vdso_image_start) db 0
+vdso_image_end:
+vdso_data: ; where VdsoData ends up
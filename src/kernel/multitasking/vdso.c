@@ -0,0 +1,88 @@
+#include <bootloader.h>
+#include <clocksource.h>
+#include <paging.h>
+#include <pmm.h>
+#include <string.h>
+#include <system.h>
+#include <timer.h>
+#include <util.h>
+#include <vdso.h>
+
+// vDSO, the shared object every process gets for syscall-free timekeeping
+// Copyright (C) 2025 Panagiotis
+
+_Static_assert(offsetof(VdsoData, seq) == 0, "see vdso.asm");
+_Static_assert(offsetof(VdsoData, clockMode) == 4, "see vdso.asm");
+_Static_assert(offsetof(VdsoData, baseNs) == 8, "see vdso.asm");
+_Static_assert(offsetof(VdsoData, baseCycles) == 16, "see vdso.asm");
+_Static_assert(offsetof(VdsoData, mult) == 24, "see vdso.asm");
+_Static_assert(offsetof(VdsoData, realtimeNs) == 32, "see vdso.asm");
+_Static_assert(offsetof(VdsoData, rdtscp) == 40, "see vdso.asm");
+
+extern uint8_t vdso_image_start[];
+extern uint8_t vdso_image_end[];
+
+VdsoData *vdsoData = 0;
+
+// both shared by every process, never freed
+static size_t vdsoImagePhys = 0;
+static size_t vdsoDataPhys = 0;
+
+// RDTSCP (CPUID.80000001h:EDX[27])
+bool vdsoRdtscpSupported() {
+  uint32_t eax = 0x80000000, ebx = 0, ecx = 0, edx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  if (eax < 0x80000001)
+    return false;
+
+  eax = 0x80000001;
+  ecx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  return (edx >> 27) & 1;
+}
+
+void initiateVdso() {
+  size_t size = (size_t)vdso_image_end - (size_t)vdso_image_start;
+  if (size != PAGE_SIZE) {
+    debugf("[vdso] FATAL! Image isn't a single page! size{%lx}\n", size);
+    panic();
+  }
+
+  vdsoImagePhys = PhysicalAllocate(1);
+  memcpy((void *)(vdsoImagePhys + bootloader.hhdmOffset), vdso_image_start,
+         size);
+
+  vdsoDataPhys = PhysicalAllocateZeroed(1);
+  vdsoData = (VdsoData *)(vdsoDataPhys + bootloader.hhdmOffset);
+  vdsoData->rdtscp = vdsoRdtscpSupported();
+
+  debugf("[vdso] Ready: image{%lx} data{%lx} rdtscp{%d}\n", USER_VDSO_IMAGE,
+         USER_VDSO_DATA, vdsoData->rdtscp);
+}
+
+// Maps both pages read-only into the address space, returning where the image
+// went (for AT_SYSINFO_EHDR). Each mapping holds its own reference, so they go
+// through fork() & teardown just like any other user page.
+uint64_t vdsoMap(uint64_t *pagedir) {
+  PhysicalReference(vdsoImagePhys);
+  VirtualMapL(pagedir, USER_VDSO_IMAGE, vdsoImagePhys, PF_USER);
+  PhysicalReference(vdsoDataPhys);
+  VirtualMapL(pagedir, USER_VDSO_DATA, vdsoDataPhys, PF_USER);
+  return USER_VDSO_IMAGE;
+}
+
+// Publishes the clocksource's state (see clocksourceSwitch()). Only ever done
+// while a single CPU is up, but userland might be reading it on another one.
+void vdsoClockUpdate(uint32_t mode, uint64_t baseNs, uint64_t baseCycles,
+                     uint64_t mult) {
+  if (!vdsoData)
+    return;
+
+  atomicWrite32(&vdsoData->seq, vdsoData->seq + 1);
+  vdsoData->clockMode = mode;
+  vdsoData->baseNs = baseNs;
+  vdsoData->baseCycles = baseCycles;
+  vdsoData->mult = mult;
+  vdsoData->realtimeNs = timerBootUnix * NS_PER_SEC;
+  atomicWrite32(&vdsoData->seq, vdsoData->seq + 1);
+}
@@ -2602,6 +2602,11 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
   } else {
     SYS_ARCH_UNPROTECT(lev);
   }
+#ifdef LWIP_HOOK_SOCKETS_EVENT
+  if (check_waiters) {
+    LWIP_HOOK_SOCKETS_EVENT(s, evt);
+  }
+#endif /* LWIP_HOOK_SOCKETS_EVENT */
   done_socket(sock);
 }
 
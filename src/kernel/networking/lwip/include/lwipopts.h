@@ -35,17 +35,15 @@
 #define SYS_LIGHTWEIGHT_PROT 0
 #define LWIP_COMPAT_SOCKETS 0
 
-typedef struct mboxBlock {
-  struct mboxBlock *next;
-
-  Task *task;
-  bool  write;
-} mboxBlock;
+// poll()/epoll_wait() get woken up on socket events (see sockets.c)
+void pollWake();
+#define LWIP_HOOK_SOCKETS_EVENT(s, evt) pollWake()
 
 typedef struct {
   Spinlock LOCK;
 
-  mboxBlock *firstBlock;
+  Blocking blockingFetch; // waiting for messages
+  Blocking blockingPost;  // waiting for room
 
   bool   invalid;
   int    ptrRead;
@@ -11,7 +11,7 @@
 #include <lwip/sys.h>
 #include <timer.h>
 
-#include <linked_list.h>
+#include <clocksource.h>
 
 // lwip glue code for cavOS
 // Copyright (C) 2024 Panagiotis
@@ -33,9 +33,7 @@ err_t sys_sem_new(sys_sem_t *sem, uint8_t cnt) {
     debugf("[lwip::glue::sem::new] cnt{%d}\n", cnt);
     panic();
   }
-  sem->invalid = false;
-  sem->cnt = 0;
-  sys_mutex_new(&sem->LOCK);
+  memset(sem, 0, sizeof(sys_sem_t));
 
   return ERR_OK;
 }
@@ -43,10 +41,6 @@ err_t sys_sem_new(sys_sem_t *sem, uint8_t cnt) {
 void sys_sem_signal(sys_sem_t *sem) { semaphorePost(sem); }
 
 uint32_t sys_arch_sem_wait(sys_sem_t *sem, uint32_t timeout) {
-  if (timeout) {
-    debugf("[lwip::glue] todo: Timeout\n");
-    panic();
-  }
   bool ret = semaphoreWait(sem, timeout);
   return ret ? 0 : SYS_ARCH_TIMEOUT;
 }
@@ -64,7 +58,7 @@ void sys_sem_set_invalid(sys_sem_t *sem) {
 
 int sys_sem_valid(sys_sem_t *sem) { return !sem->invalid; }
 
-uint32_t sys_now(void) { return timerBootUnix * 1000 + timerTicks; }
+uint32_t sys_now(void) { return clockRealtime() / NS_PER_MS; }
 
 sys_thread_t sys_thread_new(const char *pcName,
                             void (*pxThread)(void *pvParameters), void *pvArg,
@@ -108,22 +102,11 @@ int sys_mbox_valid(sys_mbox_t *mbox) {
   return ret;
 }
 
+// Expects q->LOCK to be held, releases it
 void sys_mbox_post_unsafe(sys_mbox_t *q, void *msg) {
-  // spinlockAcquire(&q->LOCK);
   q->msges[q->ptrWrite] = msg;
   q->ptrWrite = (q->ptrWrite + 1) % q->size;
-
-  mboxBlock *browse = q->firstBlock;
-  while (browse) {
-    mboxBlock *next = browse->next;
-    if (browse->write == false) {
-      browse->task->forcefulWakeupTimeUnsafe = 0;
-      browse->task->state = TASK_STATE_READY;
-      LinkedListRemove((void **)&q->firstBlock, browse);
-    }
-    browse = next;
-  }
-
+  taskUnblockOne(&q->blockingFetch, 0);
   spinlockRelease(&q->LOCK);
 }
 
@@ -132,10 +115,7 @@ void sys_mbox_post(sys_mbox_t *q, void *msg) {
     spinlockAcquire(&q->LOCK);
     if ((q->ptrWrite + 1) % q->size != q->ptrRead)
       break;
-    spinlockRelease(&q->LOCK);
-    // would optimize blocking here too (with the write field) but it happens so
-    // rarely it's not worth it
-    handControl();
+    taskBlockWait(&q->blockingPost, &q->LOCK, 0, false);
   }
 
   sys_mbox_post_unsafe(q, msg);
@@ -157,34 +137,26 @@ err_t sys_mbox_trypost_fromisr(sys_mbox_t *q, void *msg) {
   return sys_mbox_trypost(q, msg); // xd
 }
 
+// Expects q->LOCK to be held, releases it
+static void sys_arch_mbox_fetch_unsafe(sys_mbox_t *q, void **msg) {
+  *msg = q->msges[q->ptrRead];
+  q->ptrRead = (q->ptrRead + 1) % q->size;
+  taskUnblockOne(&q->blockingPost, 0);
+  spinlockRelease(&q->LOCK);
+}
+
 u32_t sys_arch_mbox_fetch(sys_mbox_t *q, void **msg, u32_t timeout) {
-  uint64_t timeStart = timerTicks;
+  uint64_t wakeAt = timeout ? timerTicks + timeout : 0;
   while (true) {
     spinlockAcquire(&q->LOCK);
     if (q->ptrRead != q->ptrWrite)
       break;
-    // spinlockRelease(&q->LOCK);
-    if (timeout && timerTicks >= (timeStart + timeout)) {
-      spinlockRelease(&q->LOCK);
+    if (taskBlockWait(&q->blockingFetch, &q->LOCK, wakeAt, false) ==
+        BLOCK_TIMEOUT)
       return SYS_ARCH_TIMEOUT;
-    }
-    if (timeout)
-      currentTask->forcefulWakeupTimeUnsafe = timeStart + timeout;
-    mboxBlock *block =
-        LinkedListAllocate((void **)&q->firstBlock, sizeof(mboxBlock));
-    block->task = currentTask;
-    block->write = false;
-    taskSpinlockExit(currentTask, &q->LOCK);
-    currentTask->state = TASK_STATE_BLOCKED;
-    handControl();
-    assert(!currentTask->forcefulWakeupTimeUnsafe);
   }
 
-  // spinlockAcquire(&q->LOCK);
-  *msg = q->msges[q->ptrRead];
-  q->ptrRead = (q->ptrRead + 1) % q->size;
-  spinlockRelease(&q->LOCK);
-
+  sys_arch_mbox_fetch_unsafe(q, msg);
   return 0;
 }
 
@@ -195,11 +167,7 @@ u32_t sys_arch_mbox_tryfetch(sys_mbox_t *q, void **msg) {
     return SYS_MBOX_EMPTY;
   }
 
-  // spinlockAcquire(&q->LOCK);
-  *msg = q->msges[q->ptrRead];
-  q->ptrRead = (q->ptrRead + 1) % q->size;
-  spinlockRelease(&q->LOCK);
-
+  sys_arch_mbox_fetch_unsafe(q, msg);
   return ERR_OK;
 }
 
@@ -3,6 +3,7 @@
 #include <kb.h>
 #include <linux.h>
 #include <malloc.h>
+#include <poll.h>
 #include <syscalls.h>
 #include <task.h>
 
@@ -14,6 +15,7 @@ typedef struct EventFd {
 
   int      utilizedBy;
   Spinlock LOCK_EVENTFD;
+  Blocking blocking; // readers & writers alike
 } EventFd;
 
 size_t eventFdOpen(uint64_t initValue, int flags) {
@@ -78,13 +80,14 @@ size_t eventFdRead(OpenFile *fd, uint8_t *out, size_t limit) {
       spinlockRelease(&eventFd->LOCK_EVENTFD);
       return ERR(EWOULDBLOCK);
     }
-    spinlockRelease(&eventFd->LOCK_EVENTFD);
-    handControl();
+    taskBlockWait(&eventFd->blocking, &eventFd->LOCK_EVENTFD, 0, true);
   }
 
   atomicWrite64((void *)out, eventFd->counter);
   eventFd->counter = 0;
+  taskUnblock(&eventFd->blocking);
   spinlockRelease(&eventFd->LOCK_EVENTFD);
+  pollWake();
   return 8;
 }
 
@@ -105,12 +108,13 @@ size_t eventFdWrite(OpenFile *fd, uint8_t *in, size_t limit) {
       spinlockRelease(&eventFd->LOCK_EVENTFD);
       return ERR(EWOULDBLOCK);
     }
-    spinlockRelease(&eventFd->LOCK_EVENTFD);
-    handControl();
+    taskBlockWait(&eventFd->blocking, &eventFd->LOCK_EVENTFD, 0, true);
   }
 
   eventFd->counter += toAdd;
+  taskUnblock(&eventFd->blocking);
   spinlockRelease(&eventFd->LOCK_EVENTFD);
+  pollWake();
   return 8;
 }
 
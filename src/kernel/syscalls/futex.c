@@ -1,209 +1,318 @@
-#include <console.h>
-#include <fb.h>
-#include <kb.h>
+#include <clocksource.h>
 #include <linux.h>
-#include <malloc.h>
 #include <paging.h>
+#include <schedule.h>
 #include <syscalls.h>
 #include <system.h>
 #include <task.h>
 #include <timer.h>
-
-#include <avl_tree.h>
-#include <linked_list.h>
+#include <util.h>
+#include <vma.h>
 
 // Futex syscall for fast userspace locking
 // Copyright (C) 2025 Panagiotis
 
-typedef struct FutexAsleep {
-  struct FutexAsleep *next;
-  struct Futex       *above;
-
-  bool  awoken;
-  Task *task;
-} FutexAsleep;
-
-typedef struct Futex {
-  Spinlock LOCK_PROP;
-
-  FutexAsleep *firstAsleep;
-  // int          pid; // really it is tgid but whatever
-} Futex;
-
-// todo: find some sensible way to clean all of these up after use
-AVLheader *firstFutex = 0;
-Spinlock   LOCK_AVL_FUTEX = {0};
-
-Futex *futexFind(size_t phys) {
-  spinlockAcquire(&LOCK_AVL_FUTEX);
-  Futex *futex = (Futex *)AVLLookup(firstFutex, phys);
-  if (futex)
-    goto cleanup;
-
-  // not found, create it
-  futex = calloc(sizeof(Futex), 1);
-  AVLAllocate((void **)&firstFutex, phys, (avlval)futex);
-cleanup:
-  spinlockAcquire(&futex->LOCK_PROP);
-  spinlockRelease(&LOCK_AVL_FUTEX);
-  return futex;
+// Waiters are kept in a fixed-size hash of buckets, each with its own lock, so
+// unrelated futexes rarely get in each other's way. Nothing is allocated: the
+// waiter entries live on the waiting tasks' stacks & are gone with them, so
+// there's nothing left behind once nobody's waiting on a futex anymore.
+#define FUTEX_BUCKETS_BITS 8
+#define FUTEX_BUCKETS (1 << FUTEX_BUCKETS_BITS)
+
+// Private futexes are told apart by address space & virtual address. Shared
+// ones by the physical address (mm is 0), so they work across address spaces.
+// Only MAP_SHARED memory keeps the same pageframe across address spaces though
+// (anything else gets split up by copy-on-write), so the rest always counts as
+// private no matter what userland says.
+typedef struct FutexKey {
+  void  *mm;
+  size_t addr;
+} FutexKey;
+
+typedef struct FutexBucket FutexBucket;
+
+typedef struct FutexWaiter {
+  struct FutexWaiter *next;
+  struct FutexWaiter *prev;
+
+  FutexBucket *bucket; // the one it's on, changes when requeued
+  FutexKey     key;
+  uint32_t     bitset;
+  Task        *task;
+  bool         queued; // taken off by whoever wakes it up
+} FutexWaiter;
+
+struct FutexBucket {
+  Spinlock     LOCK_BUCKET;
+  FutexWaiter *firstWaiter;
+  FutexWaiter *lastWaiter;
+};
+
+static FutexBucket futexBuckets[FUTEX_BUCKETS] = {0};
+
+static FutexBucket *futexBucket(FutexKey *key) {
+  uint64_t hash = (key->addr >> 2) ^ ((size_t)key->mm >> 4);
+  hash *= 0x9E3779B97F4A7C15ULL; // fibonacci hashing
+  return &futexBuckets[hash >> (64 - FUTEX_BUCKETS_BITS)];
 }
 
-size_t futexSyscall(uint32_t *addr, int op, uint32_t value,
-                    struct timespec *utime, uint32_t *addr2, uint32_t value3) {
-  /* Don't use currentTask here as FUTEX_WAKE is used by task exit */
+static bool futexKeyEqual(FutexKey *a, FutexKey *b) {
+  return a->mm == b->mm && a->addr == b->addr;
+}
 
-  /*debugf("FUTEX! HIDE THE KIDS!! addr{%lx} op{%x} value{%d} utime{%lx} "
-         "uaddr2{%lx} value3{%d}\n",
-         addr, op, value, utime, addr2, value3);*/
-  if (op & FUTEX_CLOCK_REALTIME) {
-    debugf("[futex] Seriously, it uses FUTEX_CLOCK_REALTIME: op{%x}\n", op);
-    panic();
+static size_t futexKeyGet(uint32_t *addr, bool private, FutexKey *key) {
+  if (!addr || ((size_t)addr % 4) != 0)
+    return ERR(EINVAL);
+  (void)atomicRead32(addr); // demand-paged memory has to be faulted in
+
+  // (for exit wakeups that's the dead task's address space too, see taskKill())
+  TaskInfoPagedir *info = currentTask->infoPd;
+  if (!private) {
+    spinlockAcquire(&info->LOCK_PD);
+    VmArea *vma = vmaFind(info, (size_t)addr);
+    private = !vma || !vma->shared;
+    spinlockRelease(&info->LOCK_PD);
   }
 
-  // todo: we wont care about private rn
-  // bool private = op & FUTEX_PRIVATE_FLAG;
-  op &= ~FUTEX_PRIVATE_FLAG;
+  if (private) {
+    key->mm = info;
+    key->addr = (size_t)addr;
+    return 0;
+  }
 
-  size_t phys = 0;
-  if (op == FUTEX_WAIT || op == FUTEX_WAKE || op == FUTEX_REQUEUE) {
-    if (!addr || ((size_t)addr % 4) != 0)
-      return ERR(EINVAL);
-    phys = VirtualToPhysical((size_t)addr);
-    assert(phys);
-    dbgSysExtraf("phys{%lx}", phys);
+  // shared mappings are never copied on write, so the pageframe stays put
+  key->mm = 0;
+  key->addr = VirtualToPhysical((size_t)addr);
+  if (!key->addr) // got unmapped right after being faulted in
+    return ERR(EFAULT);
+  dbgSysExtraf("phys{%lx}", key->addr);
+  return 0;
+}
+
+// Expects the bucket to be held
+static void futexQueue(FutexBucket *bucket, FutexWaiter *waiter) {
+  waiter->bucket = bucket;
+  waiter->next = 0;
+  waiter->prev = bucket->lastWaiter;
+  if (bucket->lastWaiter)
+    bucket->lastWaiter->next = waiter;
+  else
+    bucket->firstWaiter = waiter;
+  bucket->lastWaiter = waiter;
+  waiter->queued = true;
+}
+
+// Expects the bucket to be held
+static void futexUnqueue(FutexBucket *bucket, FutexWaiter *waiter) {
+  if (waiter->prev)
+    waiter->prev->next = waiter->next;
+  else
+    bucket->firstWaiter = waiter->next;
+  if (waiter->next)
+    waiter->next->prev = waiter->prev;
+  else
+    bucket->lastWaiter = waiter->prev;
+
+  waiter->next = 0;
+  waiter->prev = 0;
+  waiter->queued = false;
+}
+
+// Locks whichever bucket the waiter is on right now (requeueing moves it, with
+// both buckets held)
+static FutexBucket *futexWaiterLock(FutexWaiter *waiter) {
+  while (true) {
+    FutexBucket *bucket =
+        (FutexBucket *)atomicRead64((volatile uint64_t *)&waiter->bucket);
+    spinlockAcquire(&bucket->LOCK_BUCKET);
+    if (waiter->bucket == bucket)
+      return bucket;
+    spinlockRelease(&bucket->LOCK_BUCKET);
   }
+}
 
-  size_t phys2 = 0;
-  if (op == FUTEX_REQUEUE) {
-    if (!addr2 || ((size_t)addr2 % 4) != 0)
-      return ERR(EINVAL);
-    phys2 = VirtualToPhysical((size_t)addr2);
-    assert(phys2);
-    dbgSysExtraf("phys2{%lx}", phys2);
+// Always in the same order, so two requeues the other way around can't
+// deadlock
+static void futexBucketsLock(FutexBucket *a, FutexBucket *b) {
+  if (a == b) {
+    spinlockAcquire(&a->LOCK_BUCKET);
+    return;
   }
+  if (a > b) {
+    FutexBucket *tmp = a;
+    a = b;
+    b = tmp;
+  }
+  spinlockAcquire(&a->LOCK_BUCKET);
+  spinlockAcquire(&b->LOCK_BUCKET);
+}
 
-  switch (op) {
-  case FUTEX_WAIT: {
-    if (atomicRead32(addr) != value)
-      return ERR(EAGAIN);
-    size_t ret = -1;
-
-    Futex *futex = futexFind(phys);
-    // if (private)
-    //   futex->pid = currentTask->pgid;
-
-    FutexAsleep *asleep =
-        LinkedListAllocate((void **)&futex->firstAsleep, sizeof(FutexAsleep));
-    asleep->above = futex;
-    asleep->task = currentTask;
-
-    // spinlockRelease(&futex->LOCK_PROP);
-    taskSpinlockExit(currentTask, &futex->LOCK_PROP);
-    if (utime)
-      currentTask->forcefulWakeupTimeUnsafe =
-          timerTicks + DivRoundUp(utime->tv_nsec, 1000000) +
-          utime->tv_sec * 1000;
-    currentTask->state = TASK_STATE_FUTEX;
-    while (currentTask->state != TASK_STATE_READY)
-      handControl();
-    assert(!currentTask->forcefulWakeupTimeUnsafe);
-
-    // figure out what happened to wake us up from our nap
-    Futex *newfutex = asleep->above; // might've changed!
-    spinlockAcquire(&newfutex->LOCK_PROP);
-    if (asleep->awoken)
-      ret = 0;
-    else { // either timeout, or a pending signal
-      if (signalsPendingQuick(currentTask))
-        ret = ERR(EINTR);
-      else
-        ret = ERR(ETIMEDOUT);
-    }
+static void futexBucketsUnlock(FutexBucket *a, FutexBucket *b) {
+  if (a != b)
+    spinlockRelease(&b->LOCK_BUCKET);
+  spinlockRelease(&a->LOCK_BUCKET);
+}
 
-    // get rid of it, we are done
-    assert(LinkedListRemove((void **)&newfutex->firstAsleep, asleep));
-    spinlockRelease(&newfutex->LOCK_PROP);
+// Converts the timeout to timerTicks. FUTEX_WAIT's is relative, while
+// FUTEX_WAIT_BITSET's is absolute (on whichever clock was asked for)
+static uint64_t futexWakeAt(struct timespec *utime, bool absolute,
+                            bool realtime) {
+  if (!utime)
+    return 0;
 
-    return ret;
-    break;
+  uint64_t ns = utime->tv_sec * NS_PER_SEC + utime->tv_nsec;
+  if (absolute) {
+    uint64_t now = realtime ? clockRealtime() : clockMonotonic();
+    if (ns <= now)
+      return timerTicks; // (not 0, that'd be forever)
+    ns -= now;
   }
-  case FUTEX_WAKE: {
-    /* Don't use currentTask here as FUTEX_WAKE is used by task exit */
-    uint8_t currentTask = 0;
-    (void)currentTask;
-
-    Futex       *futex = futexFind(phys);
-    FutexAsleep *browse = futex->firstAsleep;
-    int          awokenCnt = 0;
-
-    while (browse) {
-      if (!browse->awoken && awokenCnt < value) {
-        // wake it up
-        browse->task->forcefulWakeupTimeUnsafe = 0;
-        browse->task->state = TASK_STATE_READY;
-        browse->awoken = true;
-        awokenCnt++; // ack
-      }
-      browse = browse->next;
+
+  return timerTicks + DivRoundUp(ns, 1000000);
+}
+
+static size_t futexWait(uint32_t *addr, FutexKey *key, uint32_t value,
+                        uint32_t bitset, uint64_t wakeAt) {
+  Task        *task = currentTask;
+  FutexWaiter  waiter = {.key = *key, .bitset = bitset, .task = task};
+  FutexBucket *bucket = futexBucket(key);
+
+  // checked under the bucket, so a wakeup after the value changed can't be
+  // missed
+  spinlockAcquire(&bucket->LOCK_BUCKET);
+  if (atomicRead32(addr) != value) {
+    spinlockRelease(&bucket->LOCK_BUCKET);
+    return ERR(EAGAIN);
+  }
+  futexQueue(bucket, &waiter);
+
+  taskSpinlockExit(task, &bucket->LOCK_BUCKET);
+  scheduleBlockUntil(TASK_STATE_FUTEX, wakeAt);
+  while (task->state != TASK_STATE_READY)
+    handControl();
+  assert(!task->forcefulWakeupTimeUnsafe);
+
+  // figure out what happened to wake us up from our nap
+  bucket = futexWaiterLock(&waiter); // might've changed!
+  bool woken = !waiter.queued;
+  if (!woken)
+    futexUnqueue(bucket, &waiter);
+  spinlockRelease(&bucket->LOCK_BUCKET);
+
+  if (woken)
+    return 0;
+  if (signalsPendingQuick(task)) // either a pending signal, or timeout
+    return ERR(EINTR);
+  return ERR(ETIMEDOUT);
+}
+
+// Expects the bucket to be held. Returns how many got woken up
+static size_t futexWakeLocked(FutexBucket *bucket, FutexKey *key,
+                              uint32_t max, uint32_t bitset) {
+  size_t       awokenCnt = 0;
+  FutexWaiter *browse = bucket->firstWaiter;
+  while (browse && awokenCnt < max) {
+    FutexWaiter *next = browse->next; // gone as soon as the bucket's let go
+    if (futexKeyEqual(&browse->key, key) && (browse->bitset & bitset)) {
+      futexUnqueue(bucket, browse);
+      scheduleWake(browse->task);
+      awokenCnt++;
     }
-    spinlockRelease(&futex->LOCK_PROP);
+    browse = next;
+  }
+  return awokenCnt;
+}
+
+static size_t futexWake(FutexKey *key, uint32_t max, uint32_t bitset) {
+  FutexBucket *bucket = futexBucket(key);
+  spinlockAcquire(&bucket->LOCK_BUCKET);
+  size_t awokenCnt = futexWakeLocked(bucket, key, max, bitset);
+  spinlockRelease(&bucket->LOCK_BUCKET);
+  return awokenCnt;
+}
 
-    return awokenCnt;
-    break;
+// Wakes up to max waiters & moves up to maxRequeue of the rest onto key2.
+// compare is only checked against *addr for FUTEX_CMP_REQUEUE
+static size_t futexRequeue(uint32_t *addr, FutexKey *key, FutexKey *key2,
+                           uint32_t max, uint32_t maxRequeue, bool cmp,
+                           uint32_t compare) {
+  FutexBucket *bucket = futexBucket(key);
+  FutexBucket *bucket2 = futexBucket(key2);
+  futexBucketsLock(bucket, bucket2);
+
+  if (cmp && atomicRead32(addr) != compare) {
+    futexBucketsUnlock(bucket, bucket2);
+    return ERR(EAGAIN);
   }
-  case FUTEX_REQUEUE: {
-    Futex *futex = futexFind(phys);
-    Futex *futex2 = futexFind(phys2);
-
-    FutexAsleep *browse = futex->firstAsleep;
-    int          awokenCnt = 0;
-    int          movedCnt = 0;
-
-    while (browse) {
-      if (!browse->awoken && awokenCnt < value) {
-        // wake it up
-        browse->task->forcefulWakeupTimeUnsafe = 0;
-        browse->task->state = TASK_STATE_READY;
-        browse->awoken = true;
-        awokenCnt++; // ack
-      } else if (!browse->awoken && movedCnt < (uint32_t)(size_t)(utime)) {
-        // move those
-        movedCnt++;
-        FutexAsleep *next = browse->next;
-        assert(LinkedListUnregister((void **)&futex->firstAsleep, browse));
-        browse->next = 0;
-        browse->above = futex2;
-        // LinkedListPushFrontUnsafe((void **)&futex2->firstAsleep, browse);
-        FutexAsleep *b = futex2->firstAsleep;
-        if (!b)
-          futex2->firstAsleep = browse;
-        else {
-          while (b) {
-            if (!b->next)
-              break;
-            b = b->next;
-          }
-          b->next = browse;
-        }
-        browse = next;
-        continue;
+
+  size_t awokenCnt =
+      futexWakeLocked(bucket, key, max, FUTEX_BITSET_MATCH_ANY);
+
+  // & whoever's left after that gets moved over
+  size_t       movedCnt = 0;
+  FutexWaiter *browse = bucket->firstWaiter;
+  while (browse && movedCnt < maxRequeue) {
+    FutexWaiter *next = browse->next;
+    if (futexKeyEqual(&browse->key, key)) {
+      browse->key = *key2;
+      if (bucket != bucket2) {
+        futexUnqueue(bucket, browse);
+        futexQueue(bucket2, browse);
       }
-      browse = browse->next;
+      movedCnt++;
     }
-    spinlockRelease(&futex2->LOCK_PROP);
-    spinlockRelease(&futex->LOCK_PROP);
+    browse = next;
+  }
 
-    return awokenCnt + movedCnt;
-    break;
+  futexBucketsUnlock(bucket, bucket2);
+  return awokenCnt + movedCnt;
+}
+
+size_t futexSyscall(uint32_t *addr, int op, uint32_t value,
+                    struct timespec *utime, uint32_t *addr2, uint32_t value3) {
+  /* FUTEX_WAKE is also used by task exit, for whichever task died */
+
+  /*debugf("FUTEX! HIDE THE KIDS!! addr{%lx} op{%x} value{%d} utime{%lx} "
+         "uaddr2{%lx} value3{%d}\n",
+         addr, op, value, utime, addr2, value3);*/
+  bool private = op & FUTEX_PRIVATE_FLAG;
+  bool realtime = op & FUTEX_CLOCK_REALTIME;
+  op &= FUTEX_CMD_MASK;
+  if (realtime && op != FUTEX_WAIT && op != FUTEX_WAIT_BITSET)
+    return ERR(ENOSYS);
+
+  FutexKey key = {0};
+  size_t   ret = futexKeyGet(addr, private, &key);
+  if (RET_IS_ERR(ret))
+    return ret;
+
+  // for the requeues, utime is really the max amount to move
+  switch (op) {
+  case FUTEX_WAIT:
+    return futexWait(addr, &key, value, FUTEX_BITSET_MATCH_ANY,
+                     futexWakeAt(utime, false, realtime));
+  case FUTEX_WAIT_BITSET:
+    if (!value3)
+      return ERR(EINVAL);
+    return futexWait(addr, &key, value, value3,
+                     futexWakeAt(utime, true, realtime));
+  case FUTEX_WAKE:
+    return futexWake(&key, value, FUTEX_BITSET_MATCH_ANY);
+  case FUTEX_WAKE_BITSET:
+    if (!value3)
+      return ERR(EINVAL);
+    return futexWake(&key, value, value3);
+  case FUTEX_REQUEUE:
+  case FUTEX_CMP_REQUEUE: {
+    FutexKey key2 = {0};
+    ret = futexKeyGet(addr2, private, &key2);
+    if (RET_IS_ERR(ret))
+      return ret;
+    return futexRequeue(addr, &key, &key2, value, (uint32_t)(size_t)utime,
+                        op == FUTEX_CMP_REQUEUE, value3);
   }
   default:
     debugf("[futex] Invalid operation{%x}\n", op);
-    panic();
     return ERR(ENOSYS);
-    break;
   }
-
-  debugf("[futex] Dead-end. It requires some serious effort to end up here!\n");
-  assert(false);
 }
@@ -117,17 +117,14 @@ size_t statHandler(OpenFile *fd, stat *target) {
   return 0;
 }
 
-// if this doesn't give you enough cues as to why you NEED to avoid the kernel
-// shell at all costs then idk what does. the reason this exists btw is for
-// bash's readline to not freak out over pselect6()
-bool ioSwitch = false;
-int  internalPollHandler(OpenFile *fd, int events) {
+// Readable once something's been typed that nobody's read yet, which wakes
+// pollers up as well (see kbIrq())
+int internalPollHandler(OpenFile *fd, int events) {
   int revents = 0;
-  if (events & EPOLLIN && ioSwitch)
+  if (events & EPOLLIN && kbHasInput())
     revents |= EPOLLIN;
   if (events & EPOLLOUT)
     revents |= EPOLLOUT;
-  ioSwitch = !ioSwitch;
   return revents;
 }
 
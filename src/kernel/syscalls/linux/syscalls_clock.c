@@ -1,4 +1,6 @@
+#include <clocksource.h>
 #include <linux.h>
+#include <schedule.h>
 #include <syscalls.h>
 #include <system.h>
 #include <task.h>
@@ -12,8 +14,7 @@ static int syscallNanosleep(struct timespec *duration, struct timespec *rem) {
     return -EINVAL;
 
   size_t ms = duration->tv_sec * 1000 + duration->tv_nsec / 1000000;
-  currentTask->forcefulWakeupTimeUnsafe = timerTicks + ms;
-  currentTask->state = TASK_STATE_BLOCKED;
+  scheduleBlockUntil(TASK_STATE_BLOCKED, timerTicks + ms);
   do
     handControl();
   while (currentTask->forcefulWakeupTimeUnsafe > timerTicks);
@@ -30,6 +31,15 @@ uint64_t timeval_to_ms(struct timeval tv) {
   return (uint64_t)tv.tv_sec * 1000 + DivRoundUp(tv.tv_usec, 1000);
 }
 
+// SIGALRM for whoever armed it, for as long as they're around (see taskKill())
+static uint64_t itimerRealFire(Timer *timer) {
+  IntTimerInternal *itimer = (IntTimerInternal *)timer->data;
+  Task             *task = (Task *)itimer->task;
+  atomicBitmapSet(&task->sigPendingList, SIGALRM);
+  signalsRevive(task);
+  return itimer->reset ? timerTicks + itimer->reset : 0;
+}
+
 #define SYSCALL_SETITIMER 38
 static size_t syscallSetitimer(int which, struct itimerval *value,
                                struct itimerval *old) {
@@ -38,13 +48,13 @@ static size_t syscallSetitimer(int which, struct itimerval *value,
     return ERR(ENOSYS);
   }
 
-  uint64_t rtAt = atomicRead64(&currentTask->infoSignals->itimerReal.at);
-  uint64_t rtReset = atomicRead64(&currentTask->infoSignals->itimerReal.reset);
+  IntTimerInternal *itimer = &currentTask->infoSignals->itimerReal;
 
   if (old) {
-    uint64_t realValue = MAX(0, rtAt - timerTicks);
-    ms_to_timeval(realValue, &old->it_value);
-    ms_to_timeval(rtReset, &old->it_interval);
+    uint64_t now = timerTicks;
+    uint64_t rtAt = itimer->timer.armed ? itimer->timer.expires : 0;
+    ms_to_timeval(rtAt > now ? rtAt - now : 0, &old->it_value);
+    ms_to_timeval(itimer->reset, &old->it_interval);
   }
 
   if (value) {
@@ -53,14 +63,13 @@ static size_t syscallSetitimer(int which, struct itimerval *value,
 
     dbgSysExtraf("val{%ld} int{%ld}", targValue, targInterval);
 
-    asm volatile("cli"); // just in case
+    timerDisarm(&itimer->timer);
+    itimer->reset = targInterval;
+    itimer->task = currentTask;
+    itimer->timer.callback = itimerRealFire;
+    itimer->timer.data = itimer;
     if (targValue)
-      atomicWrite64(&currentTask->infoSignals->itimerReal.at,
-                    timerTicks + targValue);
-    else
-      atomicWrite64(&currentTask->infoSignals->itimerReal.at, 0);
-    atomicWrite64(&currentTask->infoSignals->itimerReal.reset, targInterval);
-    asm volatile("sti");
+      timerArm(&itimer->timer, timerTicks + targValue);
   }
 
   return 0;
@@ -68,35 +77,70 @@ static size_t syscallSetitimer(int which, struct itimerval *value,
 
 #define SYSCALL_CLOCK_GETTIME 228
 static size_t syscallClockGettime(int which, timespec *spec) {
+  uint64_t time = 0;
   switch (which) {
-  case CLOCK_MONOTONIC: // <- todo
-  case 6:               // CLOCK_MONOTONIC_COARSE
-  case 4:               // CLOCK_MONOTONIC_RAW
-  case CLOCK_REALTIME: {
-    size_t time = timerBootUnix * 1000 + timerTicks;
-    spec->tv_sec = time / 1000;
-    spec->tv_nsec = (time % 1000) * 1000000;
-    // todo: accurancy
-    return 0;
+  case CLOCK_REALTIME:
+  case CLOCK_REALTIME_COARSE:
+    time = clockRealtime();
     break;
-  }
-  case CLOCK_BOOTTIME: {
-    size_t time = timerBootUnix * 1000;
-    spec->tv_sec = time / 1000;
-    spec->tv_nsec = (time % 1000) * 1000000;
-    return 0;
+  case CLOCK_MONOTONIC:
+  case CLOCK_MONOTONIC_RAW:
+  case CLOCK_MONOTONIC_COARSE:
+  case CLOCK_BOOTTIME: // (no suspending, so the same)
+    time = clockMonotonic();
     break;
-  }
   default:
     dbgSysStubf("clock not supported\n");
     return ERR(EINVAL);
     break;
   }
+
+  spec->tv_sec = time / NS_PER_SEC;
+  spec->tv_nsec = time % NS_PER_SEC;
+  return 0;
+}
+
+#define SYSCALL_GETTIMEOFDAY 96
+static size_t syscallGettimeofday(timeval *tv, struct timezone *tz) {
+  if (tv) {
+    uint64_t time = clockRealtime();
+    tv->tv_sec = time / NS_PER_SEC;
+    tv->tv_usec = (time % NS_PER_SEC) / 1000;
+  }
+  if (tz) { // always UTC
+    tz->tz_minuteswest = 0;
+    tz->tz_dsttime = 0;
+  }
+  return 0;
+}
+
+#define SYSCALL_TIME 201
+static size_t syscallTime(int64_t *tloc) {
+  int64_t time = clockRealtime() / NS_PER_SEC;
+  if (tloc)
+    *tloc = time;
+  return time;
 }
 
 #define SYSCALL_CLOCK_GETRES 229
 static size_t syscallClockGetres(int which, timespec *spec) {
-  spec->tv_nsec = 1000000; // 1ms for every clock
+  switch (which) {
+  case CLOCK_REALTIME:
+  case CLOCK_REALTIME_COARSE:
+  case CLOCK_MONOTONIC:
+  case CLOCK_MONOTONIC_RAW:
+  case CLOCK_MONOTONIC_COARSE:
+  case CLOCK_BOOTTIME:
+    break;
+  default:
+    return ERR(EINVAL);
+  }
+
+  // every clock is read off of the same clocksource
+  if (spec) {
+    spec->tv_sec = 0;
+    spec->tv_nsec = clocksource->resolution;
+  }
   return 0;
 }
 
@@ -104,5 +148,7 @@ void syscallsRegClock() {
   registerSyscall(SYSCALL_NANOSLEEP, syscallNanosleep);
   registerSyscall(SYSCALL_CLOCK_GETTIME, syscallClockGettime);
   registerSyscall(SYSCALL_CLOCK_GETRES, syscallClockGetres);
+  registerSyscall(SYSCALL_GETTIMEOFDAY, syscallGettimeofday);
+  registerSyscall(SYSCALL_TIME, syscallTime);
   registerSyscall(SYSCALL_SETITIMER, syscallSetitimer);
 }
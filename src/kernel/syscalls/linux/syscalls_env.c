@@ -9,6 +9,15 @@
 #define SYSCALL_GETPID 39
 static size_t syscallGetPid() { return currentTask->tgid; }
 
+#define SYSCALL_GETCPU 309
+static size_t syscallGetcpu(uint32_t *cpu, uint32_t *node, void *cache) {
+  if (cpu)
+    *cpu = currentTask->cpu;
+  if (node) // no NUMA
+    *node = 0;
+  return 0;
+}
+
 #define SYSCALL_GETCWD 79
 static size_t syscallGetcwd(char *buff, size_t size) {
   spinlockAcquire(&currentTask->infoFs->LOCK_FS);
@@ -66,10 +75,10 @@ struct rlimit {
 static size_t syscallGetrlimit(int resource, struct rlimit *rlim) {
   switch (resource) {
   case 7: // max open fds
-    spinlockCntReadAcquire(&currentTask->infoFiles->WLOCK_FILES);
+    rwlockReadAcquire(&currentTask->infoFiles->WLOCK_FILES);
     rlim->rlim_cur = currentTask->infoFiles->rlimitFdsSoft;
     rlim->rlim_max = currentTask->infoFiles->rlimitFdsHard;
-    spinlockCntReadRelease(&currentTask->infoFiles->WLOCK_FILES);
+    rwlockReadRelease(&currentTask->infoFiles->WLOCK_FILES);
     // todo: ENSURE hard limits are multiples of 8 (for later)
     return 0;
     break;
@@ -215,4 +224,5 @@ void syscallsRegEnv() {
   registerSyscall(SYSCALL_FCHDIR, syscallFchdir);
   registerSyscall(SYSCALL_GETGROUPS, syscallGetgroups);
   registerSyscall(SYSCALL_GETRANDOM, syscallGetRandom);
+  registerSyscall(SYSCALL_GETCPU, syscallGetcpu);
 }
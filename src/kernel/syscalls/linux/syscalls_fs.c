@@ -216,7 +216,7 @@ static size_t syscallDup2(uint32_t oldFd, uint32_t newFd) {
     return newFd;
 
   // determine how we're going to do this
-  spinlockCntWriteAcquire(&currentTask->infoFiles->WLOCK_FILES);
+  rwlockWriteAcquire(&currentTask->infoFiles->WLOCK_FILES);
   OpenFile *browse =
       (OpenFile *)AVLLookup(currentTask->infoFiles->firstFile, newFd);
   if (!browse) {
@@ -226,7 +226,7 @@ static size_t syscallDup2(uint32_t oldFd, uint32_t newFd) {
     // do NOT free the id on close in order to avoid race conditions
     browse->closeFlags |= VFS_CLOSE_FLAG_RETAIN_ID;
   }
-  spinlockCntWriteRelease(&currentTask->infoFiles->WLOCK_FILES);
+  rwlockWriteRelease(&currentTask->infoFiles->WLOCK_FILES);
 
   if (browse)
     assert(fsUserClose(currentTask, newFd) == 0);
@@ -3,6 +3,7 @@
 #include <syscalls.h>
 #include <task.h>
 #include <util.h>
+#include <vma.h>
 
 #define SYSCALL_MMAP 9
 static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
@@ -15,32 +16,39 @@ static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
   if (!addr)
     flags &= ~MAP_FIXED;
 
-  if (flags & MAP_FIXED && flags & MAP_ANONYMOUS) {
-    size_t pages = DivRoundUp(length, PAGE_SIZE);
-
-    spinlockAcquire(&currentTask->infoPd->LOCK_PD);
-    size_t end = addr + pages * PAGE_SIZE;
-    if (end > currentTask->infoPd->mmap_end)
-      currentTask->infoPd->mmap_end = end;
-    spinlockRelease(&currentTask->infoPd->LOCK_PD);
+  // anonymous memory is only reserved here & filled in on page faults
+  bool populate = flags & MAP_POPULATE;
+  flags &= ~(MAP_POPULATE | MAP_NORESERVE);
 
-    for (int i = 0; i < pages; i++)
-      VirtualMap(addr + i * PAGE_SIZE, PhysicalAllocate(1), PF_RW | PF_USER);
-
-    memset((void *)addr, 0, pages * PAGE_SIZE);
+  TaskInfoPagedir *info = currentTask->infoPd;
+  uint64_t         mappingFlags = vmaProtFlags(prot);
+  if (flags & MAP_FIXED && flags & MAP_ANONYMOUS) {
+    size_t end = addr + length;
+    if (end < addr || end > USER_STACK_BOTTOM)
+      return ERR(EINVAL);
+
+    // whatever used to be there gets dropped
+    spinlockAcquire(&info->LOCK_PD);
+    vmaAdd(info, addr, end, mappingFlags);
+    VirtualUnmapRegionL(info->pagedir, addr, length);
+    if (populate)
+      vmaPopulate(info, addr, end);
+    spinlockRelease(&info->LOCK_PD);
     return addr;
   }
 
-  if (!addr && fd == -1 &&
-      (flags & ~MAP_FIXED & ~MAP_PRIVATE) ==
-          MAP_ANONYMOUS) { // before: !addr &&
-    spinlockAcquire(&currentTask->infoPd->LOCK_PD);
-    size_t curr = currentTask->infoPd->mmap_end;
-    taskAdjustHeap(currentTask, currentTask->infoPd->mmap_end + length,
-                   &currentTask->infoPd->mmap_start,
-                   &currentTask->infoPd->mmap_end);
-    spinlockRelease(&currentTask->infoPd->LOCK_PD);
-    memset((void *)curr, 0, length);
+  if (fd == -1 && (flags & ~MAP_FIXED & ~MAP_PRIVATE) == MAP_ANONYMOUS) {
+    // addr is only taken as a hint here
+    spinlockAcquire(&info->LOCK_PD);
+    size_t curr = vmaPlace(info, addr, length);
+    if (curr) {
+      vmaAdd(info, curr, curr + length, mappingFlags);
+      if (populate)
+        vmaPopulate(info, curr, curr + length);
+    }
+    spinlockRelease(&info->LOCK_PD);
+    if (!curr)
+      return ERR(ENOMEM);
     return curr;
   } else if (!addr && fd == -1 &&
              (flags & ~MAP_FIXED & ~MAP_PRIVATE & ~MAP_SHARED) ==
@@ -69,6 +77,12 @@ static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
     size_t ret =
         file->handlers->mmap(addr, length, prot, flags, file, pgoffset);
     spinlockRelease(&file->LOCK_OPERATIONS);
+
+    if (!RET_IS_ERR(ret) && populate) {
+      spinlockAcquire(&info->LOCK_PD);
+      vmaPopulate(info, ret, ret + length);
+      spinlockRelease(&info->LOCK_PD);
+    }
     return ret;
   }
 
@@ -78,7 +92,21 @@ static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
 
 #define SYSCALL_MPROTECT 10
 static size_t syscallMprotect(uint64_t start, uint64_t len, uint64_t prot) {
-  // todo
+  if ((start % PAGE_SIZE) != 0)
+    return ERR(EINVAL);
+
+  size_t end = start + DivRoundUp(len, PAGE_SIZE) * PAGE_SIZE;
+  if (end < start || end > USER_STACK_BOTTOM)
+    return ERR(ENOMEM);
+
+  // ELF segments & stacks aren't tracked as regions, their pages still get
+  // updated below
+  uint64_t         flags = vmaProtFlags(prot);
+  TaskInfoPagedir *info = currentTask->infoPd;
+  spinlockAcquire(&info->LOCK_PD);
+  vmaProtect(info, start, end, flags);
+  VirtualProtectRegionL(info->pagedir, start, end - start, flags);
+  spinlockRelease(&info->LOCK_PD);
   return 0;
 }
 
@@ -87,22 +115,17 @@ static size_t syscallMunmap(uint64_t addr, size_t len) {
   if ((addr % PAGE_SIZE) != 0 || !len)
     return ERR(EINVAL);
 
-  spinlockAcquire(&currentTask->infoPd->LOCK_PD);
-  bool insideBounds = addr >= currentTask->infoPd->mmap_start &&
-                      (addr + len) <= currentTask->infoPd->mmap_end;
-  spinlockRelease(&currentTask->infoPd->LOCK_PD);
-  if (!insideBounds)
+  size_t end = addr + DivRoundUp(len, PAGE_SIZE) * PAGE_SIZE;
+  if (end < addr || end > USER_STACK_BOTTOM)
     return ERR(EINVAL);
 
-  size_t pages = DivRoundUp(len, PAGE_SIZE);
-  for (size_t i = 0; i < pages; i++) {
-    size_t phys = VirtualToPhysical(addr + i * PAGE_SIZE);
-    if (!phys)
-      continue;
-    // debugf("%lx %lx\n", addr + i * PAGE_SIZE, phys);
-    VirtualMap(addr + i * PAGE_SIZE, 0, PF_USER);
-    // PhysicalFree(phys, 1); will be done by ^
-  }
+  // partially covered regions get split, frames get freed along (once nothing
+  // else references them)
+  TaskInfoPagedir *info = currentTask->infoPd;
+  spinlockAcquire(&info->LOCK_PD);
+  vmaRemove(info, addr, end);
+  VirtualUnmapRegionL(info->pagedir, addr, end - addr);
+  spinlockRelease(&info->LOCK_PD);
   return 0;
 }
 
@@ -122,8 +145,13 @@ static uint64_t syscallBrk(uint64_t brk) {
     goto cleanup;
   }
 
-  taskAdjustHeap(currentTask, brk, &currentTask->infoPd->heap_start,
-                 &currentTask->infoPd->heap_end);
+  // just reserve it, pages get filled in on page faults
+  size_t oldTop = DivRoundUp(currentTask->infoPd->heap_end, PAGE_SIZE);
+  size_t newTop = DivRoundUp(brk, PAGE_SIZE);
+  if (newTop > oldTop)
+    vmaAdd(currentTask->infoPd, oldTop * PAGE_SIZE, newTop * PAGE_SIZE,
+           PF_RW | PF_USER);
+  currentTask->infoPd->heap_end = brk;
 
   ret = currentTask->infoPd->heap_end;
 cleanup:
@@ -131,9 +159,58 @@ cleanup:
   return ret;
 }
 
+#define SYSCALL_MADVISE 28
+static size_t syscallMadvise(uint64_t start, size_t len, int advice) {
+  if ((start % PAGE_SIZE) != 0)
+    return ERR(EINVAL);
+
+  size_t end = start + DivRoundUp(len, PAGE_SIZE) * PAGE_SIZE;
+  if (end < start || end > USER_STACK_BOTTOM)
+    return ERR(EINVAL);
+
+  TaskInfoPagedir *info = currentTask->infoPd;
+  switch (advice) {
+  case MADV_NORMAL:
+  case MADV_RANDOM:
+  case MADV_SEQUENTIAL:
+    break;
+  case MADV_WILLNEED:
+    spinlockAcquire(&info->LOCK_PD);
+    vmaPopulate(info, start, end);
+    spinlockRelease(&info->LOCK_PD);
+    break;
+  case MADV_DONTNEED:
+  case MADV_FREE:
+    // next access gets zero-filled (or re-read from the file) pages. only
+    // demand-paged regions can do that, so the rest is left alone
+    spinlockAcquire(&info->LOCK_PD);
+    for (VmArea *vma = vmaFirstFrom(info, start); vma && vma->start < end;
+         vma = vmaNext(info, vma)) {
+      size_t    from = MAX(start, vma->start);
+      size_t    to = MIN(end, vma->end);
+      OpenFile *file = vma->file;
+      // unmapped page cache pages may get evicted, so write shared ones back
+      if (file && vma->shared && vma->flags & PF_RW &&
+          file->handlers->mmapSync) {
+        spinlockAcquire(&file->LOCK_OPERATIONS);
+        file->handlers->mmapSync(file, vma->pgoffset + (from - vma->start),
+                                 to - from);
+        spinlockRelease(&file->LOCK_OPERATIONS);
+      }
+      vmaDropPages(info, from, to);
+    }
+    spinlockRelease(&info->LOCK_PD);
+    break;
+  default:
+    return ERR(EINVAL);
+  }
+  return 0;
+}
+
 void syscallRegMem() {
   registerSyscall(SYSCALL_MMAP, syscallMmap);
   registerSyscall(SYSCALL_MUNMAP, syscallMunmap);
   registerSyscall(SYSCALL_MPROTECT, syscallMprotect);
   registerSyscall(SYSCALL_BRK, syscallBrk);
+  registerSyscall(SYSCALL_MADVISE, syscallMadvise);
 }
\ No newline at end of file
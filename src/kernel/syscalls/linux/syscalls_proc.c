@@ -4,6 +4,7 @@
 #include <linked_list.h>
 #include <linux.h>
 #include <malloc.h>
+#include <schedule.h>
 #include <string.h>
 #include <syscalls.h>
 #include <system.h>
@@ -79,6 +80,8 @@ static size_t syscallClone(uint64_t flags, uint64_t newsp, int *parent_tid,
   Task *newTask =
       taskFork(currentTask->syscallRegs,
                newsp ? newsp : currentTask->syscallRsp, flags, false);
+  if (!newTask)
+    return ERR(EAGAIN);
   uint64_t id = newTask->id;
 
   if (flags & CLONE_SETTLS)
@@ -104,15 +107,20 @@ static size_t syscallClone(uint64_t flags, uint64_t newsp, int *parent_tid,
 
 #define SYSCALL_FORK 57
 static size_t syscallFork() {
-  return taskFork(currentTask->syscallRegs, currentTask->syscallRsp, 0, true)
-      ->id;
+  Task *newTask =
+      taskFork(currentTask->syscallRegs, currentTask->syscallRsp, 0, true);
+  if (!newTask)
+    return ERR(EAGAIN);
+  return newTask->id;
 }
 
 #define SYSCALL_VFORK 58
 static size_t syscallVfork() {
   Task *newTask = taskFork(currentTask->syscallRegs, currentTask->syscallRsp,
                            CLONE_VM, false);
-  int   id = newTask->id;
+  if (!newTask)
+    return ERR(EAGAIN);
+  int id = newTask->id;
 
   // no race condition today :")
   taskCreateFinish(newTask);
@@ -249,12 +257,11 @@ static size_t syscallExecve(char *filename, char **argv, char **envp) {
   if (!ret)
     return ERR(ENOENT);
 
-  int targetId = currentTask->id;
-  currentTask->id = taskGenerateId();
+  // the new one takes our pid, we're left with the one it got (& exit soon)
   int targetTgid = currentTask->tgid;
+  taskPidSwap(currentTask, ret);
   currentTask->tgid = currentTask->id; // better way to do alladat
 
-  ret->id = targetId;
   ret->tgid = targetTgid;
   ret->parent = currentTask->parent;
   ret->pgid = currentTask->pgid;
@@ -274,7 +281,7 @@ static size_t syscallExecve(char *filename, char **argv, char **envp) {
 
   taskCreateFinish(ret);
   if (currentTask->parent->state == TASK_STATE_WAITING_VFORK)
-    currentTask->parent->state = TASK_STATE_READY;
+    scheduleWake(currentTask->parent);
 
   currentTask->noInformParent = true;
   taskKill(currentTask->id, 0);
@@ -381,9 +388,11 @@ static size_t syscallWait4(int pid, int *wstatus, int options,
   int ret = target->ret;
 
   // cleanup
-  LinkedListRemove((void **)(&currentTask->firstChildTerminated), target);
+  LinkedListRemoveSlab((void **)(&currentTask->firstChildTerminated),
+                       &cacheKilledInfo, target);
   currentTask->childrenTerminatedAmnt--;
   spinlockRelease(&currentTask->LOCK_CHILD_TERM);
+  taskPidFree(output); // was kept for us (see taskKill())
 
   if (wstatus) {
     if (ret < 128)
@@ -431,6 +440,7 @@ static void syscallExitGroup(int return_code) {
     if (browse->tgid == currentTask->tgid && browse->id != currentTask->id) {
       // found one of ours!
       atomicBitmapSet(&browse->sigPendingList, SIGKILL);
+      signalsRevive(browse);
     }
     browse = browse->next;
   }
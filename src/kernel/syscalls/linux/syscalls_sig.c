@@ -106,25 +106,32 @@ static size_t syscallKill(int pid, int sig) {
   }
 
   if (pid > 0) {
-    // specific tgid
-    spinlockCntReadAcquire(&TASK_LL_MODIFY);
-    Task *target = firstTask;
-    while (target) {
-      if (target->tgid == pid)
-        break;
-      target = target->next;
+    // specific tgid, that's usually its leader's pid
+    Task *target = taskGet(pid);
+    if (!target || target->tgid != pid || target->state == TASK_STATE_DEAD) {
+      // (unless it's exited, with other threads still around)
+      spinlockCntReadAcquire(&TASK_LL_MODIFY);
+      target = firstTask;
+      while (target) {
+        if (target->tgid == pid && target->state != TASK_STATE_DEAD)
+          break;
+        target = target->next;
+      }
+      spinlockCntReadRelease(&TASK_LL_MODIFY);
     }
-    spinlockCntReadRelease(&TASK_LL_MODIFY);
     if (!target || target->state == TASK_STATE_DEAD)
       return ERR(ESRCH);
     atomicBitmapSet(&target->sigPendingList, sig);
+    signalsRevive(target);
   } else if (!pid) {
     // sent to every process in our group
     spinlockCntReadAcquire(&TASK_LL_MODIFY);
     Task *target = firstTask;
     while (target) {
-      if (target->pgid == currentTask->pgid)
+      if (target->pgid == currentTask->pgid) {
         atomicBitmapSet(&target->sigPendingList, sig);
+        signalsRevive(target);
+      }
       target = target->next;
     }
     spinlockCntReadRelease(&TASK_LL_MODIFY);
@@ -136,6 +143,7 @@ static size_t syscallKill(int pid, int sig) {
     while (target) {
       cnt++;
       atomicBitmapSet(&target->sigPendingList, sig);
+      signalsRevive(target);
       target = target->next;
     }
     spinlockCntReadRelease(&TASK_LL_MODIFY);
@@ -146,8 +154,10 @@ static size_t syscallKill(int pid, int sig) {
     spinlockCntReadAcquire(&TASK_LL_MODIFY);
     Task *target = firstTask;
     while (target) {
-      if (target->pgid == -pid)
+      if (target->pgid == -pid) {
         atomicBitmapSet(&target->sigPendingList, sig);
+        signalsRevive(target);
+      }
       target = target->next;
     }
     spinlockCntReadRelease(&TASK_LL_MODIFY);
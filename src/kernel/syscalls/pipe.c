@@ -3,15 +3,18 @@
 #include <kb.h>
 #include <linux.h>
 #include <malloc.h>
+#include <paging.h>
+#include <poll.h>
 #include <syscalls.h>
 #include <task.h>
+#include <vmm.h>
 
 // Industrial two-way solid steel pipe()
 // Copyright (C) 2024 Panagiotis
 
 #define PIPE_BUFF 65536
 typedef struct PipeInfo {
-  char buf[PIPE_BUFF];
+  char *buf; // PIPE_BUFF bytes, see VirtualAllocateScattered()
   int  assigned;
 
   int writeFds;
@@ -46,6 +49,7 @@ size_t pipeOpen(int *fds) {
 
   PipeInfo *info = (PipeInfo *)malloc(sizeof(PipeInfo));
   memset(info, 0, sizeof(PipeInfo));
+  info->buf = VirtualAllocateScattered(PIPE_BUFF / PAGE_SIZE);
   info->readFds = 1;
   info->writeFds = 1;
 
@@ -104,8 +108,7 @@ size_t pipeRead(OpenFile *fd, uint8_t *out, size_t limit) {
       spinlockRelease(&pipe->LOCK);
       return ERR(EWOULDBLOCK);
     }
-    taskBlock(&pipe->blockingRead, currentTask, &pipe->LOCK, true);
-    handControl();
+    taskBlockWait(&pipe->blockingRead, &pipe->LOCK, 0, false);
   }
 
   if (!pipe->assigned) {
@@ -123,6 +126,7 @@ size_t pipeRead(OpenFile *fd, uint8_t *out, size_t limit) {
   memmove(pipe->buf, &pipe->buf[toCopy], PIPE_BUFF - toCopy);
   taskUnblock(&pipe->blockingWrite);
   spinlockRelease(&pipe->LOCK);
+  pollWake();
 
   return toCopy;
 }
@@ -143,8 +147,7 @@ size_t pipeWriteInner(OpenFile *fd, uint8_t *in, size_t limit) {
       spinlockRelease(&pipe->LOCK);
       return ERR(EWOULDBLOCK);
     }
-    taskBlock(&pipe->blockingWrite, currentTask, &pipe->LOCK, true);
-    handControl();
+    taskBlockWait(&pipe->blockingWrite, &pipe->LOCK, 0, false);
   }
 
   // we already have a spinlock!
@@ -152,6 +155,7 @@ size_t pipeWriteInner(OpenFile *fd, uint8_t *in, size_t limit) {
   pipe->assigned += limit;
   taskUnblock(&pipe->blockingRead);
   spinlockRelease(&pipe->LOCK);
+  pollWake();
 
   return limit;
 }
@@ -227,9 +231,11 @@ bool pipeCloseEnd(OpenFile *readFd) {
   if (!pipe->readFds) // edge case (more aggressive)
     taskUnblock(&pipe->blockingWrite);
   spinlockRelease(&pipe->LOCK);
+  pollWake();
 
   if (!pipe->readFds && !pipe->writeFds) {
     spinlockAcquire(&pipe->LOCK);
+    VirtualFree(pipe->buf, PIPE_BUFF / PAGE_SIZE);
     free(pipe);
   }
 
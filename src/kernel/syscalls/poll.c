@@ -5,6 +5,7 @@
 #include <linux.h>
 #include <malloc.h>
 #include <poll.h>
+#include <slab.h>
 #include <syscalls.h>
 #include <task.h>
 #include <timer.h>
@@ -12,6 +13,15 @@
 // Polling APIs & kernel helper utility
 // Copyright (C) 2025 Panagiotis
 
+SlabCache cacheEpollWatch = SLAB_CACHE_INIT("epoll_watch", EpollWatch, 0);
+
+Blocking pollBlocking = {0};
+
+// Nothing keeps track of who's polling what, so everyone polling gets woken up
+// to look again. Has to follow anything that could make a file pollable (after
+// the change, under whatever lock it's made under or not)
+void pollWake() { taskUnblock(&pollBlocking); }
+
 // epoll API
 size_t epollCreate1(int flags) {
   size_t epollFd = fsUserOpen(currentTask, "/dev/null", O_RDWR, 0);
@@ -76,8 +86,8 @@ void epollCloseNotify(OpenFile *fd) {
     }
     if (browseEpollWatch) {
       // we found it!
-      LinkedListRemove((void **)(&browseEpoll->firstEpollWatch),
-                       browseEpollWatch);
+      LinkedListRemoveSlab((void **)(&browseEpoll->firstEpollWatch),
+                           &cacheEpollWatch, browseEpollWatch);
       spinlockRelease(&browseEpoll->LOCK_EPOLL);
       spinlockRelease(&LOCK_LL_EPOLL);
       return;
@@ -117,8 +127,8 @@ size_t epollCtl(OpenFile *epollFd, int op, int fd, struct epoll_event *event) {
 
   switch (op) {
   case EPOLL_CTL_ADD: {
-    EpollWatch *epollWatch = LinkedListAllocate(
-        (void **)(&epoll->firstEpollWatch), sizeof(EpollWatch));
+    EpollWatch *epollWatch = LinkedListAllocateSlab(
+        (void **)(&epoll->firstEpollWatch), &cacheEpollWatch);
     epollWatch->fd = fdNode;
     epollWatch->watchEvents = event->events;
     epollWatch->userlandData = event->data;
@@ -150,7 +160,8 @@ size_t epollCtl(OpenFile *epollFd, int op, int fd, struct epoll_event *event) {
       ret = ERR(ENOENT);
       goto cleanup;
     }
-    assert(LinkedListRemove((void **)(&epoll->firstEpollWatch), browse));
+    assert(LinkedListRemoveSlab((void **)(&epoll->firstEpollWatch),
+                                &cacheEpollWatch, browse));
     break;
   }
   default:
@@ -172,10 +183,12 @@ size_t epollWait(OpenFile *epollFd, struct epoll_event *events, int maxevents,
 
   bool sigexit = false;
 
-  // hack'y way but until I implement wake queues, it is what it is
-  int    ready = 0;
-  size_t target = timerTicks + timeout;
-  do {
+  int      ready = 0;
+  uint64_t wakeAt = timeout > 0 ? timerTicks + timeout : 0;
+  while (true) {
+    BlockedTask entry;
+    taskBlockPrepare(&pollBlocking, &entry, 0);
+
     spinlockAcquire(&epoll->LOCK_EPOLL);
     EpollWatch *browse = epoll->firstEpollWatch;
     while (browse && ready < maxevents) {
@@ -191,10 +204,14 @@ size_t epollWait(OpenFile *epollFd, struct epoll_event *events, int maxevents,
     spinlockRelease(&epoll->LOCK_EPOLL);
 
     sigexit = signalsPendingQuick(currentTask);
-    if (ready > 0 || sigexit) // break immidiately!
+    if (ready > 0 || sigexit || timeout == 0) { // break immidiately!
+      taskBlockCancel(&pollBlocking, &entry);
+      break;
+    }
+    if (taskBlockSleep(&pollBlocking, &entry, 0, wakeAt, true) ==
+        BLOCK_TIMEOUT)
       break;
-    handControl();
-  } while (timeout != 0 && (timeout == -1 || timerTicks < target));
+  }
 
   if (!ready && sigexit)
     return ERR(EINTR);
@@ -272,10 +289,13 @@ size_t poll(struct pollfd *fds, int nfds, int timeout) {
   if (nfds < 0)
     return ERR(EINVAL);
   dbgSysExtraf("0: fd{%d} events{%d}", fds[0].fd, fds[0].events);
-  int    ret = 0;
-  bool   sigexit = false;
-  size_t target = timerTicks + timeout;
-  do {
+  int      ret = 0;
+  bool     sigexit = false;
+  uint64_t wakeAt = timeout > 0 ? timerTicks + timeout : 0;
+  while (true) {
+    BlockedTask entry;
+    taskBlockPrepare(&pollBlocking, &entry, 0);
+
     for (int i = 0; i < nfds; i++) {
       fds[i].revents = 0; // zero it out first
       OpenFile *fd = fsUserGetNode(currentTask, fds[i].fd);
@@ -297,10 +317,14 @@ size_t poll(struct pollfd *fds, int nfds, int timeout) {
     }
 
     sigexit = signalsPendingQuick(currentTask);
-    if (ret > 0 || sigexit) // return immidiately!
+    if (ret > 0 || sigexit || timeout == 0) { // return immidiately!
+      taskBlockCancel(&pollBlocking, &entry);
       break;
-    handControl();
-  } while (timeout != 0 && (timeout == -1 || timerTicks < target));
+    }
+    if (taskBlockSleep(&pollBlocking, &entry, 0, wakeAt, true) ==
+        BLOCK_TIMEOUT)
+      break;
+  }
 
   if (!ret && sigexit)
     return ERR(EINTR);
@@ -1,26 +1,30 @@
 #include <bootloader.h>
+#include <fpu.h>
 #include <gdt.h>
 #include <linked_list.h>
 #include <paging.h>
+#include <schedule.h>
 #include <stdatomic.h>
 #include <syscalls.h>
 #include <task.h>
 #include <timer.h>
 #include <util.h>
+#include <vma.h>
 
 // Signal dispatcher, generator & general utility
 // Copyright (C) 2025 Panagiotis
 
+#undef currentTask
 #define currentTask (youWillNotUseThisInNoWayImaginable())
 
 SignalInternal signalInternalDecisions[_NSIG] = {0};
-extern void    syscall_entry();
+extern void    syscall_reentry();
 
 // stack is laid out like this afterwards
 // * uint64_t retaddr;
 // * struct sigcontext ucontext;
 // * struct siginfo info; (optional)
-// * struct fpstate fp;
+// * struct fpstate fp; (64 byte aligned, xsave area if enabled)
 
 void initiateSignalDefs() {
   signalInternalDecisions[SIGABRT] = SIGNAL_INTERNAL_CORE;
@@ -153,7 +157,19 @@ bool signalsPendingQuick(void *taskPtr) {
 bool signalsRevivableState(int state) {
   return state == TASK_STATE_WAITING_CHILD ||
          state == TASK_STATE_WAITING_CHILD_SPECIFIC ||
-         state == TASK_STATE_FUTEX;
+         state == TASK_STATE_FUTEX || state == TASK_STATE_INTERRUPTIBLE;
+}
+
+// Has to follow every signal raised on another task, as those interrupt the
+// waits above (& running tasks won't look until they're rescheduled)
+void signalsRevive(void *taskPtr) {
+  Task *task = (Task *)taskPtr;
+  if (!signalsPendingQuick(task))
+    return;
+  if (signalsRevivableState(task->state))
+    scheduleWake(task);
+  else
+    scheduleKick(task);
 }
 
 // these functions should be fairly bare-bones as they are invoked from
@@ -229,8 +245,7 @@ void signalsPendingHandleSys(void *taskPtr, uint64_t *rsp,
   oldstate.usermode_rsp = *rsp;
   oldstate.usermode_ss = GDT_USER_DATA | DPL_USER;
   // since the scheduler, our fpu state might've changed (from task.c)
-  asm volatile(" fxsave %0 " ::"m"(task->fpuenv));
-  asm("stmxcsr (%%rax)" : : "a"(&task->mxcsr));
+  fpuSave(task);
 
   size_t sigrsp = *rsp;
 
@@ -241,9 +256,10 @@ void signalsPendingHandleSys(void *taskPtr, uint64_t *rsp,
   sigrsp -= PAGE_SIZE;
   sigrsp = (sigrsp / PAGE_SIZE) * PAGE_SIZE;
 
-  sigrsp -= sizeof(struct fpstate);
+  sigrsp -= fpuSignalSize();
+  sigrsp &= ~63; // xsave areas have to be 64 byte aligned
   struct fpstate *fpu = (struct fpstate *)sigrsp;
-  memcpy(fpu, task->fpuenv, sizeof(struct fpstate));
+  fpuSignalSave(task, fpu);
 
   sigrsp -= sizeof(struct sigcontext);
   struct sigcontext *ucontext = (struct sigcontext *)sigrsp;
@@ -263,6 +279,31 @@ void signalsPendingHandleSys(void *taskPtr, uint64_t *rsp,
   registers->rcx = (size_t)handler;
   registers->rdi = signal;
 }
+// Terminates the task on a safer context than the scheduler, by faking a
+// sys_exit() for it to run next
+static void signalsKillSched(Task *task, int signal) {
+  task->registers.rax = 60;           // void sys_exit(...)
+  task->registers.rdi = 128 + signal; // int return_code
+  task->registers.r11 = task->registers.rflags;
+  task->registers.rcx = task->registers.rip;
+  task->registers.rflags &= ~(rdmsr(0xC0000084)); // IA32_FMASK
+  task->registers.cs = GDT_KERNEL_CODE;
+  task->registers.ds = GDT_KERNEL_DATA;
+  task->registers.usermode_ss = GDT_KERNEL_DATA;
+  task->registers.rip = (size_t)syscall_reentry;
+}
+
+// The frame's page might not have been touched yet (demand paging), & we can't
+// take a fault on the task's behalf from here, so it's faulted in by hand.
+// Returns 0 if there's nothing mapped there at all
+static size_t signalsFramePhys(Task *task, size_t frame) {
+  TaskInfoPagedir *info = task->infoPd;
+  size_t           phys = VirtualToPhysicalWritableL(info->pagedir, frame);
+  if (!phys && vmaHandleFault(info, frame, PFERR_WRITE))
+    phys = VirtualToPhysicalWritableL(info->pagedir, frame);
+  return phys;
+}
+
 void signalsPendingHandleSched(void *taskPtr) {
   Task *task = (Task *)taskPtr;
 
@@ -282,16 +323,7 @@ void signalsPendingHandleSched(void *taskPtr) {
     case SIGNAL_INTERNAL_TERM:
       dbgSigHitf("--- %ld [signals] Killing! ---\n", task->id);
 
-      // do the termination on a safer context than here, fake a syscall
-      task->registers.rax = 60;           // void sys_exit(...)
-      task->registers.rdi = 128 + signal; // int return_code
-      task->registers.r11 = task->registers.rflags;
-      task->registers.rcx = task->registers.rip;
-      task->registers.rflags &= ~(rdmsr(0xC0000084)); // IA32_FMASK
-      task->registers.cs = GDT_KERNEL_CODE;
-      task->registers.ds = GDT_KERNEL_DATA;
-      task->registers.usermode_ss = GDT_KERNEL_DATA;
-      task->registers.rip = (size_t)syscall_entry;
+      signalsKillSched(task, signal);
       atomicBitmapClear(&task->sigPendingList, signal);
       return; // get it done with
 
@@ -315,6 +347,21 @@ void signalsPendingHandleSched(void *taskPtr) {
     return;
   }
 
+  // get down to avoid the red zone (will be left-overs but make sure), then
+  // another page so we can go to the end and put our stuff
+  size_t frame = task->registers.usermode_rsp - 128 - PAGE_SIZE;
+  frame = (frame / PAGE_SIZE) * PAGE_SIZE; // align properly
+
+  // ensure we haven't ran out of stack space
+  size_t regionPhys = signalsFramePhys(task, frame);
+  if (!regionPhys) {
+    // nowhere to put the frame, it's a SIGSEGV no matter what it's handling
+    dbgSigHitf("--- %ld [signals] Bad stack, killing! ---\n", task->id);
+    signalsKillSched(task, SIGSEGV);
+    atomicBitmapClear(&task->sigPendingList, signal);
+    return;
+  }
+
   // (also SA_NODEFER)
   sigset_t oldMask = task->sigBlockList;
   task->sigBlockList |= (1 << signal) | atomicRead64(&action->sa_mask);
@@ -322,27 +369,18 @@ void signalsPendingHandleSched(void *taskPtr) {
 
   AsmPassedInterrupt oldstate = {0};
   memcpy(&oldstate, &task->registers, sizeof(AsmPassedInterrupt));
-
-  // get down to avoid the red zone (will be left-overs but make sure)
-  task->registers.usermode_rsp -= 128;
-
-  // get down another page so we can go to the end and put our stuff
-  task->registers.usermode_rsp -= PAGE_SIZE;
-  task->registers.usermode_rsp =
-      (task->registers.usermode_rsp / PAGE_SIZE) * PAGE_SIZE; // align properly
-
-  // ensure we haven't ran out of stack space
-  size_t regionPhys =
-      VirtualToPhysicalL(task->infoPd->pagedir, task->registers.usermode_rsp);
-  assert(regionPhys);
+  task->registers.usermode_rsp = frame;
 
   // make a region which we access by it's end (max 4KiB // PAGE_SIZE)
   int    top = PAGE_SIZE;
   size_t region = bootloader.hhdmOffset + regionPhys;
 
-  top -= sizeof(struct fpstate);
+  // it might've kept running on this CPU, with its state still in registers
+  fpuSave(task);
+  top -= fpuSignalSize();
+  top &= ~63; // xsave areas have to be 64 byte aligned
   struct fpstate *fpu = (struct fpstate *)(region + top);
-  memcpy(fpu, task->fpuenv, sizeof(struct fpstate));
+  fpuSignalSave(task, fpu);
   int fpuoffset = top;
 
   top -= sizeof(struct sigcontext);
@@ -390,7 +428,8 @@ size_t signalsSigreturnSyscall(void *taskPtr) {
     assert(sysIntr);
 
     int number = sysIntr->number;
-    LinkedListRemove((void **)&task->firstSysIntr, sysIntr);
+    LinkedListRemoveSlab((void **)&task->firstSysIntr, &cacheTaskSysInterrupted,
+                         sysIntr);
 
     if (number != 0 &&   // SYS_read
         number != 1 &&   // SYS_write
@@ -428,7 +467,7 @@ size_t signalsSigreturnSyscall(void *taskPtr) {
       regs.cs = GDT_KERNEL_CODE;
       regs.ds = GDT_KERNEL_DATA;
       regs.usermode_ss = GDT_KERNEL_DATA;
-      regs.rip = (size_t)syscall_entry;
+      regs.rip = (size_t)syscall_reentry;
     }
   }
 
@@ -440,17 +479,16 @@ size_t signalsSigreturnSyscall(void *taskPtr) {
   // this doesn't matter at all since they will be saved, but better be safe
   memcpy(&task->registers, iretqRsp, sizeof(AsmPassedInterrupt));
 
-  memcpy(task->fpuenv, ucontext->fpstate, sizeof(task->fpuenv));
-  task->mxcsr = ucontext->fpstate->mxcsr;
-  asm volatile(" fxrstor %0 " ::"m"(task->fpuenv));
+  fpuSignalRestore(task, ucontext->fpstate); // gets loaded once it's used
 
   task->systemCallInProgress = false;
   task->syscallRegs = 0;
   task->syscallRsp = 0;
 
   task->sigBlockList = ucontext->oldmask & ~((1 << SIGKILL) | (1 << SIGSTOP));
-  asm_finalize((size_t)iretqRsp,
-               VirtualToPhysical((size_t)task->infoPd->pagedir));
+  uint64_t cr3 =
+      ChangePageDirectoryFake(task->infoPd->pagedir, task->infoPd->pcid);
+  asm_finalize((size_t)iretqRsp, cr3, 0);
 
   // will never be reached
   panic();
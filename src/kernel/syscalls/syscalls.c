@@ -45,7 +45,6 @@ void registerSyscall(uint32_t id, void *handler) {
 typedef uint64_t (*SyscallHandler)(uint64_t a1, uint64_t a2, uint64_t a3,
                                    uint64_t a4, uint64_t a5, uint64_t a6);
 void syscallHandler(AsmPassedInterrupt *regs) {
-  wrmsr(MSRID_KERNEL_GSBASE, (size_t)&threadInfo);
   uint64_t *rspPtr = (uint64_t *)((size_t)regs + sizeof(AsmPassedInterrupt));
   uint64_t  rsp = *rspPtr;
 
@@ -116,7 +115,7 @@ void syscallHandler(AsmPassedInterrupt *regs) {
 #endif
 
   if (RET_IS_ERR((size_t)ret) && (size_t)ret == ERR(EINTR)) {
-    TaskSysInterrupted *sysIntr = calloc(sizeof(TaskSysInterrupted), 1);
+    TaskSysInterrupted *sysIntr = slabAlloc(&cacheTaskSysInterrupted);
     sysIntr->number = regs->rax;
     LinkedListPushFrontUnsafe((void **)&currentTask->firstSysIntr, sysIntr);
   }
@@ -1,15 +1,25 @@
 #include <linked_list.h>
 #include <malloc.h>
+#include <paging.h>
+#include <poll.h>
 #include <syscalls.h>
 #include <task.h>
 #include <unixSocket.h>
 #include <util.h>
+#include <vmm.h>
 
 #include <lwip/sockets.h>
 
 // AF_UNIX socket implementation (still needs a lot of testing)
 // Copyright (C) 2025 Panagiotis
 
+// Either end (or poll()) might've been waiting on what just changed. Expects
+// LOCK_PAIR to be held
+void unixSocketPairWake(UnixSocketPair *pair) {
+  taskUnblock(&pair->blocking);
+  pollWake();
+}
+
 OpenFile *unixSocketAcceptCreate(UnixSocketPair *dir) {
   size_t sockFd = fsUserOpen(currentTask, "/dev/null", O_RDWR, 0);
   assert(!RET_IS_ERR(sockFd));
@@ -37,15 +47,17 @@ UnixSocketPair *unixSocketAllocatePair() {
   UnixSocketPair *pair = calloc(sizeof(UnixSocketPair), 1);
   pair->clientBuffSize = UNIX_SOCK_BUFF_DEFAULT;
   pair->serverBuffSize = UNIX_SOCK_BUFF_DEFAULT;
-  pair->serverBuff = malloc(pair->serverBuffSize);
-  pair->clientBuff = malloc(pair->clientBuffSize);
+  pair->serverBuff =
+      VirtualAllocateScattered(DivRoundUp(pair->serverBuffSize, PAGE_SIZE));
+  pair->clientBuff =
+      VirtualAllocateScattered(DivRoundUp(pair->clientBuffSize, PAGE_SIZE));
   return pair;
 }
 
 void unixSocketFreePair(UnixSocketPair *pair) {
   assert(pair->serverFds == 0 && pair->clientFds == 0);
-  free(pair->clientBuff);
-  free(pair->serverBuff);
+  VirtualFree(pair->clientBuff, DivRoundUp(pair->clientBuffSize, PAGE_SIZE));
+  VirtualFree(pair->serverBuff, DivRoundUp(pair->serverBuffSize, PAGE_SIZE));
   free(pair->filename);
   free(pair);
 }
@@ -57,8 +69,10 @@ bool unixSocketAcceptClose(OpenFile *fd) {
 
   if (pair->serverFds == 0 && pair->clientFds == 0)
     unixSocketFreePair(pair);
-  else
+  else {
+    unixSocketPairWake(pair);
     spinlockRelease(&pair->LOCK_PAIR);
+  }
 
   return true;
 }
@@ -84,7 +98,7 @@ size_t unixSocketAcceptRecvfrom(OpenFile *fd, uint8_t *out, size_t limit,
       return ERR(EWOULDBLOCK);
     } else if (pair->serverBuffPos > 0)
       break;
-    spinlockRelease(&pair->LOCK_PAIR);
+    taskBlockWait(&pair->blocking, &pair->LOCK_PAIR, 0, false);
   }
 
   // spinlock already acquired
@@ -93,6 +107,7 @@ size_t unixSocketAcceptRecvfrom(OpenFile *fd, uint8_t *out, size_t limit,
   memmove(pair->serverBuff, &pair->serverBuff[toCopy],
           pair->serverBuffPos - toCopy);
   pair->serverBuffPos -= toCopy;
+  unixSocketPairWake(pair);
   spinlockRelease(&pair->LOCK_PAIR);
 
   return toCopy;
@@ -123,12 +138,13 @@ size_t unixSocketAcceptSendto(OpenFile *fd, uint8_t *in, size_t limit,
       return ERR(EWOULDBLOCK);
     } else if ((pair->clientBuffPos + limit) <= pair->clientBuffSize)
       break;
-    spinlockRelease(&pair->LOCK_PAIR);
+    taskBlockWait(&pair->blocking, &pair->LOCK_PAIR, 0, false);
   }
 
   // spinlock already acquired
   memcpy(&pair->clientBuff[pair->clientBuffPos], in, limit);
   pair->clientBuffPos += limit;
+  unixSocketPairWake(pair);
   spinlockRelease(&pair->LOCK_PAIR);
 
   return limit;
@@ -305,8 +321,7 @@ size_t unixSocketAccept(OpenFile *fd, sockaddr_linux *addr, uint32_t *len) {
       return ERR(EWOULDBLOCK);
     } else
       sock->acceptWouldBlock = false;
-    spinlockRelease(&sock->LOCK_SOCK);
-    handControl();
+    taskBlockWait(&sock->blockingAccept, &sock->LOCK_SOCK, 0, false);
   }
 
   // now pick the first thing! (sock spinlock already engaged)
@@ -316,6 +331,7 @@ size_t unixSocketAccept(OpenFile *fd, sockaddr_linux *addr, uint32_t *len) {
   pair->serverFds++;
   pair->established = true;
   pair->filename = strdup(sock->bindAddr);
+  unixSocketPairWake(pair); // connect() is waiting for it
   spinlockRelease(&pair->LOCK_PAIR);
 
   OpenFile *acceptFd = unixSocketAcceptCreate(pair);
@@ -388,7 +404,9 @@ size_t unixSocketConnect(OpenFile *fd, sockaddr_linux *addr, uint32_t len) {
   sock->pair = pair;
   pair->clientFds = 1;
   parent->backlog[parent->connCurr++] = pair;
+  taskUnblock(&parent->blockingAccept);
   spinlockRelease(&parent->LOCK_SOCK);
+  pollWake();
 
   // todo!
   assert(!(fd->flags & O_NONBLOCK));
@@ -396,9 +414,8 @@ size_t unixSocketConnect(OpenFile *fd, sockaddr_linux *addr, uint32_t len) {
     spinlockAcquire(&pair->LOCK_PAIR);
     if (pair->established)
       break;
-    spinlockRelease(&pair->LOCK_PAIR);
     // wait for parent to accept this thing and have it's own fd on the side
-    handControl();
+    taskBlockWait(&pair->blocking, &pair->LOCK_PAIR, 0, false);
   }
   spinlockRelease(&pair->LOCK_PAIR);
 
@@ -429,8 +446,10 @@ bool unixSocketClose(OpenFile *fd) {
     unixSocket->pair->clientFds--;
     if (!unixSocket->pair->clientFds && !unixSocket->pair->serverFds)
       unixSocketFreePair(unixSocket->pair);
-    else
+    else {
+      unixSocketPairWake(unixSocket->pair);
       spinlockRelease(&unixSocket->pair->LOCK_PAIR);
+    }
   }
   if (unixSocket->timesOpened == 0) {
     // destroy it
@@ -466,7 +485,7 @@ size_t unixSocketRecvfrom(OpenFile *fd, uint8_t *out, size_t limit, int flags,
       return ERR(EWOULDBLOCK);
     } else if (pair->clientBuffPos > 0)
       break;
-    spinlockRelease(&pair->LOCK_PAIR);
+    taskBlockWait(&pair->blocking, &pair->LOCK_PAIR, 0, false);
   }
 
   // spinlock already acquired
@@ -475,6 +494,7 @@ size_t unixSocketRecvfrom(OpenFile *fd, uint8_t *out, size_t limit, int flags,
   memmove(pair->clientBuff, &pair->clientBuff[toCopy],
           pair->clientBuffPos - toCopy);
   pair->clientBuffPos -= toCopy;
+  unixSocketPairWake(pair);
   spinlockRelease(&pair->LOCK_PAIR);
 
   return toCopy;
@@ -508,12 +528,13 @@ size_t unixSocketSendto(OpenFile *fd, uint8_t *in, size_t limit, int flags,
       return ERR(EWOULDBLOCK);
     } else if ((pair->serverBuffPos + limit) <= pair->serverBuffSize)
       break;
-    spinlockRelease(&pair->LOCK_PAIR);
+    taskBlockWait(&pair->blocking, &pair->LOCK_PAIR, 0, false);
   }
 
   // spinlock already acquired
   memcpy(&pair->serverBuff[pair->serverBuffPos], in, limit);
   pair->serverBuffPos += limit;
+  unixSocketPairWake(pair);
   spinlockRelease(&pair->LOCK_PAIR);
 
   return limit;
@@ -225,3 +225,37 @@ avlval AVLLookup(void *raw, avlkey key) {
     return AVLLookup(root->left, key);
   return root->value;
 }
+
+// Value of the biggest key that's <= key (for range lookups)
+avlval AVLLookupFloor(void *raw, avlkey key) {
+  AVLheader *browse = raw;
+  avlval     ret = 0;
+  while (browse) {
+    if (key < browse->key)
+      browse = browse->left;
+    else {
+      ret = browse->value;
+      if (key == browse->key)
+        break;
+      browse = browse->right;
+    }
+  }
+  return ret;
+}
+
+// Value of the smallest key that's >= key (for in-order iteration)
+avlval AVLLookupCeil(void *raw, avlkey key) {
+  AVLheader *browse = raw;
+  avlval     ret = 0;
+  while (browse) {
+    if (key > browse->key)
+      browse = browse->right;
+    else {
+      ret = browse->value;
+      if (key == browse->key)
+        break;
+      browse = browse->left;
+    }
+  }
+  return ret;
+}
@@ -17,10 +17,7 @@
  * +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
  */
 
-void *LinkedListAllocate(void **LLfirstPtr, uint32_t structSize) {
-  LLheader *target = (LLheader *)malloc(structSize);
-  memset(target, 0, structSize);
-
+static void LinkedListAppend(void **LLfirstPtr, LLheader *target) {
   LLheader *curr = (LLheader *)(*LLfirstPtr);
   while (1) {
     if (curr == 0) {
@@ -37,6 +34,12 @@ void *LinkedListAllocate(void **LLfirstPtr, uint32_t structSize) {
   }
 
   target->next = 0; // null ptr
+}
+
+void *LinkedListAllocate(void **LLfirstPtr, uint32_t structSize) {
+  LLheader *target = (LLheader *)malloc(structSize);
+  memset(target, 0, structSize);
+  LinkedListAppend(LLfirstPtr, target);
   return target;
 }
 
@@ -94,3 +97,16 @@ void LinkedListPushFrontUnsafe(void **LLfirstPtr, void *LLtarget) {
   LLheader *target = (LLheader *)(LLtarget);
   target->next = next;
 }
+
+// Same as above, for structs that come from an object cache (see slab.h)
+void *LinkedListAllocateSlab(void **LLfirstPtr, SlabCache *cache) {
+  LLheader *target = (LLheader *)slabAlloc(cache);
+  LinkedListAppend(LLfirstPtr, target);
+  return target;
+}
+
+bool LinkedListRemoveSlab(void **LLfirstPtr, SlabCache *cache, void *LLtarget) {
+  bool res = LinkedListUnregister(LLfirstPtr, LLtarget);
+  slabFree(cache, LLtarget);
+  return res;
+}
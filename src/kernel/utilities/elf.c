@@ -52,13 +52,8 @@ void elfProcessLoad(Elf64_Phdr *elf_phdr, uint8_t *out, size_t base) {
   size_t   startRounded = (elf_phdr->p_vaddr & ~0xFFF);
   uint64_t pagesRequired = DivRoundUp(
       (elf_phdr->p_vaddr - startRounded) + elf_phdr->p_memsz, 0x1000);
-  for (int j = 0; j < pagesRequired; j++) {
-    size_t vaddr = (elf_phdr->p_vaddr & ~0xFFF) + j * 0x1000;
-    if (VirtualToPhysical(base + vaddr))
-      continue;
-    size_t paddr = PhysicalAllocate(1);
-    VirtualMap(base + vaddr, paddr, PF_USER | PF_RW);
-  }
+  VirtualPopulateRegionL(GetPageDirectory(), base + startRounded,
+                         pagesRequired * PAGE_SIZE, PF_USER | PF_RW);
 
   // Copy the required info
   memcpy((void *)(base + elf_phdr->p_vaddr), out + elf_phdr->p_offset,
@@ -83,7 +78,7 @@ Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
   debugf("[elf] Executing %s: filesize{%d}\n", filepath, filesize);
 #endif
   size_t   outSize = DivRoundUp(filesize, BLOCK_SIZE);
-  uint8_t *out = (uint8_t *)VirtualAllocate(outSize);
+  uint8_t *out = (uint8_t *)VirtualAllocateScattered(outSize);
   fsRead(dir, out, filesize);
   fsKernelClose(dir);
 
@@ -135,7 +130,7 @@ Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
 
       size_t   intContentsSize = DivRoundUp(size, BLOCK_SIZE);
       uint8_t *interpreterContents =
-          (uint8_t *)VirtualAllocate(intContentsSize);
+          (uint8_t *)VirtualAllocateScattered(intContentsSize);
       fsRead(interpreter, interpreterContents, size);
       fsKernelClose(interpreter);
 
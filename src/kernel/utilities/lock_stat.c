@@ -0,0 +1,137 @@
+#include <ahci.h>
+#include <caching.h>
+#include <clocksource.h>
+#include <lock_stat.h>
+#include <malloc_glue.h>
+#include <paging.h>
+#include <pmm.h>
+#include <slab.h>
+#include <stdatomic.h>
+#include <syscalls.h>
+#include <system.h>
+#include <task.h>
+#include <util.h>
+
+// Lock contention & hold time statistics (see lock_stat.h)
+// Copyright (C) 2025 Panagiotis
+
+// Entries are only ever appended (while booting), & published by bumping
+// lockStatsCnt after they're filled in, so lookups (from inside every lock)
+// need no lock at all
+static LockStat lockStats[LOCK_STAT_MAX] = {0};
+static size_t   lockStatsCnt = 0;
+
+void initiateLockStat() {
+#if LOCK_STAT
+  lockStatRegister(&LOCK_PMM, LOCK_STAT_SPINLOCK, "LOCK_PMM");
+  lockStatRegister(&WLOCK_PAGING, LOCK_STAT_RWLOCK, "WLOCK_PAGING");
+  lockStatRegister(&malloc_global_mutex, LOCK_STAT_SPINLOCK,
+                   "malloc_global_mutex");
+  lockStatRegister(&LOCK_SLAB_CACHES, LOCK_STAT_SPINLOCK, "LOCK_SLAB_CACHES");
+  lockStatRegister(&LOCK_CACHING, LOCK_STAT_SPINLOCK, "LOCK_CACHING");
+  lockStatRegister(&LOCK_AHCI_CMD_FIND, LOCK_STAT_SPINLOCK,
+                   "LOCK_AHCI_CMD_FIND");
+  lockStatRegister(&TASK_LL_MODIFY, LOCK_STAT_CNT, "TASK_LL_MODIFY");
+  debugf("[lock_stat] Tracking locks: cnt{%ld}\n", lockStatsCnt);
+#endif
+}
+
+void lockStatRegister(void *lock, LockStatKind kind, const char *name) {
+  size_t index = lockStatsCnt;
+  if (index >= LOCK_STAT_MAX) {
+    debugf("[lock_stat] Too many locks, not tracking: name{%s}\n", name);
+    return;
+  }
+
+  LockStat *stat = &lockStats[index];
+  memset(stat, 0, sizeof(LockStat));
+  stat->name = name;
+  stat->lock = lock;
+  stat->kind = kind;
+  atomic_store((volatile _Atomic size_t *)&lockStatsCnt, index + 1);
+}
+
+#if LOCK_STAT
+LockStat *lockStatFind(void *lock, LockStatKind kind) {
+  size_t cnt = atomic_load((volatile _Atomic size_t *)&lockStatsCnt);
+  for (size_t i = 0; i < cnt; i++) {
+    if (lockStats[i].lock == lock && lockStats[i].kind == kind)
+      return &lockStats[i];
+  }
+  return 0;
+}
+
+// Shared locks get acquired concurrently & sleepers count themselves in
+// without any lock, hence the counters are atomic
+void lockStatAcquired(LockStat *stat, size_t waits) {
+  if (!stat)
+    return;
+
+  atomic_fetch_add((volatile _Atomic uint64_t *)&stat->acquisitions, 1);
+  if (!waits)
+    return;
+  atomic_fetch_add((volatile _Atomic uint64_t *)&stat->contended, 1);
+  atomic_fetch_add((volatile _Atomic uint64_t *)&stat->waits, waits);
+}
+
+// Both of these are called by whoever's holding the lock (or its inner one)
+void lockStatHeld(LockStat *stat) {
+  if (stat)
+    stat->heldSince = clockMonotonic();
+}
+
+void lockStatUnheld(LockStat *stat) {
+  if (!stat)
+    return;
+
+  uint64_t held = clockMonotonic() - stat->heldSince;
+  if (held > stat->holdMax)
+    stat->holdMax = held;
+}
+
+// Most contended first, then by how long they were waited on
+static bool lockStatBefore(LockStat *a, LockStat *b) {
+  if (a->contended != b->contended)
+    return a->contended > b->contended;
+  return a->waits > b->waits;
+}
+#endif
+
+// The sorted table behind /proc/lock_stat. Statistics are copied racily, good
+// enough for a snapshot
+size_t lockStatPrint(char *out, size_t size) {
+  size_t length = snprintf(out, size, "lock_stat version 0.1\n");
+
+#if LOCK_STAT
+  size_t   cnt = atomic_load((volatile _Atomic size_t *)&lockStatsCnt);
+  LockStat sorted[LOCK_STAT_MAX];
+  memcpy(sorted, lockStats, cnt * sizeof(LockStat));
+
+  // insertion sort, there's only a few of them
+  for (size_t i = 1; i < cnt; i++) {
+    LockStat curr = sorted[i];
+    size_t   j = i;
+    while (j > 0 && lockStatBefore(&curr, &sorted[j - 1])) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = curr;
+  }
+
+  length += snprintf(&out[length], size - length,
+                     "# %-22s %14s %12s %14s %14s\n", "name", "acquisitions",
+                     "contended", "waits", "holdtime-max");
+  for (size_t i = 0; i < cnt && length < size; i++) {
+    LockStat *stat = &sorted[i];
+    length += snprintf(&out[length], size - length,
+                       "%-24s %14lu %12lu %14lu %12luns\n", stat->name,
+                       stat->acquisitions, stat->contended, stat->waits,
+                       stat->holdMax);
+  }
+#else
+  length += snprintf(&out[length], size - length,
+                     "# disabled, see LOCK_STAT in lock_stat.h\n");
+#endif
+
+  return MIN(length, size - 1);
+}
@@ -6,6 +6,7 @@
 #include <malloc.h>
 #include <nic_controller.h>
 #include <paging.h>
+#include <schedule.h>
 #include <pci.h>
 #include <pmm.h>
 #include <rtc.h>
@@ -182,7 +183,7 @@ void launch_shell(int n) {
       echo(ch);
     } else if (strEql(ch, "dump")) {
       printf("\n");
-      BitmapDumpBlocks(&physical);
+      PhysicalDump();
     } else if (strEql(ch, "help")) {
       help();
     } else if (strEql(ch, "readdisk")) {
@@ -257,7 +258,7 @@ void launch_shell(int n) {
       printf("\n");
     } else if (strEql(ch, "crack")) {
       Task *fr = firstTask->next;
-      fr->state = TASK_STATE_READY;
+      scheduleWake(fr);
       printf("\n");
     } else if (strEql(ch, "bash")) {
       printf("\n");
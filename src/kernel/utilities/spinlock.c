@@ -1,17 +1,94 @@
+#include <lock_stat.h>
 #include <spinlock.h>
 #include <system.h>
+#include <task.h>
 #include <timer.h>
 
 // Various thread-safe locking mechanisms
 // Copyright (C) 2024 Panagiotis
 
-void spinlockAcquire(Spinlock *lock) {
-  while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire))
+// Contended locks are spun on for a bit, then slept on in one of a few shared
+// wait queues (picked by the lock's address). Releasing only wakes sleepers
+// up with interrupts on: anything nested in LOCK_SCHED, the timer wheels or
+// the wait queues themselves is only ever taken with them off, so it never has
+// any sleepers (& NMIs can't end up in the scheduler). Locks that do get let
+// go of with interrupts off (see schedule()) leave their sleepers to the
+// SPINLOCK_SLEEP timeout instead.
+#define SPINLOCK_SPINS 128
+#define SPINLOCK_SLEEP 1 // ms
+#define SPINLOCK_BUCKETS 64
+
+static Blocking spinlockBuckets[SPINLOCK_BUCKETS] = {0};
+
+static Blocking *spinlockBucket(Spinlock *lock) {
+  return &spinlockBuckets[((size_t)lock >> 3) % SPINLOCK_BUCKETS];
+}
+
+// With interrupts off we can't be switched away from, so whoever is holding
+// it has to be running on another CPU & will be done soon enough
+static void spinlockWait() {
+  if (checkInterrupts())
     handControl();
+  else
+    asm volatile("pause");
+}
+
+// Sleeping means being in a state of our own, which whatever else we might be
+// in the middle of waiting for can't afford to lose
+static bool spinlockCanSleep() {
+  if (!tasksInitiated || !checkInterrupts())
+    return false;
+  Task *task = currentTask;
+  return task->state == TASK_STATE_READY && !task->spinlockQueueEntry;
+}
+
+// Returns whether the lock got taken meanwhile
+static bool spinlockSleep(Spinlock *lock) {
+  Blocking   *bucket = spinlockBucket(lock);
+  BlockedTask entry;
+  taskBlockPrepare(bucket, &entry, lock);
+  if (!atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+    taskBlockCancel(bucket, &entry);
+    return true;
+  }
+  taskBlockSleep(bucket, &entry, 0, timerTicks + SPINLOCK_SLEEP, false);
+  return false;
+}
+
+void spinlockAcquire(Spinlock *lock) {
+  size_t spins = 0;
+  while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+    if (spins++ < SPINLOCK_SPINS)
+      asm volatile("pause");
+    else if (!spinlockCanSleep())
+      spinlockWait();
+    else if (spinlockSleep(lock))
+      break;
+  }
+
+  LockStat *stat = lockStatFind(lock, LOCK_STAT_SPINLOCK);
+  lockStatAcquired(stat, spins);
+  lockStatHeld(stat);
 }
 
 void spinlockRelease(Spinlock *lock) {
-  atomic_flag_clear_explicit(lock, memory_order_release);
+  lockStatUnheld(lockStatFind(lock, LOCK_STAT_SPINLOCK));
+  // ordered against the sleeper queueing itself before trying one last time
+  atomic_flag_clear_explicit(lock, memory_order_seq_cst);
+  Blocking *bucket = spinlockBucket(lock);
+  if (bucket->firstBlockedTask && checkInterrupts())
+    taskUnblockOne(bucket, lock);
+}
+
+// For places that can't afford to wait (or to deadlock), like memory reclaim
+bool spinlockTryAcquire(Spinlock *lock) {
+  if (atomic_flag_test_and_set_explicit(lock, memory_order_acquire))
+    return false;
+
+  LockStat *stat = lockStatFind(lock, LOCK_STAT_SPINLOCK);
+  lockStatAcquired(stat, 0);
+  lockStatHeld(stat);
+  return true;
 }
 
 // Cnt spinlock is basically just a counter that increases for every read
@@ -19,18 +96,24 @@ void spinlockRelease(Spinlock *lock) {
 // makes it -1, not permitting any reads. Useful for linked lists..
 
 void spinlockCntReadAcquire(SpinlockCnt *lock) {
+  LockStat *stat = lockStatFind(lock, LOCK_STAT_CNT);
+  size_t    waits = 0;
   while (true) {
     spinlockAcquire(&lock->LOCK);
     if (lock->cnt > -1) {
+      if (!lock->cnt)
+        lockStatHeld(stat);
       lock->cnt++;
       goto cleanup;
     }
     spinlockRelease(&lock->LOCK);
-    handControl();
+    spinlockWait();
+    waits++;
   }
 
 cleanup:
   spinlockRelease(&lock->LOCK);
+  lockStatAcquired(stat, waits);
 }
 
 void spinlockCntReadRelease(SpinlockCnt *lock) {
@@ -41,10 +124,14 @@ void spinlockCntReadRelease(SpinlockCnt *lock) {
   }
 
   lock->cnt--;
+  if (!lock->cnt)
+    lockStatUnheld(lockStatFind(lock, LOCK_STAT_CNT));
   spinlockRelease(&lock->LOCK);
 }
 
 void spinlockCntWriteAcquire(SpinlockCnt *lock) {
+  LockStat *stat = lockStatFind(lock, LOCK_STAT_CNT);
+  size_t    waits = 0;
   while (true) {
     spinlockAcquire(&lock->LOCK);
     if (lock->cnt == 0) {
@@ -52,11 +139,30 @@ void spinlockCntWriteAcquire(SpinlockCnt *lock) {
       goto cleanup;
     }
     spinlockRelease(&lock->LOCK);
-    handControl();
+    spinlockWait();
+    waits++;
   }
 
 cleanup:
   spinlockRelease(&lock->LOCK);
+  lockStatAcquired(stat, waits);
+  lockStatHeld(stat);
+}
+
+bool spinlockCntWriteTryAcquire(SpinlockCnt *lock) {
+  if (!spinlockTryAcquire(&lock->LOCK))
+    return false;
+  bool ret = lock->cnt == 0;
+  if (ret)
+    lock->cnt = -1;
+  spinlockRelease(&lock->LOCK);
+
+  if (ret) {
+    LockStat *stat = lockStatFind(lock, LOCK_STAT_CNT);
+    lockStatAcquired(stat, 0);
+    lockStatHeld(stat);
+  }
+  return ret;
 }
 
 void spinlockCntWriteRelease(SpinlockCnt *lock) {
@@ -65,35 +171,227 @@ void spinlockCntWriteRelease(SpinlockCnt *lock) {
     debugf("[spinlock] Something very bad is going on...\n");
     panic();
   }
+  lockStatUnheld(lockStatFind(lock, LOCK_STAT_CNT));
   lock->cnt = 0;
   spinlockRelease(&lock->LOCK);
 }
 
+// timeout (ms) of 0 waits forever
 bool semaphoreWait(Semaphore *sem, uint32_t timeout) {
-  uint64_t timerStart = timerTicks;
-  bool     ret = false;
+  uint64_t wakeAt = timeout ? timerTicks + timeout : 0;
 
   while (true) {
-    if (timeout > 0 && timerTicks > (timerStart + timeout))
-      goto just_return; // not under any lock atm
     spinlockAcquire(&sem->LOCK);
-    if (sem->cnt > 0) {
-      sem->cnt--;
-      ret = true;
-      goto cleanup;
-    }
-    spinlockRelease(&sem->LOCK);
-    handControl();
+    if (sem->cnt > 0)
+      break;
+    if (taskBlockWait(&sem->blocking, &sem->LOCK, wakeAt, false) ==
+        BLOCK_TIMEOUT)
+      return false; // not under any lock atm
   }
 
-cleanup:
+  sem->cnt--;
   spinlockRelease(&sem->LOCK);
-just_return:
-  return ret;
+  return true;
 }
 
 void semaphorePost(Semaphore *sem) {
   spinlockAcquire(&sem->LOCK);
   sem->cnt++;
+  taskUnblockOne(&sem->blocking, 0);
   spinlockRelease(&sem->LOCK);
 }
+
+// Sleeping locks (see spinlock.h). Whatever can't sleep (see
+// spinlockCanSleep()) spins on them like it would on a SpinlockCnt instead,
+// outside of the queue & its fairness.
+
+// Queues up & sleeps until woken. Expects parent to be held, returns without
+// it. Whether the lock got handed over is in entry->woken
+static void lockSleep(Blocking *blocking, BlockedTask *entry,
+                      Spinlock *parent) {
+  taskBlockPrepare(blocking, entry, 0);
+  taskBlockSleep(blocking, entry, parent, 0, false);
+}
+
+// Expects parent to be held, returns with it held again
+static void lockSpin(Spinlock *parent) {
+  spinlockRelease(parent);
+  spinlockWait();
+  spinlockAcquire(parent);
+}
+
+void mutexAcquire(Mutex *mutex) {
+  LockStat *stat = lockStatFind(mutex, LOCK_STAT_MUTEX);
+  size_t    waits = 0;
+
+  spinlockAcquire(&mutex->LOCK);
+  while (mutex->locked) {
+    waits++;
+    if (!spinlockCanSleep()) {
+      lockSpin(&mutex->LOCK);
+      continue;
+    }
+
+    BlockedTask entry;
+    lockSleep(&mutex->blocking, &entry, &mutex->LOCK);
+    if (entry.woken) {
+      lockStatAcquired(stat, waits);
+      return; // handed straight over to us
+    }
+    spinlockAcquire(&mutex->LOCK);
+  }
+
+  mutex->locked = true;
+  lockStatHeld(stat);
+  spinlockRelease(&mutex->LOCK);
+  lockStatAcquired(stat, waits);
+}
+
+bool mutexTryAcquire(Mutex *mutex) {
+  if (!spinlockTryAcquire(&mutex->LOCK))
+    return false;
+  bool ret = !mutex->locked;
+  if (ret) {
+    mutex->locked = true;
+    LockStat *stat = lockStatFind(mutex, LOCK_STAT_MUTEX);
+    lockStatAcquired(stat, 0);
+    lockStatHeld(stat);
+  }
+  spinlockRelease(&mutex->LOCK);
+  return ret;
+}
+
+void mutexRelease(Mutex *mutex) {
+  LockStat *stat = lockStatFind(mutex, LOCK_STAT_MUTEX);
+  spinlockAcquire(&mutex->LOCK);
+  if (!mutex->locked) {
+    debugf("[spinlock] Something very bad is going on...\n");
+    panic();
+  }
+
+  // the first one waiting becomes the owner, so it stays locked
+  lockStatUnheld(stat);
+  if (taskUnblockOne(&mutex->blocking, 0))
+    lockStatHeld(stat);
+  else
+    mutex->locked = false;
+  spinlockRelease(&mutex->LOCK);
+}
+
+// Gives the (now free) lock to a waiting writer if there is one, otherwise to
+// every waiting reader at once. Expects LOCK to be held
+static void rwlockHandoff(RwLock *lock) {
+  if (lock->writersWaiting && taskUnblockOne(&lock->blockingWrite, 0)) {
+    lock->writersWaiting--;
+    lock->cnt = -1;
+  } else {
+    while (taskUnblockOne(&lock->blockingRead, 0))
+      lock->cnt++;
+  }
+
+  if (lock->cnt)
+    lockStatHeld(lockStatFind(lock, LOCK_STAT_RWLOCK));
+}
+
+void rwlockReadAcquire(RwLock *lock) {
+  LockStat *stat = lockStatFind(lock, LOCK_STAT_RWLOCK);
+  size_t    waits = 0;
+
+  spinlockAcquire(&lock->LOCK);
+  while (lock->cnt < 0 || lock->writersWaiting) {
+    if (!spinlockCanSleep()) {
+      // can't wait in line, so might as well not let writers hold us back
+      if (lock->cnt >= 0)
+        break;
+      waits++;
+      lockSpin(&lock->LOCK);
+      continue;
+    }
+
+    BlockedTask entry;
+    waits++;
+    lockSleep(&lock->blockingRead, &entry, &lock->LOCK);
+    if (entry.woken) {
+      lockStatAcquired(stat, waits);
+      return; // already counted in by whoever woke us up
+    }
+    spinlockAcquire(&lock->LOCK);
+  }
+
+  if (!lock->cnt)
+    lockStatHeld(stat);
+  lock->cnt++;
+  spinlockRelease(&lock->LOCK);
+  lockStatAcquired(stat, waits);
+}
+
+void rwlockReadRelease(RwLock *lock) {
+  spinlockAcquire(&lock->LOCK);
+  if (lock->cnt <= 0) {
+    debugf("[spinlock] Something very bad is going on...\n");
+    panic();
+  }
+
+  lock->cnt--;
+  if (!lock->cnt) {
+    lockStatUnheld(lockStatFind(lock, LOCK_STAT_RWLOCK));
+    rwlockHandoff(lock);
+  }
+  spinlockRelease(&lock->LOCK);
+}
+
+void rwlockWriteAcquire(RwLock *lock) {
+  LockStat *stat = lockStatFind(lock, LOCK_STAT_RWLOCK);
+  size_t    waits = 0;
+
+  spinlockAcquire(&lock->LOCK);
+  while (lock->cnt != 0) {
+    waits++;
+    if (!spinlockCanSleep()) {
+      lockSpin(&lock->LOCK);
+      continue;
+    }
+
+    BlockedTask entry;
+    lock->writersWaiting++;
+    lockSleep(&lock->blockingWrite, &entry, &lock->LOCK);
+    if (entry.woken) {
+      lockStatAcquired(stat, waits);
+      return; // handed straight over to us (& taken off writersWaiting)
+    }
+    spinlockAcquire(&lock->LOCK);
+    lock->writersWaiting--;
+  }
+
+  lock->cnt = -1;
+  lockStatHeld(stat);
+  spinlockRelease(&lock->LOCK);
+  lockStatAcquired(stat, waits);
+}
+
+bool rwlockWriteTryAcquire(RwLock *lock) {
+  if (!spinlockTryAcquire(&lock->LOCK))
+    return false;
+  bool ret = lock->cnt == 0;
+  if (ret) {
+    lock->cnt = -1;
+    LockStat *stat = lockStatFind(lock, LOCK_STAT_RWLOCK);
+    lockStatAcquired(stat, 0);
+    lockStatHeld(stat);
+  }
+  spinlockRelease(&lock->LOCK);
+  return ret;
+}
+
+void rwlockWriteRelease(RwLock *lock) {
+  spinlockAcquire(&lock->LOCK);
+  if (lock->cnt != -1) {
+    debugf("[spinlock] Something very bad is going on...\n");
+    panic();
+  }
+
+  lockStatUnheld(lockStatFind(lock, LOCK_STAT_RWLOCK));
+  lock->cnt = 0;
+  rwlockHandoff(lock);
+  spinlockRelease(&lock->LOCK);
+}